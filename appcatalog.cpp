@@ -0,0 +1,123 @@
+#include "appcatalog.h"
+
+#include <QSettings>
+
+AppCatalog::AppCatalog()
+    : m_ownedSettings(new QSettings)
+    , m_settings(m_ownedSettings.get())
+    , m_batchDepth(0)
+{
+}
+
+AppCatalog::AppCatalog(QSettings *settings)
+    : m_settings(settings)
+    , m_batchDepth(0)
+{
+}
+
+QMap<QString, PortableAppInfo> AppCatalog::load() const
+{
+    QMap<QString, PortableAppInfo> apps;
+    
+    // Pick up what other processes wrote, e.g. the GUI while the builder
+    // service runs
+    m_settings->sync();
+    
+    int size = m_settings->beginReadArray("portableApps");
+    for (int i = 0; i < size; ++i) {
+        m_settings->setArrayIndex(i);
+        PortableAppInfo info;
+        info.id = m_settings->value("id").toString();
+        info.name = m_settings->value("name").toString();
+        info.version = m_settings->value("version").toString();
+        info.description = m_settings->value("description").toString();
+        info.category = m_settings->value("category").toString();
+        info.sourceDir = m_settings->value("sourceDir").toString();
+        info.executablePath = m_settings->value("executablePath").toString();
+        info.installerPath = m_settings->value("installerPath").toString();
+        info.iconPath = m_settings->value("iconPath").toString();
+        info.wineVersion = m_settings->value("wineVersion").toString();
+        info.wineDllOverrides = m_settings->value("wineDllOverrides").toString();
+        info.wineArch = m_settings->value("wineArch").toString();
+        info.performanceProfile = m_settings->value("performanceProfile").toString();
+        info.enableDxvk = m_settings->value("enableDxvk", false).toBool();
+        info.dxvkVersion = m_settings->value("dxvkVersion", "latest").toString();
+        info.dxvkStateCachePath = m_settings->value("dxvkStateCachePath").toString();
+        info.prefixMode = m_settings->value("prefixMode", "private").toString();
+        info.serverTimeout = m_settings->value("serverTimeout", 300).toInt();
+        info.variants = m_settings->value("variants").toStringList();
+        info.requiredDLLs = m_settings->value("requiredDLLs").toStringList();
+        info.allowNetworkAccess = m_settings->value("allowNetworkAccess", true).toBool();
+        info.allowDocumentsAccess = m_settings->value("allowDocumentsAccess", true).toBool();
+        info.allowDownloadsAccess = m_settings->value("allowDownloadsAccess", true).toBool();
+        info.allowAudio = m_settings->value("allowAudio", true).toBool();
+        info.pruneRules = m_settings->value("pruneRules").toStringList();
+        
+        apps[info.id] = info;
+    }
+    m_settings->endArray();
+    
+    return apps;
+}
+
+void AppCatalog::save(const QMap<QString, PortableAppInfo> &apps)
+{
+    // Inside a batch the write is deferred to commitBatch()
+    if (m_batchDepth > 0)
+        return;
+    
+    // Drop entries of apps that were removed since the last save
+    m_settings->remove("portableApps");
+    
+    m_settings->beginWriteArray("portableApps", apps.size());
+    
+    int i = 0;
+    for (auto it = apps.constBegin(); it != apps.constEnd(); ++it) {
+        m_settings->setArrayIndex(i++);
+        const PortableAppInfo &info = it.value();
+        
+        m_settings->setValue("id", info.id);
+        m_settings->setValue("name", info.name);
+        m_settings->setValue("version", info.version);
+        m_settings->setValue("description", info.description);
+        m_settings->setValue("category", info.category);
+        m_settings->setValue("sourceDir", info.sourceDir);
+        m_settings->setValue("executablePath", info.executablePath);
+        m_settings->setValue("installerPath", info.installerPath);
+        m_settings->setValue("iconPath", info.iconPath);
+        m_settings->setValue("wineVersion", info.wineVersion);
+        m_settings->setValue("wineDllOverrides", info.wineDllOverrides);
+        m_settings->setValue("wineArch", info.wineArch);
+        m_settings->setValue("performanceProfile", info.performanceProfile);
+        m_settings->setValue("enableDxvk", info.enableDxvk);
+        m_settings->setValue("dxvkVersion", info.dxvkVersion);
+        m_settings->setValue("dxvkStateCachePath", info.dxvkStateCachePath);
+        m_settings->setValue("prefixMode", info.prefixMode);
+        m_settings->setValue("serverTimeout", info.serverTimeout);
+        m_settings->setValue("variants", info.variants);
+        m_settings->setValue("requiredDLLs", info.requiredDLLs);
+        m_settings->setValue("allowNetworkAccess", info.allowNetworkAccess);
+        m_settings->setValue("allowDocumentsAccess", info.allowDocumentsAccess);
+        m_settings->setValue("allowDownloadsAccess", info.allowDownloadsAccess);
+        m_settings->setValue("allowAudio", info.allowAudio);
+        m_settings->setValue("pruneRules", info.pruneRules);
+    }
+    
+    m_settings->endArray();
+    
+    // Other processes read the file, e.g. the builder service
+    m_settings->sync();
+}
+
+void AppCatalog::beginBatch()
+{
+    m_batchDepth++;
+}
+
+void AppCatalog::commitBatch(const QMap<QString, PortableAppInfo> &apps)
+{
+    if (m_batchDepth > 0 && --m_batchDepth > 0)
+        return;
+    
+    save(apps);
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef APPCATALOG_H
+#define APPCATALOG_H
+
+#include <QMap>
+#include <QString>
+
+#include <memory>
+
+#include "portableappinfo.h"
+
+class QSettings;
+
+/**
+ * Persistent list of imported apps, stored in the application settings
+ */
+class AppCatalog
+{
+public:
+    // Uses the default application settings
+    AppCatalog();
+    
+    // Uses the given settings object, e.g. a separate file
+    explicit AppCatalog(QSettings *settings);
+    
+    QMap<QString, PortableAppInfo> load() const;
+    void save(const QMap<QString, PortableAppInfo> &apps);
+    
+    // Batched updates: changes are collected and written with a single
+    // save when the outermost batch is committed
+    void beginBatch();
+    void commitBatch(const QMap<QString, PortableAppInfo> &apps);
+    bool inBatch() const { return m_batchDepth > 0; }
+    
+private:
+    std::unique_ptr<QSettings> m_ownedSettings;
+    QSettings *m_settings;
+    int m_batchDepth;
+};
+
+#endif // APPCATALOG_H
\ No newline at end of file
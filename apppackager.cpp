@@ -0,0 +1,359 @@
+#include "apppackager.h"
+#include "buildmetrics.h"
+#include "fontcachescript.h"
+#include "launcherscript.h"
+#include "sharedmodules.h"
+#include "storagemanager.h"
+#include "tracer.h"
+#include "wineprofile.h"
+#include "winecomponents.h"
+
+#include <KLocalizedString>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QRegularExpression>
+#include <QSettings>
+
+QString AppPackager::appId(const PortableAppInfo &appInfo)
+{
+    // Id elements may only hold letters, digits and underscores, and must
+    // not start with a digit ("7-Zip")
+    QString name = appInfo.name.toLower().replace(QRegularExpression("[^a-z0-9_]"), "_");
+    if (name.isEmpty() || name[0].isDigit()) {
+        name.prepend('_');
+    }
+    
+    QString id = "org.winepak." + name;
+    
+    // Variants install side by side, each with a prefix of its own
+    if (!appInfo.variantId.isEmpty()) {
+        id += "." + appInfo.variantId;
+    }
+    
+    return id;
+}
+
+QString AppPackager::relativeExecutable(const PortableAppInfo &appInfo)
+{
+    QString relativeExePath = appInfo.executablePath;
+    relativeExePath.replace(appInfo.sourceDir, "");
+    if (relativeExePath.startsWith('/')) {
+        relativeExePath.remove(0, 1);
+    }
+    
+    return relativeExePath;
+}
+
+FlatpakManifest AppPackager::generateManifest(const PortableAppInfo &appInfo, QStringList *log)
+{
+    TraceSpan span("manifest", QStringLiteral("generate manifest"), appInfo.name);
+    
+    FlatpakManifest manifest;
+    manifest.setAppId(appId(appInfo));
+    manifest.setAppName(appInfo.name);
+    manifest.setAppVersion(appInfo.version);
+    manifest.setAppDescription(appInfo.description);
+    
+    // Set icon if available
+    if (!appInfo.iconPath.isEmpty() && QFile::exists(appInfo.iconPath)) {
+        manifest.setAppIcon(appInfo.iconPath);
+    }
+    
+    manifest.setRuntime("org.freedesktop.Platform");
+    manifest.setRuntimeVersion("22.08");
+    manifest.setSdk("org.freedesktop.Sdk");
+    
+    // Add Wine and related modules. Everything up to the base prefix is
+    // the same for all apps with the same settings, so flatpak-builder
+    // reuses its cache when only the app changes.
+    manifest.addWineModule(appInfo.wineVersion, appInfo.wineArch);
+    
+    if (appInfo.enableDxvk) {
+        manifest.addDxvkModule(appInfo.dxvkVersion);
+    }
+    
+    // Bundle Mono/Gecko when the PE analysis found users of them, so the
+    // prefix is created offline and without installer dialogs
+    const bool needsMono = WineComponents::needsMono(appInfo.requiredDLLs);
+    const bool needsGecko = WineComponents::needsGecko(appInfo.requiredDLLs);
+    
+    QVector<WineComponents::Component> components;
+    if (needsMono) {
+        components += WineComponents::mono(appInfo.wineVersion);
+    }
+    if (needsGecko) {
+        components += WineComponents::gecko(appInfo.wineVersion, appInfo.wineArch);
+    }
+    
+    TraceSpan componentSpan("manifest", QStringLiteral("checksum wine components"));
+    QMap<QString, QMap<QString, QString>> componentFiles;
+    for (const WineComponents::Component &component : qAsConst(components)) {
+        if (component.sha256.isEmpty()) {
+            if (log) {
+                *log << i18n("The checksum of Wine %1 %2 is not known, set wineComponents/sha256/%3 in the config file",
+                             component.name, component.version, component.fileName);
+            }
+            continue;
+        }
+        
+        const bool cached = WineComponents::checksum(component);
+        BuildMetrics::instance().increment(cached ? "fpb_artifact_cache_hits_total" : "fpb_artifact_cache_misses_total",
+                                           BuildMetrics::label("artifact", component.name));
+        if (!cached) {
+            // flatpak-builder downloads it and checks the published checksum
+            if (log) {
+                *log << i18n("Wine %1 %2 is not cached, it is downloaded from %3",
+                             component.name, component.version, component.url);
+            }
+            componentFiles[component.name][component.url] = component.sha256;
+            continue;
+        }
+        componentFiles[component.name]["wine-components/" + component.fileName] = component.sha256;
+    }
+    for (auto it = componentFiles.constBegin(); it != componentFiles.constEnd(); ++it) {
+        manifest.addWineComponentModule(it.key(), it.value());
+    }
+    
+    // The base prefix comes after the components, so it includes the ones
+    // the app needs
+    const bool layeredPrefix = appInfo.prefixMode == "layered";
+    if (layeredPrefix) {
+        manifest.addBasePrefixModule(appInfo.wineArch, componentFiles.keys());
+    }
+    
+    manifest.addAppModule();
+    
+    // Warm font caches for the app's bundled fonts
+    manifest.addFontCacheModule(FontCacheScript::fileName(), FontCacheScript::lines());
+    
+    // Configure environment variables
+    QMap<QString, QString> env;
+    env["WINEPREFIX"] = "/var/data/wine";
+    env["FONTCONFIG_FILE"] = FontCacheScript::configPath();
+    
+    // Apps that need neither get no installer prompts at all
+    QStringList dllOverrides;
+    if (!appInfo.wineDllOverrides.isEmpty()) {
+        dllOverrides << appInfo.wineDllOverrides;
+    }
+    if (!needsMono) {
+        dllOverrides << "mscoree=";
+    }
+    if (!needsGecko) {
+        dllOverrides << "mshtml=";
+    }
+    
+    if (!dllOverrides.isEmpty()) {
+        env["WINEDLLOVERRIDES"] = dllOverrides.join(';');
+    }
+    
+    manifest.setEnvironment(env);
+    
+    // Merge the performance profile, app specific settings take precedence
+    if (!appInfo.performanceProfile.isEmpty()) {
+        WineProfile profile = WineProfile::find(appInfo.performanceProfile);
+        if (profile.isValid()) {
+            manifest.addEnvironment(profile.environment, false);
+            for (const QString &arg : qAsConst(profile.finishArgs)) {
+                manifest.addFinishArg(arg);
+            }
+            if (log) {
+                *log << i18n("Performance profile: %1 (version %2)", profile.name, profile.version);
+            }
+        } else if (log) {
+            *log << i18n("Performance profile %1 not found, ignoring it", appInfo.performanceProfile);
+        }
+    }
+    
+    // Sandbox permissions
+    manifest.setAllowNetwork(appInfo.allowNetworkAccess);
+    manifest.setAllowAudio(appInfo.allowAudio);
+    
+    // The launcher sets up the runtime state and then starts the app,
+    // which is installed below /app/app
+    LauncherScript launcher;
+    launcher.setExecutable(relativeExecutable(appInfo));
+    
+    if (layeredPrefix) {
+        // A new base prefix ships whenever Wine, the architecture, the
+        // included components or the app version change
+        QStringList baseId = { appInfo.wineVersion, appInfo.wineArch };
+        baseId += componentFiles.keys();
+        baseId << appInfo.version;
+        launcher.setLayeredPrefix(true, baseId.join('-'));
+    }
+    
+    // Warm starts and further windows reuse a running wineserver
+    launcher.setPersistentServer(appInfo.serverTimeout);
+    launcher.setPreloadDlls(appInfo.requiredDLLs);
+    
+    if (appInfo.enableDxvk) {
+        // Ship the pre-recorded state cache, named after the executable
+        // like the caches DXVK writes itself
+        QString cacheFile;
+        QString cacheHash;
+        if (!appInfo.dxvkStateCachePath.isEmpty() && QFile::exists(appInfo.dxvkStateCachePath)) {
+            cacheFile = dxvkStateCacheFileName(appInfo);
+            
+            QFile cache(appInfo.dxvkStateCachePath);
+            if (cache.open(QIODevice::ReadOnly)) {
+                QCryptographicHash hash(QCryptographicHash::Sha256);
+                hash.addData(&cache);
+                cacheHash = QString::fromLatin1(hash.result().toHex().left(16));
+            }
+            
+            manifest.addDxvkStateCacheModule("dxvk-cache/" + cacheFile);
+        }
+        launcher.setDxvkStateCache(true, cacheFile, cacheHash);
+    }
+    
+    manifest.addLauncherModule(LauncherScript::fileName(), launcher.lines());
+    manifest.setCommand(LauncherScript::fileName());
+    
+    // Configure filesystem access
+    manifest.addFilesystemAccess("~/.local/share/winepak/" + manifest.appId() + ":create");
+    if (appInfo.allowDocumentsAccess) {
+        manifest.addFilesystemAccess("xdg-documents");
+    }
+    if (appInfo.allowDownloadsAccess) {
+        manifest.addFilesystemAccess("xdg-download");
+    }
+    
+    return manifest;
+}
+
+AppScanIndex AppPackager::scanPayload(const PortableAppInfo &appInfo, QVector<PruneReportEntry> *report, QStringList *log)
+{
+    AppScanIndex index = AppScanIndex::scan(appInfo.sourceDir);
+    
+    PayloadPruner pruner;
+    
+    // Global rules can be replaced through the config file
+    QSettings settings;
+    if (settings.contains("pruning/rules")) {
+        pruner.setRules(settings.value("pruning/rules").toStringList());
+    }
+    pruner.addOverrides(appInfo.pruneRules);
+    
+    // Never prune the files the manifest refers to
+    QDir sourceDir(appInfo.sourceDir);
+    if (!appInfo.executablePath.isEmpty()) {
+        pruner.addProtectedPath(sourceDir.relativeFilePath(appInfo.executablePath));
+    }
+    if (!appInfo.iconPath.isEmpty()) {
+        pruner.addProtectedPath(sourceDir.relativeFilePath(appInfo.iconPath));
+    }
+    
+    if (log) {
+        for (const QString &rule : pruner.invalidRules()) {
+            *log << i18n("Ignoring invalid pruning rule: %1", rule);
+        }
+    }
+    
+    QVector<PruneReportEntry> savings = pruner.apply(index);
+    if (report) {
+        *report = savings;
+    }
+    
+    return index;
+}
+
+QString AppPackager::inputsHash(const FlatpakManifest &manifest, const PortableAppInfo &appInfo)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(manifest.toJson());
+    for (const QString &module : manifest.sharedModules()) {
+        hash.addData(SharedModules::contents(module));
+    }
+    if (!appInfo.iconPath.isEmpty()) {
+        const QFileInfo icon(appInfo.iconPath);
+        hash.addData(QByteArray::number(icon.size()) + ':' + QByteArray::number(icon.lastModified().toMSecsSinceEpoch()));
+    }
+    
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+void AppPackager::stageSupportFiles(const PortableAppInfo &appInfo, const QString &buildDir)
+{
+    TraceSpan span("stage", QStringLiteral("stage support files"));
+    
+    // Copy icon file if specified
+    if (!appInfo.iconPath.isEmpty() && QFile::exists(appInfo.iconPath)) {
+        QString iconDir = buildDir + "/icon";
+        QDir().mkpath(iconDir);
+        QFile::copy(appInfo.iconPath, iconDir + "/" + QFileInfo(appInfo.iconPath).fileName());
+    }
+    
+    // Stage the cached Mono/Gecko installers for their manifest modules
+    QStringList componentPaths;
+    if (WineComponents::needsMono(appInfo.requiredDLLs)) {
+        for (const WineComponents::Component &component : WineComponents::mono(appInfo.wineVersion)) {
+            componentPaths << WineComponents::cachedPath(component);
+        }
+    }
+    if (WineComponents::needsGecko(appInfo.requiredDLLs)) {
+        for (const WineComponents::Component &component : WineComponents::gecko(appInfo.wineVersion, appInfo.wineArch)) {
+            componentPaths << WineComponents::cachedPath(component);
+        }
+    }
+    for (const QString &path : qAsConst(componentPaths)) {
+        if (!QFile::exists(path))
+            continue;
+        
+        // Keeps used downloads in the cache when storage is collected
+        StorageManager::touch(path);
+        
+        QString componentDir = buildDir + "/wine-components";
+        QString componentDest = componentDir + "/" + QFileInfo(path).fileName();
+        QDir().mkpath(componentDir);
+        if (!QFile::exists(componentDest)) {
+            QFile::copy(path, componentDest);
+        }
+    }
+    
+    // Stage the pre-recorded DXVK state cache for its manifest module
+    if (appInfo.enableDxvk && !appInfo.dxvkStateCachePath.isEmpty() && QFile::exists(appInfo.dxvkStateCachePath)) {
+        QString cacheDir = buildDir + "/dxvk-cache";
+        QString cacheDest = cacheDir + "/" + dxvkStateCacheFileName(appInfo);
+        QDir().mkpath(cacheDir);
+        QFile::remove(cacheDest);
+        QFile::copy(appInfo.dxvkStateCachePath, cacheDest);
+    }
+}
+
+QString AppPackager::dxvkStateCacheFileName(const PortableAppInfo &appInfo)
+{
+    return QFileInfo(appInfo.executablePath).completeBaseName() + ".dxvk-cache";
+}
+
+QStringList AppPackager::cacheKeys(const PortableAppInfo &appInfo)
+{
+    // Mirrors the modules added by generateManifest() before the app
+    // module. flatpak-builder's cache of a module is only valid after the
+    // same modules, so each key names the whole chain up to it.
+    QStringList keys;
+    QString chain = "wine-" + appInfo.wineVersion + "-" + appInfo.wineArch;
+    keys << chain;
+    
+    if (appInfo.enableDxvk) {
+        chain += "+dxvk-" + appInfo.dxvkVersion;
+        keys << chain;
+    }
+    
+    if (appInfo.prefixMode == "layered") {
+        if (WineComponents::needsMono(appInfo.requiredDLLs)) {
+            chain += "+mono";
+        }
+        if (WineComponents::needsGecko(appInfo.requiredDLLs)) {
+            chain += "+gecko";
+        }
+        chain += "+base-prefix";
+        keys << chain;
+    }
+    
+    return keys;
+}
\ No newline at end of file
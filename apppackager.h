@@ -0,0 +1,57 @@
+#ifndef APPPACKAGER_H
+#define APPPACKAGER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "appscanindex.h"
+#include "flatpakmanifest.h"
+#include "payloadpruner.h"
+#include "portableappinfo.h"
+
+/**
+ * Turns a PortableAppInfo into a manifest and a staged build directory.
+ *
+ * This is the packaging logic shared by the main window, which builds
+ * locally, and the build farm coordinator, which hands the staged
+ * directory to workers. Nothing here touches the UI; messages meant for
+ * the user are appended to an optional log.
+ */
+class AppPackager
+{
+public:
+    // Flatpak app id derived from the app name, plus the variant id for
+    // variant builds
+    static QString appId(const PortableAppInfo &appInfo);
+    
+    // Path of the main executable relative to the app root
+    static QString relativeExecutable(const PortableAppInfo &appInfo);
+    
+    // Complete manifest for the app's current Wine and sandbox settings
+    static FlatpakManifest generateManifest(const PortableAppInfo &appInfo, QStringList *log = nullptr);
+    
+    // Scan the app and apply the global and per-app pruning rules
+    static AppScanIndex scanPayload(const PortableAppInfo &appInfo, QVector<PruneReportEntry> *report = nullptr,
+                                    QStringList *log = nullptr);
+    
+    // Hash over everything a build of the app depends on: the manifest,
+    // which pins the payload fingerprint and the component checksums, the
+    // shared module files and the icon, the only input it refers to by path
+    static QString inputsHash(const FlatpakManifest &manifest, const PortableAppInfo &appInfo);
+    
+    // Copy the files besides the app tree that the manifest refers to:
+    // icon, Wine Mono/Gecko installers and the DXVK state cache
+    static void stageSupportFiles(const PortableAppInfo &appInfo, const QString &buildDir);
+    
+    // Name the DXVK state cache is shipped under, like the caches DXVK
+    // writes itself
+    static QString dxvkStateCacheFileName(const PortableAppInfo &appInfo);
+    
+    // flatpak-builder module caches a build of the app relies on, e.g.
+    // "wine-stable-win64" and "wine-stable-win64+dxvk-2.3". Used to send
+    // jobs to build hosts that have them already.
+    static QStringList cacheKeys(const PortableAppInfo &appInfo);
+};
+
+#endif // APPPACKAGER_H
\ No newline at end of file
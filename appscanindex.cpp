@@ -0,0 +1,365 @@
+#include "appscanindex.h"
+#include "tracer.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+#include <algorithm>
+
+namespace {
+
+// Try to clone the source file into the destination without copying data.
+// Returns false if the filesystem does not support reflinks.
+bool reflinkFile(const QString &source, const QString &destination)
+{
+#ifdef FICLONE
+    int srcFd = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+    if (srcFd < 0)
+        return false;
+    
+    int dstFd = ::open(QFile::encodeName(destination).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dstFd < 0) {
+        ::close(srcFd);
+        return false;
+    }
+    
+    bool cloned = ::ioctl(dstFd, FICLONE, srcFd) == 0;
+    ::close(dstFd);
+    ::close(srcFd);
+    
+    if (!cloned) {
+        QFile::remove(destination);
+        return false;
+    }
+    
+    // Keep the permissions of the original, like QFile::copy does
+    QFile::setPermissions(destination, QFile::permissions(source));
+    return true;
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(destination);
+    return false;
+#endif
+}
+
+// Target of a symbolic link as stored, so relative links stay relative
+QString readLink(const QString &path)
+{
+    QByteArray target(4096, Qt::Uninitialized);
+    const ssize_t length = ::readlink(QFile::encodeName(path).constData(), target.data(), target.size());
+    if (length < 0)
+        return QString();
+    
+    target.truncate(int(length));
+    return QFile::decodeName(target);
+}
+
+} // namespace
+
+AppScanIndex AppScanIndex::scan(const QString &rootDir)
+{
+    TraceSpan span("scan", QStringLiteral("scan"), rootDir);
+    
+    AppScanIndex index;
+    index.m_rootDir = QDir(rootDir).absolutePath();
+    
+    QDir root(index.m_rootDir);
+    QStringList dirs;
+    QSet<QString> parents;
+    
+    // Links to directories are listed but not descended into
+    QDirIterator it(index.m_rootDir, QDir::Files | QDir::Dirs | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        const QString relativePath = root.relativeFilePath(info.filePath());
+        parents.insert(QFileInfo(relativePath).path());
+        
+        if (info.isDir() && info.isSymLink()) {
+            index.m_dirLinks.insert(relativePath, readLink(info.filePath()));
+            continue;
+        }
+        
+        if (info.isDir()) {
+            dirs.append(relativePath);
+            continue;
+        }
+        
+        ScannedFile file;
+        file.relativePath = relativePath;
+        file.size = info.size();
+        file.modified = info.lastModified().toMSecsSinceEpoch();
+        index.m_files.append(file);
+    }
+    
+    // A directory is empty if nothing found names it as its parent
+    for (const QString &dir : qAsConst(dirs)) {
+        if (!parents.contains(dir))
+            index.m_emptyDirs.append(dir);
+    }
+    index.m_emptyDirs.sort();
+    
+    span.setDetail(QStringLiteral("%1 files").arg(index.m_files.size()));
+    
+    return index;
+}
+
+qint64 AppScanIndex::totalSize() const
+{
+    qint64 total = 0;
+    for (const ScannedFile &file : m_files) {
+        total += file.size;
+    }
+    return total;
+}
+
+qint64 AppScanIndex::retainedSize() const
+{
+    qint64 total = 0;
+    for (const ScannedFile &file : m_files) {
+        if (!file.excluded)
+            total += file.size;
+    }
+    return total;
+}
+
+int AppScanIndex::retainedCount() const
+{
+    int count = 0;
+    for (const ScannedFile &file : m_files) {
+        if (!file.excluded)
+            ++count;
+    }
+    return count;
+}
+
+bool AppScanIndex::stageFile(const ScannedFile &file, const QString &destDir, QSet<QString> &createdDirs,
+                             StageResult &stats, QString *errorMessage) const
+{
+    const QString source = m_rootDir + QLatin1Char('/') + file.relativePath;
+    const QString destination = destDir + QLatin1Char('/') + file.relativePath;
+    
+    // Create each parent directory only once
+    const QString parentDir = QFileInfo(destination).path();
+    if (!createdDirs.contains(parentDir)) {
+        if (!QDir().mkpath(parentDir)) {
+            if (errorMessage)
+                *errorMessage = QStringLiteral("Cannot create directory %1").arg(parentDir);
+            return false;
+        }
+        createdDirs.insert(parentDir);
+    }
+    
+    if (QFile::exists(destination))
+        QFile::remove(destination);
+    
+    if (reflinkFile(source, destination)) {
+        stats.reflinkedBytes += file.size;
+    } else if (!QFile::copy(source, destination)) {
+        if (errorMessage)
+            *errorMessage = QStringLiteral("Cannot copy %1").arg(file.relativePath);
+        return false;
+    }
+    
+    stats.files++;
+    stats.bytes += file.size;
+    return true;
+}
+
+bool AppScanIndex::stageDirectory(const QString &relativePath, const QString &destDir, QString *errorMessage) const
+{
+    const QString destination = destDir + QLatin1Char('/') + relativePath;
+    if (!QDir().mkpath(destination)) {
+        if (errorMessage)
+            *errorMessage = QStringLiteral("Cannot create directory %1").arg(relativePath);
+        return false;
+    }
+    
+    return true;
+}
+
+bool AppScanIndex::stageLink(const QString &relativePath, const QString &destDir, QString *errorMessage) const
+{
+    const QString destination = destDir + QLatin1Char('/') + relativePath;
+    
+    // Replace whatever an earlier stage left there
+    const QFileInfo info(destination);
+    if (info.isDir() && !info.isSymLink()) {
+        QDir(destination).removeRecursively();
+    } else if (info.exists() || info.isSymLink()) {
+        QFile::remove(destination);
+    }
+    
+    if (!QDir().mkpath(info.path())
+        || ::symlink(QFile::encodeName(m_dirLinks.value(relativePath)).constData(),
+                     QFile::encodeName(destination).constData()) != 0) {
+        if (errorMessage)
+            *errorMessage = QStringLiteral("Cannot create link %1").arg(relativePath);
+        return false;
+    }
+    
+    return true;
+}
+
+bool AppScanIndex::stageTo(const QString &destDir, StageResult *result, QString *errorMessage) const
+{
+    TraceSpan span("stage", QStringLiteral("copy tree"), destDir);
+    
+    StageResult stats;
+    QSet<QString> createdDirs;
+    
+    for (const ScannedFile &file : m_files) {
+        if (file.excluded)
+            continue;
+        
+        if (!stageFile(file, destDir, createdDirs, stats, errorMessage))
+            return false;
+    }
+    
+    for (const QString &dir : m_emptyDirs) {
+        if (!stageDirectory(dir, destDir, errorMessage))
+            return false;
+    }
+    
+    for (auto it = m_dirLinks.constBegin(); it != m_dirLinks.constEnd(); ++it) {
+        if (!stageLink(it.key(), destDir, errorMessage))
+            return false;
+    }
+    
+    if (result)
+        *result = stats;
+    
+    return true;
+}
+
+bool AppScanIndex::restage(const QString &destDir, const QStringList &relativePaths,
+                           StageResult *result, QString *errorMessage) const
+{
+    TraceSpan span("stage", QStringLiteral("restage"), QStringLiteral("%1 paths").arg(relativePaths.size()));
+    
+    QHash<QString, int> byPath;
+    byPath.reserve(m_files.size());
+    for (int i = 0; i < m_files.size(); ++i) {
+        byPath.insert(m_files[i].relativePath, i);
+    }
+    
+    StageResult stats;
+    QSet<QString> createdDirs;
+    
+    for (const QString &path : relativePaths) {
+        auto it = byPath.constFind(path);
+        if (it != byPath.constEnd()) {
+            const ScannedFile &file = m_files[it.value()];
+            if (!file.excluded) {
+                if (!stageFile(file, destDir, createdDirs, stats, errorMessage))
+                    return false;
+                continue;
+            }
+        }
+        
+        // Gone, excluded or a directory: drop the staged copy first
+        const QString destination = destDir + QLatin1Char('/') + path;
+        QFileInfo info(destination);
+        if (info.isDir() && !info.isSymLink()) {
+            QDir(destination).removeRecursively();
+        } else if (info.exists() || info.isSymLink()) {
+            QFile::remove(destination);
+        }
+        
+        // Then restage whatever still lives at or below a directory path
+        const QString prefix = path + QLatin1Char('/');
+        for (const ScannedFile &file : m_files) {
+            if (!file.excluded && file.relativePath.startsWith(prefix)) {
+                if (!stageFile(file, destDir, createdDirs, stats, errorMessage))
+                    return false;
+            }
+        }
+        for (const QString &dir : m_emptyDirs) {
+            if (dir == path || dir.startsWith(prefix)) {
+                if (!stageDirectory(dir, destDir, errorMessage))
+                    return false;
+            }
+        }
+        for (auto link = m_dirLinks.constBegin(); link != m_dirLinks.constEnd(); ++link) {
+            if (link.key() == path || link.key().startsWith(prefix)) {
+                if (!stageLink(link.key(), destDir, errorMessage))
+                    return false;
+            }
+        }
+    }
+    
+    if (result)
+        *result = stats;
+    
+    return true;
+}
+
+QString AppScanIndex::fingerprint() const
+{
+    TraceSpan span("stage", QStringLiteral("fingerprint"));
+    
+    QVector<const ScannedFile *> retained;
+    retained.reserve(m_files.size());
+    for (const ScannedFile &file : m_files) {
+        if (!file.excluded)
+            retained.append(&file);
+    }
+    
+    // Directory iteration order is not stable across filesystems
+    std::sort(retained.begin(), retained.end(), [](const ScannedFile *a, const ScannedFile *b) {
+        return a->relativePath < b->relativePath;
+    });
+    
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    for (const ScannedFile *file : qAsConst(retained)) {
+        hash.addData(file->relativePath.toUtf8());
+        hash.addData(QByteArray::number(file->size));
+        hash.addData(QByteArray::number(file->modified));
+    }
+    
+    // Trees without empty directories or links keep their fingerprint
+    for (const QString &dir : m_emptyDirs) {
+        hash.addData("d:" + dir.toUtf8());
+    }
+    for (auto it = m_dirLinks.constBegin(); it != m_dirLinks.constEnd(); ++it) {
+        hash.addData("l:" + it.key().toUtf8() + "->" + it.value().toUtf8());
+    }
+    
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+bool AppScanIndex::matchesStaged(const QString &destDir) const
+{
+    if (!QFileInfo(destDir).isDir())
+        return false;
+    
+    QHash<QString, qint64> expected;
+    for (const ScannedFile &file : m_files) {
+        if (!file.excluded)
+            expected.insert(file.relativePath, file.size);
+    }
+    
+    const AppScanIndex staged = scan(destDir);
+    if (staged.files().size() != expected.size()
+        || staged.m_emptyDirs != m_emptyDirs || staged.m_dirLinks != m_dirLinks)
+        return false;
+    
+    for (const ScannedFile &file : staged.files()) {
+        auto it = expected.constFind(file.relativePath);
+        if (it == expected.constEnd() || it.value() != file.size)
+            return false;
+    }
+    
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef APPSCANINDEX_H
+#define APPSCANINDEX_H
+
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * A single regular file found while scanning a PortableApp directory
+ */
+struct ScannedFile
+{
+    QString relativePath;   // Path relative to the scanned root, '/' separated
+    qint64 size = 0;
+    qint64 modified = 0;    // Modification time in ms since epoch
+    
+    // Set by the pruning stage
+    bool excluded = false;
+    QString excludedBy;
+};
+
+/**
+ * Result of copying the retained part of a scan index into a staging directory
+ */
+struct StageResult
+{
+    int files = 0;
+    qint64 bytes = 0;
+    qint64 reflinkedBytes = 0;
+};
+
+/**
+ * Flat index of every file below a PortableApp directory.
+ *
+ * The index is built once per build and shared by the later stages
+ * (pruning, staging), so the source tree is only walked a single time.
+ * Empty directories and symbolic links to directories are kept aside,
+ * they are never pruned.
+ */
+class AppScanIndex
+{
+public:
+    AppScanIndex() = default;
+    
+    // Walk rootDir recursively and record every regular file, empty
+    // directory and link to a directory
+    static AppScanIndex scan(const QString &rootDir);
+    
+    QString rootDir() const { return m_rootDir; }
+    
+    const QVector<ScannedFile> &files() const { return m_files; }
+    QVector<ScannedFile> &files() { return m_files; }
+    
+    // Size accounting
+    qint64 totalSize() const;
+    qint64 retainedSize() const;
+    int retainedCount() const;
+    
+    // Copy every file that is not excluded into destDir, recreating the
+    // directory layout. Files are reflinked when the filesystem allows it,
+    // empty directories are created and links to directories recreated as
+    // links.
+    bool stageTo(const QString &destDir, StageResult *result = nullptr, QString *errorMessage = nullptr) const;
+    
+    // Bring only the given paths of an already staged tree up to date.
+    // Paths that are gone or excluded are removed from destDir; a path
+    // naming a directory covers everything below it.
+    bool restage(const QString &destDir, const QStringList &relativePaths,
+                 StageResult *result = nullptr, QString *errorMessage = nullptr) const;
+    
+    // Hash over path, size and modification time of all retained files.
+    // Changes whenever the staged tree would change.
+    QString fingerprint() const;
+    
+    // Whether destDir holds exactly the retained files, compared by path
+    // and size. Used to trust a staged tree left by an interrupted build.
+    bool matchesStaged(const QString &destDir) const;
+    
+private:
+    bool stageFile(const ScannedFile &file, const QString &destDir, QSet<QString> &createdDirs,
+                   StageResult &stats, QString *errorMessage) const;
+    bool stageDirectory(const QString &relativePath, const QString &destDir, QString *errorMessage) const;
+    bool stageLink(const QString &relativePath, const QString &destDir, QString *errorMessage) const;
+    
+    QString m_rootDir;
+    QVector<ScannedFile> m_files;
+    QStringList m_emptyDirs;                // Sorted relative paths
+    QMap<QString, QString> m_dirLinks;      // Relative path -> link target as stored
+};
+
+#endif // APPSCANINDEX_H
\ No newline at end of file
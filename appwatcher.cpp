@@ -0,0 +1,176 @@
+#include "appwatcher.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+
+namespace {
+
+const uint32_t WatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                         | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR;
+
+} // namespace
+
+AppWatcher::AppWatcher(QObject *parent)
+    : QObject(parent)
+    , m_debounceInterval(400)
+    , m_maximumDelay(3000)
+{
+    m_debounceTimer.setSingleShot(true);
+    connect(&m_debounceTimer, &QTimer::timeout, this, &AppWatcher::flushPending);
+}
+
+AppWatcher::~AppWatcher()
+{
+    stop();
+}
+
+bool AppWatcher::watch(const QString &rootDir)
+{
+    stop();
+    
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0)
+        return false;
+    
+    m_rootDir = QDir(rootDir).absolutePath();
+    addWatchRecursive(m_rootDir);
+    
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &AppWatcher::readEvents);
+    
+    return true;
+}
+
+void AppWatcher::stop()
+{
+    m_debounceTimer.stop();
+    m_pending.clear();
+    m_overflow = false;
+    m_watchDirs.clear();
+    
+    delete m_notifier;
+    m_notifier = nullptr;
+    
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void AppWatcher::setDebounceInterval(int msec)
+{
+    m_debounceInterval = msec;
+}
+
+void AppWatcher::setMaximumDelay(int msec)
+{
+    m_maximumDelay = msec;
+}
+
+void AppWatcher::addWatchRecursive(const QString &dirPath)
+{
+    QStringList dirs{dirPath};
+    QDirIterator it(dirPath, QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        dirs << it.next();
+    }
+    
+    for (const QString &dir : qAsConst(dirs)) {
+        int wd = inotify_add_watch(m_fd, QFile::encodeName(dir).constData(), WatchMask);
+        if (wd >= 0) {
+            m_watchDirs.insert(wd, dir);
+        }
+    }
+}
+
+void AppWatcher::markChanged(const QString &absolutePath)
+{
+    if (m_pending.isEmpty() && !m_overflow) {
+        m_pendingSince.start();
+    }
+    
+    m_pending.insert(QDir(m_rootDir).relativeFilePath(absolutePath));
+}
+
+void AppWatcher::readEvents()
+{
+    alignas(struct inotify_event) char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    
+    for (;;) {
+        ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+        
+        for (char *ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+            
+            if (event->mask & IN_Q_OVERFLOW) {
+                if (m_pending.isEmpty() && !m_overflow)
+                    m_pendingSince.start();
+                m_overflow = true;
+                continue;
+            }
+            
+            if (event->mask & IN_IGNORED) {
+                m_watchDirs.remove(event->wd);
+                continue;
+            }
+            
+            const QString dir = m_watchDirs.value(event->wd);
+            if (dir.isEmpty() || event->len == 0)
+                continue;
+            
+            const QString path = dir + QLatin1Char('/') + QFile::decodeName(event->name);
+            
+            if (event->mask & IN_ISDIR) {
+                // New directories need their own watches, and everything
+                // that was created inside before the watch existed counts
+                // as changed
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    addWatchRecursive(path);
+                    QDirIterator it(path, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+                    while (it.hasNext()) {
+                        markChanged(it.next());
+                    }
+                } else if (event->mask & IN_MOVED_FROM) {
+                    // The files below a moved-away directory are gone; the
+                    // restage treats a directory path as a prefix
+                    markChanged(path);
+                }
+                continue;
+            }
+            
+            // Ignore partially written files, IN_CLOSE_WRITE follows
+            if (event->mask == IN_CREATE)
+                continue;
+            
+            markChanged(path);
+        }
+    }
+    
+    if (m_pending.isEmpty() && !m_overflow)
+        return;
+    
+    // Debounce, but never hold changes back beyond the maximum delay
+    m_debounceTimer.start(m_pendingSince.elapsed() >= m_maximumDelay ? 0 : m_debounceInterval);
+}
+
+void AppWatcher::flushPending()
+{
+    QStringList paths;
+    if (!m_overflow) {
+        paths = m_pending.values();
+    }
+    
+    m_pending.clear();
+    m_overflow = false;
+    
+    emit filesChanged(paths);
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef APPWATCHER_H
+#define APPWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class QSocketNotifier;
+
+/**
+ * Watches a PortableApp directory tree with inotify.
+ *
+ * Events are coalesced per file and delivered after the tree has been
+ * quiet for the debounce interval, so an unpacked archive or a save
+ * storm results in a single notification. A notification is never held
+ * back for longer than the maximum delay.
+ */
+class AppWatcher : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit AppWatcher(QObject *parent = nullptr);
+    ~AppWatcher() override;
+    
+    // Start watching rootDir and all directories below it
+    bool watch(const QString &rootDir);
+    void stop();
+    
+    bool isWatching() const { return m_fd >= 0; }
+    QString rootDir() const { return m_rootDir; }
+    
+    // Quiet period before changes are reported, in milliseconds
+    void setDebounceInterval(int msec);
+    
+    // Upper bound for holding back changes during a continuous storm
+    void setMaximumDelay(int msec);
+    
+signals:
+    // Paths are relative to the root. An empty list means the kernel
+    // queue overflowed and the whole tree must be treated as changed.
+    void filesChanged(const QStringList &relativePaths);
+    
+private slots:
+    void readEvents();
+    void flushPending();
+    
+private:
+    void addWatchRecursive(const QString &dirPath);
+    void markChanged(const QString &absolutePath);
+    
+    int m_fd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QString m_rootDir;
+    QHash<int, QString> m_watchDirs;
+    
+    QSet<QString> m_pending;
+    bool m_overflow = false;
+    QTimer m_debounceTimer;
+    QElapsedTimer m_pendingSince;
+    int m_debounceInterval;
+    int m_maximumDelay;
+};
+
+#endif // APPWATCHER_H
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include <benchmark/benchmark.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QSettings>
+#include <QTemporaryDir>
+
+#include "appcatalog.h"
+#include "appscanindex.h"
+#include "fixturegenerator.h"
+#include "flatpakmanifest.h"
+#include "payloadpruner.h"
+#include "portableappdetector.h"
+
+// Tree sizes for the filesystem benchmarks, capped by FixtureGenerator::maxFileCount()
+static const int TreeSizes[] = { 1000, 10000, 100000, 1000000 };
+
+// Manifest with the given number of modules and finish-args, shaped like
+// the ones generated for real apps
+static FlatpakManifest makeManifest(int count)
+{
+    FlatpakManifest manifest;
+    manifest.setAppId("org.winepak.BenchApp");
+    manifest.setAppName("BenchApp");
+    manifest.setAppVersion("1.0");
+    manifest.setRuntime("org.freedesktop.Platform");
+    manifest.setRuntimeVersion("23.08");
+    manifest.setSdk("org.freedesktop.Sdk");
+    manifest.addWineModule("stable", "win64");
+    manifest.addAppModule();
+    manifest.setCommand("winepak-launcher");
+    manifest.setPayloadFingerprint(QString(64, 'a'));
+    
+    for (int i = 0; i < count; ++i) {
+        QJsonObject source;
+        source["type"] = "file";
+        source["path"] = QString("files/component-%1.tar.xz").arg(i);
+        source["sha256"] = QString(64, 'b');
+        
+        QJsonObject module;
+        module["name"] = QString("component-%1").arg(i);
+        module["buildsystem"] = "simple";
+        module["build-commands"] = QJsonArray{ QString("install -Dm644 component-%1.tar.xz ${FLATPAK_DEST}/share/component-%1.tar.xz").arg(i) };
+        module["sources"] = QJsonArray{ source };
+        manifest.addModule(module);
+        
+        manifest.addFinishArg(QString("--env=BENCH_VAR_%1=value-%1").arg(i));
+        manifest.addFilesystemAccess(QString("xdg-data/bench-%1:ro").arg(i));
+    }
+    
+    return manifest;
+}
+
+// Catalog entries as written by the bulk import
+static QMap<QString, PortableAppInfo> makeApps(int count)
+{
+    QMap<QString, PortableAppInfo> apps;
+    
+    for (int i = 0; i < count; ++i) {
+        PortableAppInfo info;
+        info.id = QString("org.winepak.BenchApp%1").arg(i);
+        info.name = QString("BenchApp %1").arg(i);
+        info.version = "1.0";
+        info.description = "Synthetic benchmark fixture";
+        info.category = "Utilities";
+        info.sourceDir = QString("/media/portable/PortableApps/BenchApp%1Portable").arg(i);
+        info.executablePath = info.sourceDir + "/BenchApp.exe";
+        info.iconPath = info.sourceDir + "/App/AppInfo/appicon.ico";
+        info.wineVersion = "stable";
+        info.wineArch = "win64";
+        info.requiredDLLs = QStringList{ "kernel32.dll", "user32.dll", "gdi32.dll", "msvcrt.dll" };
+        info.pruneRules = QStringList{ "keep App/locales/en-US.pak" };
+        apps.insert(info.id, info);
+    }
+    
+    return apps;
+}
+
+static void BM_ManifestToJson(benchmark::State &state)
+{
+    const FlatpakManifest manifest = makeManifest(state.range(0));
+    
+    for (auto _ : state)
+        benchmark::DoNotOptimize(manifest.toJsonObject());
+    
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ManifestToJson)->RangeMultiplier(10)->Range(10, 10000);
+
+static void BM_ManifestSerialize(benchmark::State &state)
+{
+    const FlatpakManifest manifest = makeManifest(state.range(0));
+    
+    for (auto _ : state)
+        benchmark::DoNotOptimize(manifest.toJson());
+    
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ManifestSerialize)->RangeMultiplier(10)->Range(10, 10000);
+
+static void BM_ManifestSave(benchmark::State &state)
+{
+    const FlatpakManifest manifest = makeManifest(state.range(0));
+    QTemporaryDir tempDir;
+    const QString path = tempDir.filePath("manifest.json");
+    
+    for (auto _ : state) {
+        if (!manifest.saveToFile(path)) {
+            state.SkipWithError("Could not write manifest");
+            break;
+        }
+    }
+    
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ManifestSave)->RangeMultiplier(10)->Range(10, 10000);
+
+// Manifests of a whole catalog written into one directory, like a farm
+// restaging every app after a Wine update
+static void BM_ManifestRegenerate(benchmark::State &state)
+{
+    QVector<FlatpakManifest> manifests;
+    for (int i = 0; i < state.range(0); ++i) {
+        FlatpakManifest manifest = makeManifest(0);
+        manifest.setAppId(QString("org.winepak.BenchApp%1").arg(i));
+        manifest.addDxvkModule("2.3");
+        manifests.append(manifest);
+    }
+    
+    QTemporaryDir tempDir;
+    
+    for (auto _ : state) {
+        for (int i = 0; i < manifests.size(); ++i) {
+            if (!manifests[i].saveToFile(tempDir.filePath(QString("manifest-%1.json").arg(i)))) {
+                state.SkipWithError("Could not write manifest");
+                return;
+            }
+        }
+    }
+    
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ManifestRegenerate)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+static void BM_CatalogSave(benchmark::State &state)
+{
+    const QMap<QString, PortableAppInfo> apps = makeApps(state.range(0));
+    QTemporaryDir tempDir;
+    QSettings settings(tempDir.filePath("catalog.ini"), QSettings::IniFormat);
+    AppCatalog catalog(&settings);
+    
+    for (auto _ : state) {
+        catalog.save(apps);
+        settings.sync();
+    }
+    
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CatalogSave)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMillisecond);
+
+static void BM_CatalogLoad(benchmark::State &state)
+{
+    QTemporaryDir tempDir;
+    const QString path = tempDir.filePath("catalog.ini");
+    
+    {
+        QSettings settings(path, QSettings::IniFormat);
+        AppCatalog(&settings).save(makeApps(state.range(0)));
+    }
+    
+    for (auto _ : state) {
+        // Fresh settings object each time, like a startup reading from disk
+        QSettings settings(path, QSettings::IniFormat);
+        benchmark::DoNotOptimize(AppCatalog(&settings).load());
+    }
+    
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CatalogLoad)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMillisecond);
+
+// Metadata detection as done when importing a single app
+static void BM_DetectApp(benchmark::State &state, int fileCount)
+{
+    const QString rootDir = FixtureGenerator::appTree(fileCount);
+    if (rootDir.isEmpty()) {
+        state.SkipWithError("Could not generate fixture");
+        return;
+    }
+    
+    for (auto _ : state)
+        benchmark::DoNotOptimize(PortableAppDetector::detect(rootDir));
+}
+
+static void BM_ScanIndex(benchmark::State &state, int fileCount)
+{
+    const QString rootDir = FixtureGenerator::appTree(fileCount);
+    if (rootDir.isEmpty()) {
+        state.SkipWithError("Could not generate fixture");
+        return;
+    }
+    
+    for (auto _ : state)
+        benchmark::DoNotOptimize(AppScanIndex::scan(rootDir));
+    
+    state.SetItemsProcessed(state.iterations() * fileCount);
+}
+
+static void BM_PruneApply(benchmark::State &state, int fileCount)
+{
+    const QString rootDir = FixtureGenerator::appTree(fileCount);
+    if (rootDir.isEmpty()) {
+        state.SkipWithError("Could not generate fixture");
+        return;
+    }
+    
+    const AppScanIndex scanned = AppScanIndex::scan(rootDir);
+    PayloadPruner pruner;
+    
+    for (auto _ : state) {
+        state.PauseTiming();
+        AppScanIndex index = scanned;
+        state.ResumeTiming();
+        
+        benchmark::DoNotOptimize(pruner.apply(index));
+    }
+    
+    state.SetItemsProcessed(state.iterations() * fileCount);
+}
+
+static void BM_StageTree(benchmark::State &state, int fileCount)
+{
+    const QString rootDir = FixtureGenerator::appTree(fileCount);
+    if (rootDir.isEmpty()) {
+        state.SkipWithError("Could not generate fixture");
+        return;
+    }
+    
+    const AppScanIndex index = AppScanIndex::scan(rootDir);
+    
+    // Stage next to the fixtures, so reflinks behave like they would for
+    // a build directory on the same filesystem
+    const QString destDir = FixtureGenerator::fixtureDir() + "/stage";
+    StageResult result;
+    
+    for (auto _ : state) {
+        state.PauseTiming();
+        QDir(destDir).removeRecursively();
+        result = StageResult();
+        state.ResumeTiming();
+        
+        if (!index.stageTo(destDir, &result)) {
+            state.SkipWithError("Staging failed");
+            break;
+        }
+    }
+    
+    QDir(destDir).removeRecursively();
+    
+    state.SetItemsProcessed(state.iterations() * result.files);
+    state.SetBytesProcessed(state.iterations() * result.bytes);
+    state.counters["reflinked_bytes"] = result.reflinkedBytes;
+}
+
+// The filesystem benchmarks depend on the fixture size limit, so they are
+// registered at runtime instead of with BENCHMARK()
+static void registerTreeBenchmarks()
+{
+    for (int fileCount : TreeSizes) {
+        if (fileCount > FixtureGenerator::maxFileCount())
+            break;
+        
+        const std::string suffix = "/files:" + std::to_string(fileCount);
+        
+        benchmark::RegisterBenchmark(("BM_DetectApp" + suffix).c_str(), BM_DetectApp, fileCount)
+            ->Unit(benchmark::kMillisecond)->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_ScanIndex" + suffix).c_str(), BM_ScanIndex, fileCount)
+            ->Unit(benchmark::kMillisecond)->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_PruneApply" + suffix).c_str(), BM_PruneApply, fileCount)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("BM_StageTree" + suffix).c_str(), BM_StageTree, fileCount)
+            ->Unit(benchmark::kMillisecond)->UseRealTime();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // QSettings and QStandardPaths expect an application instance
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("KDE");
+    QCoreApplication::setApplicationName("flatpack-portable-builder-benchmarks");
+    
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    
+    registerTreeBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "fixturegenerator.h"
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#include <algorithm>
+#include <random>
+
+namespace {
+
+// Marker written last, a tree without it is from an interrupted run
+const char *const CompleteMarker = ".fixture-complete";
+
+// Extensions roughly weighted like a typical PortableApp payload
+const char *const Extensions[] = {
+    "dll", "dll", "dll", "pak", "dat", "txt", "xml", "png", "ico", "log", "js", "json"
+};
+
+// Folders the default pruning rules care about, so pruning has work to do
+const char *const TopLevelDirs[] = {
+    "App/%1", "App/%1/locales", "App/%1/plugins", "App/%1/resources", "Data/settings", "Other/Source", "Other/Help"
+};
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    
+    return file.write(data) == data.size();
+}
+
+} // namespace
+
+QString FixtureGenerator::fixtureDir()
+{
+    const QString dir = qEnvironmentVariable("FPB_BENCH_FIXTURE_DIR");
+    if (!dir.isEmpty())
+        return dir;
+    
+    return QDir::tempPath() + "/flatpack-portable-builder-fixtures";
+}
+
+int FixtureGenerator::maxFileCount()
+{
+    bool ok = false;
+    const int max = qEnvironmentVariableIntValue("FPB_BENCH_MAX_FILES", &ok);
+    return ok && max > 0 ? max : 100000;
+}
+
+QString FixtureGenerator::appTree(int fileCount, quint32 seed)
+{
+    const QString fixture = QString("%1/app-%2-%3").arg(fixtureDir()).arg(fileCount).arg(seed);
+    const QString rootDir = fixture + "/BenchAppPortable";
+    
+    // The marker lives next to the app root so it doesn't show up in scans
+    if (QFile::exists(fixture + "/" + CompleteMarker))
+        return rootDir;
+    
+    // Start over after an interrupted run
+    QDir(fixture).removeRecursively();
+    
+    if (!generate(rootDir, fileCount, seed) || !writeFile(fixture + "/" + CompleteMarker, QByteArray()))
+        return QString();
+    
+    return rootDir;
+}
+
+bool FixtureGenerator::generate(const QString &rootDir, int fileCount, quint32 seed)
+{
+    std::mt19937 rng(seed);
+    QDir root;
+    
+    // Fixed PortableApps.com skeleton
+    if (!root.mkpath(rootDir + "/App/AppInfo"))
+        return false;
+    
+    const QByteArray appInfo =
+        "[Details]\n"
+        "Name=BenchApp Portable\n"
+        "AppID=BenchAppPortable\n"
+        "Category=Utilities\n"
+        "Description=Synthetic benchmark fixture\n"
+        "\n"
+        "[Version]\n"
+        "DisplayVersion=1.0\n";
+    
+    if (!writeFile(rootDir + "/App/AppInfo/appinfo.ini", appInfo)
+        || !writeFile(rootDir + "/App/AppInfo/appicon.ico", QByteArray(1024, '\0'))
+        || !writeFile(rootDir + "/BenchAppPortable.exe", QByteArray("MZ") + QByteArray(4094, '\0'))
+        || !writeFile(rootDir + "/App/BenchApp/BenchApp.exe", QByteArray("MZ") + QByteArray(65534, '\0')))
+        return false;
+    
+    // Spread the remaining files over a tree of at most 256 files per
+    // directory, three levels deep below the top level folders
+    const int filesPerDir = 256;
+    const int topLevelCount = sizeof(TopLevelDirs) / sizeof(TopLevelDirs[0]);
+    const int extensionCount = sizeof(Extensions) / sizeof(Extensions[0]);
+    
+    std::uniform_int_distribution<int> extensionDist(0, extensionCount - 1);
+    std::uniform_int_distribution<int> topLevelDist(0, topLevelCount - 1);
+    std::uniform_int_distribution<int> byteDist(0, 255);
+    
+    // Mostly small files with a long tail, capped to keep 1M file trees
+    // at a few GB
+    std::geometric_distribution<int> sizeDist(1.0 / 2048);
+    
+    QString currentDir;
+    for (int i = 0; i < fileCount - 4; ++i) {
+        if (i % filesPerDir == 0) {
+            const int dirIndex = i / filesPerDir;
+            currentDir = QString("%1/%2/d%3/d%4/d%5")
+                .arg(rootDir)
+                .arg(QString(TopLevelDirs[topLevelDist(rng)]).arg("BenchApp"))
+                .arg(dirIndex / 4096)
+                .arg((dirIndex / 64) % 64)
+                .arg(dirIndex % 64);
+            
+            if (!root.mkpath(currentDir))
+                return false;
+        }
+        
+        const int size = std::min(sizeDist(rng), 256 * 1024);
+        QByteArray data(size, '\0');
+        
+        // Only the head is random, enough to defeat dedup of small files
+        for (int b = 0; b < std::min(size, 64); ++b)
+            data[b] = static_cast<char>(byteDist(rng));
+        
+        const QString name = QString("%1/f%2.%3").arg(currentDir).arg(i).arg(Extensions[extensionDist(rng)]);
+        if (!writeFile(name, data))
+            return false;
+    }
+    
+    return true;
+}
\ No newline at end of file
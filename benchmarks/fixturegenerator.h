@@ -0,0 +1,30 @@
+#ifndef FIXTUREGENERATOR_H
+#define FIXTUREGENERATOR_H
+
+#include <QString>
+
+/**
+ * Builds synthetic PortableApps.com style app trees for the benchmarks.
+ *
+ * The tree layout and file contents only depend on the file count and the
+ * seed, so runs on different commits operate on identical input. Generated
+ * trees are cached below fixtureDir() and reused by later runs.
+ */
+class FixtureGenerator
+{
+public:
+    // Cache directory, FPB_BENCH_FIXTURE_DIR or a directory below /tmp
+    static QString fixtureDir();
+    
+    // Largest tree the suite should use, FPB_BENCH_MAX_FILES (default 100000)
+    static int maxFileCount();
+    
+    // Path of an app root holding fileCount files, generated on first use.
+    // Returns an empty string if the tree could not be written.
+    static QString appTree(int fileCount, quint32 seed = 1);
+    
+private:
+    static bool generate(const QString &rootDir, int fileCount, quint32 seed);
+};
+
+#endif // FIXTUREGENERATOR_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "builddirlock.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+const QString BuildDirLock::FileName = QStringLiteral(".lock");
+
+BuildDirLock::~BuildDirLock()
+{
+    unlock();
+}
+
+bool BuildDirLock::lock(const QString &dir, QString *errorMessage)
+{
+    const QString cleanDir = QDir::cleanPath(dir);
+    if (isLocked() && m_dir == cleanDir)
+        return true;
+    
+    unlock();
+    
+    // Not inherited by flatpak-builder, the lock ends with this process
+    const QString path = cleanDir + "/" + FileName;
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        if (errorMessage)
+            *errorMessage = i18n("Cannot open %1: %2", path, QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+    
+    if (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        const int error = errno;
+        ::close(fd);
+        if (errorMessage)
+            *errorMessage = error == EWOULDBLOCK ? i18n("%1 is in use by another build", cleanDir)
+                                                 : i18n("Cannot lock %1: %2", path, QString::fromLocal8Bit(strerror(error)));
+        return false;
+    }
+    
+    m_dir = cleanDir;
+    m_fd = fd;
+    return true;
+}
+
+void BuildDirLock::unlock()
+{
+    if (!isLocked())
+        return;
+    
+    ::close(m_fd);
+    m_fd = -1;
+    m_dir.clear();
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef BUILDDIRLOCK_H
+#define BUILDDIRLOCK_H
+
+#include <QString>
+
+/**
+ * Ownership of a build directory across processes.
+ *
+ * The window and the builder service build in the same build directories,
+ * each with a storage manager and a RAM workspace of its own. The process
+ * that builds in a directory, or keeps it warm as the one being worked
+ * on, holds an exclusive flock on its .lock file. Other processes do not
+ * build there, and storage managers do not remove it or its outputs. The
+ * kernel drops the lock when its holder exits, also after a crash.
+ *
+ * Locks are per open file, so a second lock on the same directory fails
+ * within one process as well.
+ */
+class BuildDirLock
+{
+public:
+    static const QString FileName;
+    
+    BuildDirLock() = default;
+    ~BuildDirLock();
+    
+    BuildDirLock(const BuildDirLock &) = delete;
+    BuildDirLock &operator=(const BuildDirLock &) = delete;
+    
+    // Take the lock of dir without waiting. False with the reason if
+    // someone else holds it. Releases a lock held on another directory.
+    bool lock(const QString &dir, QString *errorMessage = nullptr);
+    void unlock();
+    
+    bool isLocked() const { return m_fd >= 0; }
+    QString dir() const { return m_dir; }
+    
+private:
+    QString m_dir;
+    int m_fd = -1;
+};
+
+#endif // BUILDDIRLOCK_H
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "builderclient.h"
+#include "builderservice.h"
+
+#include <KLocalizedString>
+
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QDBusReply>
+#include <QDBusServiceWatcher>
+#include <QTimer>
+
+namespace {
+
+QDBusMessage methodCall(const QString &method)
+{
+    return QDBusMessage::createMethodCall(BuilderService::serviceName(), BuilderService::objectPath(),
+                                          BuilderService::interfaceName(), method);
+}
+
+} // namespace
+
+BuilderClient::BuilderClient(const QDBusConnection &bus, QObject *parent)
+    : QObject(parent)
+    , m_bus(bus)
+{
+    // Connected by name, so the signals keep arriving if the service is
+    // restarted
+    const QString service = BuilderService::serviceName();
+    const QString path = BuilderService::objectPath();
+    const QString interface = BuilderService::interfaceName();
+    m_bus.connect(service, path, interface, QStringLiteral("jobProgress"), this, SIGNAL(jobProgress(QString,QString,int)));
+    m_bus.connect(service, path, interface, QStringLiteral("jobLog"), this, SIGNAL(jobLog(QString,QString)));
+    m_bus.connect(service, path, interface, QStringLiteral("jobFinished"), this, SIGNAL(jobFinished(QString,bool,QString)));
+}
+
+bool BuilderClient::isRunning() const
+{
+    return m_bus.isConnected() && m_bus.interface()->isServiceRegistered(BuilderService::serviceName());
+}
+
+bool BuilderClient::isAvailable() const
+{
+    if (isRunning())
+        return true;
+    
+    if (!m_bus.isConnected())
+        return false;
+    
+    const QDBusReply<QStringList> names = m_bus.interface()->call(QStringLiteral("ListActivatableNames"));
+    return names.isValid() && names.value().contains(BuilderService::serviceName());
+}
+
+QString BuilderClient::enqueue(const QString &app, const QString &branch, QString *errorMessage)
+{
+    QDBusMessage call = methodCall(QStringLiteral("enqueue"));
+    call << app << branch;
+    
+    const QDBusReply<QString> reply = m_bus.call(call);
+    if (!reply.isValid()) {
+        if (errorMessage)
+            *errorMessage = reply.error().message();
+        return QString();
+    }
+    
+    return reply.value();
+}
+
+bool BuilderClient::cancel(const QString &jobId, QString *errorMessage)
+{
+    QDBusMessage call = methodCall(QStringLiteral("cancel"));
+    call << jobId;
+    
+    const QDBusReply<bool> reply = m_bus.call(call);
+    if (!reply.isValid()) {
+        if (errorMessage)
+            *errorMessage = reply.error().message();
+        return false;
+    }
+    
+    if (!reply.value() && errorMessage) {
+        *errorMessage = i18n("No unfinished job %1", jobId);
+    }
+    return reply.value();
+}
+
+QString BuilderClient::missingDependency(bool *ok)
+{
+    const QDBusReply<QString> reply = m_bus.call(methodCall(QStringLiteral("missingDependency")));
+    if (ok) {
+        *ok = reply.isValid();
+    }
+    
+    return reply.isValid() ? reply.value() : QString();
+}
+
+void BuilderClient::submit(const QStringList &apps, const QString &branch)
+{
+    connect(this, &BuilderClient::jobLog, this, [this](const QString &jobId, const QString &text) {
+        if (m_pending.contains(jobId)) {
+            emit logMessage(text);
+        }
+    });
+    
+    connect(this, &BuilderClient::jobFinished, this, [this](const QString &jobId, bool success, const QString &message) {
+        if (!m_pending.remove(jobId))
+            return;
+        
+        if (!success) {
+            m_failed++;
+        }
+        emit logMessage(success ? i18n("Job %1 done: %2", jobId, message) : i18n("Job %1 failed: %2", jobId, message));
+        
+        if (m_pending.isEmpty()) {
+            emit finished(m_failed);
+        }
+    });
+    
+    // The jobs are lost with the service
+    auto *watcher = new QDBusServiceWatcher(BuilderService::serviceName(), m_bus,
+                                            QDBusServiceWatcher::WatchForUnregistration, this);
+    connect(watcher, &QDBusServiceWatcher::serviceUnregistered, this, [this]() {
+        if (m_pending.isEmpty())
+            return;
+        
+        emit logMessage(i18n("Lost connection to the builder service"));
+        m_failed += m_pending.size();
+        m_pending.clear();
+        emit finished(m_failed);
+    });
+    
+    for (const QString &app : apps) {
+        QString error;
+        const QString jobId = enqueue(app, branch, &error);
+        if (jobId.isEmpty()) {
+            emit logMessage(i18n("Cannot queue %1: %2", app, error));
+            m_failed++;
+            continue;
+        }
+        
+        m_pending.insert(jobId);
+        emit logMessage(i18n("Queued %1 as job %2", app, jobId));
+    }
+    
+    // Nothing to wait for, report once the event loop runs
+    if (m_pending.isEmpty()) {
+        QTimer::singleShot(0, this, [this]() {
+            emit finished(m_failed);
+        });
+    }
+}
\ No newline at end of file
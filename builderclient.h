@@ -0,0 +1,60 @@
+#ifndef BUILDERCLIENT_H
+#define BUILDERCLIENT_H
+
+#include <QDBusConnection>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Talks to the builder service, see BuilderService.
+ *
+ * The service is started by the bus on the first call if it is
+ * installed as a D-Bus service, so isAvailable() is also true while it
+ * is not running yet.
+ */
+class BuilderClient : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit BuilderClient(const QDBusConnection &bus = QDBusConnection::sessionBus(), QObject *parent = nullptr);
+    
+    // Whether the service is running
+    bool isRunning() const;
+    
+    // Whether the service is running or can be started by the bus
+    bool isAvailable() const;
+    
+    // Queue a catalog app, returns the job id or an empty string
+    QString enqueue(const QString &app, const QString &branch = QStringLiteral("master"),
+                    QString *errorMessage = nullptr);
+    
+    bool cancel(const QString &jobId, QString *errorMessage = nullptr);
+    
+    // The service's dependency probe, see BuilderService::missingDependency()
+    QString missingDependency(bool *ok = nullptr);
+    
+    // Queue apps and follow them until they are done, for the command
+    // line. Emits finished().
+    void submit(const QStringList &apps, const QString &branch = QStringLiteral("master"));
+    
+signals:
+    // Relayed from the service, for all jobs
+    void jobProgress(const QString &jobId, const QString &stage, int percent);
+    void jobLog(const QString &jobId, const QString &text);
+    void jobFinished(const QString &jobId, bool success, const QString &message);
+    
+    void logMessage(const QString &message);
+    
+    // All jobs of submit() are done, or none could be queued
+    void finished(int failedCount);
+    
+private:
+    QDBusConnection m_bus;
+    QSet<QString> m_pending;
+    int m_failed = 0;
+};
+
+#endif // BUILDERCLIENT_H
\ No newline at end of file
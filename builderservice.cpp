@@ -0,0 +1,705 @@
+#include "builderservice.h"
+#include "apppackager.h"
+#include "buildmetrics.h"
+#include "flatpakexporter.h"
+#include "manifestvalidator.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QDBusConnectionInterface>
+#include <QDBusReply>
+#include <QDir>
+#include <QFileInfo>
+#include <QLocale>
+#include <QProcess>
+#include <QSettings>
+#include <QUuid>
+#include <QtConcurrent>
+
+namespace {
+
+// Output kept per job for log()
+const int OutputTailSize = 64 * 1024;
+
+// Finished jobs that can still be asked about
+const int FinishedJobsKept = 50;
+
+const char *stateName(int state)
+{
+    static const char *const names[] = {
+        "queued", "staging", "waiting", "building", "succeeded", "failed", "cancelled",
+    };
+    return names[state];
+}
+
+} // namespace
+
+BuilderService::BuilderService(QObject *parent)
+    : QObject(parent)
+    , m_dataDir(StorageManager::defaultDataDir())
+    , m_repoPath(QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString())
+    , m_exporter(new FlatpakExporter(this))
+{
+    // Probe once, clients ask the service instead of starting the tools
+    m_dependencyProbe = QtConcurrent::run(&BuilderService::findMissingDependency);
+    
+    connect(m_exporter, &FlatpakExporter::logMessage, this, &BuilderService::logMessage);
+    connect(m_exporter, &FlatpakExporter::exportFinished, this, &BuilderService::exportFinished);
+    
+    // Deferred jobs are retried as the pressure averages move
+    m_admissionTimer.setInterval(2000);
+    connect(&m_admissionTimer, &QTimer::timeout, this, &BuilderService::admitJobs);
+    
+    // The service owns the caches of all clients
+    m_storage.setDataDir(m_dataDir);
+    m_storage.setAreas(StorageManager::builderAreas(m_dataDir));
+    connect(&m_storage, &StorageManager::logMessage, this, &BuilderService::logMessage);
+    QTimer::singleShot(30000, this, &BuilderService::collectStorage);
+    
+    updateMetrics();
+}
+
+BuilderService::~BuilderService()
+{
+    for (const Job &job : qAsConst(m_jobs)) {
+        if (job.process) {
+            job.process->disconnect(this);
+            job.process->kill();
+            job.process->waitForFinished();
+        }
+    }
+}
+
+QDBusConnection BuilderService::connectBus(const QString &address)
+{
+    if (address.isEmpty())
+        return QDBusConnection::sessionBus();
+    
+    return QDBusConnection::connectToBus(address, QStringLiteral("flatpack-portable-builder"));
+}
+
+bool BuilderService::registerOn(QDBusConnection bus, QString *errorMessage)
+{
+    if (!bus.isConnected()) {
+        if (errorMessage)
+            *errorMessage = bus.lastError().message();
+        return false;
+    }
+    
+    if (!bus.registerObject(objectPath(), this, QDBusConnection::ExportScriptableSlots | QDBusConnection::ExportScriptableSignals)) {
+        if (errorMessage)
+            *errorMessage = i18n("Cannot export %1", objectPath());
+        return false;
+    }
+    
+    // Only one service per bus, a second one would split the queue
+    const QDBusReply<QDBusConnectionInterface::RegisterServiceReply> reply = bus.interface()->registerService(
+        serviceName(), QDBusConnectionInterface::DontQueueService, QDBusConnectionInterface::DontAllowReplacement);
+    if (!reply.isValid() || reply.value() != QDBusConnectionInterface::ServiceRegistered) {
+        if (errorMessage)
+            *errorMessage = reply.isValid() ? i18n("%1 is already running", serviceName()) : reply.error().message();
+        bus.unregisterObject(objectPath());
+        return false;
+    }
+    
+    emit logMessage(i18n("Builder service running as %1", serviceName()));
+    return true;
+}
+
+QString BuilderService::enqueue(const QString &app, const QString &branch)
+{
+    PortableAppInfo appInfo;
+    if (!findApp(app, &appInfo)) {
+        if (calledFromDBus()) {
+            sendErrorReply(serviceName() + ".Error.UnknownApp", i18n("Unknown app: %1", app));
+        }
+        return QString();
+    }
+    
+    Job job;
+    job.id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    job.appInfo = appInfo;
+    job.appId = AppPackager::appId(appInfo);
+    job.branch = branch.isEmpty() ? QStringLiteral("master") : branch;
+    job.buildDir = m_dataDir + "/" + job.appId;
+    job.stage = QStringLiteral("queued");
+    job.timer.start();
+    
+    m_jobs.insert(job.id, job);
+    m_queue << job.id;
+    
+    emit logMessage(i18n("Queued %1 as job %2", appInfo.name, job.id));
+    emit jobQueued(job.id, appInfo.name);
+    
+    // Reply first, the job may start right away
+    QTimer::singleShot(0, this, &BuilderService::schedule);
+    updateMetrics();
+    return job.id;
+}
+
+bool BuilderService::cancel(const QString &jobId)
+{
+    auto job = m_jobs.find(jobId);
+    if (job == m_jobs.end() || job->state >= Succeeded || job->cancelled)
+        return false;
+    
+    job->cancelled = true;
+    emit logMessage(i18n("Cancelling job %1", jobId));
+    
+    switch (job->state) {
+    case Queued:
+    case Waiting:
+        finishJob(jobId, Cancelled, i18n("Cancelled"));
+        break;
+    case Staging:
+        // Staging cannot be interrupted, the job ends once it is done
+        break;
+    case Building:
+        if (job->process) {
+            job->process->terminate();
+        }
+        break;
+    default:
+        break;
+    }
+    
+    return true;
+}
+
+QStringList BuilderService::jobs() const
+{
+    return m_queue;
+}
+
+QVariantMap BuilderService::jobInfo(const QString &jobId) const
+{
+    const auto job = m_jobs.constFind(jobId);
+    if (job == m_jobs.constEnd()) {
+        if (calledFromDBus()) {
+            sendErrorReply(serviceName() + ".Error.UnknownJob", i18n("Unknown job: %1", jobId));
+        }
+        return QVariantMap();
+    }
+    
+    return QVariantMap{
+        { "app", job->appInfo.name },
+        { "appId", job->appId },
+        { "branch", job->branch },
+        { "state", QString::fromLatin1(stateName(job->state)) },
+        { "stage", job->stage },
+        { "progress", job->progress },
+        { "message", job->message },
+        { "seconds", job->timer.elapsed() / 1000.0 },
+    };
+}
+
+QString BuilderService::log(const QString &jobId) const
+{
+    return QString::fromUtf8(m_jobs.value(jobId).output);
+}
+
+QString BuilderService::missingDependency()
+{
+    return m_dependencyProbe.result();
+}
+
+QString BuilderService::findMissingDependency()
+{
+    // flatpak-builder, wine and bsdtar (for extracting archives)
+    for (const char *tool : { "flatpak-builder", "wine", "bsdtar" }) {
+        QProcess process;
+        process.start(tool, QStringList() << "--version");
+        if (!process.waitForFinished() || process.exitCode() != 0)
+            return QString::fromLatin1(tool);
+    }
+    
+    return QString();
+}
+
+bool BuilderService::findApp(const QString &app, PortableAppInfo *appInfo)
+{
+    // Always read the catalog fresh, the GUI may have changed it
+    const QMap<QString, PortableAppInfo> apps = m_catalog.load();
+    
+    for (auto it = apps.constBegin(); it != apps.constEnd(); ++it) {
+        const PortableAppInfo &info = it.value();
+        if (info.id == app || info.name.compare(app, Qt::CaseInsensitive) == 0 || AppPackager::appId(info) == app) {
+            *appInfo = info;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void BuilderService::schedule()
+{
+    QHash<QString, QString> refused;
+    
+    // Jobs of an app share its build directory, so they take turns
+    for (const QString &jobId : qAsConst(m_queue)) {
+        Job &job = m_jobs[jobId];
+        if (job.state != Queued || m_busyApps.contains(job.appId))
+            continue;
+        
+        // The window, or another service, may be building the app
+        QString error;
+        job.lock = std::make_shared<BuildDirLock>();
+        QDir().mkpath(job.buildDir);
+        if (!job.lock->lock(job.buildDir, &error)) {
+            job.lock.reset();
+            refused.insert(jobId, error);
+            continue;
+        }
+        
+        m_busyApps.insert(job.appId);
+        job.state = Staging;
+        setProgress(job, QStringLiteral("staging"), 5);
+        m_storage.pin(job.buildDir);
+        StorageManager::touch(job.buildDir);
+        
+        // Read per job, so a changed policy applies without a restart
+        job.workspace = std::make_shared<BuildWorkspace>();
+        
+        // Staging copies the whole app, keep the bus responsive
+        auto *watcher = new QFutureWatcher<PreparedBuild>(this);
+        connect(watcher, &QFutureWatcher<PreparedBuild>::finished, this, [this, watcher, jobId]() {
+            buildPrepared(jobId, watcher->result());
+            watcher->deleteLater();
+        });
+        watcher->setFuture(QtConcurrent::run(&BuilderService::prepareBuild, job.appInfo, job.buildDir, job.workspace));
+    }
+    
+    for (auto it = refused.constBegin(); it != refused.constEnd(); ++it) {
+        finishJob(it.key(), Failed, i18n("Cannot build: %1", it.value()));
+    }
+    
+    updateMetrics();
+}
+
+BuilderService::PreparedBuild BuilderService::prepareBuild(const PortableAppInfo &appInfo, const QString &buildDir,
+                                                           const std::shared_ptr<BuildWorkspace> &workspace)
+{
+    TraceSpan span("stage", QStringLiteral("prepare build"), appInfo.name);
+    QElapsedTimer timer;
+    timer.start();
+    
+    PreparedBuild build;
+    
+    FlatpakManifest manifest = AppPackager::generateManifest(appInfo, &build.log);
+    const AppScanIndex index = AppPackager::scanPayload(appInfo, nullptr, &build.log);
+    manifest.setPayloadFingerprint(index.fingerprint());
+    
+    QDir().mkpath(buildDir);
+    
+    // Staged files and flatpak-builder's scratch directories go to RAM
+    // if the build fits next to the running ones
+    QString message;
+    workspace->prepare(buildDir, workspace->estimate(index), &message);
+    if (!message.isEmpty()) {
+        build.log << message;
+    }
+    
+    // The same journal as builds from the window, either one continues
+    // where the other stopped
+    QString error;
+    build.journal = PipelineJournal(buildDir + "/journal.jsonl");
+    if (!build.journal.begin(AppPackager::inputsHash(manifest, appInfo), &error)) {
+        build.log << i18n("Cannot write the build journal: %1", error);
+    }
+    
+    auto record = [&build](const QString &stage, const QString &outputHash) {
+        QString error;
+        if (!build.journal.complete(stage, outputHash, QJsonObject(), &error)) {
+            build.log << i18n("Cannot write the build journal: %1", error);
+        }
+    };
+    
+    const QString appDir = buildDir + "/app";
+    if (build.journal.isComplete("stage") && index.matchesStaged(appDir)) {
+        build.log << i18n("Staged files from the previous run are intact, skipping staging");
+    } else {
+        // Start from an empty directory so files pruned since the last
+        // build disappear
+        QDir(appDir).removeRecursively();
+        QDir().mkpath(appDir);
+        if (!index.stageTo(appDir, &build.stageResult, &build.error))
+            return build;
+        
+        build.staged = true;
+        build.prunedBytes = index.totalSize() - index.retainedSize();
+        record(QStringLiteral("stage"), index.fingerprint());
+    }
+    
+    const QStringList supportDirs = { "icon", "wine-components", "dxvk-cache" };
+    if (!build.journal.isComplete("artifacts")
+        || build.journal.outputHash("artifacts") != PipelineJournal::hashFiles(buildDir, supportDirs)) {
+        AppPackager::stageSupportFiles(appInfo, buildDir);
+        record(QStringLiteral("artifacts"), PipelineJournal::hashFiles(buildDir, supportDirs));
+    }
+    
+    build.manifestPath = buildDir + "/manifest.json";
+    if (!build.journal.isComplete("manifest")
+        || build.journal.outputHash("manifest") != PipelineJournal::hashFile(build.manifestPath)) {
+        if (!manifest.saveToFile(build.manifestPath)) {
+            build.error = i18n("Failed to write manifest file!");
+            return build;
+        }
+        record(QStringLiteral("manifest"), PipelineJournal::hashFile(build.manifestPath));
+    }
+    
+    const ManifestValidator::Report report = ManifestValidator::validateFile(build.manifestPath);
+    for (const QString &warning : report.warnings()) {
+        build.log << warning;
+    }
+    if (report.hasErrors()) {
+        build.error = i18n("Invalid manifest: %1", report.errors().join("; "));
+        return build;
+    }
+    
+    build.seconds = timer.elapsed() / 1000.0;
+    build.success = true;
+    return build;
+}
+
+void BuilderService::buildPrepared(const QString &jobId, const PreparedBuild &build)
+{
+    if (!m_jobs.contains(jobId))
+        return;
+    
+    Job &job = m_jobs[jobId];
+    job.journal = build.journal;
+    
+    for (const QString &line : build.log) {
+        appendOutput(job, line);
+    }
+    
+    if (job.cancelled) {
+        finishJob(jobId, Cancelled, i18n("Cancelled"));
+        return;
+    }
+    
+    if (!build.success) {
+        finishJob(jobId, Failed, i18n("Staging failed: %1", build.error));
+        return;
+    }
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "stage"), build.seconds);
+    if (build.staged) {
+        metrics.increment("fpb_staged_files_total", QString(), build.stageResult.files);
+        metrics.increment("fpb_staged_bytes_total", QString(), build.stageResult.bytes);
+        metrics.increment("fpb_reflinked_bytes_total", QString(), build.stageResult.reflinkedBytes);
+        metrics.increment("fpb_pruned_bytes_total", QString(), build.prunedBytes);
+        appendOutput(job, i18n("Staged %1 files (%2), pruned %3",
+                               build.stageResult.files,
+                               QLocale().formattedDataSize(build.stageResult.bytes),
+                               QLocale().formattedDataSize(build.prunedBytes)));
+    }
+    
+    // The build finished before an interruption if the repo still has
+    // the commit it recorded, like in the window
+    switch (FlatpakExporter::resumePoint(job.journal, m_repoPath, job.appId, job.branch)) {
+    case FlatpakExporter::ResumeBuild:
+        break;
+    case FlatpakExporter::ResumeInstall:
+        appendOutput(job, i18n("%1 is already built, installing it", job.appId));
+        installBuild(jobId);
+        return;
+    case FlatpakExporter::ResumeExport:
+        appendOutput(job, i18n("%1 is already built and installed", job.appId));
+        buildFinished(jobId, 0);
+        return;
+    case FlatpakExporter::ResumeDone:
+        job.journal.remove();
+        finishJob(jobId, Succeeded, i18n("%1 is already built, installed and exported", job.appId));
+        return;
+    }
+    
+    job.state = Waiting;
+    setProgress(job, QStringLiteral("waiting"), 10);
+    m_admissionQueue << jobId;
+    admitJobs();
+}
+
+void BuilderService::admitJobs()
+{
+    int running = 0;
+    for (const Job &job : qAsConst(m_jobs)) {
+        running += job.state == Building ? 1 : 0;
+    }
+    
+    while (!m_admissionQueue.isEmpty() && m_governor.admit(running)) {
+        startBuild(m_admissionQueue.takeFirst());
+        running++;
+    }
+    
+    if (m_admissionQueue.isEmpty()) {
+        m_admissionTimer.stop();
+    } else if (!m_admissionTimer.isActive()) {
+        emit logMessage(i18np("1 job waits for resources", "%1 jobs wait for resources", m_admissionQueue.size()));
+        m_admissionTimer.start();
+    }
+    
+    updateMetrics();
+}
+
+void BuilderService::startBuild(const QString &jobId)
+{
+    if (!m_jobs.contains(jobId))
+        return;
+    
+    Job &job = m_jobs[jobId];
+    
+    job.trace = std::make_shared<ProcessTrace>(QStringLiteral("flatpak-builder"), job.appId);
+    auto trace = job.trace;
+    
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::MergedChannels);
+    process->setWorkingDirectory(job.buildDir);
+    connect(process, &QProcess::readyReadStandardOutput, this, [this, jobId, process, trace]() {
+        const QByteArray output = process->readAllStandardOutput();
+        const QString phase = trace->phase();
+        trace->addOutput(output);
+        m_governor.setStage(process, trace->phase());
+        
+        if (!m_jobs.contains(jobId))
+            return;
+        
+        Job &job = m_jobs[jobId];
+        if (trace->phase() != phase) {
+            setProgress(job, trace->phase(), job.progress);
+        }
+        appendOutput(job, QString::fromLocal8Bit(output).trimmed());
+    });
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, jobId, process, trace](int exitCode, QProcess::ExitStatus exitStatus) {
+                trace->finish(exitCode);
+                Tracer::flush();
+                
+                const double seconds = m_jobs.value(jobId).timer.elapsed() / 1000.0;
+                BuildMetrics &metrics = BuildMetrics::instance();
+                metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "flatpak_builder"), seconds);
+                metrics.increment("fpb_worker_busy_seconds_total", BuildMetrics::label("pool", "service"), seconds);
+                metrics.increment("fpb_build_cache_hits_total", QString(), trace->moduleCacheHits());
+                metrics.increment("fpb_build_cache_misses_total", QString(), trace->moduleBuilds());
+                
+                const ResourceUsage usage = m_governor.takeUsage(process);
+                process->deleteLater();
+                
+                if (!m_jobs.contains(jobId))
+                    return;
+                
+                Job &job = m_jobs[jobId];
+                if (usage.available) {
+                    appendOutput(job, i18n("Build used %1", usage.toString()));
+                }
+                if (usage.profile.available) {
+                    appendOutput(job, i18n("Build ran %1", usage.profile.toString()));
+                }
+                
+                const int code = exitStatus == QProcess::NormalExit ? exitCode : -1;
+                metrics.increment(code == 0 ? "fpb_builds_succeeded_total" : "fpb_builds_failed_total");
+                if (code == 0) {
+                    // The usage goes into the build record for capacity planning
+                    QString error;
+                    const QString commit = FlatpakExporter::commitOf(m_repoPath, job.appId, job.branch);
+                    if (!job.journal.complete(QStringLiteral("build"), commit, usage.toJson(), &error)) {
+                        appendOutput(job, i18n("Cannot write the build journal: %1", error));
+                    }
+                }
+                buildFinished(jobId, code);
+            });
+    
+    job.state = Building;
+    job.process = process;
+    job.timer.restart();
+    setProgress(job, QStringLiteral("building"), 10);
+    BuildMetrics::instance().increment("fpb_builds_started_total");
+    
+    // Every build is committed to the persistent export repo, on top of
+    // the previous build of the app
+    trace->start();
+    m_governor.start(process, "flatpak-builder", QStringList()
+                   << "--force-clean"
+                   << "--user"
+                   << "--install"
+                   << "--repo=" + m_repoPath
+                   << "--default-branch=" + job.branch
+                   << "--subject=" + job.appInfo.name + " " + job.appInfo.version
+                   << job.workspace->outputDir()
+                   << job.buildDir + "/manifest.json");
+}
+
+void BuilderService::installBuild(const QString &jobId)
+{
+    Job &job = m_jobs[jobId];
+    
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::MergedChannels);
+    connect(process, &QProcess::readyReadStandardOutput, this, [this, jobId, process]() {
+        const QByteArray output = process->readAllStandardOutput();
+        if (m_jobs.contains(jobId)) {
+            appendOutput(m_jobs[jobId], QString::fromLocal8Bit(output).trimmed());
+        }
+    });
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, jobId, process](int exitCode, QProcess::ExitStatus exitStatus) {
+                process->deleteLater();
+                if (m_jobs.contains(jobId)) {
+                    buildFinished(jobId, exitStatus == QProcess::NormalExit ? exitCode : -1);
+                }
+            });
+    
+    // Counts as a build, so it can be cancelled like one
+    job.state = Building;
+    job.process = process;
+    setProgress(job, QStringLiteral("installing"), 90);
+    process->start("flatpak", FlatpakExporter::installArguments(m_repoPath, job.appId, job.branch));
+}
+
+void BuilderService::buildFinished(const QString &jobId, int exitCode)
+{
+    Job &job = m_jobs[jobId];
+    
+    if (job.cancelled) {
+        finishJob(jobId, Cancelled, i18n("Cancelled"));
+        return;
+    }
+    
+    if (exitCode != 0) {
+        finishJob(jobId, Failed, i18n("Flatpak build failed with exit code: %1", exitCode));
+        return;
+    }
+    
+    // Publish the new commit: static deltas and optional bundle
+    if (!job.journal.isComplete("export")
+        || job.journal.outputHash("export") != FlatpakExporter::commitOf(m_repoPath, job.appId, job.branch)) {
+        ExportJob exportJob;
+        exportJob.appId = job.appId;
+        exportJob.branch = job.branch;
+        exportJob.repoPath = m_repoPath;
+        if (QSettings().value("export/createBundle", false).toBool()) {
+            const QString version = job.appInfo.version.isEmpty() ? QStringLiteral("latest") : job.appInfo.version;
+            exportJob.bundlePath = m_dataDir + "/bundles/" + job.appId + "-" + version + ".flatpak";
+        }
+        m_exporter->enqueue(exportJob);
+        m_exportJournals[job.appId] << qMakePair(job.journal.path(), job.branch);
+    }
+    
+    finishJob(jobId, Succeeded, i18n("%1 built and installed", job.appId));
+}
+
+void BuilderService::exportFinished(const QString &appId, bool success)
+{
+    // Exports of an app finish in the order they were queued
+    auto it = m_exportJournals.find(appId);
+    if (it == m_exportJournals.end())
+        return;
+    
+    const QPair<QString, QString> exported = it->takeFirst();
+    if (it->isEmpty()) {
+        m_exportJournals.erase(it);
+    }
+    
+    PipelineJournal journal(exported.first);
+    
+    // Only the export of the journaled build completes its pipeline,
+    // the next build starts over
+    if (success && journal.load()) {
+        const QString commit = FlatpakExporter::commitOf(m_repoPath, appId, exported.second);
+        if (journal.isComplete("build") && commit == journal.outputHash("build")) {
+            journal.remove();
+        }
+    }
+    
+    // New bundles count against the storage quota
+    collectStorage();
+}
+
+void BuilderService::setProgress(Job &job, const QString &stage, int percent)
+{
+    job.stage = stage;
+    job.progress = percent;
+    emit jobProgress(job.id, stage, percent);
+}
+
+void BuilderService::appendOutput(Job &job, const QString &text)
+{
+    if (text.isEmpty())
+        return;
+    
+    job.output += text.toUtf8() + '\n';
+    if (job.output.size() > OutputTailSize) {
+        job.output.remove(0, job.output.size() - OutputTailSize);
+    }
+    
+    emit jobLog(job.id, text);
+}
+
+void BuilderService::finishJob(const QString &jobId, State state, const QString &message)
+{
+    Job &job = m_jobs[jobId];
+    
+    // The commit is in the export repo on disk, free the memory for the
+    // next job
+    if (job.workspace) {
+        job.workspace->release();
+    }
+    
+    // Last, the next owner may set up a workspace of its own
+    if (job.state >= Staging) {
+        m_busyApps.remove(job.appId);
+        m_storage.unpin(job.buildDir);
+        StorageManager::touch(job.buildDir);
+        job.lock.reset();
+    }
+    
+    job.state = state;
+    job.message = message;
+    job.process = nullptr;
+    job.trace.reset();
+    setProgress(job, QString::fromLatin1(stateName(state)), 100);
+    
+    emit logMessage(state == Succeeded ? i18n("Job %1 (%2) finished", jobId, job.appInfo.name)
+                                       : i18n("Job %1 (%2) failed: %3", jobId, job.appInfo.name, message));
+    emit jobFinished(jobId, state == Succeeded, message);
+    
+    m_queue.removeAll(jobId);
+    m_admissionQueue.removeAll(jobId);
+    m_finished << jobId;
+    while (m_finished.size() > FinishedJobsKept) {
+        m_jobs.remove(m_finished.takeFirst());
+    }
+    
+    // The next job of the same app may go now
+    QTimer::singleShot(0, this, &BuilderService::schedule);
+    admitJobs();
+    collectStorage();
+}
+
+void BuilderService::collectStorage()
+{
+    // Unpacked installers of apps still in the catalog stay
+    QStringList sourceDirs;
+    for (const PortableAppInfo &info : m_catalog.load()) {
+        sourceDirs << info.sourceDir;
+    }
+    
+    m_storage.setReferenced(sourceDirs);
+    m_storage.collect();
+}
+
+void BuilderService::updateMetrics()
+{
+    int running = 0;
+    for (const Job &job : qAsConst(m_jobs)) {
+        running += job.state == Building ? 1 : 0;
+    }
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "service"), running);
+    metrics.setGauge("fpb_queue_depth", BuildMetrics::label("queue", "service"), m_queue.size());
+    metrics.writeTextFile();
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+#ifndef BUILDERSERVICE_H
+#define BUILDERSERVICE_H
+
+#include <QDBusConnection>
+#include <QDBusContext>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QPointer>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantMap>
+
+#include <memory>
+
+#include "appcatalog.h"
+#include "appscanindex.h"
+#include "builddirlock.h"
+#include "buildworkspace.h"
+#include "pipelinejournal.h"
+#include "portableappinfo.h"
+#include "resourcegovernor.h"
+#include "storagemanager.h"
+
+class FlatpakExporter;
+class ProcessTrace;
+class QProcess;
+
+/**
+ * Long-running build service on D-Bus.
+ *
+ * Owns the build queue, so a build outlives the window that started it,
+ * and the GUI, the command line and scripts all share one queue. Apps are
+ * given by catalog id or name and built the way the GUI builds them: in
+ * the app's build directory below the data directory, with its journal,
+ * its flatpak-builder caches and the export repo. Jobs of different apps
+ * run side by side as far as the resource governor admits them, jobs of
+ * the same app one after the other.
+ *
+ * State that is expensive to set up stays resident for the lifetime of
+ * the service instead of being rebuilt by every client: the catalog, the
+ * dependency probe and the storage accounting of the data directory,
+ * which the service collects.
+ *
+ * The object is exported at objectPath() with the scriptable slots and
+ * signals below. Progress and output go out as signals, so any number
+ * of clients can follow a job; log() returns what a client missed.
+ */
+class BuilderService : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.FlatpackPortableBuilder.Builder")
+    
+public:
+    explicit BuilderService(QObject *parent = nullptr);
+    ~BuilderService() override;
+    
+    static QString serviceName() { return QStringLiteral("org.kde.FlatpackPortableBuilder"); }
+    static QString objectPath() { return QStringLiteral("/Builder"); }
+    static QString interfaceName() { return QStringLiteral("org.kde.FlatpackPortableBuilder.Builder"); }
+    
+    // The session bus, or the bus at address, e.g. a private one for tests
+    static QDBusConnection connectBus(const QString &address = QString());
+    
+    // Export the object and take the service name. Fails if another
+    // service already runs on the bus.
+    bool registerOn(QDBusConnection bus, QString *errorMessage = nullptr);
+    
+    // Name of the first required tool that does not run, empty if all do.
+    // Blocks while the tools start.
+    static QString findMissingDependency();
+    
+public slots:
+    // Queue a catalog app by id, name or Flatpak app id. Returns the job
+    // id, or an UnknownApp error.
+    Q_SCRIPTABLE QString enqueue(const QString &app, const QString &branch);
+    
+    // Stop a queued or running job. False if there is no such job or it
+    // has already finished.
+    Q_SCRIPTABLE bool cancel(const QString &jobId);
+    
+    // Unfinished jobs, oldest first
+    Q_SCRIPTABLE QStringList jobs() const;
+    
+    // app, appId, branch, state, stage, progress and message of a job,
+    // also of the last finished ones
+    Q_SCRIPTABLE QVariantMap jobInfo(const QString &jobId) const;
+    
+    // The last part of a job's output
+    Q_SCRIPTABLE QString log(const QString &jobId) const;
+    
+    // First required tool that does not run, empty if all do. Probed
+    // once when the service starts.
+    Q_SCRIPTABLE QString missingDependency();
+    
+signals:
+    Q_SCRIPTABLE void jobQueued(const QString &jobId, const QString &app);
+    Q_SCRIPTABLE void jobProgress(const QString &jobId, const QString &stage, int percent);
+    Q_SCRIPTABLE void jobLog(const QString &jobId, const QString &text);
+    Q_SCRIPTABLE void jobFinished(const QString &jobId, bool success, const QString &message);
+    
+    // Everything the service logs, for its own output
+    void logMessage(const QString &message);
+    
+private:
+    enum State {
+        Queued,
+        Staging,
+        Waiting,        // For the resource governor
+        Building,
+        Succeeded,
+        Failed,
+        Cancelled,
+    };
+    
+    struct Job
+    {
+        QString id;
+        PortableAppInfo appInfo;
+        QString appId;
+        QString branch;
+        QString buildDir;
+        State state = Queued;
+        QString stage;
+        int progress = 0;
+        QString message;
+        QByteArray output;
+        bool cancelled = false;
+        
+        PipelineJournal journal;
+        QPointer<QProcess> process;
+        std::shared_ptr<ProcessTrace> trace;
+        std::shared_ptr<BuildWorkspace> workspace;
+        std::shared_ptr<BuildDirLock> lock;     // Held from staging until the job ends
+        QElapsedTimer timer;
+    };
+    
+    struct PreparedBuild
+    {
+        bool success = false;
+        QString error;
+        QStringList log;
+        PipelineJournal journal;
+        QString manifestPath;
+        bool staged = false;
+        StageResult stageResult;
+        qint64 prunedBytes = 0;
+        double seconds = 0;
+    };
+    
+    // Scan, set up the workspace, stage and write the manifest like a
+    // build from the window. Runs in a worker thread.
+    static PreparedBuild prepareBuild(const PortableAppInfo &appInfo, const QString &buildDir,
+                                      const std::shared_ptr<BuildWorkspace> &workspace);
+    
+    bool findApp(const QString &app, PortableAppInfo *appInfo);
+    void schedule();
+    void buildPrepared(const QString &jobId, const PreparedBuild &build);
+    void admitJobs();
+    void startBuild(const QString &jobId);
+    
+    // Install a build that finished before but is not installed
+    void installBuild(const QString &jobId);
+    void buildFinished(const QString &jobId, int exitCode);
+    void exportFinished(const QString &appId, bool success);
+    void setProgress(Job &job, const QString &stage, int percent);
+    void appendOutput(Job &job, const QString &text);
+    void finishJob(const QString &jobId, State state, const QString &message);
+    void collectStorage();
+    void updateMetrics();
+    
+    AppCatalog m_catalog;
+    QString m_dataDir;
+    QString m_repoPath;
+    QFuture<QString> m_dependencyProbe;
+    
+    QHash<QString, Job> m_jobs;
+    QStringList m_queue;                // Unfinished jobs, oldest first
+    QStringList m_finished;             // Kept for jobInfo() and log()
+    QSet<QString> m_busyApps;           // Apps with a job past the queue
+    QStringList m_admissionQueue;
+    
+    ResourceGovernor m_governor{QStringLiteral("service")};
+    QTimer m_admissionTimer;
+    StorageManager m_storage;
+    FlatpakExporter *m_exporter;
+    
+    // Journals of exported builds by app id, in export order, with the
+    // branch they were built for
+    QHash<QString, QList<QPair<QString, QString>>> m_exportJournals;
+};
+
+#endif // BUILDERSERVICE_H
\ No newline at end of file
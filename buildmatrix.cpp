@@ -0,0 +1,302 @@
+#include "buildmatrix.h"
+#include "apppackager.h"
+#include "buildmetrics.h"
+#include "manifestvalidator.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+
+#include <memory>
+
+namespace {
+
+QString capitalized(const QString &text)
+{
+    return text.left(1).toUpper() + text.mid(1);
+}
+
+} // namespace
+
+bool BuildVariant::parse(const QString &name, BuildVariant *variant)
+{
+    const int dash = name.lastIndexOf('-');
+    if (dash <= 0 || dash == name.size() - 1)
+        return false;
+    
+    variant->wineVersion = name.left(dash);
+    variant->wineArch = name.mid(dash + 1);
+    return true;
+}
+
+QString BuildVariant::name() const
+{
+    return wineVersion + "-" + wineArch;
+}
+
+QString BuildVariant::id() const
+{
+    return capitalized(wineVersion) + capitalized(wineArch);
+}
+
+PortableAppInfo BuildVariant::apply(const PortableAppInfo &appInfo) const
+{
+    PortableAppInfo variantInfo = appInfo;
+    variantInfo.wineVersion = wineVersion;
+    variantInfo.wineArch = wineArch;
+    variantInfo.variantId = id();
+    variantInfo.variants.clear();
+    
+    return variantInfo;
+}
+
+MatrixBuilder::MatrixBuilder(QObject *parent)
+    : QObject(parent)
+{
+    // Deferred builds are retried as the pressure averages move
+    m_admissionTimer.setInterval(2000);
+    connect(&m_admissionTimer, &QTimer::timeout, this, &MatrixBuilder::admitBuilds);
+}
+
+MatrixBuilder::~MatrixBuilder()
+{
+    for (const VariantBuild &build : qAsConst(m_builds)) {
+        if (build.process) {
+            build.process->disconnect(this);
+            build.process->kill();
+            build.process->waitForFinished();
+        }
+    }
+}
+
+bool MatrixBuilder::start(const PortableAppInfo &appInfo, const QVector<BuildVariant> &variants,
+                          const QString &buildDir, const QString &repoPath, QString *errorMessage)
+{
+    if (isRunning()) {
+        if (errorMessage)
+            *errorMessage = i18n("A variant matrix is already being built");
+        return false;
+    }
+    
+    if (variants.isEmpty()) {
+        if (errorMessage)
+            *errorMessage = i18n("No variants selected");
+        return false;
+    }
+    
+    TraceSpan span("stage", QStringLiteral("stage matrix"), appInfo.name);
+    QElapsedTimer timer;
+    timer.start();
+    
+    // Scan, prune and stage once for all variants
+    QStringList log;
+    const AppScanIndex index = AppPackager::scanPayload(appInfo, nullptr, &log);
+    
+    // A link left by a RAM workspace goes, not what it points to
+    const QString appDir = buildDir + "/app";
+    if (QFileInfo(appDir).isSymLink()) {
+        QFile::remove(appDir);
+    } else {
+        QDir(appDir).removeRecursively();
+    }
+    QDir().mkpath(appDir);
+    
+    StageResult stageResult;
+    if (!index.stageTo(appDir, &stageResult, errorMessage))
+        return false;
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "stage"), timer.elapsed() / 1000.0);
+    metrics.increment("fpb_staged_files_total", QString(), stageResult.files);
+    metrics.increment("fpb_staged_bytes_total", QString(), stageResult.bytes);
+    metrics.increment("fpb_reflinked_bytes_total", QString(), stageResult.reflinkedBytes);
+    metrics.increment("fpb_pruned_bytes_total", QString(), index.totalSize() - index.retainedSize());
+    
+    // Every variant's manifest pins the same payload
+    const QString fingerprint = index.fingerprint();
+    
+    QVector<VariantBuild> builds;
+    for (const BuildVariant &variant : variants) {
+        const PortableAppInfo variantInfo = variant.apply(appInfo);
+        
+        // Wine Gecko differs by architecture, everything else is shared
+        AppPackager::stageSupportFiles(variantInfo, buildDir);
+        
+        FlatpakManifest manifest = AppPackager::generateManifest(variantInfo, &log);
+        manifest.setPayloadFingerprint(fingerprint);
+        
+        VariantBuild build;
+        build.variant = variant;
+        build.appId = manifest.appId();
+        build.subject = appInfo.name + " " + appInfo.version + " (" + variant.name() + ")";
+        build.manifestPath = buildDir + "/manifest-" + variant.name() + ".json";
+        if (!manifest.saveToFile(build.manifestPath)) {
+            if (errorMessage)
+                *errorMessage = i18n("Failed to write manifest file!");
+            return false;
+        }
+        
+        builds << build;
+    }
+    
+    for (const QString &line : qAsConst(log)) {
+        emit logMessage(line);
+    }
+    emit logMessage(i18np("Staged %2 files once for 1 variant", "Staged %2 files once for %1 variants",
+                          variants.size(), stageResult.files));
+    
+    // Check all manifests in parallel before the first build starts
+    QStringList manifestPaths;
+    for (const VariantBuild &build : qAsConst(builds)) {
+        manifestPaths << build.manifestPath;
+    }
+    
+    QStringList errors;
+    for (const ManifestValidator::Report &report : ManifestValidator::validateFiles(manifestPaths)) {
+        const QString fileName = QFileInfo(report.manifestPath).fileName();
+        for (const QString &warning : report.warnings()) {
+            emit logMessage(i18n("%1: %2", fileName, warning));
+        }
+        for (const QString &error : report.errors()) {
+            errors << i18n("%1: %2", fileName, error);
+        }
+    }
+    
+    if (!errors.isEmpty()) {
+        if (errorMessage)
+            *errorMessage = errors.join('\n');
+        return false;
+    }
+    
+    m_buildDir = buildDir;
+    m_repoPath = repoPath;
+    m_builds = builds;
+    m_failed = 0;
+    m_pending.clear();
+    for (int i = 0; i < m_builds.size(); ++i) {
+        m_pending << i;
+    }
+    
+    admitBuilds();
+    return true;
+}
+
+void MatrixBuilder::admitBuilds()
+{
+    while (!m_pending.isEmpty() && m_governor.admit(m_running)) {
+        startBuild(m_pending.takeFirst());
+    }
+    
+    if (m_pending.isEmpty()) {
+        m_admissionTimer.stop();
+    } else if (!m_admissionTimer.isActive()) {
+        m_admissionTimer.start();
+    }
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "matrix"), m_running);
+    metrics.setGauge("fpb_queue_depth", BuildMetrics::label("queue", "matrix"), m_running + m_pending.size());
+    metrics.writeTextFile();
+}
+
+void MatrixBuilder::startBuild(int index)
+{
+    VariantBuild &build = m_builds[index];
+    const QString name = build.variant.name();
+    
+    emit logMessage(i18n("Building variant %1 as %2...", name, build.appId));
+    
+    auto trace = std::make_shared<ProcessTrace>(QStringLiteral("flatpak-builder"), build.appId);
+    
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::MergedChannels);
+    process->setWorkingDirectory(m_buildDir);
+    connect(process, &QProcess::readyReadStandardOutput, this, [this, process, trace, name]() {
+        const QByteArray output = process->readAllStandardOutput();
+        trace->addOutput(output);
+        m_governor.setStage(process, trace->phase());
+        
+        // The builds run concurrently, tag their lines
+        for (const QByteArray &line : output.split('\n')) {
+            if (!line.trimmed().isEmpty()) {
+                emit logMessage("[" + name + "] " + QString::fromLocal8Bit(line));
+            }
+        }
+    });
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, process, trace, index, name](int exitCode, QProcess::ExitStatus exitStatus) {
+                trace->finish(exitCode);
+                
+                BuildMetrics &metrics = BuildMetrics::instance();
+                metrics.increment("fpb_build_cache_hits_total", QString(), trace->moduleCacheHits());
+                metrics.increment("fpb_build_cache_misses_total", QString(), trace->moduleBuilds());
+                
+                const ResourceUsage usage = m_governor.takeUsage(process);
+                if (usage.available) {
+                    emit logMessage(i18n("Variant %1 used %2", name, usage.toString()));
+                }
+                if (usage.profile.available) {
+                    emit logMessage(i18n("Variant %1 ran %2", name, usage.profile.toString()));
+                }
+                
+                process->deleteLater();
+                buildFinished(index, exitStatus == QProcess::NormalExit && exitCode == 0);
+            });
+    
+    QStringList arguments;
+    arguments << "--force-clean"
+              << "--user"
+              << "--install"
+              << "--repo=" + m_repoPath
+              << "--subject=" + build.subject
+              // Concurrent builds must not share a state directory
+              << "--state-dir=" + m_buildDir + "/.flatpak-builder-variants/" + name;
+    
+    // Reuse what the regular build of the app has downloaded
+    const QString downloads = m_buildDir + "/.flatpak-builder/downloads";
+    if (QFileInfo(downloads).isDir()) {
+        arguments << "--extra-sources=" + downloads;
+    }
+    
+    arguments << "build-" + name << build.manifestPath;
+    
+    build.process = process;
+    build.timer.start();
+    m_running++;
+    BuildMetrics::instance().increment("fpb_builds_started_total");
+    
+    trace->start();
+    m_governor.start(process, "flatpak-builder", arguments);
+}
+
+void MatrixBuilder::buildFinished(int index, bool success)
+{
+    m_running--;
+    
+    const VariantBuild &build = m_builds[index];
+    const double seconds = build.timer.elapsed() / 1000.0;
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.increment(success ? "fpb_builds_succeeded_total" : "fpb_builds_failed_total");
+    metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "flatpak_builder"), seconds);
+    metrics.increment("fpb_worker_busy_seconds_total", BuildMetrics::label("pool", "matrix"), seconds);
+    
+    if (success) {
+        emit logMessage(i18n("Variant %1 built and installed as %2", build.variant.name(), build.appId));
+    } else {
+        m_failed++;
+        emit logMessage(i18n("Variant %1 failed", build.variant.name()));
+    }
+    
+    emit variantFinished(build.appId, success);
+    
+    admitBuilds();
+    
+    if (!isRunning()) {
+        emit finished(m_failed);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef BUILDMATRIX_H
+#define BUILDMATRIX_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include "portableappinfo.h"
+#include "resourcegovernor.h"
+
+class QProcess;
+
+/**
+ * One Wine version and architecture an app is built for
+ */
+struct BuildVariant
+{
+    QString wineVersion;
+    QString wineArch;
+    
+    // Parse "staging-win32", false if it is not of that form
+    static bool parse(const QString &name, BuildVariant *variant);
+    
+    // "staging-win32"
+    QString name() const;
+    
+    // "StagingWin32", the last component of the variant's app id
+    QString id() const;
+    
+    // The app with the variant's Wine settings and app id
+    PortableAppInfo apply(const PortableAppInfo &appInfo) const;
+};
+
+/**
+ * Builds an app for several Wine versions and architectures at once.
+ *
+ * The app is scanned, pruned and staged once. Each variant gets its own
+ * manifest next to the staged tree, with an app id of its own, so the
+ * variants install side by side with separate Wine prefixes.
+ * flatpak-builder only reads the tree, so all variant builds share it.
+ * They run concurrently, each with its own build and state directory,
+ * and the resource governor decides how many run at the same time.
+ */
+class MatrixBuilder : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit MatrixBuilder(QObject *parent = nullptr);
+    ~MatrixBuilder() override;
+    
+    bool isRunning() const { return m_running > 0 || !m_pending.isEmpty(); }
+    
+    // Stage the app into buildDir and start building the variants into
+    // repoPath. Fails if staging fails or a matrix is already running.
+    bool start(const PortableAppInfo &appInfo, const QVector<BuildVariant> &variants,
+               const QString &buildDir, const QString &repoPath, QString *errorMessage = nullptr);
+    
+signals:
+    void logMessage(const QString &message);
+    void variantFinished(const QString &appId, bool success);
+    void finished(int failedCount);
+    
+private:
+    struct VariantBuild
+    {
+        BuildVariant variant;
+        QString appId;
+        QString subject;
+        QString manifestPath;
+        QPointer<QProcess> process;
+        QElapsedTimer timer;
+    };
+    
+    void admitBuilds();
+    void startBuild(int index);
+    void buildFinished(int index, bool success);
+    
+    QString m_buildDir;
+    QString m_repoPath;
+    QVector<VariantBuild> m_builds;
+    QList<int> m_pending;
+    int m_running = 0;
+    int m_failed = 0;
+    
+    ResourceGovernor m_governor{QStringLiteral("matrix")};
+    QTimer m_admissionTimer;
+};
+
+#endif // BUILDMATRIX_H
\ No newline at end of file
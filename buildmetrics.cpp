@@ -0,0 +1,243 @@
+#include "buildmetrics.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cmath>
+
+namespace {
+
+QString formatValue(double value)
+{
+    if (std::isinf(value))
+        return value > 0 ? QStringLiteral("+Inf") : QStringLiteral("-Inf");
+    
+    return QString::number(value, 'g', 15);
+}
+
+// name{labels} or name{labels,extra}
+QString series(const QString &name, const QString &labels, const QString &extra = QString())
+{
+    QString joined = labels;
+    if (!extra.isEmpty()) {
+        joined = joined.isEmpty() ? extra : joined + QLatin1Char(',') + extra;
+    }
+    
+    if (joined.isEmpty())
+        return name;
+    
+    return name + QLatin1Char('{') + joined + QLatin1Char('}');
+}
+
+} // namespace
+
+BuildMetrics &BuildMetrics::instance()
+{
+    static BuildMetrics metrics;
+    return metrics;
+}
+
+BuildMetrics::BuildMetrics()
+{
+    // Stages range from sub-second manifest writes to hour long builds
+    const QVector<double> durationBuckets = { 0.1, 0.5, 1, 5, 15, 30, 60, 120, 300, 600, 1200, 1800, 3600, 7200 };
+    
+    declare("fpb_builds_started_total", Counter, "Flatpak builds started");
+    declare("fpb_builds_succeeded_total", Counter, "Flatpak builds that finished successfully");
+    declare("fpb_builds_failed_total", Counter, "Flatpak builds that failed");
+    declare("fpb_exports_total", Counter, "Finished exports (static deltas, bundles) by result");
+    declare("fpb_stage_duration_seconds", Histogram, "Duration of pipeline stages", durationBuckets);
+    
+    declare("fpb_staged_files_total", Counter, "Files copied into build directories");
+    declare("fpb_staged_bytes_total", Counter, "Bytes copied into build directories");
+    declare("fpb_reflinked_bytes_total", Counter, "Staged bytes shared with the source through reflinks");
+    declare("fpb_pruned_bytes_total", Counter, "Bytes left out of build directories by pruning rules");
+    
+    declare("fpb_artifact_cache_hits_total", Counter, "Downloadable artifacts (Wine Mono/Gecko) found in the local cache");
+    declare("fpb_artifact_cache_misses_total", Counter, "Downloadable artifacts missing from the local cache");
+    declare("fpb_build_cache_hits_total", Counter, "flatpak-builder modules reused from the build cache");
+    declare("fpb_build_cache_misses_total", Counter, "flatpak-builder modules that had to be built");
+    declare("fpb_installers_unpacked_total", Counter, "Setup programs unpacked on import, by installer type");
+    
+    declare("fpb_queue_depth", Gauge, "Jobs waiting or running, by queue");
+    declare("fpb_workers", Gauge, "Job slots, by pool");
+    declare("fpb_workers_busy", Gauge, "Job slots in use, by pool");
+    declare("fpb_worker_busy_seconds_total", Counter, "Time spent running jobs, by pool");
+    
+    // Resource use of build jobs, from their cgroups
+    const QVector<double> memoryBuckets = { 256e6, 512e6, 1e9, 2e9, 4e9, 8e9, 16e9, 32e9 };
+    declare("fpb_job_cpu_seconds_total", Counter, "CPU time used by build jobs, by pool");
+    declare("fpb_job_memory_peak_bytes", Histogram, "Peak memory of build jobs, by pool", memoryBuckets);
+    declare("fpb_job_io_bytes_total", Counter, "Bytes read and written by build jobs, by pool and direction");
+    declare("fpb_job_memory_average_bytes", Histogram, "Average resident memory of the process trees of build jobs, by pool", memoryBuckets);
+    declare("fpb_job_stage_cpu_seconds_total", Counter, "CPU time used by the process trees of build jobs, by pool and flatpak-builder stage");
+    declare("fpb_pressure_avg10", Gauge, "Share of time tasks stalled on a resource (PSI some avg10, percent), by resource");
+    declare("fpb_admissions_deferred_total", Counter, "Admission checks that held back a job because of resource pressure, by pool");
+    
+    // Disk use of build directories and caches, see StorageManager
+    declare("fpb_storage_bytes", Gauge, "Disk space used, by storage area");
+    declare("fpb_storage_quota_bytes", Gauge, "Disk space all storage areas may use together");
+    declare("fpb_storage_evictions_total", Counter, "Entries removed to stay within the storage quota, by storage area");
+    declare("fpb_storage_freed_bytes_total", Counter, "Disk space freed by storage collections");
+    declare("fpb_workspace_builds_total", Counter, "Builds by where their workspace was placed, by location (ram, disk)");
+    
+    declare("fpb_last_update_timestamp_seconds", Gauge, "Time the metrics were last written");
+}
+
+void BuildMetrics::declare(const QString &name, Type type, const QString &help, const QVector<double> &buckets)
+{
+    Family &family = m_families[name];
+    family.type = type;
+    family.help = help;
+    family.buckets = buckets;
+}
+
+QString BuildMetrics::label(const QString &name, const QString &value)
+{
+    QString escaped = value;
+    escaped.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+    escaped.replace(QLatin1Char('"'), QLatin1String("\\\""));
+    escaped.replace(QLatin1Char('\n'), QLatin1String("\\n"));
+    
+    return name + QLatin1String("=\"") + escaped + QLatin1Char('"');
+}
+
+void BuildMetrics::increment(const QString &name, const QString &labels, double value)
+{
+    QMutexLocker locker(&m_mutex);
+    
+    auto it = m_families.find(name);
+    if (it == m_families.end() || it->type != Counter)
+        return;
+    
+    it->values[labels] += value;
+}
+
+void BuildMetrics::setGauge(const QString &name, const QString &labels, double value)
+{
+    QMutexLocker locker(&m_mutex);
+    
+    auto it = m_families.find(name);
+    if (it == m_families.end() || it->type != Gauge)
+        return;
+    
+    it->values[labels] = value;
+}
+
+void BuildMetrics::observe(const QString &name, const QString &labels, double value)
+{
+    QMutexLocker locker(&m_mutex);
+    
+    auto it = m_families.find(name);
+    if (it == m_families.end() || it->type != Histogram)
+        return;
+    
+    HistogramData &histogram = it->histograms[labels];
+    if (histogram.bucketCounts.isEmpty()) {
+        histogram.bucketCounts.fill(0, it->buckets.size());
+    }
+    
+    for (int i = 0; i < it->buckets.size(); ++i) {
+        if (value <= it->buckets[i]) {
+            histogram.bucketCounts[i]++;
+        }
+    }
+    histogram.count++;
+    histogram.sum += value;
+}
+
+void BuildMetrics::setTextFilePath(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    m_textFilePath = path;
+}
+
+QString BuildMetrics::textFilePath() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_textFilePath;
+}
+
+QString BuildMetrics::defaultTextFilePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/metrics/flatpak_portable_builder.prom";
+}
+
+QString BuildMetrics::textFilePathForMode(const QString &path, const QString &mode)
+{
+    if (mode.isEmpty() || path.isEmpty())
+        return path;
+    
+    const QFileInfo info(path);
+    const QString suffix = info.suffix().isEmpty() ? QString() : "." + info.suffix();
+    return info.path() + "/" + info.completeBaseName() + "_" + mode + suffix;
+}
+
+QByteArray BuildMetrics::toText() const
+{
+    QMutexLocker locker(&m_mutex);
+    
+    QString out;
+    for (auto it = m_families.constBegin(); it != m_families.constEnd(); ++it) {
+        const QString &name = it.key();
+        const Family &family = it.value();
+        
+        // Families without samples are left out entirely
+        if (family.values.isEmpty() && family.histograms.isEmpty())
+            continue;
+        
+        static const char *const typeNames[] = { "counter", "gauge", "histogram" };
+        out += QStringLiteral("# HELP %1 %2\n").arg(name, family.help);
+        out += QStringLiteral("# TYPE %1 %2\n").arg(name, QLatin1String(typeNames[family.type]));
+        
+        for (auto value = family.values.constBegin(); value != family.values.constEnd(); ++value) {
+            out += series(name, value.key()) + QLatin1Char(' ') + formatValue(value.value()) + QLatin1Char('\n');
+        }
+        
+        for (auto histogram = family.histograms.constBegin(); histogram != family.histograms.constEnd(); ++histogram) {
+            const HistogramData &data = histogram.value();
+            for (int i = 0; i < family.buckets.size(); ++i) {
+                out += series(name + "_bucket", histogram.key(), label("le", formatValue(family.buckets[i])))
+                     + QLatin1Char(' ') + QString::number(data.bucketCounts[i]) + QLatin1Char('\n');
+            }
+            out += series(name + "_bucket", histogram.key(), label("le", "+Inf"))
+                 + QLatin1Char(' ') + QString::number(data.count) + QLatin1Char('\n');
+            out += series(name + "_sum", histogram.key()) + QLatin1Char(' ') + formatValue(data.sum) + QLatin1Char('\n');
+            out += series(name + "_count", histogram.key()) + QLatin1Char(' ') + QString::number(data.count) + QLatin1Char('\n');
+        }
+    }
+    
+    return out.toUtf8();
+}
+
+bool BuildMetrics::writeTextFile(QString *errorMessage)
+{
+    const QString path = textFilePath();
+    if (path.isEmpty())
+        return true;
+    
+    setGauge("fpb_last_update_timestamp_seconds", QString(), QDateTime::currentMSecsSinceEpoch() / 1000.0);
+    
+    QDir().mkpath(QFileInfo(path).path());
+    
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    
+    file.write(toText());
+    
+    if (!file.commit()) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef BUILDMETRICS_H
+#define BUILDMETRICS_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+/**
+ * Counters, gauges and histograms of the packaging pipeline.
+ *
+ * The values are written in the Prometheus text format to a file that the
+ * node-exporter textfile collector picks up, so build hosts can be
+ * monitored without an extra daemon. All methods are thread-safe.
+ */
+class BuildMetrics
+{
+public:
+    static BuildMetrics &instance();
+    
+    // Format a single label, e.g. label("stage", "scan") -> stage="scan"
+    static QString label(const QString &name, const QString &value);
+    
+    void increment(const QString &name, const QString &labels = QString(), double value = 1);
+    void setGauge(const QString &name, const QString &labels, double value);
+    
+    // Add a sample to a histogram declared in the constructor
+    void observe(const QString &name, const QString &labels, double value);
+    
+    // Where writeTextFile() goes, empty disables writing
+    void setTextFilePath(const QString &path);
+    QString textFilePath() const;
+    
+    // <data>/flatpak-wine-builder/metrics/flatpak_portable_builder.prom
+    static QString defaultTextFilePath();
+    
+    // path with "_<mode>" before its extension, e.g.
+    // flatpak_portable_builder_service.prom. Processes running side by
+    // side need files of their own, or their counters would overwrite
+    // each other and look like resets. An empty mode keeps path.
+    static QString textFilePathForMode(const QString &path, const QString &mode);
+    
+    QByteArray toText() const;
+    
+    // Replace the text file atomically, so the collector never reads a
+    // partial file
+    bool writeTextFile(QString *errorMessage = nullptr);
+    
+private:
+    BuildMetrics();
+    
+    enum Type { Counter, Gauge, Histogram };
+    
+    struct HistogramData
+    {
+        QVector<quint64> bucketCounts;
+        quint64 count = 0;
+        double sum = 0;
+    };
+    
+    struct Family
+    {
+        Type type = Counter;
+        QString help;
+        QVector<double> buckets;                // Histograms only
+        QMap<QString, double> values;           // Labels -> value
+        QMap<QString, HistogramData> histograms;
+    };
+    
+    void declare(const QString &name, Type type, const QString &help, const QVector<double> &buckets = QVector<double>());
+    
+    mutable QMutex m_mutex;
+    QMap<QString, Family> m_families;
+    QString m_textFilePath;
+};
+
+#endif // BUILDMETRICS_H
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "buildworkspace.h"
+#include "appscanindex.h"
+#include "buildmetrics.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLocale>
+#include <QMutex>
+#include <QSettings>
+#include <QStorageInfo>
+
+#include <unistd.h>
+
+namespace {
+
+// Scratch directories, relative to the build directory, and their names
+// in RAM. flatpak-builder's output directory is not among them:
+// --force-clean removes it, links included, so it is passed as a path of
+// its own.
+const struct {
+    const char *path;
+    const char *ramName;
+} ScratchDirs[] = {
+    { "app", "app" },
+    { ".flatpak-builder/build", "module-builds" },
+};
+
+QMutex reservationMutex;
+qint64 reservedBytes = 0;
+
+// Per user, several users may share /dev/shm
+QString ramRoot(const WorkspacePolicy &policy)
+{
+    return policy.ramDir + "/flatpack-portable-builder-" + QString::number(::getuid());
+}
+
+QString ramDirFor(const WorkspacePolicy &policy, const QString &buildDir)
+{
+    return ramRoot(policy) + "/" + QFileInfo(buildDir).fileName();
+}
+
+// MemAvailable of /proc/meminfo, 0 if it cannot be read
+qint64 availableMemory()
+{
+    QFile file(QStringLiteral("/proc/meminfo"));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine();
+        if (line.startsWith("MemAvailable:"))
+            return line.mid(13).simplified().split(' ').value(0).toLongLong() * 1024;
+    }
+    
+    return 0;
+}
+
+} // namespace
+
+WorkspacePolicy WorkspacePolicy::fromSettings()
+{
+    WorkspacePolicy policy;
+    
+    QSettings settings;
+    settings.beginGroup("workspace");
+    policy.useRam = settings.value("useRam", policy.useRam).toBool();
+    policy.ramDir = settings.value("ramDir", policy.ramDir).toString();
+    policy.headroom = qint64(settings.value("headroomGiB", double(policy.headroom >> 30)).toDouble() * (1LL << 30));
+    policy.maxMemoryPercent = settings.value("maxMemoryPercent", policy.maxMemoryPercent).toInt();
+    
+    return policy;
+}
+
+BuildWorkspace::BuildWorkspace(const WorkspacePolicy &policy)
+    : m_policy(policy)
+{
+}
+
+BuildWorkspace::~BuildWorkspace()
+{
+    release();
+}
+
+qint64 BuildWorkspace::estimate(const AppScanIndex &index) const
+{
+    // The app is staged, copied into the module build directory and
+    // installed into the output directory
+    return 3 * index.retainedSize() + m_policy.headroom;
+}
+
+bool BuildWorkspace::prepare(const QString &buildDir, qint64 estimatedBytes, QString *message)
+{
+    if (buildDir != m_buildDir) {
+        release();
+        m_buildDir = buildDir;
+    }
+    
+    QString dummy;
+    if (!message) {
+        message = &dummy;
+    }
+    
+    // Where the staged files are, empty if they are gone
+    const QString appDir = buildDir + "/app";
+    const QString stagedDir = QFileInfo(appDir).canonicalFilePath();
+    
+    if (inRam() && QFileInfo(m_ramDir + "/app").isDir()) {
+        *message = i18n("Building in RAM in %1", m_ramDir);
+        return true;
+    }
+    release();
+    
+    // The first build of an app builds the shared modules (Wine, DXVK),
+    // whose size the scan index knows nothing about
+    QString reason;
+    if (!m_policy.useRam) {
+        message->clear();
+    } else if (!QDir(buildDir + "/.flatpak-builder/cache").exists()) {
+        *message = i18n("Building on disk, the first build of an app builds the shared modules");
+    } else if (!reserve(estimatedBytes, &reason)) {
+        *message = i18n("Building on disk: %1", reason);
+    } else {
+        m_ramDir = ramDirFor(m_policy, buildDir);
+        
+        QString error;
+        if (linkToRam(&error)) {
+            *message = i18n("Building in RAM in %1, %2 estimated", m_ramDir, QLocale().formattedDataSize(estimatedBytes));
+            BuildMetrics::instance().increment("fpb_workspace_builds_total", BuildMetrics::label("location", "ram"));
+            return false;
+        }
+        
+        *message = i18n("Building on disk, cannot set up the RAM workspace: %1", error);
+        release();
+    }
+    
+    // Links left by an earlier process, e.g. after a crash or a reboot
+    // emptied the tmpfs
+    unlinkFromRam();
+    BuildMetrics::instance().increment("fpb_workspace_builds_total", BuildMetrics::label("location", "disk"));
+    
+    return !stagedDir.isEmpty() && QFileInfo(appDir).canonicalFilePath() == stagedDir;
+}
+
+void BuildWorkspace::release()
+{
+    if (!inRam())
+        return;
+    
+    unlinkFromRam();
+    unreserve();
+    m_ramDir.clear();
+}
+
+QString BuildWorkspace::outputDir() const
+{
+    return (inRam() ? m_ramDir : m_buildDir) + "/build";
+}
+
+bool BuildWorkspace::reserve(qint64 estimatedBytes, QString *reason)
+{
+    const QStorageInfo storage(m_policy.ramDir);
+    if (!storage.isValid() || storage.fileSystemType() != "tmpfs") {
+        *reason = i18n("%1 is not a tmpfs", m_policy.ramDir);
+        return false;
+    }
+    
+    const QLocale locale;
+    QMutexLocker locker(&reservationMutex);
+    
+    // tmpfs pages are memory of the build's scope, the compilers need
+    // the rest
+    const qint64 memory = availableMemory() * m_policy.maxMemoryPercent / 100 - reservedBytes;
+    if (estimatedBytes > memory) {
+        *reason = i18n("needs %1, %2 of memory available", locale.formattedDataSize(estimatedBytes),
+                       locale.formattedDataSize(qMax(memory, qint64(0))));
+        return false;
+    }
+    
+    const qint64 space = storage.bytesAvailable() - reservedBytes;
+    if (estimatedBytes > space) {
+        *reason = i18n("needs %1, %2 free in %3", locale.formattedDataSize(estimatedBytes),
+                       locale.formattedDataSize(qMax(space, qint64(0))), m_policy.ramDir);
+        return false;
+    }
+    
+    reservedBytes += estimatedBytes;
+    m_reserved = estimatedBytes;
+    return true;
+}
+
+void BuildWorkspace::unreserve()
+{
+    QMutexLocker locker(&reservationMutex);
+    reservedBytes -= m_reserved;
+    m_reserved = 0;
+}
+
+bool BuildWorkspace::linkToRam(QString *errorMessage)
+{
+    unlinkFromRam();
+    
+    if (!QDir().mkpath(ramRoot(m_policy))
+        || !QFile::setPermissions(ramRoot(m_policy), QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner)) {
+        *errorMessage = i18n("Cannot create %1", ramRoot(m_policy));
+        return false;
+    }
+    
+    // Output of a build on disk, --force-clean would remove it anyway
+    QDir(m_buildDir + "/build").removeRecursively();
+    
+    for (const auto &dir : ScratchDirs) {
+        const QString path = m_buildDir + "/" + QLatin1String(dir.path);
+        const QString target = m_ramDir + "/" + QLatin1String(dir.ramName);
+        
+        QDir(path).removeRecursively();
+        if (!QDir().mkpath(target) || !QDir().mkpath(QFileInfo(path).path()) || !QFile::link(target, path)) {
+            *errorMessage = i18n("Cannot link %1 to %2", path, target);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+void BuildWorkspace::unlinkFromRam()
+{
+    if (m_buildDir.isEmpty())
+        return;
+    
+    // Only what is below the RAM root is removed, whatever the links say
+    const QString root = ramRoot(m_policy) + "/";
+    for (const auto &dir : ScratchDirs) {
+        const QString path = m_buildDir + "/" + QLatin1String(dir.path);
+        const QFileInfo info(path);
+        if (!info.isSymLink())
+            continue;
+        
+        const QString target = info.symLinkTarget();
+        QFile::remove(path);
+        if (target.startsWith(root)) {
+            QDir(target).removeRecursively();
+        }
+    }
+    
+    QDir(ramDirFor(m_policy, m_buildDir)).removeRecursively();
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#ifndef BUILDWORKSPACE_H
+#define BUILDWORKSPACE_H
+
+#include <QString>
+#include <QStringList>
+
+class AppScanIndex;
+
+/**
+ * Where build workspaces may go
+ */
+struct WorkspacePolicy
+{
+    bool useRam = false;                        // Place workspaces on the tmpfs at ramDir if they fit
+    QString ramDir = QStringLiteral("/dev/shm");
+    qint64 headroom = 2LL << 30;                // Wine and runtime files checked out next to the app
+    int maxMemoryPercent = 50;                  // Of the available memory, for all RAM workspaces together
+    
+    // Values from the workspace/ group of the config file
+    static WorkspacePolicy fromSettings();
+};
+
+/**
+ * The scratch directories of a build: the staged app and flatpak-builder's
+ * output and module build directories.
+ *
+ * They are only written and read during a single build, and checking out,
+ * committing and cleaning them up is mostly metadata work, which is slow
+ * on spinning disks. If the policy allows it and the estimated size fits
+ * into the available memory, they are placed on a tmpfs and the build
+ * directory links to them. Everything that outlives the build stays on
+ * disk: the manifest, the journal, flatpak-builder's module cache and the
+ * export repo the build is committed to. Builds that do not fit, and the
+ * first build of an app, which builds the shared modules, use the disk.
+ *
+ * RAM workspaces are counted in the whole process, so builds running side
+ * by side do not overcommit the memory. Prepare and release them from one
+ * thread at a time per workspace, while holding the BuildDirLock of the
+ * build directory: setting up and releasing a workspace removes the RAM
+ * directory the build directory links to, whoever set it up.
+ */
+class BuildWorkspace
+{
+public:
+    explicit BuildWorkspace(const WorkspacePolicy &policy = WorkspacePolicy::fromSettings());
+    ~BuildWorkspace();
+    
+    BuildWorkspace(const BuildWorkspace &) = delete;
+    BuildWorkspace &operator=(const BuildWorkspace &) = delete;
+    
+    // Bytes a build of the retained files of index needs in the workspace
+    qint64 estimate(const AppScanIndex &index) const;
+    
+    // Set up the workspace of buildDir in RAM or on disk. A RAM workspace
+    // that is still in place is kept, with its staged files. message says
+    // where it went and why. False if the files staged by an earlier
+    // build are gone, so only a full staging will do.
+    bool prepare(const QString &buildDir, qint64 estimatedBytes, QString *message = nullptr);
+    
+    // Remove a RAM workspace and free its memory. The build directory
+    // stays, its staged files are restaged by the next build.
+    void release();
+    
+    QString buildDir() const { return m_buildDir; }
+    bool inRam() const { return !m_ramDir.isEmpty(); }
+    
+    // flatpak-builder's output directory, below the build directory or in RAM
+    QString outputDir() const;
+    
+private:
+    // Count estimatedBytes against the memory of all RAM workspaces of
+    // the process. False with the reason if they do not fit.
+    bool reserve(qint64 estimatedBytes, QString *reason);
+    void unreserve();
+    
+    // Replace the scratch directories of m_buildDir with links into m_ramDir
+    bool linkToRam(QString *errorMessage);
+    
+    // Remove the links of m_buildDir and what they point to, also those
+    // left by an earlier process
+    void unlinkFromRam();
+    
+    WorkspacePolicy m_policy;
+    QString m_buildDir;
+    QString m_ramDir;
+    qint64 m_reserved = 0;
+};
+
+#endif // BUILDWORKSPACE_H
\ No newline at end of file
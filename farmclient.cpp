@@ -0,0 +1,76 @@
+#include "farmclient.h"
+#include "farmconnection.h"
+
+#include <KLocalizedString>
+
+#include <QJsonArray>
+
+FarmClient::FarmClient(QObject *parent)
+    : QObject(parent)
+    , m_token(FarmConnection::defaultToken())
+{
+}
+
+void FarmClient::setToken(const QString &token)
+{
+    m_token = token;
+}
+
+void FarmClient::submit(const QString &address, const QStringList &apps, const QString &branch)
+{
+    m_connection = FarmConnection::connectTo(address, this);
+    
+    connect(m_connection, &FarmConnection::connected, this, [this, apps, branch]() {
+        m_connection->send(QJsonObject{
+            { "type", "submit" },
+            { "token", m_token },
+            { "apps", QJsonArray::fromStringList(apps) },
+            { "branch", branch },
+        });
+    });
+    
+    connect(m_connection, &FarmConnection::messageReceived, this, [this](const QJsonObject &message) {
+        const QString type = message.value("type").toString();
+        
+        if (type == "submitted") {
+            for (const QJsonValue &app : message.value("unknown").toArray()) {
+                emit logMessage(i18n("Unknown app: %1", app.toString()));
+                m_failed++;
+            }
+            for (const QJsonValue &job : message.value("jobs").toArray()) {
+                const QJsonObject object = job.toObject();
+                m_pending.insert(object.value("job").toString());
+                emit logMessage(i18n("Queued %1 as job %2", object.value("app").toString(), object.value("job").toString()));
+            }
+        } else if (type == "rejected") {
+            emit logMessage(i18n("Rejected by the coordinator: %1", message.value("message").toString()));
+            return;
+        } else if (type == "job-finished") {
+            m_pending.remove(message.value("job").toString());
+            
+            if (message.value("success").toBool()) {
+                emit logMessage(i18n("%1 built", message.value("app").toString()));
+            } else {
+                emit logMessage(i18n("%1 failed: %2", message.value("app").toString(), message.value("message").toString()));
+                m_failed++;
+            }
+        } else {
+            return;
+        }
+        
+        if (m_pending.isEmpty()) {
+            m_done = true;
+            m_connection->close();
+            emit finished(m_failed);
+        }
+    });
+    
+    connect(m_connection, &FarmConnection::disconnected, this, [this]() {
+        if (m_done)
+            return;
+        
+        m_done = true;
+        emit logMessage(i18n("Lost connection to the coordinator"));
+        emit finished(m_failed + m_pending.size() + 1);
+    });
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef FARMCLIENT_H
+#define FARMCLIENT_H
+
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+class FarmConnection;
+
+/**
+ * Submits catalog apps to a build farm coordinator and waits for them
+ */
+class FarmClient : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit FarmClient(QObject *parent = nullptr);
+    
+    // Token presented to the coordinator, farm/token by default
+    void setToken(const QString &token);
+    
+    // Apps are given by catalog id or name
+    void submit(const QString &address, const QStringList &apps, const QString &branch = QStringLiteral("master"));
+    
+signals:
+    void logMessage(const QString &message);
+    
+    // All jobs are done, or the coordinator could not be reached
+    void finished(int failedCount);
+    
+private:
+    QString m_token;
+    QPointer<FarmConnection> m_connection;
+    QSet<QString> m_pending;
+    int m_failed = 0;
+    bool m_done = false;
+};
+
+#endif // FARMCLIENT_H
\ No newline at end of file
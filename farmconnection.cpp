@@ -0,0 +1,171 @@
+#include "farmconnection.h"
+
+#include <QJsonDocument>
+#include <QLocalSocket>
+#include <QSettings>
+#include <QTcpSocket>
+#include <QtEndian>
+
+FarmConnection::FarmConnection(QIODevice *socket, QObject *parent)
+    : QObject(parent)
+    , m_socket(socket)
+{
+    m_socket->setParent(this);
+    
+    connect(m_socket, &QIODevice::readyRead, this, &FarmConnection::readFrames);
+    connect(m_socket, &QIODevice::bytesWritten, this, &FarmConnection::bytesWritten);
+    
+    if (QAbstractSocket *tcp = qobject_cast<QAbstractSocket *>(m_socket)) {
+        connect(tcp, &QAbstractSocket::connected, this, &FarmConnection::connected);
+        connect(tcp, &QAbstractSocket::disconnected, this, &FarmConnection::notifyDisconnected);
+        connect(tcp, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+                this, &FarmConnection::notifyDisconnected);
+    } else if (QLocalSocket *local = qobject_cast<QLocalSocket *>(m_socket)) {
+        connect(local, &QLocalSocket::connected, this, &FarmConnection::connected);
+        connect(local, &QLocalSocket::disconnected, this, &FarmConnection::notifyDisconnected);
+        connect(local, static_cast<void(QLocalSocket::*)(QLocalSocket::LocalSocketError)>(&QLocalSocket::error),
+                this, &FarmConnection::notifyDisconnected);
+    }
+}
+
+FarmConnection *FarmConnection::connectTo(const QString &address, QObject *parent)
+{
+    if (address.startsWith(QLatin1String("unix:"))) {
+        QLocalSocket *socket = new QLocalSocket;
+        FarmConnection *connection = new FarmConnection(socket, parent);
+        socket->connectToServer(address.mid(5));
+        return connection;
+    }
+    
+    const int colon = address.lastIndexOf(':');
+    const QString host = colon > 0 ? address.left(colon) : QStringLiteral("localhost");
+    const quint16 port = static_cast<quint16>(address.mid(colon + 1).toUInt());
+    
+    QTcpSocket *socket = new QTcpSocket;
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    FarmConnection *connection = new FarmConnection(socket, parent);
+    socket->connectToHost(host, port);
+    return connection;
+}
+
+QString FarmConnection::defaultToken()
+{
+    return QSettings().value("farm/token").toString();
+}
+
+bool FarmConnection::tokenMatches(const QString &expected, const QString &presented)
+{
+    const QByteArray a = expected.toUtf8();
+    const QByteArray b = presented.toUtf8();
+    if (a.isEmpty() || a.size() != b.size())
+        return false;
+    
+    char difference = 0;
+    for (int i = 0; i < a.size(); ++i) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+void FarmConnection::send(const QJsonObject &message)
+{
+    if (m_closed)
+        return;
+    
+    const QByteArray payload = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    
+    uchar header[4];
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()), header);
+    
+    m_socket->write(reinterpret_cast<const char *>(header), sizeof(header));
+    m_socket->write(payload);
+}
+
+qint64 FarmConnection::bytesToWrite() const
+{
+    return m_socket->bytesToWrite();
+}
+
+bool FarmConnection::isConnected() const
+{
+    if (m_closed)
+        return false;
+    
+    if (QAbstractSocket *tcp = qobject_cast<QAbstractSocket *>(m_socket))
+        return tcp->state() == QAbstractSocket::ConnectedState;
+    if (QLocalSocket *local = qobject_cast<QLocalSocket *>(m_socket))
+        return local->state() == QLocalSocket::ConnectedState;
+    
+    return m_socket->isOpen();
+}
+
+void FarmConnection::close()
+{
+    if (m_closed)
+        return;
+    
+    m_closed = true;
+    
+    if (QAbstractSocket *tcp = qobject_cast<QAbstractSocket *>(m_socket)) {
+        tcp->disconnectFromHost();
+    } else if (QLocalSocket *local = qobject_cast<QLocalSocket *>(m_socket)) {
+        local->disconnectFromServer();
+    } else {
+        m_socket->close();
+    }
+}
+
+QString FarmConnection::peerName() const
+{
+    if (QAbstractSocket *tcp = qobject_cast<QAbstractSocket *>(m_socket))
+        return tcp->peerAddress().toString() + ":" + QString::number(tcp->peerPort());
+    if (QLocalSocket *local = qobject_cast<QLocalSocket *>(m_socket))
+        return local->serverName();
+    
+    return QString();
+}
+
+void FarmConnection::readFrames()
+{
+    m_buffer += m_socket->readAll();
+    
+    int offset = 0;
+    while (!m_closed && m_buffer.size() - offset >= 4) {
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(m_buffer.constData() + offset));
+        if (length > static_cast<quint32>(MaxFrameSize)) {
+            qWarning("Dropping farm peer %s: frame of %u bytes", qPrintable(peerName()), length);
+            close();
+            notifyDisconnected();
+            return;
+        }
+        
+        if (m_buffer.size() - offset - 4 < static_cast<int>(length))
+            break;
+        
+        const QJsonDocument document = QJsonDocument::fromJson(m_buffer.mid(offset + 4, length));
+        offset += 4 + length;
+        
+        if (!document.isObject()) {
+            qWarning("Dropping farm peer %s: invalid message", qPrintable(peerName()));
+            close();
+            notifyDisconnected();
+            return;
+        }
+        
+        emit messageReceived(document.object());
+    }
+    
+    m_buffer.remove(0, offset);
+}
+
+void FarmConnection::notifyDisconnected()
+{
+    // Errors and the disconnect itself both end up here, report once
+    if (m_disconnectNotified || isConnected())
+        return;
+    
+    m_disconnectNotified = true;
+    m_closed = true;
+    emit disconnected();
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef FARMCONNECTION_H
+#define FARMCONNECTION_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * One peer of the build farm protocol.
+ *
+ * Messages are JSON objects with a "type" member, sent as a 32-bit
+ * big-endian length followed by the compact JSON text. Bulk data (staged
+ * trees, result bundles) travels base64-encoded in "data" members of
+ * chunk messages, so there is only one framing to get right.
+ *
+ * Works on TCP and Unix domain sockets. Addresses are written as
+ * "host:port" or "unix:/path/to/socket".
+ *
+ * Workers and clients present a shared token in their first message,
+ * "hello" or "submit". It is sent in plain text, so use it on trusted
+ * networks or through a tunnel.
+ */
+class FarmConnection : public QObject
+{
+    Q_OBJECT
+    
+public:
+    // Version sent in "hello", peers with another version are rejected
+    static const int ProtocolVersion = 1;
+    
+    // Frames above this size are treated as a protocol error
+    static const int MaxFrameSize = 64 * 1024 * 1024;
+    
+    // Takes ownership of a connected socket
+    explicit FarmConnection(QIODevice *socket, QObject *parent = nullptr);
+    
+    // Connect to a coordinator address, see the class documentation
+    static FarmConnection *connectTo(const QString &address, QObject *parent = nullptr);
+    
+    // The farm/token setting
+    static QString defaultToken();
+    
+    // Compare a presented token in constant time
+    static bool tokenMatches(const QString &expected, const QString &presented);
+    
+    void send(const QJsonObject &message);
+    
+    // Bytes accepted by send() but not yet written to the socket
+    qint64 bytesToWrite() const;
+    
+    bool isConnected() const;
+    void close();
+    
+    QString peerName() const;
+    
+signals:
+    void connected();
+    void messageReceived(const QJsonObject &message);
+    void bytesWritten();
+    void disconnected();
+    
+private:
+    void readFrames();
+    void notifyDisconnected();
+    
+    QIODevice *m_socket;
+    QByteArray m_buffer;
+    bool m_closed = false;
+    bool m_disconnectNotified = false;
+};
+
+#endif // FARMCONNECTION_H
\ No newline at end of file
@@ -0,0 +1,734 @@
+#include "farmcoordinator.h"
+#include "apppackager.h"
+#include "buildmetrics.h"
+#include "farmconnection.h"
+#include "farmtransfer.h"
+#include "flatpakexporter.h"
+#include "manifestvalidator.h"
+#include "resourcegovernor.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonArray>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUuid>
+#include <QtConcurrent>
+
+FarmCoordinator::FarmCoordinator(QObject *parent)
+    : QObject(parent)
+    , m_dataDir(defaultDataDir())
+    , m_token(FarmConnection::defaultToken())
+    , m_exporter(new FlatpakExporter(this))
+{
+    connect(m_exporter, &FlatpakExporter::logMessage, this, &FarmCoordinator::logMessage);
+    connect(m_exporter, &FlatpakExporter::exportFinished, this, &FarmCoordinator::exportFinished);
+    
+    m_heartbeatTimer.setInterval(5000);
+    connect(&m_heartbeatTimer, &QTimer::timeout, this, &FarmCoordinator::checkHeartbeats);
+    m_heartbeatTimer.start();
+}
+
+FarmCoordinator::~FarmCoordinator()
+{
+    qDeleteAll(m_resultDownloads);
+}
+
+QString FarmCoordinator::defaultDataDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/farm";
+}
+
+void FarmCoordinator::setDataDir(const QString &dataDir)
+{
+    m_dataDir = dataDir;
+}
+
+void FarmCoordinator::setHeartbeatTimeout(int msecs)
+{
+    m_heartbeatTimeout = msecs;
+    m_heartbeatTimer.setInterval(qMax(1000, msecs / 4));
+}
+
+void FarmCoordinator::setMaxAttempts(int attempts)
+{
+    m_maxAttempts = qMax(1, attempts);
+}
+
+void FarmCoordinator::setToken(const QString &token)
+{
+    m_token = token;
+}
+
+bool FarmCoordinator::listen(const QString &address, QString *errorMessage)
+{
+    if (address.startsWith(QLatin1String("unix:"))) {
+        const QString path = address.mid(5);
+        QLocalServer::removeServer(path);
+        
+        m_localServer = new QLocalServer(this);
+        if (!m_localServer->listen(path)) {
+            if (errorMessage)
+                *errorMessage = m_localServer->errorString();
+            return false;
+        }
+        
+        connect(m_localServer, &QLocalServer::newConnection, this, [this]() {
+            while (QLocalSocket *socket = m_localServer->nextPendingConnection()) {
+                addConnection(new FarmConnection(socket, this));
+            }
+        });
+    } else {
+        const int colon = address.lastIndexOf(':');
+        const QString host = colon > 0 ? address.left(colon) : QString();
+        const quint16 port = static_cast<quint16>(address.mid(colon + 1).toUInt());
+        
+        // Workers run what they are sent, so the farm is only reachable
+        // from elsewhere when asked for, and then only with a token
+        const QHostAddress hostAddress = host == "*" ? QHostAddress(QHostAddress::Any)
+                                       : host.isEmpty() || host == "localhost" ? QHostAddress(QHostAddress::LocalHost)
+                                       : QHostAddress(host);
+        if (!hostAddress.isLoopback() && m_token.isEmpty()) {
+            if (errorMessage)
+                *errorMessage = i18n("Listening on %1 needs a token, see --farm-token", hostAddress.toString());
+            return false;
+        }
+        
+        m_tcpServer = new QTcpServer(this);
+        if (!m_tcpServer->listen(hostAddress, port)) {
+            if (errorMessage)
+                *errorMessage = m_tcpServer->errorString();
+            return false;
+        }
+        
+        connect(m_tcpServer, &QTcpServer::newConnection, this, [this]() {
+            while (QTcpSocket *socket = m_tcpServer->nextPendingConnection()) {
+                socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+                addConnection(new FarmConnection(socket, this));
+            }
+        });
+    }
+    
+    emit logMessage(i18n("Build farm coordinator listening on %1", address));
+    
+    resumeJobs();
+    return true;
+}
+
+QString FarmCoordinator::submit(const QString &app, const QString &branch, FarmConnection *client)
+{
+    PortableAppInfo appInfo;
+    if (!findApp(app, &appInfo))
+        return QString();
+    
+    FarmJob job;
+    job.id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    job.appId = AppPackager::appId(appInfo);
+    job.appName = appInfo.name;
+    job.branch = branch;
+    job.cacheKeys = AppPackager::cacheKeys(appInfo);
+    job.client = client;
+    
+    job.journal = PipelineJournal(m_dataDir + "/jobs/" + job.id + ".journal");
+    job.journal.begin(job.appId + "/" + job.branch);
+    recordStage(job, QStringLiteral("submitted"), QString(), QJsonObject{
+        { "app", appInfo.id },
+        { "name", appInfo.name },
+        { "appId", job.appId },
+        { "branch", job.branch },
+        { "cacheKeys", QJsonArray::fromStringList(job.cacheKeys) },
+    });
+    
+    m_jobs.insert(job.id, job);
+    stageJob(job.id, appInfo);
+    
+    updateMetrics();
+    return job.id;
+}
+
+bool FarmCoordinator::findApp(const QString &app, PortableAppInfo *appInfo)
+{
+    // Always read the catalog fresh, the GUI may have changed it
+    const QMap<QString, PortableAppInfo> apps = m_catalog.load();
+    
+    for (auto it = apps.constBegin(); it != apps.constEnd(); ++it) {
+        const PortableAppInfo &info = it.value();
+        if (info.id == app || info.name.compare(app, Qt::CaseInsensitive) == 0 || AppPackager::appId(info) == app) {
+            *appInfo = info;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void FarmCoordinator::stageJob(const QString &jobId, const PortableAppInfo &appInfo)
+{
+    emit logMessage(i18n("Staging %1 for job %2...", appInfo.name, jobId));
+    
+    // Staging copies the whole app, keep the event loop (and with it the
+    // heartbeats) responsive
+    const QString treesDir = m_dataDir + "/trees";
+    auto *watcher = new QFutureWatcher<PreparedTree>(this);
+    connect(watcher, &QFutureWatcher<PreparedTree>::finished, this, [this, watcher, jobId]() {
+        treePrepared(jobId, watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run(&FarmCoordinator::prepareTree, appInfo, treesDir));
+}
+
+void FarmCoordinator::resumeJobs()
+{
+    const QString jobsDir = m_dataDir + "/jobs";
+    const QString repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    
+    // Oldest first, to keep the submission order
+    const QFileInfoList journals = QDir(jobsDir).entryInfoList(QStringList() << "*.journal", QDir::Files,
+                                                               QDir::Time | QDir::Reversed);
+    int resumed = 0;
+    
+    for (const QFileInfo &info : journals) {
+        PipelineJournal journal(info.filePath());
+        if (!journal.load() || !journal.isComplete("submitted")) {
+            journal.remove();
+            continue;
+        }
+        
+        const QJsonObject submitted = journal.data("submitted");
+        FarmJob job;
+        job.id = info.completeBaseName();
+        job.appId = submitted.value("appId").toString();
+        job.appName = submitted.value("name").toString();
+        job.branch = submitted.value("branch").toString(QStringLiteral("master"));
+        for (const QJsonValue &key : submitted.value("cacheKeys").toArray()) {
+            job.cacheKeys << key.toString();
+        }
+        job.journal = journal;
+        resumed++;
+        
+        // Imported before the restart, only the export is missing
+        const QString commit = FlatpakExporter::commitOf(repoPath, job.appId, job.branch);
+        if (journal.isComplete("build") && !commit.isEmpty() && journal.outputHash("build") == commit) {
+            emit logMessage(i18n("Resuming job %1 (%2) at the export", job.id, job.appName));
+            exportJob(job);
+            continue;
+        }
+        
+        m_jobs.insert(job.id, job);
+        
+        // The result bundle arrived but was not imported yet
+        const QString bundlePath = m_dataDir + "/results/" + job.id + ".flatpak";
+        if (journal.isComplete("result") && journal.outputHash("result") == PipelineJournal::hashFile(bundlePath)) {
+            emit logMessage(i18n("Resuming job %1 (%2) at the import", job.id, job.appName));
+            importResult(job.id, bundlePath);
+            continue;
+        }
+        
+        // Trees are renamed into place complete, existing is enough
+        QFile manifest(m_dataDir + "/trees/" + journal.outputHash("tree") + "/manifest.json");
+        if (journal.isComplete("tree") && manifest.open(QIODevice::ReadOnly)) {
+            emit logMessage(i18n("Resuming job %1 (%2) at the build", job.id, job.appName));
+            m_jobs[job.id].treeId = journal.outputHash("tree");
+            m_jobs[job.id].manifest = QString::fromUtf8(manifest.readAll());
+            m_queue.append(job.id);
+            continue;
+        }
+        
+        PortableAppInfo appInfo;
+        if (!findApp(submitted.value("app").toString(), &appInfo)) {
+            finishJob(job.id, false, i18n("%1 is no longer in the catalog", job.appName));
+            continue;
+        }
+        stageJob(job.id, appInfo);
+    }
+    
+    if (resumed > 0) {
+        emit logMessage(i18np("Resumed 1 interrupted job", "Resumed %1 interrupted jobs", resumed));
+    }
+    
+    updateMetrics();
+    dispatch();
+}
+
+void FarmCoordinator::recordStage(FarmJob &job, const QString &stage, const QString &outputHash, const QJsonObject &data)
+{
+    QString error;
+    if (!job.journal.complete(stage, outputHash, data, &error)) {
+        emit logMessage(i18n("Cannot write the journal of job %1: %2", job.id, error));
+    }
+}
+
+FarmCoordinator::PreparedTree FarmCoordinator::prepareTree(const PortableAppInfo &appInfo, const QString &treesDir)
+{
+    PreparedTree tree;
+    
+    FlatpakManifest manifest = AppPackager::generateManifest(appInfo, &tree.log);
+    const AppScanIndex index = AppPackager::scanPayload(appInfo, nullptr, &tree.log);
+    manifest.setPayloadFingerprint(index.fingerprint());
+    
+    tree.manifest = QString::fromUtf8(manifest.toJson());
+    
+    tree.treeId = AppPackager::inputsHash(manifest, appInfo);
+    
+    const QString treeDir = treesDir + "/" + tree.treeId;
+    if (QFileInfo::exists(treeDir + "/manifest.json")) {
+        tree.success = true;
+        return tree;
+    }
+    
+    // Trees of older versions hold a manifest.yml and are staged again
+    if (QFileInfo::exists(treeDir + "/manifest.yml")) {
+        QDir(treeDir).removeRecursively();
+    }
+    
+    // Stage next to the final location and rename, so a tree either
+    // exists completely or not at all
+    const QString partialDir = treeDir + ".partial-" + QUuid::createUuid().toString(QUuid::WithoutBraces);
+    QDir().mkpath(partialDir + "/app");
+    
+    if (!index.stageTo(partialDir + "/app", nullptr, &tree.error)) {
+        QDir(partialDir).removeRecursively();
+        return tree;
+    }
+    
+    AppPackager::stageSupportFiles(appInfo, partialDir);
+    
+    if (!manifest.saveToFile(partialDir + "/manifest.json")) {
+        tree.error = i18n("Failed to write manifest file!");
+        QDir(partialDir).removeRecursively();
+        return tree;
+    }
+    
+    // Trees run on the farm's thread pool, so a batch is checked in
+    // parallel before any worker starts building
+    const ManifestValidator::Report report = ManifestValidator::validateFile(partialDir + "/manifest.json");
+    for (const QString &warning : report.warnings()) {
+        tree.log << i18n("%1: %2", appInfo.name, warning);
+    }
+    if (report.hasErrors()) {
+        tree.error = i18n("Invalid manifest: %1", report.errors().join("; "));
+        QDir(partialDir).removeRecursively();
+        return tree;
+    }
+    
+    // Another job may have staged the same tree meanwhile
+    if (!QDir().rename(partialDir, treeDir)) {
+        QDir(partialDir).removeRecursively();
+    }
+    
+    tree.success = QFileInfo::exists(treeDir + "/manifest.json");
+    return tree;
+}
+
+void FarmCoordinator::treePrepared(const QString &jobId, const PreparedTree &tree)
+{
+    for (const QString &line : tree.log) {
+        emit logMessage(line);
+    }
+    
+    if (!m_jobs.contains(jobId))
+        return;
+    
+    if (!tree.success) {
+        finishJob(jobId, false, i18n("Staging failed: %1", tree.error));
+        return;
+    }
+    
+    FarmJob &job = m_jobs[jobId];
+    job.treeId = tree.treeId;
+    job.manifest = tree.manifest;
+    recordStage(job, QStringLiteral("tree"), tree.treeId);
+    
+    m_queue.append(jobId);
+    dispatch();
+}
+
+void FarmCoordinator::addConnection(FarmConnection *connection)
+{
+    connect(connection, &FarmConnection::messageReceived, this, [this, connection](const QJsonObject &message) {
+        handleMessage(connection, message);
+    });
+    connect(connection, &FarmConnection::disconnected, this, [this, connection]() {
+        connectionLost(connection);
+    });
+}
+
+void FarmCoordinator::handleMessage(FarmConnection *connection, const QJsonObject &message)
+{
+    const QString type = message.value("type").toString();
+    
+    if (m_workers.contains(connection)) {
+        m_workers[connection].lastSeen.start();
+        handleWorkerMessage(connection, message);
+        return;
+    }
+    
+    // Without a token configured, only local peers can get here
+    if (!m_token.isEmpty() && !FarmConnection::tokenMatches(m_token, message.value("token").toString())) {
+        emit logMessage(i18n("Rejecting %1: invalid token", connection->peerName()));
+        connection->send(QJsonObject{ { "type", "rejected" }, { "message", i18n("Invalid token") } });
+        connection->close();
+        return;
+    }
+    
+    if (type == "hello") {
+        if (message.value("protocol").toInt() != FarmConnection::ProtocolVersion) {
+            emit logMessage(i18n("Rejecting worker %1: protocol version %2", connection->peerName(),
+                                 message.value("protocol").toInt()));
+            connection->close();
+            return;
+        }
+        
+        Worker worker;
+        worker.name = message.value("worker").toString();
+        worker.slots = qMax(1, message.value("slots").toInt());
+        for (const QJsonValue &key : message.value("cacheKeys").toArray()) {
+            worker.cacheKeys.insert(key.toString());
+        }
+        for (const QJsonValue &tree : message.value("trees").toArray()) {
+            worker.trees.insert(tree.toString());
+        }
+        worker.lastSeen.start();
+        m_workers.insert(connection, worker);
+        
+        emit logMessage(i18n("Worker %1 joined with %2 slots", worker.name, worker.slots));
+        connection->send(QJsonObject{ { "type", "welcome" } });
+        
+        updateMetrics();
+        dispatch();
+    } else if (type == "submit") {
+        const QString branch = message.value("branch").toString(QStringLiteral("master"));
+        
+        QJsonArray accepted;
+        QJsonArray unknown;
+        for (const QJsonValue &app : message.value("apps").toArray()) {
+            const QString jobId = submit(app.toString(), branch, connection);
+            if (jobId.isEmpty()) {
+                unknown.append(app);
+            } else {
+                accepted.append(QJsonObject{ { "job", jobId }, { "app", app } });
+            }
+        }
+        
+        connection->send(QJsonObject{ { "type", "submitted" }, { "jobs", accepted }, { "unknown", unknown } });
+    } else {
+        connection->close();
+    }
+}
+
+void FarmCoordinator::handleWorkerMessage(FarmConnection *connection, const QJsonObject &message)
+{
+    const QString type = message.value("type").toString();
+    
+    if (type == "heartbeat") {
+        // lastSeen is already updated
+    } else if (type == "fetch-tree") {
+        sendTree(connection, message.value("tree").toString());
+    } else if (type == "log") {
+        emit logMessage(QStringLiteral("[%1] %2").arg(m_workers[connection].name, message.value("text").toString()));
+    } else if (type == "result-data") {
+        const QString jobId = message.value("id").toString();
+        const auto job = m_jobs.constFind(jobId);
+        if (job == m_jobs.constEnd() || job->worker != connection)
+            return;
+        
+        FarmDownload *download = m_resultDownloads.value(jobId);
+        if (!download) {
+            const QString resultsDir = m_dataDir + "/results";
+            QDir().mkpath(resultsDir);
+            
+            download = new FarmDownload;
+            download->startFile(resultsDir + "/" + jobId + ".flatpak");
+            connect(download, &FarmDownload::finished, this, [this, jobId](bool success) {
+                m_resultReceived[jobId] = success;
+                if (FarmDownload *finished = m_resultDownloads.take(jobId)) {
+                    finished->deleteLater();
+                }
+            });
+            m_resultDownloads.insert(jobId, download);
+        }
+        download->addChunk(message);
+    } else if (type == "result") {
+        jobResult(connection, message);
+    }
+}
+
+void FarmCoordinator::sendTree(FarmConnection *connection, const QString &treeId)
+{
+    // Only trees of known jobs are served
+    bool known = false;
+    for (const FarmJob &job : qAsConst(m_jobs)) {
+        known = known || job.treeId == treeId;
+    }
+    
+    const QString treeDir = m_dataDir + "/trees/" + treeId;
+    
+    FarmUpload *upload = new FarmUpload(connection, QStringLiteral("tree-data"), treeId, this);
+    connect(upload, &FarmUpload::finished, upload, &QObject::deleteLater);
+    
+    if (!known || !upload->startDirectory(treeDir)) {
+        // An end message without data tells the worker to give up
+        upload->abort();
+        connection->send(QJsonObject{ { "type", "tree-data" }, { "id", treeId }, { "end", true }, { "ok", false } });
+        upload->deleteLater();
+    }
+}
+
+void FarmCoordinator::dispatch()
+{
+    for (int i = 0; i < m_queue.size();) {
+        if (!m_jobs.contains(m_queue[i])) {
+            m_queue.removeAt(i);
+            continue;
+        }
+        
+        FarmJob &job = m_jobs[m_queue[i]];
+        
+        // Prefer the worker that has the tree and most of the caches,
+        // then the one with the most free slots
+        FarmConnection *best = nullptr;
+        int bestScore = -1;
+        int bestFree = 0;
+        bool anyFree = false;
+        
+        for (auto it = m_workers.constBegin(); it != m_workers.constEnd(); ++it) {
+            const Worker &worker = it.value();
+            const int free = worker.slots - worker.running.size();
+            if (free <= 0)
+                continue;
+            
+            anyFree = true;
+            
+            int score = worker.trees.contains(job.treeId) ? 4 : 0;
+            for (const QString &key : qAsConst(job.cacheKeys)) {
+                if (worker.cacheKeys.contains(key))
+                    score += 2;
+            }
+            
+            if (score > bestScore || (score == bestScore && free > bestFree)) {
+                best = it.key();
+                bestScore = score;
+                bestFree = free;
+            }
+        }
+        
+        if (!anyFree)
+            break;
+        
+        Worker &worker = m_workers[best];
+        worker.running.insert(job.id);
+        job.worker = best;
+        job.attempts++;
+        m_queue.removeAt(i);
+        
+        QJsonObject message;
+        message["type"] = "job";
+        message["job"] = job.id;
+        message["appId"] = job.appId;
+        message["branch"] = job.branch;
+        message["tree"] = job.treeId;
+        message["manifest"] = job.manifest;
+        message["cacheKeys"] = QJsonArray::fromStringList(job.cacheKeys);
+        best->send(message);
+        BuildMetrics::instance().increment("fpb_builds_started_total");
+        
+        emit logMessage(i18n("Job %1 (%2) sent to %3, attempt %4", job.id, job.appName, worker.name, job.attempts));
+    }
+    
+    updateMetrics();
+}
+
+void FarmCoordinator::jobResult(FarmConnection *connection, const QJsonObject &message)
+{
+    const QString jobId = message.value("job").toString();
+    Worker &worker = m_workers[connection];
+    
+    if (!worker.running.remove(jobId))
+        return;
+    
+    for (const QJsonValue &key : message.value("cacheKeys").toArray()) {
+        worker.cacheKeys.insert(key.toString());
+    }
+    
+    const ResourceUsage usage = ResourceUsage::fromJson(message.value("usage").toObject());
+    if (usage.available) {
+        emit logMessage(i18n("Job %1 on %2 used %3", jobId, worker.name, usage.toString()));
+    }
+    
+    auto job = m_jobs.find(jobId);
+    if (job != m_jobs.end()) {
+        worker.trees.insert(job->treeId);
+        job->worker = nullptr;
+    }
+    
+    const bool received = m_resultReceived.take(jobId);
+    if (message.value("success").toBool() && received && job != m_jobs.end()) {
+        const QString bundlePath = m_dataDir + "/results/" + jobId + ".flatpak";
+        recordStage(*job, QStringLiteral("result"), PipelineJournal::hashFile(bundlePath), message.value("usage").toObject());
+        importResult(jobId, bundlePath);
+    } else {
+        finishJob(jobId, false, message.value("message").toString());
+    }
+    
+    dispatch();
+}
+
+void FarmCoordinator::importResult(const QString &jobId, const QString &bundlePath)
+{
+    const QString repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::MergedChannels);
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, process, jobId, bundlePath, repoPath](int exitCode, QProcess::ExitStatus exitStatus) {
+                const bool success = exitStatus == QProcess::NormalExit && exitCode == 0;
+                const QString output = QString::fromLocal8Bit(process->readAll());
+                process->deleteLater();
+                QFile::remove(bundlePath);
+                
+                if (success && m_jobs.contains(jobId)) {
+                    FarmJob &job = m_jobs[jobId];
+                    recordStage(job, QStringLiteral("build"), FlatpakExporter::commitOf(repoPath, job.appId, job.branch));
+                    exportJob(job);
+                }
+                
+                finishJob(jobId, success, success ? QString() : output);
+            });
+    
+    QDir().mkpath(repoPath);
+    if (!QFileInfo::exists(repoPath + "/config")) {
+        QProcess::execute("ostree", QStringList() << "init" << "--mode=archive" << "--repo=" + repoPath);
+    }
+    
+    process->start("flatpak", QStringList() << "build-import-bundle" << repoPath << bundlePath);
+}
+
+void FarmCoordinator::exportJob(const FarmJob &job)
+{
+    // Static deltas against the previous commit of the app
+    ExportJob exportJob;
+    exportJob.appId = job.appId;
+    exportJob.branch = job.branch;
+    exportJob.repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    m_exporter->enqueue(exportJob);
+    
+    m_exportJournals[job.appId] << job.journal.path();
+}
+
+void FarmCoordinator::exportFinished(const QString &appId, bool success)
+{
+    // Exports of an app finish in the order they were queued
+    auto it = m_exportJournals.find(appId);
+    if (it == m_exportJournals.end())
+        return;
+    
+    const QString journalPath = it->takeFirst();
+    if (it->isEmpty()) {
+        m_exportJournals.erase(it);
+    }
+    
+    // A failed export is retried after the next restart
+    if (success) {
+        QFile::remove(journalPath);
+    }
+}
+
+void FarmCoordinator::finishJob(const QString &jobId, bool success, const QString &message)
+{
+    FarmJob job = m_jobs.take(jobId);
+    
+    if (success) {
+        emit logMessage(i18n("Job %1 (%2) finished", jobId, job.appName));
+    } else {
+        emit logMessage(i18n("Job %1 (%2) failed: %3", jobId, job.appName, message));
+        job.journal.remove();
+    }
+    
+    BuildMetrics::instance().increment(success ? "fpb_builds_succeeded_total" : "fpb_builds_failed_total");
+    
+    if (job.client && job.client->isConnected()) {
+        job.client->send(QJsonObject{
+            { "type", "job-finished" },
+            { "job", jobId },
+            { "app", job.appName },
+            { "success", success },
+            { "message", message },
+        });
+    }
+    
+    updateMetrics();
+    emit jobFinished(jobId, success);
+}
+
+void FarmCoordinator::connectionLost(FarmConnection *connection)
+{
+    connection->deleteLater();
+    
+    auto it = m_workers.find(connection);
+    if (it == m_workers.end())
+        return;
+    
+    const Worker worker = it.value();
+    m_workers.erase(it);
+    
+    emit logMessage(i18n("Lost worker %1", worker.name));
+    
+    // Retry its jobs elsewhere, ahead of jobs that have not run yet
+    for (const QString &jobId : worker.running) {
+        auto job = m_jobs.find(jobId);
+        if (job == m_jobs.end())
+            continue;
+        
+        job->worker = nullptr;
+        m_resultReceived.remove(jobId);
+        delete m_resultDownloads.take(jobId);
+        
+        if (job->attempts >= m_maxAttempts) {
+            finishJob(jobId, false, i18n("Worker lost %1 times", job->attempts));
+        } else {
+            m_queue.prepend(jobId);
+        }
+    }
+    
+    dispatch();
+}
+
+void FarmCoordinator::checkHeartbeats()
+{
+    QList<FarmConnection *> lost;
+    for (auto it = m_workers.constBegin(); it != m_workers.constEnd(); ++it) {
+        if (it.value().lastSeen.hasExpired(m_heartbeatTimeout)) {
+            lost << it.key();
+        }
+    }
+    
+    for (FarmConnection *connection : qAsConst(lost)) {
+        connection->close();
+        connectionLost(connection);
+    }
+}
+
+void FarmCoordinator::updateMetrics()
+{
+    int slots = 0;
+    int busy = 0;
+    for (const Worker &worker : qAsConst(m_workers)) {
+        slots += worker.slots;
+        busy += worker.running.size();
+    }
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.setGauge("fpb_queue_depth", BuildMetrics::label("queue", "farm"), m_jobs.size());
+    metrics.setGauge("fpb_workers", BuildMetrics::label("pool", "farm"), slots);
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "farm"), busy);
+    metrics.writeTextFile();
+}
\ No newline at end of file
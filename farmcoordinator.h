@@ -0,0 +1,173 @@
+#ifndef FARMCOORDINATOR_H
+#define FARMCOORDINATOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+#include "appcatalog.h"
+#include "pipelinejournal.h"
+#include "portableappinfo.h"
+
+class FarmConnection;
+class FarmDownload;
+class FarmUpload;
+class FlatpakExporter;
+class QLocalServer;
+class QTcpServer;
+
+/**
+ * A build job of the farm
+ */
+struct FarmJob
+{
+    QString id;
+    QString appId;
+    QString appName;
+    QString branch = QStringLiteral("master");
+    
+    // Content-addressed staged build directory, see FarmCoordinator
+    QString treeId;
+    QString manifest;
+    
+    // flatpak-builder caches the build benefits from, see AppPackager::cacheKeys()
+    QStringList cacheKeys;
+    
+    int attempts = 0;
+    
+    // Stages the job has completed, in dataDir()/jobs
+    PipelineJournal journal;
+    
+    QPointer<FarmConnection> worker;
+    QPointer<FarmConnection> client;
+};
+
+/**
+ * Coordinator of the build farm.
+ *
+ * Holds the app catalog and the job queue. Submitted apps are staged once
+ * into a content-addressed tree below dataDir()/trees, named after the
+ * hash of the generated manifest (which includes the payload fingerprint)
+ * and the support files. Workers connect, announce their job slots and
+ * what they have cached, and receive jobs as manifest plus tree id; a
+ * worker fetches a tree it does not have yet.
+ *
+ * Jobs go to the free worker with the best affinity: the tree itself
+ * and the flatpak-builder caches (Wine, DXVK, base prefix) it already
+ * holds. Workers that stop sending heartbeats are dropped and their jobs
+ * are retried elsewhere. Results come back as bundles and are imported
+ * into the local repo, from which static deltas are generated as usual.
+ *
+ * Every job keeps a journal of its completed stages (submitted, tree,
+ * result, build) until it is exported. A restarted coordinator picks up
+ * the unfinished jobs from the first stage whose output is gone.
+ */
+class FarmCoordinator : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit FarmCoordinator(QObject *parent = nullptr);
+    ~FarmCoordinator() override;
+    
+    // <data>/flatpak-wine-builder/farm
+    static QString defaultDataDir();
+    
+    void setDataDir(const QString &dataDir);
+    void setHeartbeatTimeout(int msecs);
+    void setMaxAttempts(int attempts);
+    
+    // Token workers and clients must present, farm/token by default
+    void setToken(const QString &token);
+    
+    // Listen on "host:port" or "unix:/path", then resume the jobs left
+    // over from the last run. Without a host, only local connections are
+    // accepted, "*" accepts all. TCP ports on other addresses than the
+    // loopback need a token.
+    bool listen(const QString &address, QString *errorMessage = nullptr);
+    
+    // Queue a catalog app by id or name. Returns the job id, or an empty
+    // string if the app is unknown.
+    QString submit(const QString &app, const QString &branch = QStringLiteral("master"),
+                   FarmConnection *client = nullptr);
+    
+    int queuedCount() const { return m_queue.size(); }
+    int workerCount() const { return m_workers.size(); }
+    
+signals:
+    void logMessage(const QString &message);
+    void jobFinished(const QString &jobId, bool success);
+    
+private:
+    struct Worker
+    {
+        QString name;
+        int slots = 1;
+        QSet<QString> cacheKeys;
+        QSet<QString> trees;
+        QSet<QString> running;
+        QElapsedTimer lastSeen;
+    };
+    
+    struct PreparedTree
+    {
+        bool success = false;
+        QString error;
+        QString treeId;
+        QString manifest;
+        QStringList log;
+    };
+    
+    static PreparedTree prepareTree(const PortableAppInfo &appInfo, const QString &treesDir);
+    
+    bool findApp(const QString &app, PortableAppInfo *appInfo);
+    void stageJob(const QString &jobId, const PortableAppInfo &appInfo);
+    void resumeJobs();
+    void recordStage(FarmJob &job, const QString &stage, const QString &outputHash,
+                     const QJsonObject &data = QJsonObject());
+    
+    void addConnection(FarmConnection *connection);
+    void handleMessage(FarmConnection *connection, const QJsonObject &message);
+    void handleWorkerMessage(FarmConnection *connection, const QJsonObject &message);
+    void connectionLost(FarmConnection *connection);
+    
+    void treePrepared(const QString &jobId, const PreparedTree &tree);
+    void dispatch();
+    void sendTree(FarmConnection *connection, const QString &treeId);
+    void jobResult(FarmConnection *connection, const QJsonObject &message);
+    void importResult(const QString &jobId, const QString &bundlePath);
+    void exportJob(const FarmJob &job);
+    void exportFinished(const QString &appId, bool success);
+    void finishJob(const QString &jobId, bool success, const QString &message);
+    void checkHeartbeats();
+    void updateMetrics();
+    
+    QString m_dataDir;
+    QString m_token;
+    int m_heartbeatTimeout = 20000;
+    int m_maxAttempts = 3;
+    
+    QTcpServer *m_tcpServer = nullptr;
+    QLocalServer *m_localServer = nullptr;
+    QTimer m_heartbeatTimer;
+    
+    AppCatalog m_catalog;
+    FlatpakExporter *m_exporter;
+    
+    QHash<FarmConnection *, Worker> m_workers;
+    QHash<QString, FarmJob> m_jobs;
+    QStringList m_queue;            // Staged jobs waiting for a worker
+    QHash<QString, FarmDownload *> m_resultDownloads;
+    QHash<QString, bool> m_resultReceived;
+    
+    // Journals of imported jobs by app id, in export order
+    QHash<QString, QStringList> m_exportJournals;
+};
+
+#endif // FARMCOORDINATOR_H
\ No newline at end of file
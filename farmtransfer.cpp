@@ -0,0 +1,193 @@
+#include "farmtransfer.h"
+#include "farmconnection.h"
+
+#include <QDir>
+#include <QProcess>
+
+namespace {
+
+const qint64 ChunkSize = 1024 * 1024;
+
+// Stop reading while more than this is queued on the socket
+const qint64 HighWaterMark = 16 * 1024 * 1024;
+
+} // namespace
+
+FarmUpload::FarmUpload(FarmConnection *connection, const QString &type, const QString &id, QObject *parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_type(type)
+    , m_id(id)
+{
+    connect(connection, &FarmConnection::bytesWritten, this, &FarmUpload::pump);
+    connect(connection, &FarmConnection::disconnected, this, [this]() { finish(false); });
+}
+
+bool FarmUpload::startDirectory(const QString &dirPath)
+{
+    m_tar = new QProcess(this);
+    m_tar->setWorkingDirectory(dirPath);
+    connect(m_tar, &QProcess::readyReadStandardOutput, this, &FarmUpload::pump);
+    connect(m_tar, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, &FarmUpload::pump);
+    
+    m_tar->start("tar", QStringList() << "-cf" << "-" << ".");
+    if (!m_tar->waitForStarted())
+        return false;
+    
+    m_source = m_tar;
+    return true;
+}
+
+bool FarmUpload::startFile(const QString &filePath)
+{
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+    
+    m_source = &m_file;
+    
+    // Files have no readyRead, start pumping from the event loop
+    QMetaObject::invokeMethod(this, &FarmUpload::pump, Qt::QueuedConnection);
+    return true;
+}
+
+void FarmUpload::abort()
+{
+    m_done = true;
+    
+    if (m_tar) {
+        m_tar->kill();
+    }
+}
+
+void FarmUpload::pump()
+{
+    if (m_done || !m_source)
+        return;
+    
+    if (!m_connection || !m_connection->isConnected()) {
+        finish(false);
+        return;
+    }
+    
+    while (m_connection->bytesToWrite() < HighWaterMark) {
+        const QByteArray data = m_source->read(ChunkSize);
+        
+        if (!data.isEmpty()) {
+            QJsonObject chunk;
+            chunk["type"] = m_type;
+            chunk["id"] = m_id;
+            chunk["data"] = QString::fromLatin1(data.toBase64());
+            m_connection->send(chunk);
+            continue;
+        }
+        
+        // No data right now: wait for tar, or finish at the end
+        if (m_tar) {
+            if (m_tar->state() != QProcess::NotRunning)
+                return;
+            
+            finish(m_tar->exitStatus() == QProcess::NormalExit && m_tar->exitCode() == 0);
+        } else {
+            finish(m_file.atEnd());
+        }
+        return;
+    }
+    
+    // The socket is full, bytesWritten resumes the upload
+}
+
+void FarmUpload::finish(bool success)
+{
+    if (m_done)
+        return;
+    
+    m_done = true;
+    
+    if (m_connection && m_connection->isConnected()) {
+        QJsonObject end;
+        end["type"] = m_type;
+        end["id"] = m_id;
+        end["end"] = true;
+        end["ok"] = success;
+        m_connection->send(end);
+    }
+    
+    emit finished(success);
+}
+
+FarmDownload::FarmDownload(QObject *parent)
+    : QObject(parent)
+{
+}
+
+FarmDownload::~FarmDownload()
+{
+    if (m_tar && m_tar->state() != QProcess::NotRunning) {
+        m_tar->kill();
+        m_tar->waitForFinished();
+    }
+}
+
+bool FarmDownload::startDirectory(const QString &dirPath)
+{
+    QDir().mkpath(dirPath);
+    
+    m_tar = new QProcess(this);
+    m_tar->setWorkingDirectory(dirPath);
+    m_tar->setStandardOutputFile(QProcess::nullDevice());
+    connect(m_tar, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this](int exitCode, QProcess::ExitStatus exitStatus) {
+                if (m_done) {
+                    emit finished(!m_failed && exitStatus == QProcess::NormalExit && exitCode == 0);
+                } else {
+                    m_failed = true;
+                }
+            });
+    
+    m_tar->start("tar", QStringList() << "-xf" << "-");
+    if (!m_tar->waitForStarted())
+        return false;
+    
+    m_sink = m_tar;
+    return true;
+}
+
+bool FarmDownload::startFile(const QString &filePath)
+{
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    
+    m_sink = &m_file;
+    return true;
+}
+
+void FarmDownload::addChunk(const QJsonObject &message)
+{
+    if (m_done || !m_sink)
+        return;
+    
+    if (message.value("end").toBool()) {
+        m_done = true;
+        m_failed = m_failed || !message.value("ok").toBool();
+        
+        if (m_tar) {
+            // Reported once tar has written everything
+            m_tar->closeWriteChannel();
+            if (m_tar->state() == QProcess::NotRunning) {
+                emit finished(false);
+            }
+        } else {
+            m_file.close();
+            emit finished(!m_failed);
+        }
+        return;
+    }
+    
+    const QByteArray data = QByteArray::fromBase64(message.value("data").toString().toLatin1());
+    if (m_sink->write(data) != data.size()) {
+        m_failed = true;
+    }
+}
\ No newline at end of file
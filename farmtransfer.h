@@ -0,0 +1,79 @@
+#ifndef FARMTRANSFER_H
+#define FARMTRANSFER_H
+
+#include <QFile>
+#include <QJsonObject>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+class FarmConnection;
+class QProcess;
+
+/**
+ * Streams a directory tree or a single file to a farm peer.
+ *
+ * Trees are sent as a tar stream, files as they are. The data goes out in
+ * chunk messages of the given type, tagged with id, followed by a final
+ * message with "end" set. Reading pauses while the socket has a lot of
+ * unsent data, so large trees do not pile up in memory.
+ */
+class FarmUpload : public QObject
+{
+    Q_OBJECT
+    
+public:
+    FarmUpload(FarmConnection *connection, const QString &type, const QString &id, QObject *parent = nullptr);
+    
+    bool startDirectory(const QString &dirPath);
+    bool startFile(const QString &filePath);
+    
+    // Stop sending, no end message is sent
+    void abort();
+    
+signals:
+    void finished(bool success);
+    
+private:
+    void pump();
+    void finish(bool success);
+    
+    QPointer<FarmConnection> m_connection;
+    QString m_type;
+    QString m_id;
+    QProcess *m_tar = nullptr;
+    QFile m_file;
+    QIODevice *m_source = nullptr;
+    bool m_done = false;
+};
+
+/**
+ * Receives the chunks of a FarmUpload into a directory or a file
+ */
+class FarmDownload : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit FarmDownload(QObject *parent = nullptr);
+    ~FarmDownload() override;
+    
+    // Extract a tar stream into dirPath, which is created if needed
+    bool startDirectory(const QString &dirPath);
+    bool startFile(const QString &filePath);
+    
+    // Feed a chunk message, emits finished() after the end message
+    void addChunk(const QJsonObject &message);
+    
+signals:
+    void finished(bool success);
+    
+private:
+    QProcess *m_tar = nullptr;
+    QFile m_file;
+    QIODevice *m_sink = nullptr;
+    bool m_failed = false;
+    bool m_done = false;
+};
+
+#endif // FARMTRANSFER_H
\ No newline at end of file
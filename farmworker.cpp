@@ -0,0 +1,550 @@
+#include "farmworker.h"
+#include "buildmetrics.h"
+#include "farmconnection.h"
+#include "farmtransfer.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QHostInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QStandardPaths>
+
+#include <memory>
+
+namespace {
+
+// Output kept per job for failure reports
+const int OutputTailSize = 16 * 1024;
+
+} // namespace
+
+FarmWorker::FarmWorker(QObject *parent)
+    : QObject(parent)
+    , m_dataDir(defaultDataDir())
+    , m_name(QHostInfo::localHostName() + "-" + QString::number(QCoreApplication::applicationPid()))
+    , m_token(FarmConnection::defaultToken())
+{
+    setSlots(1);
+    configureStorage();
+    connect(&m_storage, &StorageManager::logMessage, this, &FarmWorker::logMessage);
+    
+    m_heartbeatTimer.setInterval(5000);
+    connect(&m_heartbeatTimer, &QTimer::timeout, this, [this]() {
+        if (!m_connection)
+            return;
+        
+        m_connection->send(QJsonObject{
+            { "type", "heartbeat" },
+            { "running", QJsonArray::fromStringList(m_jobs.keys()) },
+        });
+    });
+    
+    m_reconnectTimer.setSingleShot(true);
+    m_reconnectTimer.setInterval(5000);
+    connect(&m_reconnectTimer, &QTimer::timeout, this, &FarmWorker::connectToCoordinator);
+    
+    // Deferred jobs are retried as the pressure averages move
+    m_admissionTimer.setInterval(2000);
+    connect(&m_admissionTimer, &QTimer::timeout, this, &FarmWorker::admitJobs);
+}
+
+FarmWorker::~FarmWorker()
+{
+    for (const Job &job : qAsConst(m_jobs)) {
+        if (job.process) {
+            job.process->kill();
+            job.process->waitForFinished();
+        }
+    }
+}
+
+QString FarmWorker::defaultDataDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/farm-worker";
+}
+
+void FarmWorker::setDataDir(const QString &dataDir)
+{
+    m_dataDir = dataDir;
+    configureStorage();
+}
+
+void FarmWorker::setName(const QString &name)
+{
+    m_name = name;
+}
+
+void FarmWorker::setSlots(int slots)
+{
+    m_slots = qMax(1, slots);
+    m_slotBusy.resize(m_slots);
+}
+
+void FarmWorker::setToken(const QString &token)
+{
+    m_token = token;
+}
+
+void FarmWorker::connectTo(const QString &address)
+{
+    m_address = address;
+    loadCacheKeys();
+    connectToCoordinator();
+}
+
+void FarmWorker::connectToCoordinator()
+{
+    m_connection = FarmConnection::connectTo(m_address, this);
+    
+    connect(m_connection, &FarmConnection::connected, this, &FarmWorker::sendHello);
+    connect(m_connection, &FarmConnection::messageReceived, this, &FarmWorker::handleMessage);
+    connect(m_connection, &FarmConnection::disconnected, this, &FarmWorker::connectionLost);
+}
+
+void FarmWorker::sendHello()
+{
+    emit logMessage(i18n("Connected to coordinator %1 as %2", m_address, m_name));
+    
+    QStringList cacheKeys = m_cacheKeys.values();
+    cacheKeys.sort();
+    
+    m_connection->send(QJsonObject{
+        { "type", "hello" },
+        { "protocol", FarmConnection::ProtocolVersion },
+        { "token", m_token },
+        { "worker", m_name },
+        { "slots", m_slots },
+        { "cacheKeys", QJsonArray::fromStringList(cacheKeys) },
+        { "trees", QJsonArray::fromStringList(cachedTrees()) },
+    });
+    
+    m_heartbeatTimer.start();
+}
+
+void FarmWorker::handleMessage(const QJsonObject &message)
+{
+    const QString type = message.value("type").toString();
+    
+    if (type == "job") {
+        startJob(message);
+    } else if (type == "tree-data") {
+        if (FarmDownload *download = m_treeDownloads.value(message.value("id").toString())) {
+            download->addChunk(message);
+        }
+    } else if (type == "rejected") {
+        emit logMessage(i18n("Rejected by the coordinator: %1", message.value("message").toString()));
+    }
+}
+
+void FarmWorker::connectionLost()
+{
+    if (m_connection) {
+        m_connection->deleteLater();
+        m_connection = nullptr;
+    }
+    m_heartbeatTimer.stop();
+    
+    // The coordinator retries these jobs on another worker
+    if (!m_jobs.isEmpty()) {
+        emit logMessage(i18np("Lost the coordinator, dropping 1 job", "Lost the coordinator, dropping %1 jobs", m_jobs.size()));
+    }
+    
+    for (const Job &job : qAsConst(m_jobs)) {
+        if (job.process) {
+            job.process->disconnect(this);
+            job.process->kill();
+            job.process->deleteLater();
+        }
+        QDir(m_dataDir + "/work/" + job.id).removeRecursively();
+        m_storage.unpin(treeDir(job.treeId));
+    }
+    m_jobs.clear();
+    m_slotBusy.fill(false);
+    m_admissionQueue.clear();
+    m_admissionTimer.stop();
+    updateMetrics();
+    
+    qDeleteAll(m_treeDownloads);
+    m_treeDownloads.clear();
+    m_waitingForTree.clear();
+    
+    m_reconnectTimer.start();
+}
+
+void FarmWorker::startJob(const QJsonObject &message)
+{
+    Job job;
+    job.id = message.value("job").toString();
+    job.appId = message.value("appId").toString();
+    job.branch = message.value("branch").toString(QStringLiteral("master"));
+    job.treeId = message.value("tree").toString();
+    job.manifest = message.value("manifest").toString();
+    for (const QJsonValue &key : message.value("cacheKeys").toArray()) {
+        job.cacheKeys << key.toString();
+    }
+    
+    // Tree ids name directories, refuse anything that could escape
+    if (job.id.isEmpty() || job.treeId.isEmpty() || job.treeId.contains('/') || job.treeId.startsWith('.')) {
+        sendResult(job.id, false, i18n("Invalid job"));
+        return;
+    }
+    
+    const int slot = m_slotBusy.indexOf(false);
+    if (slot < 0) {
+        // The coordinator only sends jobs for free slots
+        m_connection->send(QJsonObject{ { "type", "result" }, { "job", job.id }, { "success", false },
+                                        { "message", i18n("No free slot on %1", m_name) } });
+        return;
+    }
+    
+    job.slot = slot;
+    m_slotBusy[slot] = true;
+    m_jobs.insert(job.id, job);
+    m_storage.pin(treeDir(job.treeId));
+    
+    emit logMessage(i18n("Job %1: %2", job.id, job.appId));
+    
+    if (QFile::exists(treeDir(job.treeId) + "/manifest.json")) {
+        runBuild(job.id);
+        return;
+    }
+    
+    // Fetch the tree once, other jobs for it wait
+    m_waitingForTree[job.treeId] << job.id;
+    if (m_treeDownloads.contains(job.treeId))
+        return;
+    
+    const QString partialDir = treeDir(job.treeId) + ".partial";
+    QDir(partialDir).removeRecursively();
+    
+    FarmDownload *download = new FarmDownload(this);
+    const QString treeId = job.treeId;
+    connect(download, &FarmDownload::finished, this, [this, treeId](bool success) {
+        treeReady(treeId, success);
+    });
+    
+    if (!download->startDirectory(partialDir)) {
+        delete download;
+        treeReady(treeId, false);
+        return;
+    }
+    
+    m_treeDownloads.insert(treeId, download);
+    m_connection->send(QJsonObject{ { "type", "fetch-tree" }, { "tree", treeId } });
+}
+
+void FarmWorker::treeReady(const QString &treeId, bool success)
+{
+    if (FarmDownload *download = m_treeDownloads.take(treeId)) {
+        download->deleteLater();
+    }
+    
+    const QString partialDir = treeDir(treeId) + ".partial";
+    if (success) {
+        // Left over by an older version, without manifest.json
+        QDir(treeDir(treeId)).removeRecursively();
+        success = QDir().rename(partialDir, treeDir(treeId));
+    }
+    if (!success) {
+        QDir(partialDir).removeRecursively();
+    }
+    
+    const QStringList jobIds = m_waitingForTree.take(treeId);
+    for (const QString &jobId : jobIds) {
+        if (success) {
+            runBuild(jobId);
+        } else {
+            sendResult(jobId, false, i18n("Could not fetch staged tree %1", treeId));
+        }
+    }
+}
+
+void FarmWorker::runBuild(const QString &jobId)
+{
+    Job &job = m_jobs[jobId];
+    
+    // The tree is named after its manifest, a mismatch means a corrupt cache
+    QFile manifest(treeDir(job.treeId) + "/manifest.json");
+    if (!manifest.open(QIODevice::ReadOnly) || manifest.readAll() != job.manifest.toUtf8()) {
+        QDir(treeDir(job.treeId)).removeRecursively();
+        sendResult(jobId, false, i18n("Cached tree %1 does not match the job's manifest", job.treeId));
+        return;
+    }
+    
+    StorageManager::touch(treeDir(job.treeId));
+    m_admissionQueue << jobId;
+    admitJobs();
+}
+
+void FarmWorker::admitJobs()
+{
+    while (!m_admissionQueue.isEmpty() && m_governor.admit(runningBuilds())) {
+        startBuild(m_admissionQueue.takeFirst());
+    }
+    
+    if (m_admissionQueue.isEmpty()) {
+        m_admissionTimer.stop();
+    } else if (!m_admissionTimer.isActive()) {
+        emit logMessage(i18np("1 job waits for resources", "%1 jobs wait for resources", m_admissionQueue.size()));
+        m_admissionTimer.start();
+    }
+    
+    updateMetrics();
+}
+
+void FarmWorker::startBuild(const QString &jobId)
+{
+    if (!m_jobs.contains(jobId))
+        return;
+    
+    Job &job = m_jobs[jobId];
+    
+    const QString workDir = m_dataDir + "/work/" + job.id;
+    QDir(workDir).removeRecursively();
+    QDir().mkpath(workDir);
+    
+    // One state directory per slot: concurrent flatpak-builder runs must
+    // not share one, and jobs on a slot reuse its module cache
+    const QString stateDir = m_dataDir + "/state/slot-" + QString::number(job.slot);
+    
+    auto trace = std::make_shared<ProcessTrace>(QStringLiteral("flatpak-builder"), job.appId);
+    
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::MergedChannels);
+    process->setWorkingDirectory(workDir);
+    connect(process, &QProcess::readyReadStandardOutput, this, [this, jobId, process, trace]() {
+        const QByteArray output = process->readAllStandardOutput();
+        trace->addOutput(output);
+        m_governor.setStage(process, trace->phase());
+        
+        if (!m_jobs.contains(jobId))
+            return;
+        
+        Job &job = m_jobs[jobId];
+        job.output += output;
+        if (job.output.size() > OutputTailSize) {
+            job.output.remove(0, job.output.size() - OutputTailSize);
+        }
+    });
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, jobId, process, trace](int exitCode, QProcess::ExitStatus exitStatus) {
+                trace->finish(exitCode);
+                const ResourceUsage usage = m_governor.takeUsage(process);
+                if (m_jobs.contains(jobId)) {
+                    m_jobs[jobId].usage = usage;
+                    m_jobs[jobId].building = false;
+                }
+                process->deleteLater();
+                buildFinished(jobId, exitStatus == QProcess::NormalExit ? exitCode : -1);
+            });
+    
+    job.process = process;
+    job.building = true;
+    trace->start();
+    m_governor.start(process, "flatpak-builder", QStringList()
+                   << "--force-clean"
+                   << "--state-dir=" + stateDir
+                   << "--repo=" + m_dataDir + "/repo"
+                   << "--default-branch=" + job.branch
+                   << workDir + "/build"
+                   << treeDir(job.treeId) + "/manifest.json");
+}
+
+void FarmWorker::buildFinished(const QString &jobId, int exitCode)
+{
+    if (!m_jobs.contains(jobId))
+        return;
+    
+    // The slot stays taken until the result is sent, but another build
+    // may start now
+    admitJobs();
+    
+    Job &job = m_jobs[jobId];
+    
+    if (job.usage.available) {
+        emit logMessage(i18n("Job %1 used %2", jobId, job.usage.toString()));
+    }
+    
+    if (exitCode != 0) {
+        sendResult(jobId, false, i18n("flatpak-builder failed with exit code %1:\n%2",
+                                      exitCode, QString::fromLocal8Bit(job.output)));
+        return;
+    }
+    
+    // Hand the commit over as a bundle, the coordinator imports it into
+    // its own repo
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::MergedChannels);
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, jobId, process](int exitCode, QProcess::ExitStatus exitStatus) {
+                if (m_jobs.contains(jobId)) {
+                    m_jobs[jobId].output = process->readAll().right(OutputTailSize);
+                }
+                process->deleteLater();
+                bundleFinished(jobId, exitStatus == QProcess::NormalExit ? exitCode : -1);
+            });
+    
+    job.process = process;
+    process->start("flatpak", QStringList()
+                   << "build-bundle"
+                   << m_dataDir + "/repo"
+                   << m_dataDir + "/work/" + jobId + "/result.flatpak"
+                   << job.appId
+                   << job.branch);
+}
+
+void FarmWorker::bundleFinished(const QString &jobId, int exitCode)
+{
+    if (!m_jobs.contains(jobId) || !m_connection)
+        return;
+    
+    if (exitCode != 0) {
+        sendResult(jobId, false, i18n("flatpak build-bundle failed:\n%1", QString::fromLocal8Bit(m_jobs[jobId].output)));
+        return;
+    }
+    
+    FarmUpload *upload = new FarmUpload(m_connection, QStringLiteral("result-data"), jobId, this);
+    connect(upload, &FarmUpload::finished, this, [this, upload, jobId](bool success) {
+        upload->deleteLater();
+        sendResult(jobId, success, success ? QString() : i18n("Could not send the result bundle"));
+    });
+    
+    if (!upload->startFile(m_dataDir + "/work/" + jobId + "/result.flatpak")) {
+        upload->deleteLater();
+        sendResult(jobId, false, i18n("Result bundle is missing"));
+    }
+}
+
+void FarmWorker::sendResult(const QString &jobId, bool success, const QString &message)
+{
+    const Job job = m_jobs.take(jobId);
+    m_admissionQueue.removeAll(jobId);
+    
+    if (job.slot >= 0) {
+        m_slotBusy[job.slot] = false;
+    }
+    updateMetrics();
+    QDir(m_dataDir + "/work/" + jobId).removeRecursively();
+    
+    if (!job.treeId.isEmpty()) {
+        m_storage.unpin(treeDir(job.treeId));
+        m_storage.collect();
+    }
+    
+    // A successful build leaves its modules in the slot's cache
+    if (success) {
+        for (const QString &key : job.cacheKeys) {
+            m_cacheKeys.insert(key);
+        }
+        saveCacheKeys();
+    }
+    
+    emit logMessage(success ? i18n("Job %1 done", jobId) : i18n("Job %1 failed: %2", jobId, message));
+    
+    if (!m_connection)
+        return;
+    
+    m_connection->send(QJsonObject{
+        { "type", "result" },
+        { "job", jobId },
+        { "success", success },
+        { "message", message },
+        { "cacheKeys", QJsonArray::fromStringList(success ? job.cacheKeys : QStringList()) },
+        { "usage", job.usage.toJson() },
+    });
+}
+
+int FarmWorker::runningBuilds() const
+{
+    int running = 0;
+    for (const Job &job : m_jobs) {
+        running += job.building ? 1 : 0;
+    }
+    
+    return running;
+}
+
+void FarmWorker::updateMetrics()
+{
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.setGauge("fpb_workers", BuildMetrics::label("pool", "farm-worker"), m_slots);
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "farm-worker"), runningBuilds());
+    metrics.setGauge("fpb_queue_depth", BuildMetrics::label("queue", "admission"), m_admissionQueue.size());
+    metrics.writeTextFile();
+}
+
+QString FarmWorker::treeDir(const QString &treeId) const
+{
+    return m_dataDir + "/trees/" + treeId;
+}
+
+void FarmWorker::configureStorage()
+{
+    // Trees are fetched again when a job needs them. The slots' state is
+    // their module cache, which the coordinator keeps track of, and the
+    // result bundles are exported from the repo.
+    StorageArea trees;
+    trees.name = QStringLiteral("trees");
+    trees.path = m_dataDir + "/trees";
+    trees.weight = 2;
+    
+    StorageArea state;
+    state.name = QStringLiteral("state");
+    state.path = m_dataDir + "/state";
+    state.entries = false;
+    state.policy = StorageArea::Account;
+    
+    StorageArea repo;
+    repo.name = QStringLiteral("worker-repo");
+    repo.path = m_dataDir + "/repo";
+    repo.entries = false;
+    repo.policy = StorageArea::Account;
+    
+    m_storage.setDataDir(m_dataDir);
+    m_storage.setAreas({ trees, state, repo });
+}
+
+QStringList FarmWorker::cachedTrees() const
+{
+    QStringList trees;
+    
+    const QStringList dirs = QDir(m_dataDir + "/trees").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &dir : dirs) {
+        if (!dir.contains('.') && QFile::exists(treeDir(dir) + "/manifest.json")) {
+            trees << dir;
+        }
+    }
+    
+    return trees;
+}
+
+void FarmWorker::loadCacheKeys()
+{
+    QFile file(m_dataDir + "/cache-keys.json");
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    
+    for (const QJsonValue &key : QJsonDocument::fromJson(file.readAll()).array()) {
+        m_cacheKeys.insert(key.toString());
+    }
+}
+
+void FarmWorker::saveCacheKeys()
+{
+    QDir().mkpath(m_dataDir);
+    
+    QStringList keys = m_cacheKeys.values();
+    keys.sort();
+    
+    QFile file(m_dataDir + "/cache-keys.json");
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(QJsonDocument(QJsonArray::fromStringList(keys)).toJson());
+    }
+}
\ No newline at end of file
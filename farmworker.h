@@ -0,0 +1,124 @@
+#ifndef FARMWORKER_H
+#define FARMWORKER_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include "resourcegovernor.h"
+#include "storagemanager.h"
+
+class FarmConnection;
+class FarmDownload;
+class QProcess;
+
+/**
+ * Worker node of the build farm.
+ *
+ * Connects to a coordinator, runs up to slots() flatpak-builder jobs at a
+ * time and sends the results back as bundles. Staged trees are cached by
+ * id below the data directory, and each slot keeps its own flatpak-builder
+ * state directory, so Wine and DXVK module builds are reused across jobs.
+ * Builds run in cgroup scopes of their own, and a job only starts next to
+ * running ones while the host is not under resource pressure. Trees that
+ * have not been used for a while are removed once the data directory
+ * grows beyond the storage quota. The worker reconnects on its own if the
+ * coordinator goes away.
+ */
+class FarmWorker : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit FarmWorker(QObject *parent = nullptr);
+    ~FarmWorker() override;
+    
+    // <data>/flatpak-wine-builder/farm-worker
+    static QString defaultDataDir();
+    
+    void setDataDir(const QString &dataDir);
+    void setName(const QString &name);
+    void setSlots(int slots);
+    int slots() const { return m_slots; }
+    
+    // Token presented to the coordinator, farm/token by default
+    void setToken(const QString &token);
+    
+    // Connect to "host:port" or "unix:/path", retrying until it succeeds
+    void connectTo(const QString &address);
+    
+signals:
+    void logMessage(const QString &message);
+    
+private:
+    struct Job
+    {
+        QString id;
+        QString appId;
+        QString branch;
+        QString treeId;
+        QString manifest;
+        QStringList cacheKeys;
+        int slot = -1;
+        QPointer<QProcess> process;
+        bool building = false;
+        QByteArray output;
+        ResourceUsage usage;
+    };
+    
+    void connectToCoordinator();
+    void sendHello();
+    void handleMessage(const QJsonObject &message);
+    void connectionLost();
+    
+    void startJob(const QJsonObject &message);
+    void treeReady(const QString &treeId, bool success);
+    void runBuild(const QString &jobId);
+    void admitJobs();
+    void startBuild(const QString &jobId);
+    void buildFinished(const QString &jobId, int exitCode);
+    void bundleFinished(const QString &jobId, int exitCode);
+    void sendResult(const QString &jobId, bool success, const QString &message);
+    int runningBuilds() const;
+    void updateMetrics();
+    
+    QString treeDir(const QString &treeId) const;
+    void configureStorage();
+    QStringList cachedTrees() const;
+    void loadCacheKeys();
+    void saveCacheKeys();
+    
+    QString m_dataDir;
+    QString m_name;
+    QString m_token;
+    int m_slots = 1;
+    QString m_address;
+    
+    QPointer<FarmConnection> m_connection;
+    QTimer m_heartbeatTimer;
+    QTimer m_reconnectTimer;
+    
+    QHash<QString, Job> m_jobs;
+    QVector<bool> m_slotBusy;
+    QSet<QString> m_cacheKeys;
+    
+    // Jobs with a slot that wait for the governor to admit them
+    ResourceGovernor m_governor{QStringLiteral("farm-worker")};
+    QStringList m_admissionQueue;
+    QTimer m_admissionTimer;
+    
+    // Trees of running jobs are pinned
+    StorageManager m_storage;
+    
+    // Trees being fetched, and the jobs waiting for them
+    QHash<QString, FarmDownload *> m_treeDownloads;
+    QHash<QString, QStringList> m_waitingForTree;
+};
+
+#endif // FARMWORKER_H
\ No newline at end of file
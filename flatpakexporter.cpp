@@ -0,0 +1,284 @@
+#include "flatpakexporter.h"
+#include "tracer.h"
+#include "buildmetrics.h"
+#include "pipelinejournal.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QThread>
+
+#include <memory>
+
+FlatpakExporter::FlatpakExporter(QObject *parent)
+    : QObject(parent)
+    , m_maxConcurrentJobs(qMax(1, QThread::idealThreadCount() / 2))
+{
+}
+
+FlatpakExporter::~FlatpakExporter()
+{
+    // Let running exports finish in the background rather than leaving a
+    // half-written repo or bundle behind
+    const QList<QProcess *> processes = findChildren<QProcess *>();
+    for (QProcess *process : processes) {
+        process->disconnect(this);
+        process->setParent(nullptr);
+        connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                process, &QObject::deleteLater);
+    }
+}
+
+QString FlatpakExporter::defaultRepoPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/repo";
+}
+
+QString FlatpakExporter::commitOf(const QString &repoPath, const QString &appId, const QString &branch)
+{
+    // refs/heads/app/<id>/<arch>/<branch> holds the commit checksum
+    const QString appRefs = repoPath + "/refs/heads/app/" + appId;
+    const QStringList arches = QDir(appRefs).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    for (const QString &arch : arches) {
+        QFile ref(appRefs + "/" + arch + "/" + branch);
+        if (ref.open(QIODevice::ReadOnly))
+            return QString::fromLatin1(ref.readAll().trimmed());
+    }
+    
+    return QString();
+}
+
+QString FlatpakExporter::installedCommit(const QString &appId, const QString &branch)
+{
+    QProcess process;
+    process.start("flatpak", QStringList() << "info" << "--user" << "--show-commit" << appId + "//" + branch);
+    if (!process.waitForFinished() || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+        return QString();
+    
+    return QString::fromLatin1(process.readAllStandardOutput().trimmed());
+}
+
+QStringList FlatpakExporter::installArguments(const QString &repoPath, const QString &appId, const QString &branch)
+{
+    return QStringList() << "install" << "--user" << "--noninteractive" << "--reinstall"
+                         << repoPath << appId + "//" + branch;
+}
+
+FlatpakExporter::ResumePoint FlatpakExporter::resumePoint(const PipelineJournal &journal, const QString &repoPath,
+                                                          const QString &appId, const QString &branch)
+{
+    const QString commit = commitOf(repoPath, appId, branch);
+    if (!journal.isComplete("build") || commit.isEmpty() || journal.outputHash("build") != commit)
+        return ResumeBuild;
+    
+    // The app may have been uninstalled, or replaced by another build
+    if (installedCommit(appId, branch) != commit)
+        return ResumeInstall;
+    
+    if (!journal.isComplete("export") || journal.outputHash("export") != commit)
+        return ResumeExport;
+    
+    return ResumeDone;
+}
+
+void FlatpakExporter::setMaxConcurrentJobs(int count)
+{
+    m_maxConcurrentJobs = qMax(1, count);
+    startBundles();
+}
+
+void FlatpakExporter::enqueue(const ExportJob &job)
+{
+    m_deltaWaiting.append(job);
+    
+    // A run in progress may already have read the refs, so new jobs
+    // always wait for the next one
+    if (!m_deltaProcess) {
+        startDeltaRun();
+    }
+    
+    updateMetrics();
+}
+
+int FlatpakExporter::pendingCount() const
+{
+    return m_deltaWaiting.size() + m_deltaRunning.size() + m_bundleWaiting.size() + m_bundlesRunning;
+}
+
+void FlatpakExporter::startDeltaRun()
+{
+    if (m_deltaWaiting.isEmpty())
+        return;
+    
+    m_deltaRunning = m_deltaWaiting;
+    m_deltaWaiting.clear();
+    
+    // All jobs of one run share the same repo in practice, but group them
+    // anyway so a job for another repo is not silently skipped
+    const QString repoPath = m_deltaRunning.first().repoPath;
+    QList<ExportJob> otherRepo;
+    for (int i = m_deltaRunning.size() - 1; i >= 0; --i) {
+        if (m_deltaRunning[i].repoPath != repoPath) {
+            otherRepo.prepend(m_deltaRunning.takeAt(i));
+        }
+    }
+    m_deltaWaiting = otherRepo;
+    
+    emit logMessage(i18n("Generating static deltas in %1...", repoPath));
+    
+    auto trace = std::make_shared<ProcessTrace>(QStringLiteral("flatpak build-update-repo"), repoPath);
+    QElapsedTimer timer;
+    timer.start();
+    
+    m_deltaProcess = new QProcess(this);
+    m_deltaProcess->setProcessChannelMode(QProcess::MergedChannels);
+    connect(m_deltaProcess, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, trace, timer](int exitCode) {
+                trace->finish(exitCode);
+                recordRun(QStringLiteral("delta"), timer.elapsed());
+                deltaRunFinished(m_deltaProcess);
+            });
+    // finished() is not emitted if flatpak cannot be started
+    connect(m_deltaProcess, &QProcess::errorOccurred, this, [this, trace](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart) {
+            trace->finish(-1);
+            deltaRunFinished(m_deltaProcess);
+        }
+    });
+    
+    trace->start();
+    m_deltaProcess->start("flatpak", QStringList()
+                          << "build-update-repo"
+                          << "--generate-static-deltas"
+                          << "--static-delta-jobs=" + QString::number(QThread::idealThreadCount())
+                          << repoPath);
+}
+
+void FlatpakExporter::deltaRunFinished(QProcess *process)
+{
+    const bool success = processSucceeded(process);
+    
+    process->deleteLater();
+    m_deltaProcess = nullptr;
+    
+    const QList<ExportJob> jobs = m_deltaRunning;
+    m_deltaRunning.clear();
+    
+    for (const ExportJob &job : jobs) {
+        if (!success) {
+            finishJob(job, false);
+        } else if (job.bundlePath.isEmpty()) {
+            finishJob(job, true);
+        } else {
+            m_bundleWaiting.append(job);
+        }
+    }
+    
+    startBundles();
+    startDeltaRun();
+    updateMetrics();
+}
+
+void FlatpakExporter::startBundles()
+{
+    while (!m_bundleWaiting.isEmpty() && m_bundlesRunning < m_maxConcurrentJobs) {
+        const ExportJob job = m_bundleWaiting.takeFirst();
+        
+        QDir().mkpath(QFileInfo(job.bundlePath).path());
+        emit logMessage(i18n("Writing bundle %1...", job.bundlePath));
+        
+        auto trace = std::make_shared<ProcessTrace>(QStringLiteral("flatpak build-bundle"), job.appId);
+        QElapsedTimer timer;
+        timer.start();
+        
+        QProcess *process = new QProcess(this);
+        process->setProcessChannelMode(QProcess::MergedChannels);
+        connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                this, [this, process, job, trace, timer](int exitCode) {
+                    trace->finish(exitCode);
+                    recordRun(QStringLiteral("bundle"), timer.elapsed());
+                    bundleFinished(process, job);
+                });
+        connect(process, &QProcess::errorOccurred, this, [this, process, job, trace](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart) {
+                trace->finish(-1);
+                bundleFinished(process, job);
+            }
+        });
+        
+        m_bundlesRunning++;
+        trace->start();
+        process->start("flatpak", QStringList()
+                       << "build-bundle"
+                       << job.repoPath
+                       << job.bundlePath
+                       << job.appId
+                       << job.branch);
+    }
+}
+
+void FlatpakExporter::bundleFinished(QProcess *process, const ExportJob &job)
+{
+    const bool success = processSucceeded(process);
+    
+    process->deleteLater();
+    m_bundlesRunning--;
+    
+    finishJob(job, success);
+    startBundles();
+    updateMetrics();
+}
+
+bool FlatpakExporter::processSucceeded(QProcess *process)
+{
+    if (process->error() == QProcess::FailedToStart) {
+        emit logMessage(i18n("Cannot run flatpak: %1", process->errorString()));
+        return false;
+    }
+    
+    const bool success = process->exitStatus() == QProcess::NormalExit && process->exitCode() == 0;
+    if (!success) {
+        emit logMessage(QString::fromLocal8Bit(process->readAll()));
+    }
+    return success;
+}
+
+void FlatpakExporter::finishJob(const ExportJob &job, bool success)
+{
+    if (success) {
+        emit logMessage(i18n("Exported %1", job.appId));
+    } else {
+        emit logMessage(i18n("Export of %1 failed", job.appId));
+    }
+    
+    BuildMetrics::instance().increment("fpb_exports_total", BuildMetrics::label("result", success ? "success" : "failure"));
+    
+    emit exportFinished(job.appId, success);
+}
+
+void FlatpakExporter::recordRun(const QString &pool, qint64 elapsedMs)
+{
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", pool), elapsedMs / 1000.0);
+    metrics.increment("fpb_worker_busy_seconds_total", BuildMetrics::label("pool", pool), elapsedMs / 1000.0);
+}
+
+void FlatpakExporter::updateMetrics()
+{
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.setGauge("fpb_queue_depth", BuildMetrics::label("queue", "export"), pendingCount());
+    
+    // Delta generation is exclusive, bundles run in parallel
+    metrics.setGauge("fpb_workers", BuildMetrics::label("pool", "delta"), 1);
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "delta"), m_deltaProcess ? 1 : 0);
+    metrics.setGauge("fpb_workers", BuildMetrics::label("pool", "bundle"), m_maxConcurrentJobs);
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "bundle"), m_bundlesRunning);
+    
+    metrics.writeTextFile();
+}
\ No newline at end of file
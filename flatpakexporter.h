@@ -0,0 +1,111 @@
+#ifndef FLATPAKEXPORTER_H
+#define FLATPAKEXPORTER_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+class PipelineJournal;
+class QProcess;
+
+/**
+ * A single export request for an app that has been committed to the repo
+ */
+struct ExportJob
+{
+    QString appId;
+    QString branch = QStringLiteral("master");
+    QString repoPath;
+    QString bundlePath;     // Empty if no single-file bundle is wanted
+};
+
+/**
+ * Publishes builds from the local OSTree repo.
+ *
+ * flatpak-builder commits every build into a persistent repo, so each
+ * new build of an app id becomes a child of the previous commit. The
+ * exporter then generates static deltas between those commits and
+ * optionally writes single-file bundles.
+ *
+ * Delta generation works on the whole repo, so concurrent requests are
+ * coalesced into one run. Bundles are written concurrently.
+ */
+class FlatpakExporter : public QObject
+{
+    Q_OBJECT
+    
+public:
+    // What is left of a build pipeline, in order
+    enum ResumePoint {
+        ResumeBuild,        // No build, or not the one the journal recorded
+        ResumeInstall,      // Built, but the commit is not installed
+        ResumeExport,       // Built and installed, not exported
+        ResumeDone
+    };
+    
+    explicit FlatpakExporter(QObject *parent = nullptr);
+    ~FlatpakExporter() override;
+    
+    // Repo used when none is configured
+    static QString defaultRepoPath();
+    
+    // Commit the app's ref points to in repoPath, for any architecture.
+    // Empty if the app has not been committed.
+    static QString commitOf(const QString &repoPath, const QString &appId,
+                            const QString &branch = QStringLiteral("master"));
+    
+    // Commit of the app installed for the user, empty if it is not
+    // installed. Asks flatpak and waits for it.
+    static QString installedCommit(const QString &appId, const QString &branch = QStringLiteral("master"));
+    
+    // Arguments for flatpak to install the app's commit in repoPath for
+    // the user, like flatpak-builder --install does
+    static QStringList installArguments(const QString &repoPath, const QString &appId,
+                                        const QString &branch = QStringLiteral("master"));
+    
+    // Where a pipeline continues whose journal may have recorded a build.
+    // A build counts only while the repo has its commit and only skips
+    // the install if that commit is installed.
+    static ResumePoint resumePoint(const PipelineJournal &journal, const QString &repoPath, const QString &appId,
+                                   const QString &branch = QStringLiteral("master"));
+    
+    // Maximum number of bundles written at the same time
+    void setMaxConcurrentJobs(int count);
+    int maxConcurrentJobs() const { return m_maxConcurrentJobs; }
+    
+    void enqueue(const ExportJob &job);
+    
+    // Jobs that have not finished yet
+    int pendingCount() const;
+    
+signals:
+    void logMessage(const QString &message);
+    void exportFinished(const QString &appId, bool success);
+    
+private:
+    void startDeltaRun();
+    void deltaRunFinished(QProcess *process);
+    void startBundles();
+    void bundleFinished(QProcess *process, const ExportJob &job);
+    
+    // Whether a finished or failed to start process succeeded, logs why not
+    bool processSucceeded(QProcess *process);
+    void recordRun(const QString &pool, qint64 elapsedMs);
+    void updateMetrics();
+    void finishJob(const ExportJob &job, bool success);
+    
+    int m_maxConcurrentJobs;
+    
+    // Jobs waiting for the next delta run, and the ones covered by the
+    // run in progress
+    QList<ExportJob> m_deltaWaiting;
+    QList<ExportJob> m_deltaRunning;
+    QProcess *m_deltaProcess = nullptr;
+    
+    // Jobs waiting for, or writing, their bundle
+    QList<ExportJob> m_bundleWaiting;
+    int m_bundlesRunning = 0;
+};
+
+#endif // FLATPAKEXPORTER_H
\ No newline at end of file
@@ -1,7 +1,10 @@
 #include "flatpakmanifest.h"
+#include "manifestwriter.h"
+#include "sharedmodules.h"
+#include "tracer.h"
 
 #include <QFile>
-#include <QJsonDocument>
+#include <QFileInfo>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QDebug>
@@ -28,14 +31,16 @@ void FlatpakManifest::clear()
     m_command.clear();
     m_commandArgs.clear();
     m_environment.clear();
+    m_finishArgs.clear();
     
     m_filesystemAccess.clear();
     
     m_allowNetwork = true;
     m_allowAudio = true;
     
-    m_modules.empty();
+    m_modules = QJsonArray();
     m_extensions.clear();
+    m_payloadFingerprint.clear();
 }
 
 void FlatpakManifest::setAppId(const QString &appId)
@@ -80,88 +85,129 @@ void FlatpakManifest::setSdk(const QString &sdk)
 
 void FlatpakManifest::addWineModule(const QString &wineVersion, const QString &arch)
 {
-    // Create Wine module
-    QJsonObject wineModule;
-    wineModule["name"] = "wine";
-    wineModule["buildsystem"] = "simple";
-    
-    // Configure Wine build commands
-    QJsonArray buildCommands;
-    
-    // Install Wine from the repository
-    QJsonObject installCommand;
-    installCommand["type"] = "shell";
-    
-    QString command = "mkdir -p ${FLATPAK_DEST}/wine";
-    
-    // Determine which version of Wine to install
-    if (wineVersion == "staging") {
-        command += " && dnf install -y --installroot=${FLATPAK_DEST}/wine wine-staging";
-    } else if (wineVersion == "devel") {
-        command += " && dnf install -y --installroot=${FLATPAK_DEST}/wine wine-devel";
-    } else {
-        // Default to stable Wine
-        command += " && dnf install -y --installroot=${FLATPAK_DEST}/wine wine";
-    }
-    
-    installCommand["commands"] = QJsonArray{command};
-    buildCommands.append(installCommand);
-    
-    wineModule["build-commands"] = buildCommands;
-    
-    // Add to modules
-    m_modules.append(wineModule);
-    
-    // Add Wine app module (containing the actual Windows app)
+    // Wine is the same for all apps and lives in a module file of its own
+    m_modules.append(SharedModules::wine(wineVersion));
+}
+
+void FlatpakManifest::addAppModule()
+{
+    // The actual Windows app
     QJsonObject appModule;
     appModule["name"] = "app";
     appModule["buildsystem"] = "simple";
     
-    QJsonArray appBuildCommands;
-    QJsonObject appInstallCommand;
-    appInstallCommand["type"] = "shell";
-    appInstallCommand["commands"] = QJsonArray{
+    // The pruned app tree is staged next to the manifest, so only the
+    // retained files end up in the module's build directory
+    QJsonObject appSource;
+    appSource["type"] = "dir";
+    appSource["path"] = "app";
+    appModule["sources"] = QJsonArray{appSource};
+    
+    appModule["build-commands"] = QJsonArray{
         "mkdir -p ${FLATPAK_DEST}/app",
         "cp -r * ${FLATPAK_DEST}/app/"
     };
-    appBuildCommands.append(appInstallCommand);
-    
-    appModule["build-commands"] = appBuildCommands;
     m_modules.append(appModule);
 }
 
 void FlatpakManifest::addDxvkModule(const QString &dxvkVersion)
 {
-    // Create DXVK module for DirectX to Vulkan translation
-    QJsonObject dxvkModule;
-    dxvkModule["name"] = "dxvk";
-    dxvkModule["buildsystem"] = "simple";
+    // DirectX to Vulkan translation, shared like the Wine module
+    m_modules.append(SharedModules::dxvk(dxvkVersion));
+}
+
+void FlatpakManifest::addBasePrefixModule(const QString &arch, const QStringList &components)
+{
+    m_modules.append(SharedModules::basePrefix(arch, components));
+}
+
+void FlatpakManifest::addWineComponentModule(const QString &name, const QMap<QString, QString> &stagedFiles)
+{
+    QJsonObject componentModule;
+    componentModule["name"] = "wine-" + name;
+    componentModule["buildsystem"] = "simple";
     
+    QJsonArray sources;
     QJsonArray buildCommands;
-    QJsonObject installCommand;
-    installCommand["type"] = "shell";
+    for (auto it = stagedFiles.constBegin(); it != stagedFiles.constEnd(); ++it) {
+        const QString fileName = QFileInfo(it.key()).fileName();
+        
+        // Installers missing from the local cache are downloaded
+        QJsonObject source;
+        source["type"] = "file";
+        source[it.key().startsWith("https://") ? "url" : "path"] = it.key();
+        source["sha256"] = it.value();
+        sources.append(source);
+        
+        // Wine looks for the installers in <datadir>/wine/{mono,gecko}
+        buildCommands.append("install -Dm644 " + fileName + " ${FLATPAK_DEST}/wine/usr/share/wine/" + name + "/" + fileName);
+    }
     
-    QString command = "mkdir -p ${FLATPAK_DEST}/dxvk";
+    componentModule["sources"] = sources;
+    componentModule["build-commands"] = buildCommands;
     
-    // Determine DXVK version to download
-    QString dxvkUrl;
+    m_modules.append(componentModule);
+}
+
+void FlatpakManifest::addFontCacheModule(const QString &fileName, const QStringList &scriptLines)
+{
+    QJsonObject fontModule;
+    fontModule["name"] = "font-cache";
+    fontModule["buildsystem"] = "simple";
     
-    if (dxvkVersion == "latest") {
-        dxvkUrl = "https://github.com/doitsujin/dxvk/releases/latest/download/dxvk-latest.tar.gz";
-    } else {
-        dxvkUrl = "https://github.com/doitsujin/dxvk/releases/download/v" + dxvkVersion + "/dxvk-" + dxvkVersion + ".tar.gz";
-    }
+    QJsonObject scriptSource;
+    scriptSource["type"] = "script";
+    scriptSource["dest-filename"] = fileName;
+    scriptSource["commands"] = QJsonArray::fromStringList(scriptLines);
+    fontModule["sources"] = QJsonArray{scriptSource};
+    
+    fontModule["build-commands"] = QJsonArray{"./" + fileName};
+    
+    m_modules.append(fontModule);
+}
+
+void FlatpakManifest::addLauncherModule(const QString &fileName, const QStringList &scriptLines)
+{
+    QJsonObject launcherModule;
+    launcherModule["name"] = "launcher";
+    launcherModule["buildsystem"] = "simple";
+    
+    QJsonObject scriptSource;
+    scriptSource["type"] = "script";
+    scriptSource["dest-filename"] = fileName;
+    scriptSource["commands"] = QJsonArray::fromStringList(scriptLines);
+    launcherModule["sources"] = QJsonArray{scriptSource};
+    
+    launcherModule["build-commands"] = QJsonArray{
+        "install -Dm755 " + fileName + " ${FLATPAK_DEST}/bin/" + fileName
+    };
+    
+    m_modules.append(launcherModule);
+}
+
+void FlatpakManifest::addDxvkStateCacheModule(const QString &stagedPath)
+{
+    const QString fileName = QFileInfo(stagedPath).fileName();
     
-    command += " && curl -L " + dxvkUrl + " -o dxvk.tar.gz";
-    command += " && tar -xf dxvk.tar.gz -C ${FLATPAK_DEST}/dxvk --strip-components=1";
+    QJsonObject cacheModule;
+    cacheModule["name"] = "dxvk-cache";
+    cacheModule["buildsystem"] = "simple";
     
-    installCommand["commands"] = QJsonArray{command};
-    buildCommands.append(installCommand);
+    QJsonObject cacheSource;
+    cacheSource["type"] = "file";
+    cacheSource["path"] = stagedPath;
+    cacheModule["sources"] = QJsonArray{cacheSource};
     
-    dxvkModule["build-commands"] = buildCommands;
+    cacheModule["build-commands"] = QJsonArray{
+        "install -Dm644 " + fileName + " ${FLATPAK_DEST}/share/dxvk-cache/" + fileName
+    };
     
-    // Add to modules
-    m_modules.append(dxvkModule);
+    m_modules.append(cacheModule);
+}
+
+void FlatpakManifest::setPayloadFingerprint(const QString &fingerprint)
+{
+    m_payloadFingerprint = fingerprint;
 }
 
 void FlatpakManifest::setCommand(const QString &command)
@@ -179,6 +225,22 @@ void FlatpakManifest::setEnvironment(const QMap<QString, QString> &env)
     m_environment = env;
 }
 
+void FlatpakManifest::addEnvironment(const QMap<QString, QString> &env, bool overwrite)
+{
+    for (auto it = env.constBegin(); it != env.constEnd(); ++it) {
+        if (overwrite || !m_environment.contains(it.key())) {
+            m_environment[it.key()] = it.value();
+        }
+    }
+}
+
+void FlatpakManifest::addFinishArg(const QString &arg)
+{
+    if (!m_finishArgs.contains(arg)) {
+        m_finishArgs.append(arg);
+    }
+}
+
 void FlatpakManifest::addFilesystemAccess(const QString &path)
 {
     m_filesystemAccess.append(path);
@@ -206,14 +268,63 @@ void FlatpakManifest::addExtension(const QString &extensionName)
 
 bool FlatpakManifest::saveToFile(const QString &filePath) const
 {
+    TraceSpan span("manifest", QStringLiteral("write manifest"), filePath);
+    
     QFile file(filePath);
     if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
         return false;
     
-    QJsonDocument doc(toJsonObject());
-    file.write(doc.toJson());
+    const QByteArray json = toJson();
+    if (file.write(json) != json.size())
+        return false;
     
-    return true;
+    // The module files the manifest refers to go next to it
+    return SharedModules::write(sharedModules(), QFileInfo(filePath).absolutePath());
+}
+
+QByteArray FlatpakManifest::toJson() const
+{
+    QByteArray json;
+    json.reserve(4096);
+    
+    ManifestWriter writer(&json);
+    writer.beginObject();
+    
+    // Basic app information
+    writer.writeMember(QLatin1String("app-id"), m_appId);
+    writer.writeMember(QLatin1String("runtime"), m_runtime);
+    writer.writeMember(QLatin1String("runtime-version"), m_runtimeVersion);
+    writer.writeMember(QLatin1String("sdk"), m_sdk);
+    
+    // Command
+    writer.writeMember(QLatin1String("command"), m_command);
+    if (!m_commandArgs.isEmpty()) {
+        writer.writeMember(QLatin1String("command-args"), m_commandArgs);
+    }
+    
+    writer.writeMember(QLatin1String("finish-args"), finishArgs());
+    
+    if (!m_modules.isEmpty()) {
+        writer.writeKey(QLatin1String("modules"));
+        writer.writeValue(modules());
+    }
+    
+    writer.endObject();
+    json.append('\n');
+    
+    return json;
+}
+
+QStringList FlatpakManifest::sharedModules() const
+{
+    QStringList paths;
+    for (const QJsonValue &module : m_modules) {
+        if (module.isString()) {
+            paths << module.toString();
+        }
+    }
+    
+    return paths;
 }
 
 QJsonObject FlatpakManifest::toJsonObject() const
@@ -230,15 +341,21 @@ QJsonObject FlatpakManifest::toJsonObject() const
     manifest["command"] = m_command;
     
     if (!m_commandArgs.isEmpty()) {
-        QJsonArray args;
-        for (const QString &arg : m_commandArgs) {
-            args.append(arg);
-        }
-        manifest["command-args"] = args;
+        manifest["command-args"] = QJsonArray::fromStringList(m_commandArgs);
+    }
+    
+    manifest["finish-args"] = QJsonArray::fromStringList(finishArgs());
+    
+    if (!m_modules.isEmpty()) {
+        manifest["modules"] = modules();
     }
     
-    // Finish args (configure sandbox)
-    QJsonArray finishArgs;
+    return manifest;
+}
+
+QStringList FlatpakManifest::finishArgs() const
+{
+    QStringList finishArgs;
     
     // Always share IPC namespace
     finishArgs.append("--share=ipc");
@@ -257,7 +374,6 @@ QJsonObject FlatpakManifest::toJsonObject() const
     
     // X11 access for Wine
     finishArgs.append("--socket=x11");
-    finishArgs.append("--share=network");
     
     // DRI (hardware acceleration)
     finishArgs.append("--device=dri");
@@ -267,38 +383,36 @@ QJsonObject FlatpakManifest::toJsonObject() const
         finishArgs.append("--filesystem=" + path);
     }
     
-    manifest["finish-args"] = finishArgs;
-    
-    // Add environment if specified
-    if (!m_environment.isEmpty()) {
-        QJsonObject env;
-        for (auto it = m_environment.constBegin(); it != m_environment.constEnd(); ++it) {
-            env[it.key()] = it.value();
-        }
-        manifest["environment"] = env;
-    }
-    
-    // Add metadata
-    QJsonObject metadata;
-    
-    if (!m_appName.isEmpty()) {
-        metadata["name"] = m_appName;
-    }
-    
-    if (!m_appDescription.isEmpty()) {
-        QJsonObject comments;
-        comments["C"] = m_appDescription;
-        metadata["comments"] = comments;
+    // Runtime environment is passed to the sandbox through --env
+    for (auto it = m_environment.constBegin(); it != m_environment.constEnd(); ++it) {
+        finishArgs.append("--env=" + it.key() + "=" + it.value());
     }
     
-    if (!metadata.isEmpty()) {
-        manifest["metadata"] = metadata;
-    }
+    finishArgs += m_finishArgs;
     
-    // Add modules
-    if (!m_modules.isEmpty()) {
-        manifest["modules"] = m_modules;
+    return finishArgs;
+}
+
+QJsonArray FlatpakManifest::modules() const
+{
+    QJsonArray modules = m_modules;
+    
+    // flatpak-builder does not checksum the contents of dir sources,
+    // so tie the app module's cache key to the staged payload
+    if (!m_payloadFingerprint.isEmpty()) {
+        for (int i = 0; i < modules.size(); ++i) {
+            QJsonObject module = modules[i].toObject();
+            if (module["name"].toString() != "app")
+                continue;
+            
+            QJsonObject buildOptions = module["build-options"].toObject();
+            QJsonObject env = buildOptions["env"].toObject();
+            env["WINEPAK_PAYLOAD"] = m_payloadFingerprint;
+            buildOptions["env"] = env;
+            module["build-options"] = buildOptions;
+            modules[i] = module;
+        }
     }
     
-    return manifest;
+    return modules;
 }
\ No newline at end of file
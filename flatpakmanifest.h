@@ -1,6 +1,7 @@
 #ifndef FLATPAKMANIFEST_H
 #define FLATPAKMANIFEST_H
 
+#include <QByteArray>
 #include <QString>
 #include <QStringList>
 #include <QMap>
@@ -30,15 +31,51 @@ public:
     void setRuntimeVersion(const QString &version);
     void setSdk(const QString &sdk);
     
-    // Wine settings
+    // Wine settings. Wine, DXVK and the base prefix are added as
+    // references to module files, see SharedModules. flatpak-builder
+    // reuses a module's cache only if all modules before it are
+    // unchanged, so these go before the app module.
     void addWineModule(const QString &wineVersion, const QString &arch);
     void addDxvkModule(const QString &dxvkVersion = "latest");
     
+    // Create the read-only base Wine prefix at build time, used by the
+    // launcher's layered prefix mode. Goes after the modules of the Wine
+    // components it includes, see SharedModules::basePrefix().
+    void addBasePrefixModule(const QString &arch, const QStringList &components);
+    
+    // Install checksummed Wine Mono/Gecko installers staged next to the
+    // manifest into Wine's data directory (stagedPath or url -> sha256)
+    void addWineComponentModule(const QString &name, const QMap<QString, QString> &stagedFiles);
+    
+    // The pruned app tree staged next to the manifest. Comes after the
+    // modules that are the same for every app.
+    void addAppModule();
+    
+    // Build script caching the app's bundled fonts, see FontCacheScript.
+    // Must come after the app module.
+    void addFontCacheModule(const QString &fileName, const QStringList &scriptLines);
+    
+    // Launcher script used as the command, see LauncherScript
+    void addLauncherModule(const QString &fileName, const QStringList &scriptLines);
+    
+    // Ship a pre-recorded DXVK state cache staged next to the manifest
+    void addDxvkStateCacheModule(const QString &stagedPath);
+    
+    // Fingerprint of the staged app tree, used to invalidate the app module
+    void setPayloadFingerprint(const QString &fingerprint);
+    
     // Command configuration
     void setCommand(const QString &command);
     void addCommandArg(const QString &arg);
     void setEnvironment(const QMap<QString, QString> &env);
     
+    // Merge variables into the environment. Existing values are kept
+    // unless overwrite is set.
+    void addEnvironment(const QMap<QString, QString> &env, bool overwrite = true);
+    
+    // Additional sandbox arguments, e.g. from a performance profile
+    void addFinishArg(const QString &arg);
+    
     // Filesystem access
     void addFilesystemAccess(const QString &path);
     
@@ -52,18 +89,28 @@ public:
     void addModule(const QJsonObject &module);
     void addExtension(const QString &extensionName);
     
-    // Save to file
+    // Save to file, together with the shared module files it refers to
     bool saveToFile(const QString &filePath) const;
     
+    // The manifest as written by saveToFile(), streamed out without
+    // building a QJsonObject first
+    QByteArray toJson() const;
+    
     // Get the generated manifest
     QJsonObject toJsonObject() const;
     
+    // Paths of the shared module files, relative to the manifest
+    QStringList sharedModules() const;
+    
     // Access some of the set values
     QString appId() const { return m_appId; }
     QString appName() const { return m_appName; }
     QString appVersion() const { return m_appVersion; }
     
 private:
+    QStringList finishArgs() const;
+    QJsonArray modules() const;
+    
     // Basic metadata
     QString m_appId;
     QString m_appName;
@@ -80,6 +127,7 @@ private:
     QString m_command;
     QStringList m_commandArgs;
     QMap<QString, QString> m_environment;
+    QStringList m_finishArgs;
     
     // Filesystem access
     QStringList m_filesystemAccess;
@@ -91,6 +139,7 @@ private:
     // Modules and extensions
     QJsonArray m_modules;
     QStringList m_extensions;
+    QString m_payloadFingerprint;
 };
 
 #endif // FLATPAKMANIFEST_H
\ No newline at end of file
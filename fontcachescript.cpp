@@ -0,0 +1,60 @@
+#include "fontcachescript.h"
+
+QStringList FontCacheScript::lines()
+{
+    // flatpak-builder adds the shebang when writing script sources
+    return QStringList{
+        "# Generated by Flatpak Portable Builder",
+        "",
+        "APP_CONF=/app/etc/fonts/winepak-app.conf",
+        "CACHE_DIR=/app/share/winepak/fontconfig",
+        "mkdir -p /app/etc/fonts \"$CACHE_DIR\"",
+        "",
+        "# Fonts bundled with the app and their directories",
+        "find /app/app -type f \\( -iname '*.ttf' -o -iname '*.ttc' -o -iname '*.otf' -o -iname '*.otc' -o -iname '*.pfb' \\) > font-files",
+        "sed 's|/[^/]*$||' font-files | sort -u > font-dirs",
+        "",
+        "# Added to the runtime's fonts, with the caches written below into /app",
+        "{",
+        "    echo '<?xml version=\"1.0\"?>'",
+        "    echo '<!DOCTYPE fontconfig SYSTEM \"urn:fontconfig:fonts.dtd\">'",
+        "    echo '<fontconfig>'",
+        "    while IFS= read -r DIR; do",
+        "        printf '    <dir>%s</dir>\\n' \"$(printf '%s' \"$DIR\" | sed -e 's/&/\\&amp;/g' -e 's/</\\&lt;/g' -e 's/>/\\&gt;/g')\"",
+        "    done < font-dirs",
+        "    echo \"    <cachedir>$CACHE_DIR</cachedir>\"",
+        "    echo '</fontconfig>'",
+        "} > \"$APP_CONF\"",
+        "",
+        "# The runtime's configuration comes first, so users' own caches still go",
+        "# to their cache directory",
+        "{",
+        "    echo '<?xml version=\"1.0\"?>'",
+        "    echo '<!DOCTYPE fontconfig SYSTEM \"urn:fontconfig:fonts.dtd\">'",
+        "    echo '<fontconfig>'",
+        "    echo '    <include ignore_missing=\"yes\">/etc/fonts/fonts.conf</include>'",
+        "    echo \"    <include ignore_missing=\\\"yes\\\">$APP_CONF</include>\"",
+        "    echo '</fontconfig>'",
+        "} > " + configPath(),
+        "",
+        "[ -s font-dirs ] || exit 0",
+        "",
+        "# Files and directories are deployed with mtime 0, the caches must be",
+        "# made for that. fontconfig may write into the font directories on the",
+        "# first run, so reset them before the second.",
+        "while IFS= read -r FILE; do touch -h -d @0 \"$FILE\"; done < font-files",
+        "FONTCONFIG_FILE=\"$APP_CONF\" fc-cache -f",
+        "while IFS= read -r DIR; do find \"$DIR\" -type d -exec touch -h -d @0 {} +; done < font-dirs",
+        "FONTCONFIG_FILE=\"$APP_CONF\" fc-cache -f",
+        "",
+        "# A layered base prefix ships its registry. Wine lists the fonts",
+        "# fontconfig knows when the prefix is updated, so an update with the",
+        "# app's fonts visible writes their registry entries and Wine's font",
+        "# cache into it. Mono and Gecko are not installed again.",
+        "BASE_PREFIX=/app/share/wine-base-prefix",
+        "[ -f \"$BASE_PREFIX/system.reg\" ] || exit 0",
+        "export WINEPREFIX=\"$BASE_PREFIX\" WINEDEBUG=-all WINEDLLOVERRIDES=mscoree,mshtml=",
+        "FONTCONFIG_FILE=" + configPath() + " /app/wine/usr/bin/wineboot -u",
+        "/app/wine/usr/bin/wineserver --wait"
+    };
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef FONTCACHESCRIPT_H
+#define FONTCACHESCRIPT_H
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Generates the build script that caches the app's bundled fonts.
+ *
+ * Without it, fontconfig and Wine scan every font on the first launch of
+ * each user. The script runs after the app module, finds the font files
+ * in the app tree and writes a fontconfig configuration that adds their
+ * directories to the runtime's fonts. fc-cache then writes the caches
+ * into /app. Directories and font files get the mtime OSTree gives them
+ * after deployment, so the caches are still valid on clients. A layered
+ * base prefix is then updated with the fonts visible, so its shipped
+ * registry has their entries and Wine's font cache.
+ */
+class FontCacheScript
+{
+public:
+    // Name of the script inside the module's build directory
+    static QString fileName() { return QStringLiteral("winepak-fonts"); }
+    
+    // fontconfig configuration used at runtime, for FONTCONFIG_FILE
+    static QString configPath() { return QStringLiteral("/app/etc/fonts/winepak.conf"); }
+    
+    // Script contents, one entry per line
+    static QStringList lines();
+};
+
+#endif // FONTCACHESCRIPT_H
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include "installerdetector.h"
+#include "buildmetrics.h"
+#include "peimage.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QByteArrayMatcher>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QVector>
+
+namespace {
+
+// Installers are large, but not endless
+const int UnpackTimeoutMs = 30 * 60 * 1000;
+
+// Search windows, large enough for every known layout
+const qint64 HeaderWindow = 4096;
+const qint64 ResourceWindow = 4 * 1024 * 1024;
+const qint64 OverlayWindow = 64 * 1024;
+
+enum Region { Header = 1, Resources = 2, Overlay = 4 };
+
+struct Signature
+{
+    InstallerDetector::Type type;
+    int regions;
+    QByteArrayMatcher matcher;
+};
+
+const char OleMagic[] = "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1";
+
+// In order of precedence: NSIS and Inno Setup payloads may embed 7z
+// archives or MSI databases of their own
+const QVector<Signature> &signatures()
+{
+    static const QVector<Signature> list = {
+        // Loader offset table, in an RCDATA resource since 5.1.5 and in the
+        // header before that
+        { InstallerDetector::InnoSetup, Header | Resources, QByteArrayMatcher(QByteArrayLiteral("rDlPtS")) },
+        { InstallerDetector::InnoSetup, Overlay, QByteArrayMatcher(QByteArrayLiteral("Inno Setup Setup Data (")) },
+        // First header of the appended data: flags, 0xDEADBEEF, "NullsoftInst"
+        { InstallerDetector::Nsis, Overlay, QByteArrayMatcher(QByteArray("\xef\xbe\xad\xdeNullsoftInst", 16)) },
+        { InstallerDetector::SevenZip, Overlay, QByteArrayMatcher(QByteArray("7z\xbc\xaf\x27\x1c", 6)) },
+        { InstallerDetector::Msi, Overlay | Resources, QByteArrayMatcher(QByteArray(OleMagic, 8)) },
+    };
+    
+    return list;
+}
+
+QString typeId(InstallerDetector::Type type)
+{
+    switch (type) {
+    case InstallerDetector::Nsis:
+        return QStringLiteral("nsis");
+    case InstallerDetector::InnoSetup:
+        return QStringLiteral("inno");
+    case InstallerDetector::Msi:
+        return QStringLiteral("msi");
+    case InstallerDetector::SevenZip:
+        return QStringLiteral("7z");
+    case InstallerDetector::None:
+        break;
+    }
+    
+    return QString();
+}
+
+// Copy everything from offset on, an MSI database ignores what follows it
+bool copyTail(const QString &filePath, qint64 offset, QFile *destination)
+{
+    QFile source(filePath);
+    if (!source.open(QIODevice::ReadOnly) || !source.seek(offset))
+        return false;
+    
+    while (!source.atEnd()) {
+        const QByteArray chunk = source.read(1024 * 1024);
+        if (chunk.isEmpty() || destination->write(chunk) != chunk.size())
+            return false;
+    }
+    
+    return destination->flush();
+}
+
+} // namespace
+
+InstallerDetector::Result InstallerDetector::detect(const QString &filePath)
+{
+    TraceSpan span("import", QStringLiteral("installer scan"), filePath);
+    
+    Result result;
+    
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return result;
+    
+    // MSI databases are OLE compound files
+    if (file.read(8) == QByteArray(OleMagic, 8)) {
+        result.type = Msi;
+        return result;
+    }
+    
+    PeImage image;
+    if (!image.load(filePath))
+        return result;
+    
+    struct Window
+    {
+        int region;
+        qint64 offset;
+        qint64 size;
+    };
+    
+    const Window windows[] = {
+        { Header, 0, qMin(HeaderWindow, image.fileSize()) },
+        { Resources, image.resourceOffset(), qMin<qint64>(ResourceWindow, image.resourceSize()) },
+        { Overlay, image.overlayOffset(), qMin(OverlayWindow, image.fileSize() - image.overlayOffset()) },
+    };
+    
+    // Scan only the windows, not the whole (often huge) payload. Parsing
+    // the headers above maps the whole file too, but only the pages it
+    // touches are read, and the mapping is gone once load() returns.
+    const uchar *data[3] = {};
+    for (int i = 0; i < 3; ++i) {
+        if (windows[i].size > 0) {
+            data[i] = file.map(windows[i].offset, windows[i].size);
+        }
+    }
+    
+    for (const Signature &signature : signatures()) {
+        for (int i = 0; i < 3; ++i) {
+            if (!data[i] || !(signature.regions & windows[i].region))
+                continue;
+            
+            const int index = signature.matcher.indexIn(reinterpret_cast<const char *>(data[i]), int(windows[i].size));
+            if (index >= 0) {
+                result.type = signature.type;
+                result.offset = windows[i].offset + index;
+                return result;
+            }
+        }
+    }
+    
+    return result;
+}
+
+QString InstallerDetector::typeName(Type type)
+{
+    switch (type) {
+    case Nsis:
+        return QStringLiteral("NSIS");
+    case InnoSetup:
+        return QStringLiteral("Inno Setup");
+    case Msi:
+        return QStringLiteral("MSI");
+    case SevenZip:
+        return QStringLiteral("7-Zip SFX");
+    case None:
+        break;
+    }
+    
+    return QString();
+}
+
+QString InstallerDetector::unpackTool(Type type)
+{
+    switch (type) {
+    case Nsis:
+    case SevenZip:
+        return QStringLiteral("7z");
+    case InnoSetup:
+        return QStringLiteral("innoextract");
+    case Msi:
+        return QStringLiteral("msiextract");
+    case None:
+        break;
+    }
+    
+    return QString();
+}
+
+bool InstallerDetector::unpack(const QString &filePath, const Result &installer, const QString &destDir,
+                               QString *errorMessage)
+{
+    TraceSpan span("import", QStringLiteral("unpack installer"), filePath);
+    
+    const QString program = unpackTool(installer.type);
+    if (program.isEmpty() || QStandardPaths::findExecutable(program).isEmpty()) {
+        if (errorMessage)
+            *errorMessage = i18n("%1 is needed to unpack %2 installers", program, typeName(installer.type));
+        return false;
+    }
+    
+    const QString partialDir = destDir + ".partial";
+    QDir(partialDir).removeRecursively();
+    QDir().mkpath(partialDir);
+    
+    QTemporaryFile embeddedMsi(QDir::tempPath() + "/fpb-XXXXXX.msi");
+    
+    QStringList arguments;
+    switch (installer.type) {
+    case Nsis:
+    case SevenZip:
+        // 7z reads NSIS scripts and self-extracting archives directly
+        arguments << "x" << "-y" << "-bd" << "-o" + partialDir << filePath;
+        break;
+    case InnoSetup:
+        // Only {app}, not the files setup puts into system directories
+        arguments << "--extract" << "--silent" << "--include" << "app" << "--output-dir" << partialDir << filePath;
+        break;
+    case Msi: {
+        QString msiPath = filePath;
+        if (installer.offset > 0) {
+            if (!embeddedMsi.open() || !copyTail(filePath, installer.offset, &embeddedMsi)) {
+                if (errorMessage)
+                    *errorMessage = i18n("Cannot extract the MSI database: %1", embeddedMsi.errorString());
+                QDir(partialDir).removeRecursively();
+                return false;
+            }
+            msiPath = embeddedMsi.fileName();
+        }
+        arguments << "-C" << partialDir << msiPath;
+        break;
+    }
+    case None:
+        break;
+    }
+    
+    QProcess process;
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    process.start(program, arguments);
+    if (!process.waitForFinished(UnpackTimeoutMs) || process.exitStatus() != QProcess::NormalExit
+        || process.exitCode() != 0) {
+        if (errorMessage)
+            *errorMessage = i18n("%1 failed: %2", program, QString::fromLocal8Bit(process.readAll()).trimmed().right(500));
+        process.kill();
+        process.waitForFinished();
+        QDir(partialDir).removeRecursively();
+        return false;
+    }
+    
+    // Plugins and temporary files of the NSIS setup, not of the app
+    QDir(partialDir + "/$PLUGINSDIR").removeRecursively();
+    QDir(partialDir + "/$TEMP").removeRecursively();
+    
+    QDir(destDir).removeRecursively();
+    if (!QDir().rename(partialDir, destDir)) {
+        if (errorMessage)
+            *errorMessage = i18n("Cannot move the unpacked files to %1", destDir);
+        QDir(partialDir).removeRecursively();
+        return false;
+    }
+    
+    BuildMetrics::instance().increment("fpb_installers_unpacked_total", BuildMetrics::label("type", typeId(installer.type)));
+    return true;
+}
+
+QString InstallerDetector::unpackDirectory(const QString &filePath)
+{
+    const QFileInfo info(filePath);
+    
+    // A new download of the installer gets a directory of its own
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(info.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/unpacked/" + info.completeBaseName() + "-"
+           + QString::fromLatin1(hash.result().toHex().left(12));
+}
+
+QString InstallerDetector::contentRoot(const QString &dirPath)
+{
+    QString root = dirPath;
+    for (;;) {
+        const QFileInfoList entries = QDir(root).entryInfoList(QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot);
+        if (entries.size() != 1 || !entries.first().isDir() || entries.first().isSymLink())
+            return root;
+        
+        root = entries.first().filePath();
+    }
+}
\ No newline at end of file
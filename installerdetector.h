@@ -0,0 +1,56 @@
+#ifndef INSTALLERDETECTOR_H
+#define INSTALLERDETECTOR_H
+
+#include <QString>
+
+/**
+ * Recognizes setup programs posing as portable apps and unpacks them.
+ *
+ * Many downloads are NSIS, Inno Setup, MSI or 7-Zip self-extracting
+ * installers. Packaging one of those as is gives a Flatpak that runs a
+ * setup wizard. The detector looks for the installers' signatures in the
+ * places their payload lives: the PE header area, the resource section and
+ * the data appended after the last section (overlay). Only these bounded
+ * windows of the memory mapped file are searched, so checking a file costs
+ * about as much as parsing its headers. Unpacking uses 7z, innoextract or
+ * msiextract, Wine is never run.
+ */
+class InstallerDetector
+{
+public:
+    enum Type { None, Nsis, InnoSetup, Msi, SevenZip };
+    
+    struct Result
+    {
+        Type type = None;
+        
+        // File offset of the signature, the start of an embedded MSI
+        qint64 offset = 0;
+        
+        bool isInstaller() const { return type != None; }
+    };
+    
+    // Check a .exe or .msi file, type None if it is no known installer
+    static Result detect(const QString &filePath);
+    
+    // "Inno Setup", for messages
+    static QString typeName(Type type);
+    
+    // Program that unpacks the type, e.g. "innoextract"
+    static QString unpackTool(Type type);
+    
+    // Extract the files the installer would install into destDir. The
+    // tree is moved into place once complete, so an interrupted run never
+    // leaves a partial destDir behind.
+    static bool unpack(const QString &filePath, const Result &installer, const QString &destDir,
+                       QString *errorMessage = nullptr);
+    
+    // Where imports unpack the installer, one directory per file version
+    static QString unpackDirectory(const QString &filePath);
+    
+    // Innermost directory of an unpacked tree that holds more than a
+    // single subdirectory, e.g. "Program Files/Vendor/App" of an MSI
+    static QString contentRoot(const QString &dirPath);
+};
+
+#endif // INSTALLERDETECTOR_H
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include "launcherscript.h"
+
+#include <QFileInfo>
+
+namespace {
+
+// Quote a value for use inside a POSIX shell script
+QString shellQuote(const QString &value)
+{
+    QString quoted = value;
+    quoted.replace(QLatin1Char('\''), QLatin1String("'\\''"));
+    return QLatin1Char('\'') + quoted + QLatin1Char('\'');
+}
+
+// Loaded by practically every app, whatever its imports
+const QStringList CommonDlls = {
+    "ntdll.dll", "kernelbase.dll", "kernel32.dll", "user32.dll", "win32u.dll", "gdi32.dll", "advapi32.dll",
+    "rpcrt4.dll", "combase.dll", "ole32.dll", "shell32.dll", "comctl32.dll", "uxtheme.dll", "winex11.drv",
+};
+
+} // namespace
+
+void LauncherScript::setExecutable(const QString &relativePath)
+{
+    m_executable = relativePath;
+}
+
+void LauncherScript::setDxvkStateCache(bool enabled, const QString &shippedCacheFile, const QString &shippedCacheHash)
+{
+    m_dxvkStateCache = enabled;
+    m_shippedCacheFile = shippedCacheFile;
+    m_shippedCacheHash = shippedCacheHash;
+}
+
+void LauncherScript::setLayeredPrefix(bool enabled, const QString &baseId)
+{
+    m_layeredPrefix = enabled;
+    m_basePrefixId = baseId;
+}
+
+void LauncherScript::setPersistentServer(int idleTimeout)
+{
+    m_serverTimeout = qMax(0, idleTimeout);
+}
+
+void LauncherScript::setPreloadDlls(const QStringList &dlls)
+{
+    m_preloadDlls = dlls;
+}
+
+QStringList LauncherScript::lines() const
+{
+    QStringList script;
+    
+    // flatpak-builder adds the shebang when writing script sources
+    script << "# Generated by Flatpak Portable Builder"
+           << ""
+           << "export PATH=\"/app/wine/usr/bin:$PATH\"";
+    
+    if (m_serverTimeout > 0) {
+        // Flatpak shares $XDG_RUNTIME_DIR/app/$FLATPAK_ID between the
+        // instances of an app, but each runs in its own PID namespace,
+        // where Wine cannot reach the processes of the others
+        script << ""
+               << "# One session per app owns the wineserver, later launches are handed to it"
+               << "SESSION_DIR=\"$XDG_RUNTIME_DIR/app/$FLATPAK_ID\""
+               << "LAUNCH_FIFO=\"$SESSION_DIR/winepak-launch\""
+               << "SESSION_OWNER="
+               << "if command -v flock >/dev/null 2>&1; then"
+               << "    mkdir -p \"$SESSION_DIR\""
+               << "    exec 9>\"$SESSION_DIR/winepak-session.lock\""
+               << "    if flock -n 9; then"
+               << "        SESSION_OWNER=1"
+               << "    else"
+               << "        exec 9>&-"
+               << "        # One request per line, the arguments quoted for eval"
+               << "        REQUEST="
+               << "        for ARG in \"$@\"; do"
+               << "            REQUEST=\"$REQUEST '$(printf '%s' \"$ARG\" | sed \"s/'/'\\\\\\\\''/g\")'\""
+               << "        done"
+               << "        if timeout 10 sh -c 'while [ ! -p \"$1\" ]; do sleep 0.1; done; printf \"%s\\n\" \"$2\" > \"$1\"' sh \"$LAUNCH_FIFO\" \"$REQUEST\"; then"
+               << "            exit 0"
+               << "        fi"
+               << "        # The session is ending, start on our own"
+               << "    fi"
+               << "fi";
+    }
+    
+    if (m_dxvkStateCache) {
+        // The app directory is read-only, so DXVK would otherwise rebuild
+        // its pipelines on every launch. XDG_CACHE_HOME is per-app and
+        // survives updates.
+        script << ""
+               << "export DXVK_STATE_CACHE_PATH=\"$XDG_CACHE_HOME/dxvk\""
+               << "mkdir -p \"$DXVK_STATE_CACHE_PATH\""
+               << ""
+               << "# DXVK 2.x leaves pipeline caching to the driver"
+               << "export MESA_SHADER_CACHE_DIR=\"$XDG_CACHE_HOME/mesa_shader_cache\""
+               << "export __GL_SHADER_DISK_CACHE_PATH=\"$XDG_CACHE_HOME/nvidia\""
+               << "export __GL_SHADER_DISK_CACHE_SKIP_CLEANUP=1";
+        
+        if (!m_shippedCacheFile.isEmpty()) {
+            const QString shipped = "/app/share/dxvk-cache/" + m_shippedCacheFile;
+            const QString user = "$DXVK_STATE_CACHE_PATH/" + m_shippedCacheFile;
+            const QString stamp = "$DXVK_STATE_CACHE_PATH/.seeded-" + m_shippedCacheHash;
+            
+            script << ""
+                   << "# Merge the pre-recorded cache once per shipped version. Only a"
+                   << "# successful copy or merge counts, so without dxvk-cache-tool the"
+                   << "# merge is tried again on the next launch."
+                   << "if [ ! -e \"" + stamp + "\" ]; then"
+                   << "    if [ ! -s \"" + user + "\" ]; then"
+                   << "        cp " + shellQuote(shipped) + " \"" + user + "\" && touch \"" + stamp + "\""
+                   << "    elif command -v dxvk-cache-tool >/dev/null 2>&1; then"
+                   << "        (cd \"$DXVK_STATE_CACHE_PATH\" && dxvk-cache-tool -o merged.dxvk-cache "
+                      + shellQuote(shipped) + " \"" + user + "\" && mv merged.dxvk-cache \"" + user + "\")"
+                      + " && touch \"" + stamp + "\""
+                   << "    fi"
+                   << "fi";
+        }
+    }
+    
+    if (m_layeredPrefix) {
+        script << ""
+               << "# Layered prefix: read-only base in /app, per-user changes on top"
+               << "BASE_PREFIX=/app/share/wine-base-prefix"
+               << "BASE_ID=" + shellQuote(m_basePrefixId)
+               << "PREFIX_READY="
+               << ""
+               << "# Prefer a real overlay where FUSE is usable in the sandbox"
+               << "if command -v fuse-overlayfs >/dev/null 2>&1 && [ -c /dev/fuse ]; then"
+               << "    OVERLAY=\"$XDG_RUNTIME_DIR/winepak-prefix\""
+               << "    mkdir -p \"$XDG_DATA_HOME/wine-upper\" \"$XDG_DATA_HOME/wine-work\" \"$OVERLAY\""
+               << "    if mountpoint -q \"$OVERLAY\" || fuse-overlayfs -o \"lowerdir=$BASE_PREFIX,upperdir=$XDG_DATA_HOME/wine-upper,workdir=$XDG_DATA_HOME/wine-work\" \"$OVERLAY\" 2>/dev/null; then"
+               << "        export WINEPREFIX=\"$OVERLAY\""
+               << "        PREFIX_READY=1"
+               << "    fi"
+               << "fi"
+               << ""
+               << "# Otherwise build a symlink farm, once per shipped base prefix"
+               << "if [ -z \"$PREFIX_READY\" ] && [ \"$(cat \"$WINEPREFIX/.winepak-base\" 2>/dev/null)\" != \"$BASE_ID\" ]; then"
+               << "    mkdir -p \"$WINEPREFIX\""
+               << "    (cd \"$BASE_PREFIX\" && find . -type d) | while IFS= read -r d; do"
+               << "        mkdir -p \"$WINEPREFIX/$d\""
+               << "    done"
+               << "    (cd \"$BASE_PREFIX\" && find . ! -type d) | while IFS= read -r f; do"
+               << "        [ -e \"$WINEPREFIX/$f\" ] || [ -L \"$WINEPREFIX/$f\" ] && continue"
+               << "        case \"$f\" in"
+               << "            # Registry, prefix state and user profiles are written to"
+               << "            ./*.reg|./.update-timestamp|./drive_c/users/*) cp -P \"$BASE_PREFIX/$f\" \"$WINEPREFIX/$f\" ;;"
+               << "            *) if [ -L \"$BASE_PREFIX/$f\" ]; then cp -P \"$BASE_PREFIX/$f\" \"$WINEPREFIX/$f\"; else ln -s \"$BASE_PREFIX/$f\" \"$WINEPREFIX/$f\"; fi ;;"
+               << "        esac"
+               << "    done"
+               << "    echo \"$BASE_ID\" > \"$WINEPREFIX/.winepak-base\""
+               << "fi";
+    }
+    
+    const QString executable = shellQuote("/app/app/" + m_executable);
+    
+    if (m_serverTimeout > 0) {
+        // Read the DLLs while Wine starts, at low priority
+        QStringList dlls = CommonDlls + m_preloadDlls;
+        QStringList patterns;
+        for (QString &dll : dlls) {
+            dll = dll.toLower();
+            const QString baseName = QFileInfo(dll).completeBaseName();
+            patterns << "-iname " + shellQuote(dll) << "-iname " + shellQuote(baseName + ".so");
+        }
+        patterns.removeDuplicates();
+        
+        script << ""
+               << "if [ -n \"$SESSION_OWNER\" ]; then"
+               << "    # Keep the server, its registry and services up between launches"
+               << "    if [ -d \"$WINEPREFIX\" ]; then"
+               << "        wineserver -p" + QString::number(m_serverTimeout)
+               << "    fi"
+               << "    nice -n 19 find /app/wine/usr \\( " + patterns.join(" -o ") + " \\) -exec cat {} + >/dev/null 2>&1 &"
+               << ""
+               << "    rm -f \"$LAUNCH_FIFO\""
+               << "    mkfifo \"$LAUNCH_FIFO\""
+               << "    ("
+               << "        while :; do"
+               << "            while IFS= read -r REQUEST; do"
+               << "                eval \"set -- $REQUEST\""
+               << "                wine " + executable + " \"$@\" &"
+               << "            done < \"$LAUNCH_FIFO\""
+               << "        done"
+               << "    ) &"
+               << "    DISPATCHER=$!"
+               << ""
+               << "    wine " + executable + " \"$@\""
+               << "    STATUS=$?"
+               << ""
+               << "    # Handed over launches and the idle server live in this sandbox"
+               << "    wineserver -w"
+               << "    kill \"$DISPATCHER\" 2>/dev/null"
+               << "    rm -f \"$LAUNCH_FIFO\""
+               << "    exit $STATUS"
+               << "fi";
+    }
+    
+    script << ""
+           << "exec wine " + executable + " \"$@\"";
+    
+    return script;
+}
\ No newline at end of file
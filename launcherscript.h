@@ -0,0 +1,57 @@
+#ifndef LAUNCHERSCRIPT_H
+#define LAUNCHERSCRIPT_H
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Generates the shell script used as the Flatpak's command.
+ *
+ * The launcher prepares the per-user runtime state inside the sandbox
+ * (caches, prefix) and then executes the Windows app with Wine.
+ */
+class LauncherScript
+{
+public:
+    // Installed name of the launcher inside the Flatpak
+    static QString fileName() { return QStringLiteral("winepak-launcher"); }
+    
+    // Path of the app's main executable relative to the app root
+    void setExecutable(const QString &relativePath);
+    
+    // Keep DXVK's pipeline state cache in the app's persistent cache
+    // directory. If a pre-recorded cache is shipped, it is merged into
+    // the user's copy the first time each shipped version is seen.
+    void setDxvkStateCache(bool enabled, const QString &shippedCacheFile = QString(),
+                           const QString &shippedCacheHash = QString());
+    
+    // Assemble the Wine prefix from the read-only base prefix shipped
+    // in /app and a thin per-user layer holding only the app's changes.
+    // baseId changes whenever a different base prefix is shipped.
+    void setLayeredPrefix(bool enabled, const QString &baseId = QString());
+    
+    // Keep the wineserver running for idleTimeout seconds after the last
+    // Wine process exits, 0 to stop it with the app. The first launch
+    // owns the session, later launches are handed to it and start their
+    // app in the running server.
+    void setPersistentServer(int idleTimeout);
+    
+    // DLLs to read into the page cache when a session starts, e.g. the
+    // imports found by the PE analysis. Common system DLLs are added.
+    void setPreloadDlls(const QStringList &dlls);
+    
+    // Script contents, one entry per line
+    QStringList lines() const;
+    
+private:
+    QString m_executable;
+    bool m_dxvkStateCache = false;
+    QString m_shippedCacheFile;
+    QString m_shippedCacheHash;
+    bool m_layeredPrefix = false;
+    QString m_basePrefixId;
+    int m_serverTimeout = 0;
+    QStringList m_preloadDlls;
+};
+
+#endif // LAUNCHERSCRIPT_H
\ No newline at end of file
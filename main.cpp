@@ -1,13 +1,54 @@
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QScopeGuard>
+#include <QSettings>
+#include <QTimer>
 #include <KAboutData>
 #include <KLocalizedString>
 #include <KCrash>
 
 #include "mainwindow.h"
+#include "tracer.h"
+#include "buildmetrics.h"
+#include "builderclient.h"
+#include "builderservice.h"
+#include "farmclient.h"
+#include "farmcoordinator.h"
+#include "farmworker.h"
+#include "manifestvalidator.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Build farm and builder service modes run without a window, e.g. on a
+// headless server
+static bool isHeadlessMode(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        for (const char *option : { "--coordinator", "--worker", "--submit", "--validate", "--service", "--enqueue", "--cancel" }) {
+            if (std::strncmp(argv[i], option, std::strlen(option)) == 0)
+                return true;
+        }
+    }
+    
+    return false;
+}
+
+static void printMessage(const QString &message)
+{
+    std::fprintf(stdout, "%s\n", qPrintable(message));
+    std::fflush(stdout);
+}
 
 int main(int argc, char *argv[])
 {
+    // Start of the startup trace, before the application is set up
+    const qint64 startTime = Tracer::now();
+    
+    if (isHeadlessMode(argc, argv) && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    
     QApplication app(argc, argv);
     KCrash::initialize();
     
@@ -45,11 +86,224 @@ int main(int argc, char *argv[])
     
     QCommandLineParser parser;
     aboutData.setupCommandLine(&parser);
+    
+    QCommandLineOption traceOption(QStringLiteral("trace"),
+        i18n("Write a Chrome/Perfetto trace of the packaging pipeline to <file>."),
+        i18n("file"));
+    parser.addOption(traceOption);
+    
+    QCommandLineOption metricsOption(QStringLiteral("metrics-file"),
+        i18n("Write Prometheus metrics for the node-exporter textfile collector to <file>."),
+        i18n("file"));
+    parser.addOption(metricsOption);
+    
+    // Build farm
+    QCommandLineOption coordinatorOption(QStringLiteral("coordinator"),
+        i18n("Run a build farm coordinator listening on <address> (host:port or unix:/path). Without a host only local connections are accepted."),
+        i18n("address"));
+    QCommandLineOption workerOption(QStringLiteral("worker"),
+        i18n("Run a build farm worker for the coordinator at <address>."),
+        i18n("address"));
+    QCommandLineOption submitOption(QStringLiteral("submit"),
+        i18n("Submit the given apps to the coordinator at <address> and wait for the builds."),
+        i18n("address"));
+    QCommandLineOption slotsOption(QStringLiteral("slots"),
+        i18n("Number of concurrent builds of a worker."),
+        i18n("count"), QStringLiteral("1"));
+    QCommandLineOption farmDirOption(QStringLiteral("farm-dir"),
+        i18n("Data directory of the coordinator or worker."),
+        i18n("directory"));
+    QCommandLineOption workerNameOption(QStringLiteral("worker-name"),
+        i18n("Name the worker reports to the coordinator."),
+        i18n("name"));
+    QCommandLineOption branchOption(QStringLiteral("branch"),
+        i18n("Branch to build submitted apps for."),
+        i18n("branch"), QStringLiteral("master"));
+    QCommandLineOption farmTokenOption(QStringLiteral("farm-token"),
+        i18n("Token workers and clients present to the coordinator, instead of the farm/token setting."),
+        i18n("token"));
+    parser.addOptions({ coordinatorOption, workerOption, submitOption, slotsOption, farmDirOption, workerNameOption, branchOption,
+                        farmTokenOption });
+    
+    // Builder service
+    QCommandLineOption serviceOption(QStringLiteral("service"),
+        i18n("Run the builder service, which owns the build queue, on D-Bus."));
+    QCommandLineOption enqueueOption(QStringLiteral("enqueue"),
+        i18n("Queue the given apps in the builder service and wait for the builds."));
+    QCommandLineOption cancelOption(QStringLiteral("cancel"),
+        i18n("Cancel the job <id> of the builder service."),
+        i18n("id"));
+    QCommandLineOption busOption(QStringLiteral("bus"),
+        i18n("D-Bus address of the builder service, instead of the session bus."),
+        i18n("address"));
+    parser.addOptions({ serviceOption, enqueueOption, cancelOption, busOption });
+    
+    QCommandLineOption validateOption(QStringLiteral("validate"),
+        i18n("Check the given manifest files in parallel and report their errors."));
+    parser.addOption(validateOption);
+    
+    parser.addPositionalArgument(QStringLiteral("apps"), i18n("Apps to submit or queue, by catalog id or name, or manifests to validate."),
+                                 QStringLiteral("[apps...]"));
+    
     parser.process(app);
     aboutData.processCommandLine(&parser);
     
-    MainWindow *window = new MainWindow();
-    window->show();
+    // Tracing, also enabled by FPB_TRACE=<file>
+    QString traceFile = parser.value(traceOption);
+    if (traceFile.isEmpty()) {
+        traceFile = qEnvironmentVariable("FPB_TRACE");
+    }
+    
+    // Finish the trace file on every way out of main(), so it stays valid
+    // JSON when a mode fails early
+    const auto stopTracer = qScopeGuard(&Tracer::stop);
+    QTimer traceFlushTimer;
+    if (!traceFile.isEmpty()) {
+        if (Tracer::start(traceFile)) {
+            // Keep the file current, so long builds can be inspected while running
+            QObject::connect(&traceFlushTimer, &QTimer::timeout, &Tracer::flush);
+            traceFlushTimer.start(1000);
+        } else {
+            qWarning("Cannot write trace file %s", qPrintable(traceFile));
+        }
+    }
+    
+    // Metrics, the path can also be set in the config file. The window
+    // and the other modes run side by side, so each mode writes a file of
+    // its own unless one is given on the command line.
+    QString metricsFile = parser.value(metricsOption);
+    if (metricsFile.isEmpty()) {
+        const QString mode = parser.isSet(coordinatorOption) ? QStringLiteral("coordinator")
+                           : parser.isSet(workerOption) ? QStringLiteral("worker")
+                           : parser.isSet(serviceOption) ? QStringLiteral("service")
+                           : parser.isSet(submitOption) || parser.isSet(enqueueOption) || parser.isSet(cancelOption)
+                                 ? QStringLiteral("client")
+                           : parser.isSet(validateOption) ? QStringLiteral("validate")
+                           : QString();
+        metricsFile = BuildMetrics::textFilePathForMode(
+            QSettings().value("metrics/textfilePath", BuildMetrics::defaultTextFilePath()).toString(), mode);
+    }
+    BuildMetrics::instance().setTextFilePath(metricsFile);
+    
+    int result;
+    
+    if (parser.isSet(coordinatorOption)) {
+        FarmCoordinator coordinator;
+        QObject::connect(&coordinator, &FarmCoordinator::logMessage, &printMessage);
+        if (parser.isSet(farmDirOption)) {
+            coordinator.setDataDir(parser.value(farmDirOption));
+        }
+        if (parser.isSet(farmTokenOption)) {
+            coordinator.setToken(parser.value(farmTokenOption));
+        }
+        
+        QString error;
+        if (!coordinator.listen(parser.value(coordinatorOption), &error)) {
+            printMessage(i18n("Cannot listen on %1: %2", parser.value(coordinatorOption), error));
+            return 1;
+        }
+        
+        result = app.exec();
+    } else if (parser.isSet(workerOption)) {
+        FarmWorker worker;
+        QObject::connect(&worker, &FarmWorker::logMessage, &printMessage);
+        worker.setSlots(parser.value(slotsOption).toInt());
+        if (parser.isSet(farmDirOption)) {
+            worker.setDataDir(parser.value(farmDirOption));
+        }
+        if (parser.isSet(workerNameOption)) {
+            worker.setName(parser.value(workerNameOption));
+        }
+        if (parser.isSet(farmTokenOption)) {
+            worker.setToken(parser.value(farmTokenOption));
+        }
+        worker.connectTo(parser.value(workerOption));
+        
+        result = app.exec();
+    } else if (parser.isSet(submitOption)) {
+        if (parser.positionalArguments().isEmpty()) {
+            printMessage(i18n("No apps given to submit"));
+            return 1;
+        }
+        
+        FarmClient client;
+        if (parser.isSet(farmTokenOption)) {
+            client.setToken(parser.value(farmTokenOption));
+        }
+        QObject::connect(&client, &FarmClient::logMessage, &printMessage);
+        QObject::connect(&client, &FarmClient::finished, &app, [](int failed) {
+            QCoreApplication::exit(failed > 0 ? 1 : 0);
+        });
+        client.submit(parser.value(submitOption), parser.positionalArguments(), parser.value(branchOption));
+        
+        result = app.exec();
+    } else if (parser.isSet(serviceOption)) {
+        BuilderService service;
+        QObject::connect(&service, &BuilderService::logMessage, &printMessage);
+        
+        QString error;
+        if (!service.registerOn(BuilderService::connectBus(parser.value(busOption)), &error)) {
+            printMessage(i18n("Cannot start the builder service: %1", error));
+            return 1;
+        }
+        
+        result = app.exec();
+    } else if (parser.isSet(enqueueOption) || parser.isSet(cancelOption)) {
+        BuilderClient client(BuilderService::connectBus(parser.value(busOption)));
+        
+        if (parser.isSet(cancelOption)) {
+            QString error;
+            if (!client.cancel(parser.value(cancelOption), &error)) {
+                printMessage(i18n("Cannot cancel job %1: %2", parser.value(cancelOption), error));
+                return 1;
+            }
+            return 0;
+        }
+        
+        if (parser.positionalArguments().isEmpty()) {
+            printMessage(i18n("No apps given to queue"));
+            return 1;
+        }
+        
+        QObject::connect(&client, &BuilderClient::logMessage, &printMessage);
+        QObject::connect(&client, &BuilderClient::finished, &app, [](int failed) {
+            QCoreApplication::exit(failed > 0 ? 1 : 0);
+        });
+        client.submit(parser.positionalArguments(), parser.value(branchOption));
+        
+        result = app.exec();
+    } else if (parser.isSet(validateOption)) {
+        const QStringList manifests = parser.positionalArguments();
+        if (manifests.isEmpty()) {
+            printMessage(i18n("No manifests given to validate"));
+            return 1;
+        }
+        
+        int invalid = 0;
+        for (const ManifestValidator::Report &report : ManifestValidator::validateFiles(manifests)) {
+            for (const ManifestValidator::Issue &issue : report.issues) {
+                printMessage(QStringLiteral("%1: %2: %3").arg(report.manifestPath,
+                                                              issue.error ? i18n("error") : i18n("warning"),
+                                                              issue.toString()));
+            }
+            if (report.hasErrors()) {
+                invalid++;
+            }
+        }
+        
+        printMessage(i18np("Checked 1 manifest, %2 invalid", "Checked %1 manifests, %2 invalid", manifests.size(), invalid));
+        result = invalid > 0 ? 1 : 0;
+    } else {
+        MainWindow *window = nullptr;
+        {
+            TraceSpan span("startup", QStringLiteral("create window"));
+            window = new MainWindow();
+            window->setStartTime(startTime);
+            window->show();
+        }
+        
+        result = app.exec();
+    }
     
-    return app.exec();
+    return result;
 }
\ No newline at end of file
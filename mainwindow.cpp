@@ -11,7 +11,10 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QLineEdit>
+#include <QCheckBox>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QApplication>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFormLayout>
@@ -23,9 +26,31 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QLocale>
+#include <QRegularExpression>
+#include <QSet>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+
+#include "peimage.h"
+#include "winecomponents.h"
+#include "buildmetrics.h"
+#include "apppackager.h"
+#include "installerdetector.h"
+#include "manifestvalidator.h"
+#include "builderservice.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : KXmlGuiWindow(parent)
+    , m_exporter(new FlatpakExporter(this))
+    , m_governor(new ResourceGovernor(QStringLiteral("build"), this))
+    , m_matrixBuilder(new MatrixBuilder(this))
+    , m_storage(new StorageManager(this))
+    , m_builder(new BuilderClient(QDBusConnection::sessionBus(), this))
+    , m_watcher(new AppWatcher(this))
+    , m_manifestStale(false)
+    , m_rebuildPending(false)
+    , m_watchFullRestage(false)
 {
     // Setup UI first
     setupUi();
@@ -36,32 +61,66 @@ MainWindow::MainWindow(QWidget *parent)
     // Setup connections
     setupConnections();
     
-    // Check for required tools
-    if (!checkDependencies()) {
-        KMessageBox::error(this, 
-            i18n("Missing dependencies. Please install flatpak-builder, wine, and required tools."), 
-            i18n("Dependency Error"));
-    }
+    // The catalog and the dependency checks are loaded once the window
+    // is on screen, see event()
     
-    // Load any saved applications
-    loadSavedApps();
+    // Clean up after earlier sessions once the window is up
+    m_storage->setAreas(StorageManager::builderAreas(StorageManager::defaultDataDir()));
+    QTimer::singleShot(30000, this, &MainWindow::collectStorage);
     
     // Set window properties
     setWindowTitle(i18n("Flatpak Portable Builder"));
     setMinimumSize(800, 600);
     
     // Show welcome page initially
-    m_stackedWidget->setCurrentIndex(0);
+    showPage(WelcomePage);
 }
 
 MainWindow::~MainWindow()
 {
-    // Save the applications list before exiting
-    saveAppsList();
+    // Save the applications list before exiting. Without the saved apps
+    // loaded, saving would drop them from the catalog.
+    if (m_catalogLoaded) {
+        saveAppsList();
+    }
+}
+
+void MainWindow::setStartTime(qint64 startTime)
+{
+    m_startTime = startTime;
+}
+
+bool MainWindow::event(QEvent *event)
+{
+    // Everything that is not needed for the first frame waits until the
+    // window has been painted once
+    if (event->type() == QEvent::Paint && !m_painted) {
+        m_painted = true;
+        QTimer::singleShot(0, this, &MainWindow::finishStartup);
+    }
+    
+    return KXmlGuiWindow::event(event);
+}
+
+void MainWindow::finishStartup()
+{
+    if (m_startTime >= 0) {
+        const qint64 duration = Tracer::now() - m_startTime;
+        Tracer::complete("startup", QStringLiteral("first paint"), m_startTime, duration);
+        BuildMetrics::instance().observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "startup"),
+                                         duration / 1000000.0);
+    }
+    
+    loadSavedApps();
+    
+    // The probes start processes, which takes long enough to be noticed
+    m_dependencyWatcher.setFuture(QtConcurrent::run(&MainWindow::findMissingDependency));
 }
 
 void MainWindow::setupUi()
 {
+    TraceSpan span("startup", QStringLiteral("setup ui"));
+    
     // Main layout with central widget
     QWidget *centralWidget = new QWidget(this);
     setCentralWidget(centralWidget);
@@ -75,9 +134,11 @@ void MainWindow::setupUi()
     
     QPushButton *addAppButton = new QPushButton(i18n("Import New App"));
     QPushButton *removeAppButton = new QPushButton(i18n("Remove App"));
+    QPushButton *bulkImportButton = new QPushButton(i18n("Import Library..."));
     
     QHBoxLayout *appButtonsLayout = new QHBoxLayout();
     appButtonsLayout->addWidget(addAppButton);
+    appButtonsLayout->addWidget(bulkImportButton);
     appButtonsLayout->addWidget(removeAppButton);
     
     leftLayout->addWidget(appsLabel);
@@ -97,8 +158,59 @@ void MainWindow::setupUi()
     welcomeLayout->addStretch();
     m_stackedWidget->addWidget(m_welcomePage);
     
-    // App details page
+    // The other pages are placeholders until they are first shown, see
+    // ensurePage()
     m_appDetailsPage = new QWidget();
+    m_stackedWidget->addWidget(m_appDetailsPage);
+    m_wineConfigPage = new QWidget();
+    m_stackedWidget->addWidget(m_wineConfigPage);
+    m_buildPage = new QWidget();
+    m_stackedWidget->addWidget(m_buildPage);
+    
+    // Add the layouts to the main layout
+    mainLayout->addLayout(leftLayout, 1);
+    mainLayout->addWidget(m_stackedWidget, 3);
+    
+    // Connect UI elements
+    connect(addAppButton, &QPushButton::clicked, this, &MainWindow::importPortableApp);
+    connect(removeAppButton, &QPushButton::clicked, this, &MainWindow::removeSelectedApp);
+    connect(bulkImportButton, &QPushButton::clicked, this, &MainWindow::bulkImportPortableApps);
+    connect(m_appsList, &QListWidget::currentRowChanged, this, &MainWindow::appSelected);
+}
+
+void MainWindow::showPage(Page page)
+{
+    ensurePage(page);
+    m_stackedWidget->setCurrentIndex(page);
+}
+
+void MainWindow::ensurePage(Page page)
+{
+    switch (page) {
+    case WelcomePage:
+        break;
+    case AppDetailsPage:
+        if (!m_appNameEdit) {
+            setupAppDetailsPage();
+        }
+        break;
+    case WineConfigPage:
+        if (!m_wineConfigWidget) {
+            setupWineConfigPage();
+        }
+        break;
+    case BuildPage:
+        if (!m_statusLabel) {
+            setupBuildPage();
+        }
+        break;
+    }
+}
+
+void MainWindow::setupAppDetailsPage()
+{
+    TraceSpan span("startup", QStringLiteral("app details page"));
+    
     QVBoxLayout *detailsLayout = new QVBoxLayout(m_appDetailsPage);
     
     QGroupBox *appInfoGroup = new QGroupBox(i18n("Application Information"));
@@ -135,15 +247,28 @@ void MainWindow::setupUi()
     
     formLayout->addRow(i18n("Icon:"), previewLayout);
     
+    // Per-app pruning overrides
+    m_pruneRulesEdit = new QLineEdit();
+    m_pruneRulesEdit->setPlaceholderText(i18n("e.g., keep App/locales/de.pak; exclude *.dmp >10M"));
+    formLayout->addRow(i18n("Pruning Rules:"), m_pruneRulesEdit);
+    
     m_analyzeButton = new QPushButton(i18n("Analyze App"));
     
     detailsLayout->addWidget(appInfoGroup);
     detailsLayout->addWidget(m_analyzeButton);
     detailsLayout->addStretch();
-    m_stackedWidget->addWidget(m_appDetailsPage);
     
-    // Wine config page
-    m_wineConfigPage = new QWidget();
+    connect(m_analyzeButton, &QPushButton::clicked, this, &MainWindow::analyzePortableApp);
+    
+    // Icon connections
+    connect(m_iconBrowseButton, &QPushButton::clicked, this, &MainWindow::browseForIcon);
+    connect(m_iconPathEdit, &QLineEdit::textChanged, this, &MainWindow::updateIconPreview);
+}
+
+void MainWindow::setupWineConfigPage()
+{
+    TraceSpan span("startup", QStringLiteral("wine config page"));
+    
     QVBoxLayout *wineConfigLayout = new QVBoxLayout(m_wineConfigPage);
     
     m_wineConfigWidget = new WineConfigWidget();
@@ -152,39 +277,49 @@ void MainWindow::setupUi()
     wineConfigLayout->addWidget(m_wineConfigWidget);
     wineConfigLayout->addWidget(m_configureButton);
     wineConfigLayout->addStretch();
-    m_stackedWidget->addWidget(m_wineConfigPage);
     
-    // Build page
-    m_buildPage = new QWidget();
+    connect(m_configureButton, &QPushButton::clicked, this, &MainWindow::generateFlatpakManifest);
+    connect(m_wineConfigWidget, &WineConfigWidget::settingsChanged, this, &MainWindow::wineSettingsChanged);
+}
+
+void MainWindow::setupBuildPage()
+{
+    TraceSpan span("startup", QStringLiteral("build page"));
+    
     QVBoxLayout *buildLayout = new QVBoxLayout(m_buildPage);
     
+    // Messages logged before the page existed are not lost
     QLabel *buildLabel = new QLabel(i18n("Build Flatpak"));
-    m_statusLabel = new QLabel(i18n("Ready to build..."));
+    m_statusLabel = new QLabel(m_lastStatus.isEmpty() ? i18n("Ready to build...") : m_lastStatus);
     m_progressBar = new QProgressBar();
     m_buildButton = new QPushButton(i18n("Build Flatpak"));
+    m_matrixButton = new QPushButton(i18n("Build Variant Matrix"));
+    m_pruneButton = new QPushButton(i18n("Preview Pruning..."));
+    m_bundleCheck = new QCheckBox(i18n("Also create a single-file bundle"));
+    m_watchCheck = new QCheckBox(i18n("Watch for changes and rebuild automatically"));
+    m_bundleCheck->setChecked(QSettings().value("export/createBundle", false).toBool());
+    
+    // A build may have been started from the toolbar before
+    m_buildButton->setEnabled(!isBuilding());
+    m_matrixButton->setEnabled(!isBuilding());
     
     buildLayout->addWidget(buildLabel);
     buildLayout->addWidget(m_statusLabel);
     buildLayout->addWidget(m_progressBar);
+    buildLayout->addWidget(m_bundleCheck);
+    buildLayout->addWidget(m_watchCheck);
     buildLayout->addWidget(m_buildButton);
+    buildLayout->addWidget(m_matrixButton);
+    buildLayout->addWidget(m_pruneButton);
     buildLayout->addStretch();
-    m_stackedWidget->addWidget(m_buildPage);
-    
-    // Add the layouts to the main layout
-    mainLayout->addLayout(leftLayout, 1);
-    mainLayout->addWidget(m_stackedWidget, 3);
     
-    // Connect UI elements
-    connect(addAppButton, &QPushButton::clicked, this, &MainWindow::importPortableApp);
-    connect(removeAppButton, &QPushButton::clicked, this, &MainWindow::removeSelectedApp);
-    connect(m_analyzeButton, &QPushButton::clicked, this, &MainWindow::analyzePortableApp);
-    connect(m_configureButton, &QPushButton::clicked, this, &MainWindow::generateFlatpakManifest);
     connect(m_buildButton, &QPushButton::clicked, this, &MainWindow::buildFlatpak);
-    connect(m_appsList, &QListWidget::currentRowChanged, this, &MainWindow::appSelected);
-    
-    // Icon connections
-    connect(m_iconBrowseButton, &QPushButton::clicked, this, &MainWindow::browseForIcon);
-    connect(m_iconPathEdit, &QLineEdit::textChanged, this, &MainWindow::updateIconPreview);
+    connect(m_matrixButton, &QPushButton::clicked, this, &MainWindow::buildVariantMatrix);
+    connect(m_pruneButton, &QPushButton::clicked, this, &MainWindow::previewPruning);
+    connect(m_watchCheck, &QCheckBox::toggled, this, &MainWindow::toggleWatchMode);
+    connect(m_bundleCheck, &QCheckBox::toggled, [](bool checked) {
+        QSettings().setValue("export/createBundle", checked);
+    });
 }
 
 void MainWindow::setupActions()
@@ -204,12 +339,18 @@ void MainWindow::setupActions()
     importAction->setIcon(QIcon::fromTheme(QStringLiteral("document-import")));
     connect(importAction, &QAction::triggered, this, &MainWindow::importPortableApp);
     
-    QAction *buildAction = actionCollection->addAction(QStringLiteral("build_flatpak"));
-    buildAction->setText(i18n("Build Flatpak"));
-    buildAction->setIcon(QIcon::fromTheme(QStringLiteral("run-build")));
-    connect(buildAction, &QAction::triggered, this, &MainWindow::buildFlatpak);
+    QAction *bulkImportAction = actionCollection->addAction(QStringLiteral("import_library"));
+    bulkImportAction->setText(i18n("Import PortableApps Library..."));
+    bulkImportAction->setIcon(QIcon::fromTheme(QStringLiteral("folder-download")));
+    connect(bulkImportAction, &QAction::triggered, this, &MainWindow::bulkImportPortableApps);
+    
+    m_buildAction = actionCollection->addAction(QStringLiteral("build_flatpak"));
+    m_buildAction->setText(i18n("Build Flatpak"));
+    m_buildAction->setIcon(QIcon::fromTheme(QStringLiteral("run-build")));
+    connect(m_buildAction, &QAction::triggered, this, &MainWindow::buildFlatpak);
     
     // Setup XML GUI
+    TraceSpan span("startup", QStringLiteral("setup gui"));
     setupGUI(Default, "flatpack-portable-builderui.rc");
 }
 
@@ -220,164 +361,175 @@ void MainWindow::setupConnections()
             this, &MainWindow::processFinished);
     
     connect(&m_process, &QProcess::readyReadStandardOutput, [this]() {
-        QString output = QString::fromLocal8Bit(m_process.readAllStandardOutput());
-        updateLog(output);
+        QByteArray output = m_process.readAllStandardOutput();
+        m_buildTrace.addOutput(output);
+        m_governor->setStage(&m_process, m_buildTrace.phase());
+        updateLog(QString::fromLocal8Bit(output));
     });
     
     connect(&m_process, &QProcess::readyReadStandardError, [this]() {
-        QString error = QString::fromLocal8Bit(m_process.readAllStandardError());
-        updateLog(error);
+        QByteArray error = m_process.readAllStandardError();
+        m_buildTrace.addOutput(error);
+        m_governor->setStage(&m_process, m_buildTrace.phase());
+        updateLog(QString::fromLocal8Bit(error));
+    });
+    
+    connect(m_exporter, &FlatpakExporter::logMessage, this, &MainWindow::updateLog);
+    connect(m_exporter, &FlatpakExporter::exportFinished, this, &MainWindow::exportFinished);
+    
+    // Variant matrix builds, each finished variant is exported on its own
+    connect(m_matrixBuilder, &MatrixBuilder::logMessage, this, &MainWindow::updateLog);
+    connect(m_matrixBuilder, &MatrixBuilder::variantFinished, [this](const QString &appId, bool success) {
+        if (success) {
+            exportBuild(appId);
+        }
+    });
+    connect(m_matrixBuilder, &MatrixBuilder::finished, this, &MainWindow::matrixFinished);
+    
+    connect(m_storage, &StorageManager::logMessage, this, &MainWindow::updateLog);
+    
+    // Builds handed over to the builder service
+    connect(m_builder, &BuilderClient::jobLog, [this](const QString &jobId, const QString &text) {
+        if (jobId == m_serviceJobId) {
+            updateLog(text);
+        }
+    });
+    connect(m_builder, &BuilderClient::jobProgress, [this](const QString &jobId, const QString &stage, int percent) {
+        if (jobId == m_serviceJobId) {
+            m_progressBar->setValue(percent);
+            updateLog(i18n("Builder service: %1", stage));
+        }
+    });
+    connect(m_builder, &BuilderClient::jobFinished, this, &MainWindow::serviceJobFinished);
+    
+    // Bulk import
+    connect(&m_bulkImportWatcher, &QFutureWatcher<PortableAppInfo>::resultsReadyAt, this, &MainWindow::bulkImportResultsReady);
+    connect(&m_bulkImportWatcher, &QFutureWatcher<PortableAppInfo>::finished, this, &MainWindow::bulkImportFinished);
+    connect(&m_importWatcher, &QFutureWatcher<ImportResult>::finished, this, &MainWindow::importFinished);
+    
+    // Watch mode
+    m_settingsDebounce.setSingleShot(true);
+    m_settingsDebounce.setInterval(500);
+    connect(&m_settingsDebounce, &QTimer::timeout, this, &MainWindow::scheduleIncrementalBuild);
+    connect(m_watcher, &AppWatcher::filesChanged, this, &MainWindow::watchedFilesChanged);
+    
+    connect(&m_dependencyWatcher, &QFutureWatcher<QString>::finished, [this]() {
+        const QString missing = m_dependencyWatcher.result();
+        if (!missing.isEmpty()) {
+            updateLog(i18n("%1 not found!", missing));
+            KMessageBox::error(this, 
+                i18n("Missing dependencies. Please install flatpak-builder, wine, and required tools."), 
+                i18n("Dependency Error"));
+        }
     });
 }
 
-bool MainWindow::checkDependencies()
+QString MainWindow::findMissingDependency()
 {
-    // Check for flatpak-builder
-    QProcess process;
-    process.start("flatpak-builder", QStringList() << "--version");
-    if (!process.waitForFinished() || process.exitCode() != 0) {
-        updateLog(i18n("flatpak-builder not found!"));
-        return false;
-    }
-    
-    // Check for wine
-    process.start("wine", QStringList() << "--version");
-    if (!process.waitForFinished() || process.exitCode() != 0) {
-        updateLog(i18n("wine not found!"));
-        return false;
-    }
-    
-    // Check for other dependencies...
-    // bsdtar (for extracting archives)
-    process.start("bsdtar", QStringList() << "--version");
-    if (!process.waitForFinished() || process.exitCode() != 0) {
-        updateLog(i18n("bsdtar not found!"));
-        return false;
+    // The service keeps the result of its probe
+    BuilderClient client;
+    if (client.isRunning()) {
+        bool ok;
+        const QString missing = client.missingDependency(&ok);
+        if (ok)
+            return missing;
     }
     
-    return true;
+    return BuilderService::findMissingDependency();
 }
 
 void MainWindow::loadSavedApps()
 {
-    QSettings settings;
-    int size = settings.beginReadArray("portableApps");
-    
-    for (int i = 0; i < size; ++i) {
-        settings.setArrayIndex(i);
-        PortableAppInfo info;
-        info.id = settings.value("id").toString();
-        info.name = settings.value("name").toString();
-        info.version = settings.value("version").toString();
-        info.description = settings.value("description").toString();
-        info.category = settings.value("category").toString();
-        info.sourceDir = settings.value("sourceDir").toString();
-        info.executablePath = settings.value("executablePath").toString();
-        info.wineVersion = settings.value("wineVersion").toString();
-        info.wineDllOverrides = settings.value("wineDllOverrides").toString();
+    TraceSpan span("startup", QStringLiteral("load catalog"));
+    
+    // Apps imported in the meantime stay as they are
+    const QMap<QString, PortableAppInfo> savedApps = m_catalog.load();
+    
+    QStringList names;
+    for (auto it = savedApps.constBegin(); it != savedApps.constEnd(); ++it) {
+        if (m_portableApps.contains(it.key()))
+            continue;
         
-        m_portableApps[info.id] = info;
-        m_appsList->addItem(info.name + " (" + info.version + ")");
+        const PortableAppInfo &info = it.value();
+        m_portableApps.insert(it.key(), info);
+        names << info.name + " (" + info.version + ")";
     }
     
-    settings.endArray();
+    m_appsList->addItems(names);
+    m_catalogLoaded = true;
+    
+    span.setDetail(i18np("1 app", "%1 apps", savedApps.size()));
 }
 
 void MainWindow::saveAppsList()
 {
-    QSettings settings;
-    settings.beginWriteArray("portableApps");
-    
-    int i = 0;
-    for (auto it = m_portableApps.constBegin(); it != m_portableApps.constEnd(); ++it) {
-        settings.setArrayIndex(i++);
-        const PortableAppInfo &info = it.value();
-        
-        settings.setValue("id", info.id);
-        settings.setValue("name", info.name);
-        settings.setValue("version", info.version);
-        settings.setValue("description", info.description);
-        settings.setValue("category", info.category);
-        settings.setValue("sourceDir", info.sourceDir);
-        settings.setValue("executablePath", info.executablePath);
-        settings.setValue("wineVersion", info.wineVersion);
-        settings.setValue("wineDllOverrides", info.wineDllOverrides);
-    }
-    
-    settings.endArray();
+    m_catalog.save(m_portableApps);
 }
 
 void MainWindow::importPortableApp()
 {
-    QString dirPath = QFileDialog::getExistingDirectory(this, i18n("Select Portable App Directory"));
-    if (dirPath.isEmpty())
+    if (m_importWatcher.isRunning()) {
         return;
-    
-    // Generate a unique ID for this app
-    QString appId = QUuid::createUuid().toString(QUuid::WithoutBraces);
-    
-    // Create initial app info
-    PortableAppInfo appInfo;
-    appInfo.id = appId;
-    appInfo.sourceDir = dirPath;
-    
-    // Try to detect information from directory structure
-    QDir dir(dirPath);
-    appInfo.name = dir.dirName();
-    
-    // Look for .exe files
-    QStringList exeFiles;
-    QDirIterator it(dirPath, QStringList() << "*.exe", QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        it.next();
-        exeFiles << it.filePath();
     }
     
-    // If we find any exe files, select the first as default
-    if (!exeFiles.isEmpty()) {
-        appInfo.executablePath = exeFiles.first();
-    }
-    
-    // Look for icons
-    QStringList iconFiles;
-    QDirIterator iconIt(dirPath, QStringList() << "*.png" << "*.ico" << "*.svg" << "*.jpg", 
-                      QDir::Files, QDirIterator::Subdirectories);
-    while (iconIt.hasNext()) {
-        iconIt.next();
-        iconFiles << iconIt.filePath();
-    }
-    
-    // Try to find an icon that contains common names
-    QStringList iconKeywords = {"icon", "logo", appInfo.name.toLower()};
+    QString dirPath = QFileDialog::getExistingDirectory(this, i18n("Select Portable App Directory"));
+    if (dirPath.isEmpty())
+        return;
     
-    // First try to find best matching icon
-    for (const QString &keyword : iconKeywords) {
-        for (const QString &iconFile : iconFiles) {
-            if (QFileInfo(iconFile).fileName().toLower().contains(keyword)) {
-                appInfo.iconPath = iconFile;
-                break;
-            }
+    m_importStart = Tracer::now();
+    m_importTimer.start();
+    
+    // Detect name, executable and icon from the directory structure.
+    // Installers are unpacked, which can take minutes, so it runs in the
+    // background like bulk imports.
+    updateLog(i18n("Importing %1...", dirPath));
+    QApplication::setOverrideCursor(Qt::BusyCursor);
+    m_importWatcher.setFuture(QtConcurrent::run([dirPath]() {
+        ImportResult result;
+        result.first = PortableAppDetector::detect(dirPath, &result.second);
+        return result;
+    }));
+}
+
+void MainWindow::importFinished()
+{
+    QApplication::restoreOverrideCursor();
+    
+    const ImportResult result = m_importWatcher.result();
+    PortableAppInfo appInfo = result.first;
+    
+    Tracer::complete("import", QStringLiteral("import app"), m_importStart, Tracer::now() - m_importStart,
+                     appInfo.sourceDir);
+    
+    if (!appInfo.installerPath.isEmpty()) {
+        const InstallerDetector::Type type = InstallerDetector::detect(appInfo.installerPath).type;
+        if (appInfo.executablePath == appInfo.installerPath) {
+            KMessageBox::detailedError(this,
+                i18n("%1 is a setup program (%2), but it could not be unpacked. Fix the problem below and import the app again.",
+                     QFileInfo(appInfo.installerPath).fileName(), InstallerDetector::typeName(type)),
+                result.second,
+                i18n("Installer Detected"));
+        } else {
+            updateLog(i18n("Unpacked the %1 installer %2", InstallerDetector::typeName(type),
+                           QFileInfo(appInfo.installerPath).fileName()));
         }
-        if (!appInfo.iconPath.isEmpty())
-            break;
     }
     
-    // If no icon found yet, just use the first one
-    if (appInfo.iconPath.isEmpty() && !iconFiles.isEmpty()) {
-        appInfo.iconPath = iconFiles.first();
-    }
+    // Generate a unique ID for this app
+    QString appId = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    appInfo.id = appId;
     
     // Store the app info
     m_portableApps[appId] = appInfo;
     
     // Add to the list and select it
     int newRow = m_appsList->count();
-    m_appsList->addItem(appInfo.name);
+    m_appsList->addItem(appInfo.name + " (" + appInfo.version + ")");
     m_appsList->setCurrentRow(newRow);
     
     // Switch to app details page
     m_currentAppId = appId;
-    m_stackedWidget->setCurrentIndex(1);
+    showPage(AppDetailsPage);
     
     // Update the UI fields
     m_appNameEdit->setText(appInfo.name);
@@ -386,9 +538,117 @@ void MainWindow::importPortableApp()
     m_appCategoryEdit->setText(appInfo.category);
     m_executablePathEdit->setText(appInfo.executablePath);
     m_iconPathEdit->setText(appInfo.iconPath);
+    m_pruneRulesEdit->clear();
     
     // Update icon preview
     updateIconPreview(appInfo.iconPath);
+    
+    BuildMetrics::instance().observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "import"),
+                                     m_importTimer.elapsed() / 1000.0);
+}
+
+void MainWindow::bulkImportPortableApps()
+{
+    if (m_bulkImportWatcher.isRunning()) {
+        return;
+    }
+    
+    QString libraryDir = QFileDialog::getExistingDirectory(this, i18n("Select PortableApps Library Directory"));
+    if (libraryDir.isEmpty())
+        return;
+    
+    // Skip apps that are already in the catalog
+    QSet<QString> knownDirs;
+    for (auto it = m_portableApps.constBegin(); it != m_portableApps.constEnd(); ++it) {
+        knownDirs.insert(QDir(it.value().sourceDir).absolutePath());
+        if (!it.value().installerPath.isEmpty()) {
+            knownDirs.insert(QFileInfo(it.value().installerPath).absolutePath());
+        }
+    }
+    
+    m_bulkImportStart = Tracer::now();
+    
+    QStringList roots;
+    const QStringList foundRoots = PortableAppDetector::findAppRoots(libraryDir);
+    for (const QString &root : foundRoots) {
+        if (!knownDirs.contains(QDir(root).absolutePath())) {
+            roots << root;
+        }
+    }
+    
+    if (roots.isEmpty()) {
+        KMessageBox::information(this, i18n("No new portable apps found in %1.", libraryDir), i18n("Bulk Import"));
+        return;
+    }
+    
+    // Detection runs concurrently on the global thread pool
+    m_bulkImportProgress = new QProgressDialog(i18n("Importing portable apps..."), i18n("Cancel"), 0, roots.size(), this);
+    m_bulkImportProgress->setWindowModality(Qt::WindowModal);
+    m_bulkImportProgress->setMinimumDuration(0);
+    m_bulkImportProgress->setAttribute(Qt::WA_DeleteOnClose);
+    connect(m_bulkImportProgress, &QProgressDialog::canceled, &m_bulkImportWatcher, &QFutureWatcher<PortableAppInfo>::cancel);
+    
+    m_bulkImportDone = 0;
+    m_bulkImportPending.clear();
+    m_catalog.beginBatch();
+    
+    m_bulkImportWatcher.setFuture(QtConcurrent::mapped(roots,
+        static_cast<PortableAppInfo(*)(const QString &)>(&PortableAppDetector::detect)));
+}
+
+void MainWindow::bulkImportResultsReady(int begin, int end)
+{
+    for (int i = begin; i < end; ++i) {
+        PortableAppInfo info = m_bulkImportWatcher.resultAt(i);
+        info.id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+        m_bulkImportPending.append(info);
+    }
+    
+    m_bulkImportDone += end - begin;
+    if (m_bulkImportProgress) {
+        m_bulkImportProgress->setValue(m_bulkImportDone);
+        m_bulkImportProgress->setLabelText(i18n("Imported %1 of %2 portable apps...",
+                                                m_bulkImportDone, m_bulkImportProgress->maximum()));
+    }
+    
+    // Hand results to the catalog in batches rather than one by one
+    if (m_bulkImportPending.size() >= 64) {
+        flushBulkImport();
+    }
+}
+
+void MainWindow::bulkImportFinished()
+{
+    flushBulkImport();
+    m_catalog.commitBatch(m_portableApps);
+    
+    if (m_bulkImportProgress) {
+        m_bulkImportProgress->close();
+    }
+    
+    updateLog(i18np("Imported 1 portable app", "Imported %1 portable apps", m_bulkImportDone));
+    
+    Tracer::complete("import", QStringLiteral("bulk import"), m_bulkImportStart, Tracer::now() - m_bulkImportStart,
+                     QStringLiteral("%1 apps").arg(m_bulkImportDone));
+    Tracer::flush();
+}
+
+void MainWindow::flushBulkImport()
+{
+    if (m_bulkImportPending.isEmpty())
+        return;
+    
+    m_appsList->setUpdatesEnabled(false);
+    for (const PortableAppInfo &info : qAsConst(m_bulkImportPending)) {
+        m_portableApps[info.id] = info;
+        m_appsList->addItem(info.name + " (" + info.version + ")");
+    }
+    m_appsList->setUpdatesEnabled(true);
+    
+    // The catalog is written once when the import finishes. QSettings
+    // rewrites the whole file on every save, so saving each batch would
+    // make the import quadratic in the size of the catalog.
+    m_bulkImportPending.clear();
 }
 
 void MainWindow::analyzePortableApp()
@@ -398,6 +658,10 @@ void MainWindow::analyzePortableApp()
         return;
     }
     
+    TraceSpan span("analyze", QStringLiteral("analyze app"));
+    QElapsedTimer timer;
+    timer.start();
+    
     // Update app info from UI fields
     PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
     appInfo.name = m_appNameEdit->text();
@@ -406,18 +670,61 @@ void MainWindow::analyzePortableApp()
     appInfo.category = m_appCategoryEdit->text();
     appInfo.executablePath = m_executablePathEdit->text();
     appInfo.iconPath = m_iconPathEdit->text();
+    appInfo.pruneRules = m_pruneRulesEdit->text().split(';', Qt::SkipEmptyParts);
     
     // Update list item
     int currentRow = m_appsList->currentRow();
     m_appsList->item(currentRow)->setText(appInfo.name + " (" + appInfo.version + ")");
     
-    // Initialize wine config with defaults
-    m_wineConfigWidget->setWineVersion("stable");
-    m_wineConfigWidget->setWineDllOverrides("");
-    m_wineConfigWidget->setWineArch("win64");
+    // Collect the DLLs imported by every PE image the app ships
+    QStringList images;
+    const AppScanIndex index = AppScanIndex::scan(appInfo.sourceDir);
+    for (const ScannedFile &file : index.files()) {
+        const QString lower = file.relativePath.toLower();
+        if (lower.endsWith(".exe") || lower.endsWith(".dll")) {
+            images << index.rootDir() + "/" + file.relativePath;
+        }
+    }
+    
+    const QList<QStringList> imports = QtConcurrent::blockingMapped<QList<QStringList>>(images, &PeImage::dependenciesOf);
+    QSet<QString> requiredDlls;
+    for (const QStringList &dlls : imports) {
+        for (const QString &dll : dlls) {
+            requiredDlls.insert(dll);
+        }
+    }
+    appInfo.requiredDLLs = requiredDlls.values();
+    appInfo.requiredDLLs.sort();
+    
+    if (WineComponents::needsMono(appInfo.requiredDLLs)) {
+        updateLog(i18n("App uses .NET, Wine Mono will be bundled"));
+    }
+    if (WineComponents::needsGecko(appInfo.requiredDLLs)) {
+        updateLog(i18n("App uses the HTML engine, Wine Gecko will be bundled"));
+    }
+    
+    // Initialize wine config from the app, with defaults for new apps
+    ensurePage(WineConfigPage);
+    m_wineConfigWidget->setWineVersion(appInfo.wineVersion.isEmpty() ? QStringLiteral("stable") : appInfo.wineVersion);
+    m_wineConfigWidget->setWineDllOverrides(appInfo.wineDllOverrides);
+    m_wineConfigWidget->setWineArch(appInfo.wineArch.isEmpty() ? QStringLiteral("win64") : appInfo.wineArch);
+    m_wineConfigWidget->setPerformanceProfile(appInfo.performanceProfile);
+    m_wineConfigWidget->setPrefixMode(appInfo.prefixMode);
+    m_wineConfigWidget->setServerTimeout(appInfo.serverTimeout);
+    m_wineConfigWidget->setDxvkEnabled(appInfo.enableDxvk);
+    m_wineConfigWidget->setDxvkVersion(appInfo.dxvkVersion);
+    m_wineConfigWidget->setDxvkStateCachePath(appInfo.dxvkStateCachePath);
+    m_wineConfigWidget->setAllowNetwork(appInfo.allowNetworkAccess);
+    m_wineConfigWidget->setAllowDocuments(appInfo.allowDocumentsAccess);
+    m_wineConfigWidget->setAllowDownloads(appInfo.allowDownloadsAccess);
+    m_wineConfigWidget->setAllowAudio(appInfo.allowAudio);
+    m_wineConfigWidget->setVariants(appInfo.variants);
+    
+    BuildMetrics::instance().observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "analyze"),
+                                     timer.elapsed() / 1000.0);
     
     // Move to wine config page
-    m_stackedWidget->setCurrentIndex(2);
+    showPage(WineConfigPage);
 }
 
 void MainWindow::configureWineSettings()
@@ -432,65 +739,48 @@ void MainWindow::generateFlatpakManifest()
         return;
     }
     
+    QElapsedTimer timer;
+    timer.start();
+    
     PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
     
     // Update the Wine settings from the config widget
+    ensurePage(WineConfigPage);
     appInfo.wineVersion = m_wineConfigWidget->wineVersion();
     appInfo.wineDllOverrides = m_wineConfigWidget->wineDllOverrides();
     appInfo.wineArch = m_wineConfigWidget->wineArch();
+    appInfo.performanceProfile = m_wineConfigWidget->performanceProfile();
+    appInfo.prefixMode = m_wineConfigWidget->prefixMode();
+    appInfo.serverTimeout = m_wineConfigWidget->serverTimeout();
+    appInfo.enableDxvk = m_wineConfigWidget->dxvkEnabled();
+    appInfo.dxvkVersion = m_wineConfigWidget->dxvkVersion();
+    appInfo.dxvkStateCachePath = m_wineConfigWidget->dxvkStateCachePath();
+    appInfo.allowNetworkAccess = m_wineConfigWidget->allowNetwork();
+    appInfo.allowDocumentsAccess = m_wineConfigWidget->allowDocuments();
+    appInfo.allowDownloadsAccess = m_wineConfigWidget->allowDownloads();
+    appInfo.allowAudio = m_wineConfigWidget->allowAudio();
+    appInfo.variants = m_wineConfigWidget->variants();
     
     // Prepare manifest
-    m_manifest.clear();
-    m_manifest.setAppId("org.winepak." + appInfo.name.toLower().replace(" ", "_"));
-    m_manifest.setAppName(appInfo.name);
-    m_manifest.setAppVersion(appInfo.version);
-    m_manifest.setAppDescription(appInfo.description);
-    
-    // Set icon if available
-    if (!appInfo.iconPath.isEmpty() && QFile::exists(appInfo.iconPath)) {
-        m_manifest.setAppIcon(appInfo.iconPath);
-    }
-    
-    m_manifest.setRuntime("org.freedesktop.Platform");
-    m_manifest.setRuntimeVersion("22.08");
-    m_manifest.setSdk("org.freedesktop.Sdk");
-    
-    // Add Wine and related modules
-    m_manifest.addWineModule(appInfo.wineVersion, appInfo.wineArch);
-    
-    // Configure environment variables
-    QMap<QString, QString> env;
-    env["WINEPREFIX"] = "/var/data/wine";
-    
-    if (!appInfo.wineDllOverrides.isEmpty()) {
-        env["WINEDLLOVERRIDES"] = appInfo.wineDllOverrides;
-    }
+    m_manifestStale = false;
     
-    m_manifest.setEnvironment(env);
-    
-    // Set the command to run
-    QString relativeExePath = appInfo.executablePath;
-    relativeExePath.replace(appInfo.sourceDir, "");
-    if (relativeExePath.startsWith('/')) {
-        relativeExePath.remove(0, 1);
+    QStringList log;
+    m_manifest = AppPackager::generateManifest(appInfo, &log);
+    for (const QString &line : qAsConst(log)) {
+        updateLog(line);
     }
     
-    m_manifest.setCommand("wine");
-    m_manifest.addCommandArg("Z:\\app\\" + relativeExePath.replace("/", "\\"));
-    
-    // Configure filesystem access
-    m_manifest.addFilesystemAccess("~/.local/share/winepak/" + m_manifest.appId() + ":create");
-    m_manifest.addFilesystemAccess("xdg-documents");
-    m_manifest.addFilesystemAccess("xdg-download");
+    BuildMetrics::instance().observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "manifest"),
+                                     timer.elapsed() / 1000.0);
     
     // Move to build page
-    m_stackedWidget->setCurrentIndex(3);
+    showPage(BuildPage);
     
     // Show manifest summary
     updateLog(i18n("Manifest generated for %1", appInfo.name));
     updateLog(i18n("App ID: %1", m_manifest.appId()));
     updateLog(i18n("Wine version: %1", appInfo.wineVersion));
-    updateLog(i18n("Executable: %1", relativeExePath));
+    updateLog(i18n("Executable: %1", AppPackager::relativeExecutable(appInfo)));
 }
 
 void MainWindow::buildFlatpak()
@@ -500,83 +790,744 @@ void MainWindow::buildFlatpak()
         return;
     }
     
-    PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
+    // The toolbar action may be triggered while the buttons are disabled
+    if (isBuilding()) {
+        KMessageBox::error(this, i18n("Wait for the running build to finish."), i18n("Error"));
+        return;
+    }
     
-    // Prepare build directory
-    QString buildDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) 
-                     + "/flatpak-wine-builder/" + m_manifest.appId();
-    QDir().mkpath(buildDir);
+    const PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
     
-    // Write manifest to file
-    QString manifestPath = buildDir + "/manifest.yml";
-    if (!m_manifest.saveToFile(manifestPath)) {
-        KMessageBox::error(this, i18n("Failed to write manifest file!"), i18n("Error"));
+    // Builds go to the builder service if there is one, so they survive
+    // closing the window. Watch mode keeps building here.
+    if (QSettings().value("service/enabled", true).toBool() && !m_watcher->isWatching()
+        && m_builder->isAvailable() && queueInService(appInfo)) {
         return;
     }
     
-    // Copy portable app to build directory
-    QString appDestDir = buildDir + "/app";
-    QDir().mkpath(appDestDir);
+    TraceSpan span("stage", QStringLiteral("prepare build"), m_manifest.appId());
     
-    // Using tar for copying to preserve symlinks and permissions
-    QProcess copyProcess;
-    copyProcess.start("cp", QStringList() << "-r" << appInfo.sourceDir + "/." << appDestDir);
-    if (!copyProcess.waitForFinished() || copyProcess.exitCode() != 0) {
-        KMessageBox::error(this, i18n("Failed to copy application files!"), i18n("Error"));
+    // Prepare build directory
+    QString buildDir = buildDirectory();
+    QDir().mkpath(buildDir);
+    if (!useBuildDirectory(buildDir)) {
         return;
     }
     
-    // Copy icon file if specified
-    if (!appInfo.iconPath.isEmpty() && QFile::exists(appInfo.iconPath)) {
-        QString iconDir = buildDir + "/icon";
-        QDir().mkpath(iconDir);
-        QFile::copy(appInfo.iconPath, iconDir + "/" + QFileInfo(appInfo.iconPath).fileName());
+    // The fingerprint lets flatpak-builder's cache notice payload changes.
+    // The shared modules before the app module (Wine, DXVK, the base
+    // prefix) are reused, only the app module and the small ones after it
+    // are rebuilt. It is also part of the journal's inputs.
+    AppScanIndex index = scanPayload(appInfo);
+    m_manifest.setPayloadFingerprint(index.fingerprint());
+    
+    // Staged files and flatpak-builder's scratch directories go to RAM
+    // if the build fits
+    QString workspaceMessage;
+    m_workspace.prepare(buildDir, m_workspace.estimate(index), &workspaceMessage);
+    if (!workspaceMessage.isEmpty()) {
+        updateLog(workspaceMessage);
     }
     
-    // Build the flatpak
-    updateLog(i18n("Starting Flatpak build process..."));
-    m_progressBar->setValue(10);
+    // Continue where an interrupted build of the same inputs stopped
+    beginJournal(appInfo, buildDir);
     
-    // Set up build command
-    m_process.setWorkingDirectory(buildDir);
-    m_process.start("flatpak-builder", QStringList() 
-                   << "--force-clean" 
-                   << "--user" 
-                   << "--install"
-                   << "build" 
-                   << manifestPath);
+    // Stage the full pruned app tree
+    if (m_journal.isComplete("stage") && index.matchesStaged(buildDir + "/app")) {
+        updateLog(i18n("Staged files from the previous run are intact, skipping staging"));
+    } else {
+        if (!stagePayload(index, buildDir, QStringList(), true)) {
+            return;
+        }
+        recordStage(QStringLiteral("stage"), index.fingerprint());
+    }
     
-    // Disable the build button while building
-    m_buildButton->setEnabled(false);
-    updateLog(i18n("Building Flatpak... This may take several minutes."));
+    // Icon, Wine components and DXVK cache for their manifest modules
+    const QStringList supportDirs = { "icon", "wine-components", "dxvk-cache" };
+    if (!m_journal.isComplete("artifacts")
+        || m_journal.outputHash("artifacts") != PipelineJournal::hashFiles(buildDir, supportDirs)) {
+        AppPackager::stageSupportFiles(appInfo, buildDir);
+        recordStage(QStringLiteral("artifacts"), PipelineJournal::hashFiles(buildDir, supportDirs));
+    }
+    
+    startBuild(appInfo, buildDir);
 }
 
-void MainWindow::processFinished(int exitCode, QProcess::ExitStatus exitStatus)
+void MainWindow::buildVariantMatrix()
 {
-    m_buildButton->setEnabled(true);
+    if (m_currentAppId.isEmpty() || !m_portableApps.contains(m_currentAppId)) {
+        KMessageBox::error(this, i18n("No application selected!"), i18n("Error"));
+        return;
+    }
     
-    if (exitStatus == QProcess::NormalExit && exitCode == 0) {
-        m_progressBar->setValue(100);
-        updateLog(i18n("Flatpak built and installed successfully!"));
-        KMessageBox::information(this, 
-            i18n("The application has been packaged as a Flatpak and installed in your user repository."),
-            i18n("Build Successful"));
-    } else {
-        updateLog(i18n("Flatpak build failed with exit code: %1", exitCode));
-        KMessageBox::error(this, 
-            i18n("Failed to build the Flatpak. Check the output log for details."),
-            i18n("Build Failed"));
+    // The variants restage the build directory a running build or watch
+    // mode works in
+    if (isBuilding() || m_watcher->isWatching()) {
+        KMessageBox::error(this, i18n("Wait for the running build to finish and turn off watch mode before building the variant matrix."),
+                           i18n("Error"));
+        return;
     }
-}
-
+    
+    const PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
+    
+    QVector<BuildVariant> variants;
+    ensurePage(WineConfigPage);
+    for (const QString &name : m_wineConfigWidget->variants()) {
+        BuildVariant variant;
+        if (BuildVariant::parse(name, &variant)) {
+            variants << variant;
+        }
+    }
+    
+    if (variants.isEmpty()) {
+        KMessageBox::error(this, i18n("Select at least one Wine version and architecture in the variant matrix."), i18n("Error"));
+        return;
+    }
+    
+    // The variants share the staged tree of the app's regular build
+    const QString buildDir = buildDirectory();
+    QDir().mkpath(buildDir);
+    if (!useBuildDirectory(buildDir)) {
+        return;
+    }
+    
+    // The variants build on disk, staging must not follow the links of a
+    // RAM workspace
+    m_workspace.release();
+    const QString repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    
+    QString error;
+    if (!m_matrixBuilder->start(appInfo, variants, buildDir, repoPath, &error)) {
+        KMessageBox::error(this, i18n("Failed to start the variant builds: %1", error), i18n("Error"));
+        return;
+    }
+    
+    setBuildActionsEnabled(false);
+    m_progressBar->setValue(10);
+    updateLog(i18np("Building 1 variant... This may take several minutes.",
+                    "Building %1 variants... This may take several minutes.", variants.size()));
+}
+
+void MainWindow::matrixFinished(int failedCount)
+{
+    setBuildActionsEnabled(true);
+    m_progressBar->setValue(100);
+    Tracer::flush();
+    collectStorage();
+    
+    if (failedCount == 0) {
+        updateLog(i18n("All variants built and installed successfully!"));
+    } else {
+        updateLog(i18np("1 variant failed to build", "%1 variants failed to build", failedCount));
+        KMessageBox::error(this,
+            i18np("1 variant failed to build. Check the output log for details.",
+                  "%1 variants failed to build. Check the output log for details.", failedCount),
+            i18n("Build Failed"));
+    }
+}
+
+QString MainWindow::buildDirectory() const
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/" + m_manifest.appId();
+}
+
+bool MainWindow::stagePayload(const AppScanIndex &index, const QString &buildDir,
+                              const QStringList &changedPaths, bool fullRestage)
+{
+    QString appDestDir = buildDir + "/app";
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    StageResult stageResult;
+    QString stageError;
+    bool staged;
+    
+    if (fullRestage) {
+        // Start from an empty directory so files pruned since the last
+        // build disappear
+        QDir(appDestDir).removeRecursively();
+        QDir().mkpath(appDestDir);
+        staged = index.stageTo(appDestDir, &stageResult, &stageError);
+    } else {
+        staged = index.restage(appDestDir, changedPaths, &stageResult, &stageError);
+    }
+    
+    if (!staged) {
+        KMessageBox::error(this, i18n("Failed to copy application files: %1", stageError), i18n("Error"));
+        return false;
+    }
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "stage"), timer.elapsed() / 1000.0);
+    metrics.increment("fpb_staged_files_total", QString(), stageResult.files);
+    metrics.increment("fpb_staged_bytes_total", QString(), stageResult.bytes);
+    metrics.increment("fpb_reflinked_bytes_total", QString(), stageResult.reflinkedBytes);
+    if (fullRestage) {
+        metrics.increment("fpb_pruned_bytes_total", QString(), index.totalSize() - index.retainedSize());
+    }
+    
+    updateLog(i18n("Staged %1 files (%2), pruned %3",
+                   stageResult.files,
+                   QLocale().formattedDataSize(stageResult.bytes),
+                   QLocale().formattedDataSize(index.totalSize() - index.retainedSize())));
+    
+    return true;
+}
+
+void MainWindow::beginJournal(const PortableAppInfo &appInfo, const QString &buildDir)
+{
+    m_journal = PipelineJournal(buildDir + "/journal.jsonl");
+    
+    QString error;
+    if (!m_journal.begin(AppPackager::inputsHash(m_manifest, appInfo), &error)) {
+        updateLog(i18n("Cannot write the build journal: %1", error));
+    } else if (!m_journal.completedStages().isEmpty()) {
+        updateLog(i18n("Resuming the previous build, completed stages: %1", m_journal.completedStages().join(", ")));
+    }
+}
+
+void MainWindow::recordStage(const QString &stage, const QString &outputHash, const QJsonObject &data)
+{
+    QString error;
+    if (!m_journal.complete(stage, outputHash, data, &error)) {
+        updateLog(i18n("Cannot write the build journal: %1", error));
+    }
+}
+
+void MainWindow::startBuild(const PortableAppInfo &appInfo, const QString &buildDir)
+{
+    // The build can be started from the toolbar before the page was shown
+    ensurePage(BuildPage);
+    
+    // Write manifest to file
+    QString manifestPath = buildDir + "/manifest.json";
+    if (!m_journal.isComplete("manifest") || m_journal.outputHash("manifest") != PipelineJournal::hashFile(manifestPath)) {
+        if (!m_manifest.saveToFile(manifestPath)) {
+            KMessageBox::error(this, i18n("Failed to write manifest file!"), i18n("Error"));
+            return;
+        }
+        recordStage(QStringLiteral("manifest"), PipelineJournal::hashFile(manifestPath));
+    }
+    
+    // Catch broken manifests before flatpak-builder spends minutes on them
+    if (!validateManifest(manifestPath)) {
+        return;
+    }
+    
+    // Set up build command. Every build is also committed to the
+    // persistent export repo, on top of the previous build of the app.
+    QString repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    
+    // The build finished before the interruption if the repo still has
+    // the commit it recorded. It is installed again if it is gone.
+    const FlatpakExporter::ResumePoint resume = FlatpakExporter::resumePoint(m_journal, repoPath, m_manifest.appId());
+    if (resume == FlatpakExporter::ResumeInstall) {
+        updateLog(i18n("%1 is already built, installing it", m_manifest.appId()));
+        m_installing = true;
+        m_process.setWorkingDirectory(buildDir);
+        m_process.start("flatpak", FlatpakExporter::installArguments(repoPath, m_manifest.appId()));
+        setBuildActionsEnabled(false);
+        updateBuildQueueMetrics();
+        return;
+    }
+    if (resume != FlatpakExporter::ResumeBuild) {
+        m_progressBar->setValue(100);
+        if (resume == FlatpakExporter::ResumeDone) {
+            updateLog(i18n("%1 is already built, installed and exported", m_manifest.appId()));
+            m_journal.remove();
+        } else if (!m_watcher->isWatching()) {
+            updateLog(i18n("%1 is already built and installed, exporting it", m_manifest.appId()));
+            exportBuild(m_manifest.appId());
+        }
+        if (!m_watcher->isWatching()) {
+            m_workspace.release();
+        }
+        return;
+    }
+    
+    // Build the flatpak
+    updateLog(i18n("Starting Flatpak build process..."));
+    m_progressBar->setValue(10);
+    
+    // Module boundaries in the output become spans of their own
+    m_buildTrace = ProcessTrace(QStringLiteral("flatpak-builder"), m_manifest.appId());
+    m_buildTrace.start();
+    m_buildTimer.start();
+    BuildMetrics::instance().increment("fpb_builds_started_total");
+    
+    // Runs in a scope of its own, so the desktop stays responsive
+    m_process.setWorkingDirectory(buildDir);
+    m_governor->start(&m_process, "flatpak-builder", QStringList() 
+                   << "--force-clean" 
+                   << "--user" 
+                   << "--install"
+                   << "--repo=" + repoPath
+                   << "--subject=" + appInfo.name + " " + appInfo.version
+                   << m_workspace.outputDir()
+                   << manifestPath);
+    
+    // Disable the build actions while building
+    setBuildActionsEnabled(false);
+    updateLog(i18n("Building Flatpak... This may take several minutes."));
+    
+    updateBuildQueueMetrics();
+}
+
+bool MainWindow::validateManifest(const QString &manifestPath)
+{
+    QElapsedTimer timer;
+    timer.start();
+    
+    const ManifestValidator::Report report = ManifestValidator::validateFile(manifestPath);
+    BuildMetrics::instance().observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "validate"),
+                                     timer.elapsed() / 1000.0);
+    
+    for (const QString &warning : report.warnings()) {
+        updateLog(i18n("Manifest warning: %1", warning));
+    }
+    
+    if (!report.hasErrors())
+        return true;
+    
+    // Watch mode only logs, like failed builds
+    if (m_watcher->isWatching()) {
+        for (const QString &error : report.errors()) {
+            updateLog(i18n("Manifest error: %1", error));
+        }
+    } else {
+        KMessageBox::detailedError(this,
+            i18n("The manifest has errors, the build was not started."),
+            report.errors().join('\n'),
+            i18n("Invalid Manifest"));
+    }
+    
+    return false;
+}
+
+void MainWindow::toggleWatchMode(bool enabled)
+{
+    if (!enabled) {
+        m_watcher->stop();
+        m_watchedChanges.clear();
+        m_watchFullRestage = false;
+        if (m_process.state() == QProcess::NotRunning) {
+            m_workspace.release();
+        }
+        updateLog(i18n("Watch mode disabled"));
+        return;
+    }
+    
+    if (m_currentAppId.isEmpty() || !m_portableApps.contains(m_currentAppId) || m_manifest.appId().isEmpty()) {
+        KMessageBox::error(this, i18n("Generate a manifest before enabling watch mode."), i18n("Error"));
+        m_watchCheck->setChecked(false);
+        return;
+    }
+    
+    const PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
+    if (!m_watcher->watch(appInfo.sourceDir)) {
+        KMessageBox::error(this, i18n("Cannot watch %1 for changes.", appInfo.sourceDir), i18n("Error"));
+        m_watchCheck->setChecked(false);
+        return;
+    }
+    
+    // The first build in watch mode always stages everything
+    m_watchFullRestage = !QDir(buildDirectory() + "/app").exists();
+    updateLog(i18n("Watching %1 for changes...", appInfo.sourceDir));
+}
+
+void MainWindow::watchedFilesChanged(const QStringList &relativePaths)
+{
+    // An empty list means the watcher lost track of individual events
+    if (relativePaths.isEmpty()) {
+        m_watchFullRestage = true;
+    }
+    
+    for (const QString &path : relativePaths) {
+        if (!m_watchedChanges.contains(path)) {
+            m_watchedChanges.append(path);
+        }
+    }
+    
+    scheduleIncrementalBuild();
+}
+
+void MainWindow::wineSettingsChanged()
+{
+    m_manifestStale = true;
+    
+    if (m_watcher->isWatching()) {
+        m_settingsDebounce.start();
+    }
+}
+
+void MainWindow::scheduleIncrementalBuild()
+{
+    // Changes during a running build are picked up once it has finished
+    if (m_process.state() != QProcess::NotRunning) {
+        m_rebuildPending = true;
+        updateBuildQueueMetrics();
+        return;
+    }
+    
+    incrementalBuild();
+}
+
+void MainWindow::incrementalBuild()
+{
+    m_rebuildPending = false;
+    
+    if (m_currentAppId.isEmpty() || !m_portableApps.contains(m_currentAppId))
+        return;
+    
+    // Only regenerate the manifest if the Wine settings were touched
+    if (m_manifestStale) {
+        generateFlatpakManifest();
+    }
+    
+    const PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
+    QString buildDir = buildDirectory();
+    QDir().mkpath(buildDir);
+    if (!useBuildDirectory(buildDir)) {
+        return;
+    }
+    
+    AppScanIndex index = scanPayload(appInfo);
+    m_manifest.setPayloadFingerprint(index.fingerprint());
+    
+    // A RAM workspace stays for the whole watch session. If the staged
+    // files moved or are gone, everything is staged again.
+    QString workspaceMessage;
+    const bool stagedKept = m_workspace.prepare(buildDir, m_workspace.estimate(index), &workspaceMessage);
+    if (!stagedKept && !workspaceMessage.isEmpty()) {
+        updateLog(workspaceMessage);
+    }
+    
+    const QStringList changes = m_watchedChanges;
+    const bool fullRestage = m_watchFullRestage || !stagedKept;
+    m_watchedChanges.clear();
+    m_watchFullRestage = false;
+    
+    if (!fullRestage && !changes.isEmpty()) {
+        updateLog(i18np("Restaging 1 changed file...", "Restaging %1 changed files...", changes.size()));
+    }
+    
+    if (!stagePayload(index, buildDir, changes, fullRestage)) {
+        return;
+    }
+    
+    beginJournal(appInfo, buildDir);
+    recordStage(QStringLiteral("stage"), index.fingerprint());
+    
+    startBuild(appInfo, buildDir);
+}
+
+void MainWindow::processFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    setBuildActionsEnabled(true);
+    
+    if (m_installing) {
+        installFinished(exitStatus == QProcess::NormalExit ? exitCode : -1);
+        return;
+    }
+    
+    m_buildTrace.finish(exitCode);
+    Tracer::flush();
+    
+    const bool succeeded = exitStatus == QProcess::NormalExit && exitCode == 0;
+    const double buildSeconds = m_buildTimer.elapsed() / 1000.0;
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.increment(succeeded ? "fpb_builds_succeeded_total" : "fpb_builds_failed_total");
+    metrics.observe("fpb_stage_duration_seconds", BuildMetrics::label("stage", "flatpak_builder"), buildSeconds);
+    metrics.increment("fpb_worker_busy_seconds_total", BuildMetrics::label("pool", "build"), buildSeconds);
+    metrics.increment("fpb_build_cache_hits_total", QString(), m_buildTrace.moduleCacheHits());
+    metrics.increment("fpb_build_cache_misses_total", QString(), m_buildTrace.moduleBuilds());
+    
+    const ResourceUsage usage = m_governor->takeUsage(&m_process);
+    if (usage.available) {
+        updateLog(i18n("Build used %1", usage.toString()));
+    }
+    if (usage.profile.available) {
+        updateLog(i18n("Build ran %1", usage.profile.toString()));
+    }
+    updateBuildQueueMetrics();
+    collectStorage();
+    
+    // The commit is in the export repo on disk, a RAM workspace is only
+    // kept for the next build in watch mode
+    if (!m_watcher->isWatching()) {
+        m_workspace.release();
+    }
+    
+    if (succeeded) {
+        const QString repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+        // The usage goes into the build record for capacity planning
+        recordStage(QStringLiteral("build"), FlatpakExporter::commitOf(repoPath, m_manifest.appId()), usage.toJson());
+    }
+    
+    // In watch mode the next build follows right away and results are
+    // only logged, without modal dialogs
+    if (m_watcher->isWatching()) {
+        if (succeeded) {
+            m_progressBar->setValue(100);
+            updateLog(i18n("Rebuilt and installed %1", m_manifest.appId()));
+        } else {
+            updateLog(i18n("Flatpak build failed with exit code: %1", exitCode));
+        }
+        
+        if (m_rebuildPending) {
+            incrementalBuild();
+        }
+        return;
+    }
+    
+    if (succeeded) {
+        m_progressBar->setValue(100);
+        updateLog(i18n("Flatpak built and installed successfully!"));
+        
+        exportBuild(m_manifest.appId());
+        
+        KMessageBox::information(this, 
+            i18n("The application has been packaged as a Flatpak and installed in your user repository."),
+            i18n("Build Successful"));
+    } else {
+        updateLog(i18n("Flatpak build failed with exit code: %1", exitCode));
+        KMessageBox::error(this, 
+            i18n("Failed to build the Flatpak. Check the output log for details."),
+            i18n("Build Failed"));
+    }
+}
+
+void MainWindow::installFinished(int exitCode)
+{
+    m_installing = false;
+    updateBuildQueueMetrics();
+    
+    if (!m_watcher->isWatching()) {
+        m_workspace.release();
+    }
+    
+    if (exitCode != 0) {
+        updateLog(i18n("Installing %1 failed with exit code: %2", m_manifest.appId(), exitCode));
+    } else {
+        m_progressBar->setValue(100);
+        updateLog(i18n("Installed %1 from the export repo", m_manifest.appId()));
+        
+        // Exports are left to the builds outside of watch mode
+        if (!m_watcher->isWatching()) {
+            exportBuild(m_manifest.appId());
+        }
+    }
+    
+    if (m_watcher->isWatching() && m_rebuildPending) {
+        incrementalBuild();
+    }
+}
+
+void MainWindow::exportBuild(const QString &appId)
+{
+    // Publish the new commit: static deltas and optional bundle
+    ExportJob job;
+    job.appId = appId;
+    job.repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    if (m_bundleCheck->isChecked()) {
+        QString version = m_manifest.appVersion().isEmpty() ? QStringLiteral("latest") : m_manifest.appVersion();
+        job.bundlePath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+                       + "/flatpak-wine-builder/bundles/" + job.appId + "-" + version + ".flatpak";
+    }
+    m_exporter->enqueue(job);
+}
+
+void MainWindow::exportFinished(const QString &appId, bool success)
+{
+    // New bundles count against the storage quota
+    collectStorage();
+    
+    // Only the export of the journaled build completes its pipeline
+    if (!success || appId != m_manifest.appId() || !m_journal.isComplete("build"))
+        return;
+    
+    const QString repoPath = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    const QString commit = FlatpakExporter::commitOf(repoPath, appId);
+    if (commit == m_journal.outputHash("build")) {
+        // The pipeline is done, the next build starts over
+        m_journal.remove();
+    }
+}
+
+void MainWindow::updateBuildQueueMetrics()
+{
+    // Local builds run one at a time, a pending rebuild waits behind it
+    const bool running = m_process.state() != QProcess::NotRunning;
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    metrics.setGauge("fpb_workers", BuildMetrics::label("pool", "build"), 1);
+    metrics.setGauge("fpb_workers_busy", BuildMetrics::label("pool", "build"), running ? 1 : 0);
+    metrics.setGauge("fpb_queue_depth", BuildMetrics::label("queue", "build"), (running ? 1 : 0) + (m_rebuildPending ? 1 : 0));
+    
+    QString error;
+    if (!metrics.writeTextFile(&error)) {
+        updateLog(i18n("Cannot write metrics to %1: %2", metrics.textFilePath(), error));
+    }
+}
+
+bool MainWindow::useBuildDirectory(const QString &buildDir)
+{
+    // The build directory of the app being worked on is never collected,
+    // and the one worked on before stays warm the longest. Its lock keeps
+    // the builder service out while this window owns it.
+    if (m_pinnedBuildDir != buildDir) {
+        releaseBuildDirectory();
+        
+        QString error;
+        if (!m_buildDirLock.lock(buildDir, &error)) {
+            if (m_watcher->isWatching()) {
+                updateLog(i18n("Cannot build: %1", error));
+            } else {
+                KMessageBox::error(this, i18n("Cannot build: %1", error), i18n("Error"));
+            }
+            return false;
+        }
+        m_storage->pin(buildDir);
+        m_pinnedBuildDir = buildDir;
+    }
+    
+    StorageManager::touch(buildDir);
+    return true;
+}
+
+bool MainWindow::isBuilding() const
+{
+    return m_process.state() != QProcess::NotRunning || m_matrixBuilder->isRunning() || !m_serviceJobId.isEmpty();
+}
+
+void MainWindow::setBuildActionsEnabled(bool enabled)
+{
+    // The buttons only exist once the build page was shown
+    m_buildAction->setEnabled(enabled);
+    if (m_buildButton) {
+        m_buildButton->setEnabled(enabled);
+        m_matrixButton->setEnabled(enabled);
+    }
+}
+
+bool MainWindow::buildDirectoryInUse(const QString &buildDir) const
+{
+    if (buildDir == m_serviceBuildDir)
+        return true;
+    
+    if (buildDir == m_pinnedBuildDir)
+        return m_process.state() != QProcess::NotRunning || m_matrixBuilder->isRunning() || m_watcher->isWatching();
+    
+    // Another process building the app holds the lock
+    BuildDirLock lock;
+    return QFileInfo::exists(buildDir + "/" + BuildDirLock::FileName) && !lock.lock(buildDir);
+}
+
+void MainWindow::releaseBuildDirectory()
+{
+    if (m_pinnedBuildDir.isEmpty())
+        return;
+    
+    // The next owner may set up a RAM workspace of its own in the directory
+    if (m_workspace.buildDir() == m_pinnedBuildDir) {
+        m_workspace.release();
+    }
+    m_storage->unpin(m_pinnedBuildDir);
+    m_buildDirLock.unlock();
+    m_pinnedBuildDir.clear();
+}
+
+void MainWindow::collectStorage()
+{
+    // Without the saved apps, their unpacked installers would look
+    // orphaned. A running builder service collects on its own.
+    if (!m_catalogLoaded || m_builder->isRunning())
+        return;
+    
+    // Unpacked installers are kept as long as an app is imported from them
+    QStringList sourceDirs;
+    for (const PortableAppInfo &info : qAsConst(m_portableApps)) {
+        sourceDirs << info.sourceDir;
+    }
+    
+    m_storage->setReferenced(sourceDirs);
+    m_storage->collect();
+}
+
+bool MainWindow::queueInService(const PortableAppInfo &appInfo)
+{
+    // One job of the window at a time, like local builds
+    if (!m_serviceJobId.isEmpty()) {
+        updateLog(i18n("Job %1 is still running in the builder service", m_serviceJobId));
+        return true;
+    }
+    
+    // The service reads the app from the catalog
+    if (!m_catalogLoaded) {
+        loadSavedApps();
+    }
+    saveAppsList();
+    
+    // The service builds in the same directory and needs its lock
+    if (m_pinnedBuildDir == buildDirectory()) {
+        releaseBuildDirectory();
+    }
+    
+    QString error;
+    const QString jobId = m_builder->enqueue(appInfo.id, QStringLiteral("master"), &error);
+    if (jobId.isEmpty()) {
+        updateLog(i18n("The builder service did not take the build, building here: %1", error));
+        return false;
+    }
+    
+    m_serviceJobId = jobId;
+    m_serviceBuildDir = buildDirectory();
+    ensurePage(BuildPage);
+    setBuildActionsEnabled(false);
+    m_progressBar->setValue(0);
+    updateLog(i18n("Queued %1 in the builder service as job %2", appInfo.name, jobId));
+    
+    return true;
+}
+
+void MainWindow::serviceJobFinished(const QString &jobId, bool success, const QString &message)
+{
+    if (jobId != m_serviceJobId)
+        return;
+    
+    m_serviceJobId.clear();
+    m_serviceBuildDir.clear();
+    setBuildActionsEnabled(true);
+    updateLog(message);
+    
+    // The service exports the build itself
+    if (success) {
+        m_progressBar->setValue(100);
+        KMessageBox::information(this, 
+            i18n("The application has been packaged as a Flatpak and installed in your user repository."),
+            i18n("Build Successful"));
+    } else {
+        KMessageBox::error(this, 
+            i18n("Failed to build the Flatpak: %1", message),
+            i18n("Build Failed"));
+    }
+}
+
 void MainWindow::updateLog(const QString &message)
 {
-    m_statusLabel->setText(message);
+    m_lastStatus = message;
+    if (m_statusLabel) {
+        m_statusLabel->setText(message);
+    }
     // In a real app, would also append to a log widget
 }
 
 void MainWindow::updateProgress(int value)
 {
+    ensurePage(BuildPage);
     m_progressBar->setValue(value);
 }
 
@@ -594,14 +1545,17 @@ void MainWindow::appSelected(int index)
             
             // Update the UI fields
             const PortableAppInfo &info = it.value();
+            ensurePage(AppDetailsPage);
             m_appNameEdit->setText(info.name);
             m_appVersionEdit->setText(info.version);
             m_appDescriptionEdit->setText(info.description);
             m_appCategoryEdit->setText(info.category);
             m_executablePathEdit->setText(info.executablePath);
+            m_iconPathEdit->setText(info.iconPath);
+            m_pruneRulesEdit->setText(info.pruneRules.join("; "));
             
             // Show the app details page
-            m_stackedWidget->setCurrentIndex(1);
+            showPage(AppDetailsPage);
             return;
         }
     }
@@ -629,9 +1583,57 @@ void MainWindow::removeSelectedApp()
     
     // Ask for confirmation
     if (KMessageBox::questionYesNo(this,
-            i18n("Are you sure you want to remove %1?", appName),
+            i18n("Are you sure you want to remove %1? Its build directory, bundles and unpacked installer are deleted as well.", appName),
             i18n("Confirm Removal")) == KMessageBox::Yes) {
         
+        // Build directory, bundles and the unpacked installer it was
+        // imported from. Its commits stay in the export repo.
+        const PortableAppInfo &info = m_portableApps[appId];
+        const QString dataDir = StorageManager::defaultDataDir();
+        const QString buildDir = dataDir + "/" + AppPackager::appId(info);
+        
+        // A running build would lose its files
+        if (buildDirectoryInUse(buildDir)) {
+            KMessageBox::error(this, i18n("%1 is being built. Wait for the build to finish, or turn off watch mode, before removing it.", appName),
+                               i18n("Error"));
+            return;
+        }
+        
+        QStringList paths = { buildDir };
+        
+        // Bundles are named <app id>-<version>.flatpak, those of variants
+        // <app id>.<variant>-<version>.flatpak. Matching the whole name
+        // keeps the bundles of apps whose id starts with this one.
+        const QString version = info.version.isEmpty() ? QStringLiteral("latest") : info.version;
+        const QRegularExpression bundleName("^" + QRegularExpression::escape(AppPackager::appId(info))
+                                            + "(\\.[A-Za-z0-9_]+)?-" + QRegularExpression::escape(version) + "\\.flatpak$");
+        const QDir bundlesDir(dataDir + "/bundles");
+        for (const QString &bundle : bundlesDir.entryList(QStringList() << "*.flatpak", QDir::Files)) {
+            if (bundleName.match(bundle).hasMatch()) {
+                paths << bundlesDir.filePath(bundle);
+            }
+        }
+        
+        const QString unpackedRoot = dataDir + "/unpacked/";
+        if (info.sourceDir.startsWith(unpackedRoot)) {
+            const QString unpackDir = unpackedRoot + info.sourceDir.mid(unpackedRoot.size()).section('/', 0, 0);
+            bool shared = false;
+            for (auto it = m_portableApps.constBegin(); it != m_portableApps.constEnd(); ++it) {
+                shared |= it.key() != appId && (it.value().sourceDir + "/").startsWith(unpackDir + "/");
+            }
+            if (!shared) {
+                paths << unpackDir;
+            }
+        }
+        
+        if (m_pinnedBuildDir == buildDir) {
+            releaseBuildDirectory();
+        }
+        if (m_workspace.buildDir() == buildDir) {
+            m_workspace.release();
+        }
+        m_storage->remove(paths);
+        
         // Remove from map and list
         m_portableApps.remove(appId);
         delete m_appsList->takeItem(currentRow);
@@ -639,7 +1641,7 @@ void MainWindow::removeSelectedApp()
         // If the removed app was the current one, reset
         if (m_currentAppId == appId) {
             m_currentAppId.clear();
-            m_stackedWidget->setCurrentIndex(0);
+            showPage(WelcomePage);
         }
     }
 }
@@ -679,6 +1681,42 @@ void MainWindow::updateIconPreview(const QString &path)
     }
 }
 
+AppScanIndex MainWindow::scanPayload(const PortableAppInfo &appInfo, QVector<PruneReportEntry> *report)
+{
+    QStringList log;
+    AppScanIndex index = AppPackager::scanPayload(appInfo, report, &log);
+    for (const QString &line : qAsConst(log)) {
+        updateLog(line);
+    }
+    
+    return index;
+}
+
+void MainWindow::previewPruning()
+{
+    if (m_currentAppId.isEmpty() || !m_portableApps.contains(m_currentAppId)) {
+        KMessageBox::error(this, i18n("No application selected!"), i18n("Error"));
+        return;
+    }
+    
+    const PortableAppInfo &appInfo = m_portableApps[m_currentAppId];
+    
+    QVector<PruneReportEntry> report;
+    AppScanIndex index = scanPayload(appInfo, &report);
+    
+    if (report.isEmpty()) {
+        KMessageBox::information(this, i18n("No files would be pruned."), i18n("Pruning Preview"));
+        return;
+    }
+    
+    KMessageBox::informationList(this,
+        i18n("Pruning would save %1 of %2:",
+             QLocale().formattedDataSize(index.totalSize() - index.retainedSize()),
+             QLocale().formattedDataSize(index.totalSize())),
+        PayloadPruner::formatReport(report),
+        i18n("Pruning Preview"));
+}
+
 bool MainWindow::prepareWinePrefix(const PortableAppInfo &appInfo)
 {
     // Create Wine prefix for testing
@@ -5,10 +5,30 @@
 #include <QProcess>
 #include <QTemporaryDir>
 #include <QMap>
+#include <QPair>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QPointer>
+#include <QProgressDialog>
 
 #include "portableappinfo.h"
 #include "wineconfigwidget.h"
 #include "flatpakmanifest.h"
+#include "appscanindex.h"
+#include "payloadpruner.h"
+#include "flatpakexporter.h"
+#include "appwatcher.h"
+#include "appcatalog.h"
+#include "portableappdetector.h"
+#include "tracer.h"
+#include "resourcegovernor.h"
+#include "pipelinejournal.h"
+#include "buildmatrix.h"
+#include "storagemanager.h"
+#include "builddirlock.h"
+#include "buildworkspace.h"
+#include "builderclient.h"
 
 class QListWidget;
 class QStackedWidget;
@@ -16,6 +36,8 @@ class QProgressBar;
 class QLabel;
 class QPushButton;
 class QLineEdit;
+class QCheckBox;
+class QAction;
 
 class MainWindow : public KXmlGuiWindow
 {
@@ -24,13 +46,25 @@ class MainWindow : public KXmlGuiWindow
 public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow() override;
+    
+    // Tracer::now() when the process started, for the startup trace
+    void setStartTime(qint64 startTime);
+
+protected:
+    bool event(QEvent *event) override;
 
 private slots:
     void importPortableApp();
+    void importFinished();
+    void bulkImportPortableApps();
+    void bulkImportResultsReady(int begin, int end);
+    void bulkImportFinished();
     void analyzePortableApp();
     void configureWineSettings();
     void generateFlatpakManifest();
     void buildFlatpak();
+    void buildVariantMatrix();
+    void matrixFinished(int failedCount);
     void processFinished(int exitCode, QProcess::ExitStatus exitStatus);
     void updateLog(const QString &message);
     void updateProgress(int value);
@@ -38,15 +72,68 @@ private slots:
     void removeSelectedApp();
     void browseForIcon();
     void updateIconPreview(const QString &path);
+    void previewPruning();
+    void toggleWatchMode(bool enabled);
+    void watchedFilesChanged(const QStringList &relativePaths);
+    void wineSettingsChanged();
+    void scheduleIncrementalBuild();
+    void exportFinished(const QString &appId, bool success);
 
 private:
+    // Pages of the stacked widget, in their order
+    enum Page {
+        WelcomePage,
+        AppDetailsPage,
+        WineConfigPage,
+        BuildPage,
+    };
+    
     void setupActions();
     void setupUi();
     void setupConnections();
-    bool checkDependencies();
+    
+    // Only the welcome page is built with the window, the others when
+    // they are first needed
+    void showPage(Page page);
+    void ensurePage(Page page);
+    void setupAppDetailsPage();
+    void setupWineConfigPage();
+    void setupBuildPage();
+    
+    // Loads the catalog and checks the dependencies after the first frame
+    void finishStartup();
+    
+    // Name of the first required tool that does not run, empty if all do.
+    // Asks the builder service if it runs. Runs in a worker thread.
+    static QString findMissingDependency();
+    
     void loadSavedApps();
     void saveAppsList();
     bool prepareWinePrefix(const PortableAppInfo &appInfo);
+    AppScanIndex scanPayload(const PortableAppInfo &appInfo, QVector<PruneReportEntry> *report = nullptr);
+    QString buildDirectory() const;
+    bool stagePayload(const AppScanIndex &index, const QString &buildDir,
+                      const QStringList &changedPaths, bool fullRestage);
+    void beginJournal(const PortableAppInfo &appInfo, const QString &buildDir);
+    void recordStage(const QString &stage, const QString &outputHash, const QJsonObject &data = QJsonObject());
+    void startBuild(const PortableAppInfo &appInfo, const QString &buildDir);
+    bool validateManifest(const QString &manifestPath);
+    void installFinished(int exitCode);
+    void exportBuild(const QString &appId);
+    void incrementalBuild();
+    void flushBulkImport();
+    void updateBuildQueueMetrics();
+    bool useBuildDirectory(const QString &buildDir);
+    void releaseBuildDirectory();
+    bool buildDirectoryInUse(const QString &buildDir) const;
+    bool isBuilding() const;
+    void setBuildActionsEnabled(bool enabled);
+    void collectStorage();
+    
+    // Hand the build over to the builder service, so it goes on after the
+    // window is closed. False if the service did not take it.
+    bool queueInService(const PortableAppInfo &appInfo);
+    void serviceJobFinished(const QString &jobId, bool success, const QString &message);
     
     // UI Elements
     QStackedWidget *m_stackedWidget;
@@ -56,31 +143,81 @@ private:
     QWidget *m_wineConfigPage;
     QWidget *m_buildPage;
     
-    QLineEdit *m_appNameEdit;
-    QLineEdit *m_appVersionEdit;
-    QLineEdit *m_appDescriptionEdit;
-    QLineEdit *m_appCategoryEdit;
-    QLineEdit *m_executablePathEdit;
-    QLineEdit *m_iconPathEdit;
-    QPushButton *m_iconBrowseButton;
-    QLabel *m_iconPreviewLabel;
+    // Created with their pages
+    QLineEdit *m_appNameEdit = nullptr;
+    QLineEdit *m_appVersionEdit = nullptr;
+    QLineEdit *m_appDescriptionEdit = nullptr;
+    QLineEdit *m_appCategoryEdit = nullptr;
+    QLineEdit *m_executablePathEdit = nullptr;
+    QLineEdit *m_iconPathEdit = nullptr;
+    QPushButton *m_iconBrowseButton = nullptr;
+    QLabel *m_iconPreviewLabel = nullptr;
+    QLineEdit *m_pruneRulesEdit = nullptr;
+    
+    WineConfigWidget *m_wineConfigWidget = nullptr;
     
-    WineConfigWidget *m_wineConfigWidget;
+    QProgressBar *m_progressBar = nullptr;
+    QLabel *m_statusLabel = nullptr;
+    QString m_lastStatus;
+    QPushButton *m_analyzeButton = nullptr;
+    QPushButton *m_configureButton = nullptr;
+    QPushButton *m_buildButton = nullptr;
+    QPushButton *m_matrixButton = nullptr;
+    QAction *m_buildAction = nullptr;
+    QPushButton *m_pruneButton = nullptr;
+    QCheckBox *m_bundleCheck = nullptr;
+    QCheckBox *m_watchCheck = nullptr;
     
-    QProgressBar *m_progressBar;
-    QLabel *m_statusLabel;
-    QPushButton *m_importButton;
-    QPushButton *m_analyzeButton;
-    QPushButton *m_configureButton;
-    QPushButton *m_buildButton;
+    // Startup
+    qint64 m_startTime = -1;
+    bool m_painted = false;
+    bool m_catalogLoaded = false;
+    QFutureWatcher<QString> m_dependencyWatcher;
     
     // Data
     QMap<QString, PortableAppInfo> m_portableApps;
+    AppCatalog m_catalog;
     QString m_currentAppId;
     FlatpakManifest m_manifest;
     
-    // Process and directories
+    // Process and directories. m_process runs flatpak-builder, or
+    // flatpak when m_installing a finished build again.
     QProcess m_process;
+    bool m_installing = false;
+    ProcessTrace m_buildTrace{QStringLiteral("flatpak-builder")};
+    QElapsedTimer m_buildTimer;
+    FlatpakExporter *m_exporter;
+    PipelineJournal m_journal;
+    ResourceGovernor *m_governor;
+    MatrixBuilder *m_matrixBuilder;
+    StorageManager *m_storage;
+    QString m_pinnedBuildDir;
+    BuildDirLock m_buildDirLock;
+    BuildWorkspace m_workspace;
+    BuilderClient *m_builder;
+    QString m_serviceJobId;
+    QString m_serviceBuildDir;
+    
+    // Watch mode
+    AppWatcher *m_watcher;
+    QTimer m_settingsDebounce;
+    QStringList m_watchedChanges;
+    bool m_manifestStale;
+    bool m_rebuildPending;
+    bool m_watchFullRestage;
+    
+    // Import of a single app, and the reason an installer was not unpacked
+    typedef QPair<PortableAppInfo, QString> ImportResult;
+    QFutureWatcher<ImportResult> m_importWatcher;
+    QElapsedTimer m_importTimer;
+    qint64 m_importStart = 0;
+    
+    // Bulk import
+    QFutureWatcher<PortableAppInfo> m_bulkImportWatcher;
+    QPointer<QProgressDialog> m_bulkImportProgress;
+    QVector<PortableAppInfo> m_bulkImportPending;
+    int m_bulkImportDone = 0;
+    qint64 m_bulkImportStart = 0;
     QTemporaryDir m_tempDir;
 };
 
@@ -0,0 +1,590 @@
+#include "manifestvalidator.h"
+#include "pipelinejournal.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMap>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSet>
+#include <QtConcurrent>
+
+namespace {
+
+using Issue = ManifestValidator::Issue;
+
+// Properties of flatpak-builder's manifest, others are ignored by it
+const QStringList KnownProperties = {
+    "id", "app-id", "branch", "default-branch", "collection-id", "extension-tag",
+    "runtime", "runtime-version", "runtime-commit", "sdk", "sdk-commit", "sdk-extensions",
+    "platform-extensions", "base", "base-version", "base-commit", "base-extensions",
+    "inherit-extensions", "inherit-sdk-extensions", "add-extensions", "add-build-extensions",
+    "var", "metadata", "metadata-platform", "command", "modules", "build-options",
+    "build-runtime", "build-extension", "writable-sdk", "separate-locales", "tags",
+    "cleanup", "cleanup-commands", "cleanup-platform", "cleanup-platform-commands",
+    "prepare-platform-commands", "finish-args", "rename-desktop-file", "rename-appdata-file",
+    "rename-mime-file", "rename-icon", "rename-mime-icons", "appdata-license", "copy-icon",
+    "desktop-file-name-prefix", "desktop-file-name-suffix", "appstream-compose",
+};
+
+const QStringList BuildSystems = { "simple", "autotools", "cmake", "cmake-ninja", "meson", "qmake" };
+
+const QStringList SourceTypes = {
+    "archive", "git", "bzr", "svn", "dir", "file", "script", "inline", "shell", "patch", "extra-data",
+};
+
+// finish-args taking a value, and their negations
+const QStringList FinishOptions = {
+    "share", "unshare", "socket", "nosocket", "device", "nodevice", "allow", "disallow",
+    "filesystem", "nofilesystem", "env", "unset-env", "persist", "talk-name", "no-talk-name",
+    "own-name", "system-talk-name", "system-no-talk-name", "system-own-name", "add-policy",
+    "remove-policy", "require-version", "extension", "remove-extension", "extension-priority",
+    "metadata", "sdk", "runtime", "command",
+};
+
+const QMap<QString, QString> Negations = {
+    { "share", "unshare" },
+    { "socket", "nosocket" },
+    { "device", "nodevice" },
+    { "allow", "disallow" },
+    { "filesystem", "nofilesystem" },
+    { "talk-name", "no-talk-name" },
+    { "system-talk-name", "system-no-talk-name" },
+};
+
+// Installed location of the app module's dir source, see
+// FlatpakManifest::addAppModule()
+const QString InstalledAppRoot = QStringLiteral("/app/app/");
+
+// The launcher's "exec wine '/app/app/...'" line, or the lines starting
+// the app in a persistent server session
+const QRegularExpression ExecPattern(QStringLiteral("\\bwine '((?:[^']|'\\\\'')*)'"));
+
+// "modules[1]" and "sources" give "modules[1].sources"
+QString child(const QString &location, const QString &key)
+{
+    return location.isEmpty() ? key : location + "." + key;
+}
+
+void addError(QVector<Issue> &issues, const QString &location, const QString &message)
+{
+    issues.append({ true, location, message });
+}
+
+void addWarning(QVector<Issue> &issues, const QString &location, const QString &message)
+{
+    issues.append({ false, location, message });
+}
+
+// SHA-256 of local sources by path, size and modification time. Mono
+// and Gecko installers are large and the same for every app.
+QString cachedSha256(const QString &path)
+{
+    static QMutex mutex;
+    static QHash<QString, QString> cache;
+    
+    const QFileInfo info(path);
+    const QString key = info.absoluteFilePath() + ':' + QString::number(info.size()) + ':'
+                        + QString::number(info.lastModified().toMSecsSinceEpoch());
+    
+    {
+        QMutexLocker locker(&mutex);
+        const auto it = cache.constFind(key);
+        if (it != cache.constEnd())
+            return it.value();
+    }
+    
+    const QString hash = PipelineJournal::hashFile(path);
+    
+    QMutexLocker locker(&mutex);
+    cache.insert(key, hash);
+    return hash;
+}
+
+bool isHex(const QString &value, int length)
+{
+    static const QRegularExpression hexPattern(QStringLiteral("^[0-9a-f]+$"));
+    return value.size() == length && hexPattern.match(value).hasMatch();
+}
+
+bool checkStringArray(QVector<Issue> &issues, const QJsonObject &object, const QString &key,
+                      const QString &location, bool required)
+{
+    if (!object.contains(key)) {
+        if (required) {
+            addError(issues, child(location, key), i18n("is missing"));
+        }
+        return false;
+    }
+    
+    const QJsonValue value = object.value(key);
+    if (!value.isArray()) {
+        addError(issues, child(location, key), i18n("must be a list of strings"));
+        return false;
+    }
+    
+    const QJsonArray array = value.toArray();
+    for (int i = 0; i < array.size(); ++i) {
+        if (!array[i].isString()) {
+            addError(issues, QStringLiteral("%1[%2]").arg(child(location, key)).arg(i), i18n("must be a string"));
+            return false;
+        }
+    }
+    
+    if (required && array.isEmpty()) {
+        addError(issues, child(location, key), i18n("must not be empty"));
+        return false;
+    }
+    
+    return true;
+}
+
+// Executables the launcher or command-args start below /app/app
+void checkInstalledPath(QVector<Issue> &issues, const QString &location, const QString &installedPath,
+                        const QString &baseDir)
+{
+    const QString relativePath = installedPath.mid(InstalledAppRoot.size());
+    if (relativePath.isEmpty()) {
+        addError(issues, location, i18n("starts no executable, none was found when the app was imported"));
+        return;
+    }
+    
+    const QString stagedRoot = baseDir + "/app";
+    if (QFileInfo(stagedRoot).isDir() && !QFileInfo::exists(stagedRoot + "/" + relativePath)) {
+        addError(issues, location, i18n("%1 is not in the staged app tree", relativePath));
+    }
+}
+
+void checkSource(QVector<Issue> &issues, const QJsonValue &value, const QString &location, const QString &baseDir)
+{
+    // A string names a JSON file with more sources
+    if (value.isString()) {
+        if (!QFileInfo::exists(QDir(baseDir).filePath(value.toString()))) {
+            addError(issues, location, i18n("source file %1 does not exist", value.toString()));
+        }
+        return;
+    }
+    
+    if (!value.isObject()) {
+        addError(issues, location, i18n("must be an object"));
+        return;
+    }
+    
+    const QJsonObject source = value.toObject();
+    const QString type = source.value("type").toString();
+    if (type.isEmpty()) {
+        addError(issues, location, i18n("type is missing"));
+        return;
+    }
+    if (!SourceTypes.contains(type)) {
+        addError(issues, location + ".type", i18n("unknown source type %1", type));
+        return;
+    }
+    
+    const QString path = source.value("path").toString();
+    const QString url = source.value("url").toString();
+    const QString sha256 = source.value("sha256").toString();
+    
+    if (source.contains("sha256") && !isHex(sha256, 64)) {
+        addError(issues, location + ".sha256", i18n("%1 is not a SHA-256 checksum", sha256));
+        return;
+    }
+    
+    if (type == "archive" || type == "file") {
+        if (path.isEmpty() && url.isEmpty()) {
+            addError(issues, location, i18n("needs a path or a url"));
+        } else if (!url.isEmpty() && !source.contains("sha256") && !source.contains("sha512")) {
+            addError(issues, location, i18n("downloads %1 without a checksum", url));
+        } else if (!path.isEmpty()) {
+            const QString filePath = QDir(baseDir).filePath(path);
+            if (!QFileInfo(filePath).isFile()) {
+                addError(issues, location + ".path", i18n("%1 does not exist", path));
+            } else if (!sha256.isEmpty() && cachedSha256(filePath) != sha256) {
+                addError(issues, location + ".sha256", i18n("%1 does not match its checksum", path));
+            }
+        }
+    } else if (type == "dir") {
+        const QDir dir(QDir(baseDir).filePath(path));
+        if (path.isEmpty()) {
+            addError(issues, location, i18n("path is missing"));
+        } else if (!dir.exists()) {
+            addError(issues, location + ".path", i18n("directory %1 does not exist", path));
+        } else if (dir.isEmpty(QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot)) {
+            addError(issues, location + ".path", i18n("directory %1 is empty", path));
+        }
+    } else if (type == "script") {
+        if (checkStringArray(issues, source, "commands", location, true)) {
+            const QJsonArray commands = source.value("commands").toArray();
+            for (int i = 0; i < commands.size(); ++i) {
+                const QRegularExpressionMatch match = ExecPattern.match(commands[i].toString());
+                if (match.hasMatch()) {
+                    QString installedPath = match.captured(1);
+                    installedPath.replace(QLatin1String("'\\''"), QLatin1String("'"));
+                    if (installedPath.startsWith(InstalledAppRoot)) {
+                        checkInstalledPath(issues, QStringLiteral("%1.commands[%2]").arg(location).arg(i), installedPath, baseDir);
+                        break;
+                    }
+                }
+            }
+        }
+    } else if (type == "patch") {
+        if (path.isEmpty() && !source.contains("paths")) {
+            addError(issues, location, i18n("needs a path"));
+        } else if (!path.isEmpty() && !QFileInfo(QDir(baseDir).filePath(path)).isFile()) {
+            addError(issues, location + ".path", i18n("%1 does not exist", path));
+        }
+    } else if (type == "git" || type == "bzr" || type == "svn") {
+        if (url.isEmpty() && path.isEmpty()) {
+            addError(issues, location, i18n("needs a url"));
+        }
+    }
+}
+
+void checkModule(QVector<Issue> &issues, const QJsonValue &value, const QString &location,
+                 const QString &baseDir, QSet<QString> &names)
+{
+    // A string names a file holding the module, e.g. one of SharedModules
+    if (value.isString()) {
+        const QString path = QDir(baseDir).filePath(value.toString());
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            addError(issues, location, i18n("module file %1 does not exist", value.toString()));
+            return;
+        }
+        
+        // YAML module files are left to flatpak-builder
+        if (!path.endsWith(QLatin1String(".json")))
+            return;
+        
+        const QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+        if (!document.isObject()) {
+            addError(issues, location, i18n("module file %1 is not a JSON object", value.toString()));
+            return;
+        }
+        
+        // Paths inside a module file are relative to the file
+        checkModule(issues, document.object(), location, QFileInfo(path).absolutePath(), names);
+        return;
+    }
+    
+    if (!value.isObject()) {
+        addError(issues, location, i18n("must be an object"));
+        return;
+    }
+    
+    const QJsonObject module = value.toObject();
+    const QString name = module.value("name").toString();
+    if (name.isEmpty()) {
+        addError(issues, location, i18n("name is missing"));
+    } else if (names.contains(name)) {
+        addError(issues, location + ".name", i18n("another module is already named %1", name));
+    } else {
+        names.insert(name);
+    }
+    
+    const QString buildSystem = module.value("buildsystem").toString(QStringLiteral("autotools"));
+    if (!BuildSystems.contains(buildSystem)) {
+        addError(issues, location + ".buildsystem", i18n("unknown build system %1", buildSystem));
+    }
+    
+    // Simple modules do nothing but their build commands
+    checkStringArray(issues, module, "build-commands", location, buildSystem == "simple");
+    
+    if (module.contains("sources")) {
+        if (!module.value("sources").isArray()) {
+            addError(issues, location + ".sources", i18n("must be a list"));
+        } else {
+            const QJsonArray sources = module.value("sources").toArray();
+            for (int i = 0; i < sources.size(); ++i) {
+                checkSource(issues, sources[i], QStringLiteral("%1.sources[%2]").arg(location).arg(i), baseDir);
+            }
+        }
+    }
+    
+    if (module.contains("modules") && module.value("modules").isArray()) {
+        const QJsonArray modules = module.value("modules").toArray();
+        for (int i = 0; i < modules.size(); ++i) {
+            checkModule(issues, modules[i], QStringLiteral("%1.modules[%2]").arg(location).arg(i), baseDir, names);
+        }
+    }
+}
+
+void checkFinishArgs(QVector<Issue> &issues, const QJsonObject &manifest)
+{
+    if (!checkStringArray(issues, manifest, "finish-args", QString(), false))
+        return;
+    
+    const QJsonArray args = manifest.value("finish-args").toArray();
+    
+    QMap<QString, int> seen;
+    QMap<QString, QPair<QString, int>> environment;
+    for (int i = 0; i < args.size(); ++i) {
+        const QString arg = args[i].toString();
+        const QString location = QStringLiteral("finish-args[%1]").arg(i);
+        
+        if (seen.contains(arg)) {
+            addWarning(issues, location, i18n("%1 repeats finish-args[%2]", arg, seen.value(arg)));
+            continue;
+        }
+        seen.insert(arg, i);
+        
+        const int equals = arg.indexOf('=');
+        if (!arg.startsWith(QLatin1String("--")) || equals < 0) {
+            addError(issues, location, i18n("%1 is not of the form --option=value", arg));
+            continue;
+        }
+        
+        const QString option = arg.mid(2, equals - 2);
+        const QString value = arg.mid(equals + 1);
+        if (!FinishOptions.contains(option)) {
+            addWarning(issues, location, i18n("unknown option --%1", option));
+            continue;
+        }
+        
+        // The same variable set twice, only one of them takes effect
+        if (option == "env") {
+            const QString variable = value.section('=', 0, 0);
+            if (environment.contains(variable) && environment.value(variable).first != value) {
+                addError(issues, location, i18n("sets %1 again, finish-args[%2] sets it to a different value",
+                                                variable, environment.value(variable).second));
+            } else {
+                environment.insert(variable, qMakePair(value, i));
+            }
+            continue;
+        }
+        
+        // Granting and revoking the same permission
+        for (auto it = Negations.constBegin(); it != Negations.constEnd(); ++it) {
+            QString opposite;
+            if (option == it.key()) {
+                opposite = "--" + it.value() + "=" + value;
+            } else if (option == it.value()) {
+                opposite = "--" + it.key() + "=" + value;
+            }
+            if (!opposite.isEmpty() && seen.contains(opposite)) {
+                addError(issues, location, i18n("%1 conflicts with %2 in finish-args[%3]", arg, opposite, seen.value(opposite)));
+            }
+        }
+    }
+}
+
+// The command must be something a module installs into /app/bin
+bool installsCommand(const QJsonArray &modules, const QString &command)
+{
+    for (const QJsonValue &value : modules) {
+        const QJsonObject module = value.toObject();
+        for (const QJsonValue &buildCommand : module.value("build-commands").toArray()) {
+            if (buildCommand.toString().contains("/bin/" + command))
+                return true;
+        }
+        if (installsCommand(module.value("modules").toArray(), command))
+            return true;
+    }
+    
+    return false;
+}
+
+} // namespace
+
+QString ManifestValidator::Issue::toString() const
+{
+    return location.isEmpty() ? message : location + ": " + message;
+}
+
+bool ManifestValidator::Report::hasErrors() const
+{
+    for (const Issue &issue : issues) {
+        if (issue.error)
+            return true;
+    }
+    
+    return false;
+}
+
+QStringList ManifestValidator::Report::errors() const
+{
+    QStringList messages;
+    for (const Issue &issue : issues) {
+        if (issue.error) {
+            messages << issue.toString();
+        }
+    }
+    
+    return messages;
+}
+
+QStringList ManifestValidator::Report::warnings() const
+{
+    QStringList messages;
+    for (const Issue &issue : issues) {
+        if (!issue.error) {
+            messages << issue.toString();
+        }
+    }
+    
+    return messages;
+}
+
+ManifestValidator::Report ManifestValidator::validateFile(const QString &manifestPath)
+{
+    TraceSpan span("manifest", QStringLiteral("validate manifest"), manifestPath);
+    
+    Report report;
+    report.manifestPath = manifestPath;
+    
+    QFile file(manifestPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        addError(report.issues, QString(), i18n("Cannot read %1: %2", manifestPath, file.errorString()));
+        return report;
+    }
+    
+    const QByteArray contents = file.readAll();
+    const QString suffix = QFileInfo(manifestPath).suffix().toLower();
+    
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(contents, &parseError);
+    
+    // flatpak-builder picks the parser by the extension
+    if (suffix == "yml" || suffix == "yaml") {
+        if (parseError.error == QJsonParseError::NoError) {
+            addError(report.issues, QString(), i18n("%1 contains JSON but is named .%2, name it .json",
+                                                    QFileInfo(manifestPath).fileName(), suffix));
+        } else {
+            addWarning(report.issues, QString(), i18n("YAML manifests are not checked"));
+        }
+        return report;
+    }
+    
+    if (suffix != "json") {
+        addError(report.issues, QString(), i18n("%1 is neither .json nor .yml, flatpak-builder cannot read it",
+                                                QFileInfo(manifestPath).fileName()));
+        return report;
+    }
+    
+    if (parseError.error != QJsonParseError::NoError) {
+        const int line = contents.left(parseError.offset).count('\n') + 1;
+        addError(report.issues, QString(), i18n("Invalid JSON in line %1: %2", line, parseError.errorString()));
+        return report;
+    }
+    
+    if (!document.isObject()) {
+        addError(report.issues, QString(), i18n("The manifest is not a JSON object"));
+        return report;
+    }
+    
+    report.issues = validate(document.object(), QFileInfo(manifestPath).absolutePath());
+    return report;
+}
+
+QVector<ManifestValidator::Report> ManifestValidator::validateFiles(const QStringList &manifestPaths)
+{
+    return QtConcurrent::blockingMapped<QVector<Report>>(manifestPaths, &ManifestValidator::validateFile);
+}
+
+QVector<ManifestValidator::Issue> ManifestValidator::validate(const QJsonObject &manifest, const QString &baseDir)
+{
+    QVector<Issue> issues;
+    
+    for (auto it = manifest.constBegin(); it != manifest.constEnd(); ++it) {
+        if (!KnownProperties.contains(it.key())) {
+            addWarning(issues, it.key(), i18n("not a flatpak-builder property, it is ignored"));
+        }
+    }
+    
+    // App id
+    const QString appId = manifest.contains("app-id") ? manifest.value("app-id").toString()
+                                                      : manifest.value("id").toString();
+    QString reason;
+    if (appId.isEmpty()) {
+        addError(issues, QStringLiteral("app-id"), i18n("is missing"));
+    } else if (!isValidAppId(appId, &reason)) {
+        addError(issues, QStringLiteral("app-id"), i18n("%1 is not a valid application id: %2", appId, reason));
+    }
+    
+    // Required strings
+    for (const char *key : { "runtime", "runtime-version", "sdk", "command" }) {
+        if (manifest.value(key).toString().isEmpty()) {
+            addError(issues, QString::fromLatin1(key), i18n("is missing or empty"));
+        }
+    }
+    
+    // flatpak-builder only takes a file name here
+    if (manifest.contains("metadata") && !manifest.value("metadata").isString()) {
+        addWarning(issues, QStringLiteral("metadata"), i18n("must be the path of a metadata file, it is ignored"));
+    }
+    
+    // Modules and their sources
+    const QJsonArray modules = manifest.value("modules").toArray();
+    if (!manifest.value("modules").isArray() || modules.isEmpty()) {
+        addError(issues, QStringLiteral("modules"), i18n("is missing or empty"));
+    }
+    
+    QSet<QString> names;
+    for (int i = 0; i < modules.size(); ++i) {
+        checkModule(issues, modules[i], QStringLiteral("modules[%1]").arg(i), baseDir, names);
+    }
+    
+    const QString command = manifest.value("command").toString();
+    if (!command.isEmpty() && !command.contains('/') && !installsCommand(modules, command)) {
+        addError(issues, QStringLiteral("command"), i18n("no module installs %1 into /app/bin", command));
+    }
+    
+    // Arguments for the command, files below /app/app must be staged
+    if (manifest.contains("command-args")
+        && checkStringArray(issues, manifest, "command-args", QString(), false)) {
+        const QJsonArray args = manifest.value("command-args").toArray();
+        for (int i = 0; i < args.size(); ++i) {
+            if (args[i].toString().startsWith(InstalledAppRoot)) {
+                checkInstalledPath(issues, QStringLiteral("command-args[%1]").arg(i), args[i].toString(), baseDir);
+            }
+        }
+    }
+    
+    checkFinishArgs(issues, manifest);
+    
+    return issues;
+}
+
+bool ManifestValidator::isValidAppId(const QString &appId, QString *reason)
+{
+    auto fail = [reason](const QString &message) {
+        if (reason) {
+            *reason = message;
+        }
+        return false;
+    };
+    
+    if (appId.size() > 255)
+        return fail(i18n("longer than 255 characters"));
+    
+    const QStringList elements = appId.split('.');
+    if (elements.size() < 3)
+        return fail(i18n("needs at least three elements separated by dots"));
+    
+    for (int i = 0; i < elements.size(); ++i) {
+        const QString &element = elements[i];
+        const bool last = i == elements.size() - 1;
+        
+        if (element.isEmpty())
+            return fail(i18n("empty element"));
+        if (element[0].isDigit())
+            return fail(i18n("element %1 starts with a digit", element));
+        
+        for (const QChar c : element) {
+            const bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                                 || c == '_' || (c == '-' && last);
+            if (!allowed)
+                return fail(i18n("element %1 contains '%2'", element, c));
+        }
+    }
+    
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef MANIFESTVALIDATOR_H
+#define MANIFESTVALIDATOR_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Pre-flight checks of manifests before flatpak-builder runs.
+ *
+ * flatpak-builder notices many mistakes only minutes into a build, after
+ * the runtime is installed and the earlier modules are built. The
+ * validator checks a manifest file and the directory it is built in
+ * beforehand: the file format, the schema of the properties the builder
+ * reads, the app id, the files that sources and the launcher refer to,
+ * duplicate or conflicting finish-args and source checksums. It only reads
+ * metadata and small files. Checksums of large local sources are cached
+ * by size and modification time, so a manifest takes milliseconds.
+ */
+class ManifestValidator
+{
+public:
+    struct Issue
+    {
+        bool error = true;  // Warnings do not stop a build
+        QString location;   // e.g. "modules[2].sources[0].path"
+        QString message;
+        
+        QString toString() const;
+    };
+    
+    struct Report
+    {
+        QString manifestPath;
+        QVector<Issue> issues;
+        
+        bool hasErrors() const;
+        QStringList errors() const;
+        QStringList warnings() const;
+    };
+    
+    // Check a manifest file written by FlatpakManifest::saveToFile().
+    // Relative source paths are resolved against its directory.
+    static Report validateFile(const QString &manifestPath);
+    
+    // Check several manifest files at once on the global thread pool
+    static QVector<Report> validateFiles(const QStringList &manifestPaths);
+    
+    // Check a manifest, with relative source paths below baseDir
+    static QVector<Issue> validate(const QJsonObject &manifest, const QString &baseDir);
+    
+    // Flatpak's rules for application ids
+    static bool isValidAppId(const QString &appId, QString *reason = nullptr);
+};
+
+#endif // MANIFESTVALIDATOR_H
\ No newline at end of file
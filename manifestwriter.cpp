@@ -0,0 +1,209 @@
+#include "manifestwriter.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+
+#include <cstdio>
+
+namespace {
+
+const int IndentWidth = 4;
+
+} // namespace
+
+ManifestWriter::ManifestWriter(QByteArray *out)
+    : m_out(out)
+{
+}
+
+void ManifestWriter::beginObject()
+{
+    beginValue();
+    m_out->append('{');
+    m_empty.append(true);
+}
+
+void ManifestWriter::endObject()
+{
+    const bool empty = m_empty.last();
+    m_empty.removeLast();
+    if (!empty) {
+        newLine();
+    }
+    m_out->append('}');
+}
+
+void ManifestWriter::beginArray()
+{
+    beginValue();
+    m_out->append('[');
+    m_empty.append(true);
+}
+
+void ManifestWriter::endArray()
+{
+    const bool empty = m_empty.last();
+    m_empty.removeLast();
+    if (!empty) {
+        newLine();
+    }
+    m_out->append(']');
+}
+
+void ManifestWriter::writeKey(QLatin1String key)
+{
+    beginValue();
+    m_out->append('"');
+    m_out->append(key.data(), key.size());
+    m_out->append("\": ", 3);
+    m_afterKey = true;
+}
+
+void ManifestWriter::writeString(const QString &value)
+{
+    beginValue();
+    appendString(m_out, value);
+}
+
+void ManifestWriter::writeValue(const QJsonValue &value)
+{
+    switch (value.type()) {
+    case QJsonValue::Object: {
+        const QJsonObject object = value.toObject();
+        beginObject();
+        for (auto it = object.constBegin(); it != object.constEnd(); ++it) {
+            beginValue();
+            appendString(m_out, it.key());
+            m_out->append(": ", 2);
+            m_afterKey = true;
+            writeValue(it.value());
+        }
+        endObject();
+        break;
+    }
+    case QJsonValue::Array:
+        beginArray();
+        for (const QJsonValue &element : value.toArray()) {
+            writeValue(element);
+        }
+        endArray();
+        break;
+    case QJsonValue::String:
+        writeString(value.toString());
+        break;
+    case QJsonValue::Bool:
+        beginValue();
+        m_out->append(value.toBool() ? "true" : "false");
+        break;
+    case QJsonValue::Double: {
+        beginValue();
+        const double number = value.toDouble();
+        if (number == double(qint64(number))) {
+            m_out->append(QByteArray::number(qint64(number)));
+        } else {
+            m_out->append(QByteArray::number(number, 'g', 17));
+        }
+        break;
+    }
+    case QJsonValue::Null:
+    case QJsonValue::Undefined:
+        beginValue();
+        m_out->append("null", 4);
+        break;
+    }
+}
+
+void ManifestWriter::writeMember(QLatin1String key, const QString &value)
+{
+    writeKey(key);
+    writeString(value);
+}
+
+void ManifestWriter::writeMember(QLatin1String key, const QStringList &values)
+{
+    writeKey(key);
+    beginArray();
+    for (const QString &value : values) {
+        writeString(value);
+    }
+    endArray();
+}
+
+void ManifestWriter::appendString(QByteArray *out, const QString &value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    const char *data = utf8.constData();
+    
+    out->append('"');
+    
+    // Copy runs of plain characters at once, only quotes, backslashes
+    // and control characters need escaping
+    int start = 0;
+    for (int i = 0; i < utf8.size(); ++i) {
+        const uchar c = uchar(data[i]);
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        
+        out->append(data + start, i - start);
+        start = i + 1;
+        
+        switch (c) {
+        case '"':
+            out->append("\\\"", 2);
+            break;
+        case '\\':
+            out->append("\\\\", 2);
+            break;
+        case '\n':
+            out->append("\\n", 2);
+            break;
+        case '\t':
+            out->append("\\t", 2);
+            break;
+        case '\r':
+            out->append("\\r", 2);
+            break;
+        default: {
+            char escaped[7];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out->append(escaped, 6);
+            break;
+        }
+        }
+    }
+    out->append(data + start, utf8.size() - start);
+    
+    out->append('"');
+}
+
+void ManifestWriter::beginValue()
+{
+    // A value after its key stays on the key's line
+    if (m_afterKey) {
+        m_afterKey = false;
+        return;
+    }
+    
+    if (m_empty.isEmpty())
+        return;
+    
+    if (!m_empty.last()) {
+        m_out->append(',');
+    }
+    m_empty.last() = false;
+    newLine();
+}
+
+void ManifestWriter::newLine()
+{
+    static const char spaces[] = "                                ";
+    
+    m_out->append('\n');
+    
+    int indent = m_empty.size() * IndentWidth;
+    while (indent > 0) {
+        const int chunk = qMin(indent, int(sizeof(spaces)) - 1);
+        m_out->append(spaces, chunk);
+        indent -= chunk;
+    }
+}
\ No newline at end of file
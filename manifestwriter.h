@@ -0,0 +1,51 @@
+#ifndef MANIFESTWRITER_H
+#define MANIFESTWRITER_H
+
+#include <QByteArray>
+#include <QJsonValue>
+#include <QLatin1String>
+#include <QString>
+#include <QStringList>
+#include <QVarLengthArray>
+
+/**
+ * Streaming JSON writer for manifests and module files.
+ *
+ * Appends indented JSON to a buffer as the values come in, instead of
+ * building a QJsonObject tree and serializing it with QJsonDocument.
+ * Members are written in the order they are given. The writer does not
+ * check the structure, callers are expected to balance begin and end.
+ */
+class ManifestWriter
+{
+public:
+    explicit ManifestWriter(QByteArray *out);
+    
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    
+    // Key of the next value in the current object
+    void writeKey(QLatin1String key);
+    
+    void writeString(const QString &value);
+    void writeValue(const QJsonValue &value);
+    
+    // Shorthands for a key followed by its value
+    void writeMember(QLatin1String key, const QString &value);
+    void writeMember(QLatin1String key, const QStringList &values);
+    
+    // JSON string literal of value, with quotes
+    static void appendString(QByteArray *out, const QString &value);
+    
+private:
+    void beginValue();
+    void newLine();
+    
+    QByteArray *m_out;
+    QVarLengthArray<bool, 8> m_empty;  // Whether each open container has no elements yet
+    bool m_afterKey = false;
+};
+
+#endif // MANIFESTWRITER_H
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "payloadpruner.h"
+#include "appscanindex.h"
+#include "tracer.h"
+
+#include <QHash>
+#include <QLocale>
+
+#include <algorithm>
+
+namespace {
+
+// Translate a glob into an anchored regular expression. Unlike
+// QRegularExpression::wildcardToRegularExpression, '*' crosses '/'.
+QString globToRegex(const QString &glob)
+{
+    QString regex;
+    regex.reserve(glob.size() * 2);
+    
+    bool inBrackets = false;
+    for (const QChar c : glob) {
+        if (inBrackets) {
+            if (c == QLatin1Char(']'))
+                inBrackets = false;
+            regex += c;
+            continue;
+        }
+        
+        if (c == QLatin1Char('*')) {
+            regex += QLatin1String(".*");
+        } else if (c == QLatin1Char('?')) {
+            regex += QLatin1Char('.');
+        } else if (c == QLatin1Char('[')) {
+            inBrackets = true;
+            regex += c;
+        } else {
+            regex += QRegularExpression::escape(QString(c));
+        }
+    }
+    
+    return QLatin1String("\\A") + regex + QLatin1String("\\z");
+}
+
+// Parse sizes like "1024", "500K", "1M" or "2G"
+qint64 parseSize(const QString &text, bool *ok)
+{
+    QString number = text.trimmed().toUpper();
+    qint64 factor = 1;
+    
+    if (number.endsWith(QLatin1Char('K'))) {
+        factor = 1024;
+    } else if (number.endsWith(QLatin1Char('M'))) {
+        factor = 1024 * 1024;
+    } else if (number.endsWith(QLatin1Char('G'))) {
+        factor = 1024 * 1024 * 1024;
+    }
+    
+    if (factor != 1)
+        number.chop(1);
+    
+    return number.toLongLong(ok) * factor;
+}
+
+} // namespace
+
+PruneRule::PruneRule(const QString &pattern, bool keep, qint64 minSize)
+    : m_pattern(pattern)
+    , m_keep(keep)
+    , m_minSize(minSize)
+    , m_matchFileName(!pattern.contains(QLatin1Char('/')))
+    , m_regex(globToRegex(pattern), QRegularExpression::CaseInsensitiveOption)
+{
+    m_regex.optimize();
+}
+
+PruneRule PruneRule::fromString(const QString &text)
+{
+    const QStringList parts = text.simplified().split(QLatin1Char(' '), Qt::SkipEmptyParts);
+    if (parts.size() < 2 || parts.size() > 3)
+        return PruneRule();
+    
+    bool keep = false;
+    if (parts[0] == QLatin1String("keep")) {
+        keep = true;
+    } else if (parts[0] != QLatin1String("exclude")) {
+        return PruneRule();
+    }
+    
+    qint64 minSize = 0;
+    if (parts.size() == 3) {
+        if (!parts[2].startsWith(QLatin1Char('>')))
+            return PruneRule();
+        
+        bool ok = false;
+        minSize = parseSize(parts[2].mid(1), &ok);
+        if (!ok)
+            return PruneRule();
+    }
+    
+    return PruneRule(parts[1], keep, minSize);
+}
+
+QString PruneRule::toString() const
+{
+    QString text = (m_keep ? QLatin1String("keep ") : QLatin1String("exclude ")) + m_pattern;
+    if (m_minSize > 0)
+        text += QLatin1String(" >") + QString::number(m_minSize);
+    return text;
+}
+
+bool PruneRule::matches(const QString &relativePath, qint64 size) const
+{
+    if (size < m_minSize)
+        return false;
+    
+    if (m_matchFileName) {
+        const int slash = relativePath.lastIndexOf(QLatin1Char('/'));
+        return m_regex.match(relativePath.midRef(slash + 1)).hasMatch();
+    }
+    
+    return m_regex.match(relativePath).hasMatch();
+}
+
+PayloadPruner::PayloadPruner()
+{
+    addRules(defaultRules());
+}
+
+QStringList PayloadPruner::defaultRules()
+{
+    return {
+        // PortableApps.com source and help material
+        QStringLiteral("exclude Other/Source/*"),
+        QStringLiteral("exclude Other/Help/*"),
+        QStringLiteral("exclude help.html"),
+        QStringLiteral("exclude App/AppInfo/*.html"),
+        
+        // Installer and uninstaller leftovers
+        QStringLiteral("exclude App/AppInfo/installer.ini"),
+        QStringLiteral("exclude App/AppInfo/pac_installer_log.ini"),
+        QStringLiteral("exclude Uninstall*.exe"),
+        QStringLiteral("exclude unins???.exe"),
+        QStringLiteral("exclude unins???.dat"),
+        QStringLiteral("exclude *$PLUGINSDIR/*"),
+        
+        // Debug symbols and logs
+        QStringLiteral("exclude *.pdb"),
+        QStringLiteral("exclude *.log >1M"),
+        QStringLiteral("exclude Thumbs.db"),
+        
+        // Chromium/Electron locale packs, English is always kept
+        QStringLiteral("exclude */locales/*.pak"),
+        QStringLiteral("keep */locales/en-US.pak"),
+    };
+}
+
+void PayloadPruner::setRules(const QStringList &rules)
+{
+    m_excludeRules.clear();
+    m_keepRules.clear();
+    m_invalidRules.clear();
+    addRules(rules);
+}
+
+void PayloadPruner::addOverrides(const QStringList &rules)
+{
+    addRules(rules);
+}
+
+void PayloadPruner::addProtectedPath(const QString &relativePath)
+{
+    m_protectedPaths.append(relativePath);
+}
+
+void PayloadPruner::addRules(const QStringList &rules)
+{
+    for (const QString &text : rules) {
+        if (text.trimmed().isEmpty())
+            continue;
+        
+        PruneRule rule = PruneRule::fromString(text);
+        if (!rule.isValid()) {
+            m_invalidRules.append(text);
+            continue;
+        }
+        
+        if (rule.isKeep()) {
+            m_keepRules.append(rule);
+        } else {
+            m_excludeRules.append(rule);
+        }
+    }
+}
+
+QVector<PruneReportEntry> PayloadPruner::apply(AppScanIndex &index) const
+{
+    TraceSpan span("stage", QStringLiteral("prune"));
+    
+    QHash<QString, PruneReportEntry> savings;
+    
+    for (ScannedFile &file : index.files()) {
+        file.excluded = false;
+        file.excludedBy.clear();
+        
+        if (m_protectedPaths.contains(file.relativePath, Qt::CaseInsensitive))
+            continue;
+        
+        // First matching exclude rule wins the accounting
+        const PruneRule *matchedRule = nullptr;
+        for (const PruneRule &rule : m_excludeRules) {
+            if (rule.matches(file.relativePath, file.size)) {
+                matchedRule = &rule;
+                break;
+            }
+        }
+        
+        if (!matchedRule)
+            continue;
+        
+        // Keep rules (e.g. per-app overrides) rescue excluded files
+        bool kept = false;
+        for (const PruneRule &rule : m_keepRules) {
+            if (rule.matches(file.relativePath, file.size)) {
+                kept = true;
+                break;
+            }
+        }
+        
+        if (kept)
+            continue;
+        
+        file.excluded = true;
+        file.excludedBy = matchedRule->toString();
+        
+        PruneReportEntry &entry = savings[file.excludedBy];
+        entry.rule = file.excludedBy;
+        entry.files++;
+        entry.bytes += file.size;
+    }
+    
+    QVector<PruneReportEntry> report;
+    report.reserve(savings.size());
+    for (const PruneReportEntry &entry : qAsConst(savings)) {
+        report.append(entry);
+    }
+    
+    std::sort(report.begin(), report.end(), [](const PruneReportEntry &a, const PruneReportEntry &b) {
+        return a.bytes > b.bytes;
+    });
+    
+    return report;
+}
+
+QStringList PayloadPruner::formatReport(const QVector<PruneReportEntry> &report)
+{
+    QStringList lines;
+    QLocale locale;
+    
+    for (const PruneReportEntry &entry : report) {
+        lines << QStringLiteral("%1: %2 in %3 file(s)")
+                 .arg(entry.rule, locale.formattedDataSize(entry.bytes))
+                 .arg(entry.files);
+    }
+    
+    return lines;
+}
\ No newline at end of file
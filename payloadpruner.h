@@ -0,0 +1,98 @@
+#ifndef PAYLOADPRUNER_H
+#define PAYLOADPRUNER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QRegularExpression>
+
+class AppScanIndex;
+
+/**
+ * A single pruning rule.
+ *
+ * Rules are written as "<exclude|keep> <glob> [>size]", e.g.
+ *   exclude Other/Source/*
+ *   exclude *.log >1M
+ *   keep App/locales/en-US.pak
+ *
+ * A glob without '/' is matched against the file name, otherwise against
+ * the path relative to the app root. '*' also matches across directories.
+ * Matching is case-insensitive, like the Windows filesystems these apps
+ * come from.
+ */
+class PruneRule
+{
+public:
+    PruneRule() = default;
+    PruneRule(const QString &pattern, bool keep = false, qint64 minSize = 0);
+    
+    // Parse the textual form, returns an invalid rule on syntax errors
+    static PruneRule fromString(const QString &text);
+    QString toString() const;
+    
+    bool isValid() const { return m_regex.isValid() && !m_pattern.isEmpty(); }
+    bool isKeep() const { return m_keep; }
+    
+    bool matches(const QString &relativePath, qint64 size) const;
+    
+private:
+    QString m_pattern;
+    bool m_keep = false;
+    qint64 m_minSize = 0;
+    bool m_matchFileName = true;
+    QRegularExpression m_regex;
+};
+
+/**
+ * Bytes saved by one rule during a pruning run
+ */
+struct PruneReportEntry
+{
+    QString rule;
+    int files = 0;
+    qint64 bytes = 0;
+};
+
+/**
+ * Applies pruning rules to a scan index before the app is staged, so
+ * excluded files are never copied into the build directory.
+ */
+class PayloadPruner
+{
+public:
+    PayloadPruner();
+    
+    // Built-in rules for PortableApps.com leftovers
+    static QStringList defaultRules();
+    
+    // Global rules, replaces the defaults
+    void setRules(const QStringList &rules);
+    
+    // Per-app overrides, evaluated together with the global rules
+    void addOverrides(const QStringList &rules);
+    
+    // Files that must never be pruned (e.g. the main executable)
+    void addProtectedPath(const QString &relativePath);
+    
+    // Rules that failed to parse
+    QStringList invalidRules() const { return m_invalidRules; }
+    
+    // Mark excluded files in the index. Returns the savings per rule,
+    // sorted by bytes saved. The index is only annotated, so the same
+    // call doubles as a dry run.
+    QVector<PruneReportEntry> apply(AppScanIndex &index) const;
+    
+    // Human readable lines for a report, one per rule
+    static QStringList formatReport(const QVector<PruneReportEntry> &report);
+    
+private:
+    void addRules(const QStringList &rules);
+    
+    QVector<PruneRule> m_excludeRules;
+    QVector<PruneRule> m_keepRules;
+    QStringList m_protectedPaths;
+    QStringList m_invalidRules;
+};
+
+#endif // PAYLOADPRUNER_H
\ No newline at end of file
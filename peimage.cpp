@@ -0,0 +1,232 @@
+#include "peimage.h"
+#include "tracer.h"
+
+#include <QFile>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+// Data directory indices, see IMAGE_DIRECTORY_ENTRY_*
+const int ImportDirectory = 1;
+const int ResourceDirectory = 2;
+const int DelayImportDirectory = 13;
+const int ClrRuntimeDirectory = 14;
+
+quint16 read16(const uchar *data)
+{
+    return qFromLittleEndian<quint16>(data);
+}
+
+quint32 read32(const uchar *data)
+{
+    return qFromLittleEndian<quint32>(data);
+}
+
+quint64 read64(const uchar *data)
+{
+    return qFromLittleEndian<quint64>(data);
+}
+
+} // namespace
+
+bool PeImage::load(const QString &filePath)
+{
+    *this = PeImage();
+    
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    
+    m_fileSize = file.size();
+    if (m_fileSize < 64)
+        return false;
+    
+    const uchar *data = file.map(0, m_fileSize);
+    if (!data)
+        return false;
+    m_data = data;
+    
+    // DOS header
+    if (data[0] != 'M' || data[1] != 'Z') {
+        m_data = nullptr;
+        return false;
+    }
+    
+    const qint64 peOffset = read32(data + 0x3c);
+    if (peOffset + 24 > m_fileSize || memcmp(data + peOffset, "PE\0\0", 4) != 0) {
+        m_data = nullptr;
+        return false;
+    }
+    
+    // COFF header
+    const uchar *coff = data + peOffset + 4;
+    const int sectionCount = read16(coff + 2);
+    const int optionalHeaderSize = read16(coff + 16);
+    const qint64 optionalOffset = peOffset + 24;
+    if (optionalOffset + optionalHeaderSize > m_fileSize || optionalHeaderSize < 2) {
+        m_data = nullptr;
+        return false;
+    }
+    
+    // Optional header, PE32 or PE32+
+    const uchar *optional = data + optionalOffset;
+    const quint16 magic = read16(optional);
+    m_is64Bit = magic == 0x20b;
+    if (magic != 0x10b && magic != 0x20b) {
+        m_data = nullptr;
+        return false;
+    }
+    
+    const int directoryCountOffset = m_is64Bit ? 108 : 92;
+    const int directoriesOffset = m_is64Bit ? 112 : 96;
+    quint64 imageBase = 0;
+    quint32 directoryCount = 0;
+    if (optionalHeaderSize >= directoriesOffset) {
+        imageBase = m_is64Bit ? read64(optional + 24) : read32(optional + 28);
+        directoryCount = read32(optional + directoryCountOffset);
+        directoryCount = qMin<quint32>(directoryCount, (optionalHeaderSize - directoriesOffset) / 8);
+    }
+    
+    // Section table
+    const qint64 sectionsOffset = optionalOffset + optionalHeaderSize;
+    if (sectionsOffset + qint64(sectionCount) * 40 > m_fileSize) {
+        m_data = nullptr;
+        return false;
+    }
+    
+    m_overlayOffset = sectionsOffset + qint64(sectionCount) * 40;
+    for (int i = 0; i < sectionCount; ++i) {
+        const uchar *header = data + sectionsOffset + i * 40;
+        
+        Section section;
+        section.name = QByteArray(reinterpret_cast<const char *>(header), qstrnlen(reinterpret_cast<const char *>(header), 8));
+        section.virtualSize = read32(header + 8);
+        section.virtualAddress = read32(header + 12);
+        section.rawSize = read32(header + 16);
+        section.rawOffset = read32(header + 20);
+        m_sections.append(section);
+        
+        if (section.rawSize > 0) {
+            m_overlayOffset = qMax<qint64>(m_overlayOffset, qint64(section.rawOffset) + section.rawSize);
+        }
+    }
+    m_overlayOffset = qMin(m_overlayOffset, m_fileSize);
+    
+    auto directory = [&](int index, quint32 *rva, quint32 *size) {
+        if (quint32(index) >= directoryCount) {
+            *rva = *size = 0;
+            return;
+        }
+        const uchar *entry = optional + directoriesOffset + index * 8;
+        *rva = read32(entry);
+        *size = read32(entry + 4);
+    };
+    
+    quint32 rva, size;
+    
+    directory(ImportDirectory, &rva, &size);
+    if (rva && size)
+        readImports(data, rva, size);
+    
+    directory(DelayImportDirectory, &rva, &size);
+    if (rva && size)
+        readDelayImports(data, rva, size, imageBase);
+    
+    directory(ClrRuntimeDirectory, &rva, &size);
+    m_isDotNet = rva != 0 && size != 0;
+    
+    directory(ResourceDirectory, &rva, &size);
+    const qint64 resourceOffset = rva ? rvaToOffset(rva) : -1;
+    if (resourceOffset >= 0) {
+        m_resourceOffset = quint32(resourceOffset);
+        m_resourceSize = quint32(qMin<qint64>(size, m_fileSize - resourceOffset));
+    }
+    
+    // The mapping goes away with the file
+    m_data = nullptr;
+    m_valid = true;
+    return true;
+}
+
+qint64 PeImage::rvaToOffset(quint32 rva) const
+{
+    for (const Section &section : m_sections) {
+        const quint32 extent = qMax(section.virtualSize, section.rawSize);
+        if (rva >= section.virtualAddress && rva < section.virtualAddress + extent) {
+            const qint64 offset = qint64(section.rawOffset) + (rva - section.virtualAddress);
+            return offset < m_fileSize ? offset : -1;
+        }
+    }
+    
+    return -1;
+}
+
+QString PeImage::readString(qint64 offset) const
+{
+    if (offset < 0 || offset >= m_fileSize)
+        return QString();
+    
+    const char *start = reinterpret_cast<const char *>(m_data + offset);
+    const int length = int(qstrnlen(start, uint(qMin<qint64>(m_fileSize - offset, 256))));
+    return QString::fromLatin1(start, length);
+}
+
+void PeImage::readImports(const uchar *data, quint32 rva, quint32 size)
+{
+    qint64 offset = rvaToOffset(rva);
+    if (offset < 0)
+        return;
+    
+    // IMAGE_IMPORT_DESCRIPTOR entries, terminated by an all-zero entry
+    const qint64 end = qMin<qint64>(offset + size, m_fileSize);
+    for (; offset + 20 <= end; offset += 20) {
+        const quint32 nameRva = read32(data + offset + 12);
+        if (nameRva == 0 && read32(data + offset + 16) == 0)
+            break;
+        
+        const QString name = readString(rvaToOffset(nameRva)).toLower();
+        if (!name.isEmpty() && !m_importedDlls.contains(name))
+            m_importedDlls.append(name);
+    }
+}
+
+void PeImage::readDelayImports(const uchar *data, quint32 rva, quint32 size, quint64 imageBase)
+{
+    qint64 offset = rvaToOffset(rva);
+    if (offset < 0)
+        return;
+    
+    // IMAGE_DELAYLOAD_DESCRIPTOR entries, terminated by an all-zero entry
+    const qint64 end = qMin<qint64>(offset + size, m_fileSize);
+    for (; offset + 32 <= end; offset += 32) {
+        const quint32 attributes = read32(data + offset);
+        quint64 nameAddress = read32(data + offset + 4);
+        if (nameAddress == 0)
+            break;
+        
+        // Old linkers stored virtual addresses instead of RVAs
+        if (!(attributes & 1) && nameAddress >= imageBase)
+            nameAddress -= imageBase;
+        
+        const QString name = readString(rvaToOffset(quint32(nameAddress))).toLower();
+        if (!name.isEmpty() && !m_importedDlls.contains(name))
+            m_importedDlls.append(name);
+    }
+}
+
+QStringList PeImage::dependenciesOf(const QString &filePath)
+{
+    TraceSpan span("analyze", QStringLiteral("pe imports"), filePath);
+    
+    PeImage image;
+    if (!image.load(filePath))
+        return QStringList();
+    
+    QStringList dlls = image.importedDlls();
+    if (image.isDotNet() && !dlls.contains("mscoree.dll"))
+        dlls.append("mscoree.dll");
+    
+    return dlls;
+}
\ No newline at end of file
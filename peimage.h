@@ -0,0 +1,74 @@
+#ifndef PEIMAGE_H
+#define PEIMAGE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Minimal reader for Windows PE executables and DLLs.
+ *
+ * Only the headers needed for packaging decisions are parsed: sections,
+ * imported and delay-loaded DLLs and the .NET runtime header. The image
+ * is memory mapped, nothing is executed.
+ */
+class PeImage
+{
+public:
+    struct Section
+    {
+        QByteArray name;
+        quint32 virtualAddress = 0;
+        quint32 virtualSize = 0;
+        quint32 rawOffset = 0;
+        quint32 rawSize = 0;
+    };
+    
+    // Parse the headers of the image at filePath
+    bool load(const QString &filePath);
+    
+    bool isValid() const { return m_valid; }
+    bool is64Bit() const { return m_is64Bit; }
+    
+    // Managed (.NET) images depend on mscoree.dll even if they do not
+    // import it by name
+    bool isDotNet() const { return m_isDotNet; }
+    
+    // Lower-case names of imported and delay-loaded DLLs
+    QStringList importedDlls() const { return m_importedDlls; }
+    
+    const QVector<Section> &sections() const { return m_sections; }
+    
+    // File offset of data appended after the last section (e.g. installer
+    // payloads), equal to the file size if there is none
+    qint64 overlayOffset() const { return m_overlayOffset; }
+    qint64 fileSize() const { return m_fileSize; }
+    
+    // File offset and size of the resource directory, zero if absent
+    quint32 resourceOffset() const { return m_resourceOffset; }
+    quint32 resourceSize() const { return m_resourceSize; }
+    
+    // Convenience: imports of an image, including mscoree.dll for .NET
+    // images. Returns an empty list for non-PE files.
+    static QStringList dependenciesOf(const QString &filePath);
+    
+private:
+    qint64 rvaToOffset(quint32 rva) const;
+    QString readString(qint64 offset) const;
+    void readImports(const uchar *data, quint32 rva, quint32 size);
+    void readDelayImports(const uchar *data, quint32 rva, quint32 size, quint64 imageBase);
+    
+    const uchar *m_data = nullptr;
+    qint64 m_fileSize = 0;
+    bool m_valid = false;
+    bool m_is64Bit = false;
+    bool m_isDotNet = false;
+    QStringList m_importedDlls;
+    QVector<Section> m_sections;
+    qint64 m_overlayOffset = 0;
+    quint32 m_resourceOffset = 0;
+    quint32 m_resourceSize = 0;
+};
+
+#endif // PEIMAGE_H
\ No newline at end of file
@@ -0,0 +1,224 @@
+#include "pipelinejournal.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+PipelineJournal::PipelineJournal(const QString &path)
+    : m_path(path)
+{
+}
+
+bool PipelineJournal::load()
+{
+    m_inputs.clear();
+    m_entries.clear();
+    
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        
+        // Only the last line can be torn, but skipping any broken line
+        // is just as safe
+        QJsonParseError error;
+        const QJsonDocument document = QJsonDocument::fromJson(line, &error);
+        if (error.error == QJsonParseError::NoError && document.isObject()) {
+            apply(document.object());
+        }
+    }
+    
+    return !m_inputs.isEmpty();
+}
+
+bool PipelineJournal::begin(const QString &inputs, QString *errorMessage)
+{
+    if (load() && m_inputs == inputs)
+        return true;
+    
+    m_inputs.clear();
+    m_entries.clear();
+    
+    const QJsonObject record{
+        { "type", "begin" },
+        { "inputs", inputs },
+        { "time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate) },
+    };
+    if (!write(record, true, errorMessage))
+        return false;
+    
+    apply(record);
+    return true;
+}
+
+QStringList PipelineJournal::completedStages() const
+{
+    QStringList stages;
+    for (const Entry &entry : m_entries) {
+        stages << entry.stage;
+    }
+    
+    return stages;
+}
+
+bool PipelineJournal::isComplete(const QString &stage) const
+{
+    return completedStages().contains(stage);
+}
+
+QString PipelineJournal::outputHash(const QString &stage) const
+{
+    for (const Entry &entry : m_entries) {
+        if (entry.stage == stage)
+            return entry.hash;
+    }
+    
+    return QString();
+}
+
+QJsonObject PipelineJournal::data(const QString &stage) const
+{
+    for (const Entry &entry : m_entries) {
+        if (entry.stage == stage)
+            return entry.data;
+    }
+    
+    return QJsonObject();
+}
+
+bool PipelineJournal::complete(const QString &stage, const QString &outputHash,
+                               const QJsonObject &data, QString *errorMessage)
+{
+    // Without begin() there is nothing to resume
+    if (m_inputs.isEmpty())
+        return true;
+    
+    const QJsonObject record{
+        { "type", "complete" },
+        { "stage", stage },
+        { "hash", outputHash },
+        { "data", data },
+        { "time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate) },
+    };
+    if (!write(record, false, errorMessage))
+        return false;
+    
+    apply(record);
+    return true;
+}
+
+void PipelineJournal::remove()
+{
+    QFile::remove(m_path);
+    m_inputs.clear();
+    m_entries.clear();
+}
+
+void PipelineJournal::apply(const QJsonObject &record)
+{
+    const QString type = record.value("type").toString();
+    
+    if (type == "begin") {
+        m_inputs = record.value("inputs").toString();
+        m_entries.clear();
+    } else if (type == "complete") {
+        const QString stage = record.value("stage").toString();
+        for (int i = 0; i < m_entries.size(); ++i) {
+            if (m_entries[i].stage == stage) {
+                m_entries.resize(i);
+                break;
+            }
+        }
+        
+        m_entries.append({ stage, record.value("hash").toString(), record.value("data").toObject() });
+    }
+}
+
+bool PipelineJournal::write(const QJsonObject &record, bool truncate, QString *errorMessage)
+{
+    const QFileInfo info(m_path);
+    const bool created = !info.exists();
+    QDir().mkpath(info.path());
+    
+    QFile file(m_path);
+    if (!file.open(truncate ? QIODevice::WriteOnly | QIODevice::Truncate : QIODevice::WriteOnly | QIODevice::Append)) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    
+    const QByteArray line = QJsonDocument(record).toJson(QJsonDocument::Compact) + '\n';
+    if (file.write(line) != line.size() || !file.flush()) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    
+    // The record must be on disk before the stage's outputs are relied on
+    if (::fsync(file.handle()) != 0) {
+        if (errorMessage)
+            *errorMessage = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+    
+    // A new file is only durable once its directory entry is
+    if (created) {
+        const int dirFd = ::open(QFile::encodeName(info.path()).constData(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+    }
+    
+    return true;
+}
+
+QString PipelineJournal::hashFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+    
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file))
+        return QString();
+    
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QString PipelineJournal::hashFiles(const QString &rootDir, const QStringList &relativeDirs)
+{
+    const QDir root(rootDir);
+    
+    QStringList paths;
+    for (const QString &dir : relativeDirs) {
+        QDirIterator it(root.filePath(dir), QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            paths << root.relativeFilePath(it.next());
+        }
+    }
+    paths.sort();
+    
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    for (const QString &path : qAsConst(paths)) {
+        hash.addData(path.toUtf8());
+        hash.addData("\0", 1);
+        hash.addData(hashFile(root.filePath(path)).toLatin1());
+    }
+    
+    return QString::fromLatin1(hash.result().toHex());
+}
\ No newline at end of file
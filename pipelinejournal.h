@@ -0,0 +1,73 @@
+#ifndef PIPELINEJOURNAL_H
+#define PIPELINEJOURNAL_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Append-only record of the pipeline stages a job has completed.
+ *
+ * Each completed stage is appended as one JSON line with the hash of its
+ * output, and synced to disk before the pipeline moves on. After a crash
+ * or reboot the journal tells which outputs should exist. Callers check
+ * them against the recorded hashes and resume from the first stage that
+ * is missing or no longer matches. A line torn by a crash during the
+ * write is ignored.
+ */
+class PipelineJournal
+{
+public:
+    PipelineJournal() = default;
+    explicit PipelineJournal(const QString &path);
+    
+    QString path() const { return m_path; }
+    
+    // Read the records of the file, false if there are none
+    bool load();
+    
+    // Load the journal, or start it over if it was written for other
+    // inputs (or is missing). Fails only if the file cannot be written.
+    bool begin(const QString &inputs, QString *errorMessage = nullptr);
+    
+    QString inputs() const { return m_inputs; }
+    
+    // Stages in the order they completed
+    QStringList completedStages() const;
+    bool isComplete(const QString &stage) const;
+    QString outputHash(const QString &stage) const;
+    QJsonObject data(const QString &stage) const;
+    
+    // Record a completed stage. Completing a stage again drops the stages
+    // completed after it, as their outputs derive from the old one.
+    bool complete(const QString &stage, const QString &outputHash,
+                  const QJsonObject &data = QJsonObject(), QString *errorMessage = nullptr);
+    
+    // Delete the file once the job is done
+    void remove();
+    
+    // SHA-256 of a file's contents, empty if it cannot be read
+    static QString hashFile(const QString &path);
+    
+    // SHA-256 over the paths and contents of all files below the given
+    // directories of rootDir. Missing directories are skipped.
+    static QString hashFiles(const QString &rootDir, const QStringList &relativeDirs);
+    
+private:
+    struct Entry
+    {
+        QString stage;
+        QString hash;
+        QJsonObject data;
+    };
+    
+    void apply(const QJsonObject &record);
+    bool write(const QJsonObject &record, bool truncate, QString *errorMessage);
+    
+    QString m_path;
+    QString m_inputs;
+    QVector<Entry> m_entries;
+};
+
+#endif // PIPELINEJOURNAL_H
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "portableappdetector.h"
+#include "installerdetector.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSettings>
+
+namespace {
+
+bool isUninstaller(const QString &fileName)
+{
+    const QString lower = fileName.toLower();
+    return lower.startsWith(QLatin1String("uninst")) || lower.startsWith(QLatin1String("unins"));
+}
+
+} // namespace
+
+PortableAppInfo PortableAppDetector::detect(const QString &dirPath)
+{
+    return detect(dirPath, nullptr);
+}
+
+PortableAppInfo PortableAppDetector::detect(const QString &dirPath, QString *errorMessage)
+{
+    TraceSpan span("import", QStringLiteral("detect app"), dirPath);
+    
+    PortableAppInfo info;
+    info.sourceDir = dirPath;
+    
+    QDir dir(dirPath);
+    info.name = dir.dirName();
+    
+    // PortableApps.com format metadata, if present
+    readAppInfo(dirPath, info);
+    
+    if (info.executablePath.isEmpty()) {
+        info.executablePath = findExecutable(dirPath);
+    }
+    
+    // PortableApps.com launchers are NSIS programs, but never installers
+    if (!QFileInfo::exists(dirPath + "/App/AppInfo/appinfo.ini")) {
+        unpackInstaller(info, errorMessage);
+    }
+    
+    info.iconPath = findIcon(info.sourceDir, info.name);
+    
+    return info;
+}
+
+void PortableAppDetector::readAppInfo(const QString &dirPath, PortableAppInfo &info)
+{
+    const QString appInfoPath = dirPath + "/App/AppInfo/appinfo.ini";
+    if (!QFileInfo::exists(appInfoPath))
+        return;
+    
+    QSettings appInfo(appInfoPath, QSettings::IniFormat);
+    appInfo.setIniCodec("UTF-8");
+    
+    QString name = appInfo.value("Details/Name").toString();
+    if (!name.isEmpty()) {
+        // Drop the "Portable" suffix of PortableApps.com names
+        if (name.endsWith(" Portable")) {
+            name.chop(9);
+        }
+        info.name = name;
+    }
+    
+    info.description = appInfo.value("Details/Description").toString();
+    info.category = appInfo.value("Details/Category").toString();
+    
+    info.version = appInfo.value("Version/DisplayVersion").toString();
+    if (info.version.isEmpty()) {
+        info.version = appInfo.value("Version/PackageVersion").toString();
+    }
+    
+    // The launcher named in [Control] is the intended entry point
+    const QString start = appInfo.value("Control/Start").toString();
+    if (!start.isEmpty() && QFileInfo::exists(dirPath + "/" + start)) {
+        info.executablePath = dirPath + "/" + start;
+    }
+}
+
+void PortableAppDetector::unpackInstaller(PortableAppInfo &info, QString *errorMessage)
+{
+    QString installerPath = info.executablePath;
+    if (installerPath.isEmpty()) {
+        const QStringList msiFiles = QDir(info.sourceDir).entryList(QStringList() << "*.msi", QDir::Files, QDir::Name);
+        if (msiFiles.isEmpty())
+            return;
+        installerPath = info.sourceDir + "/" + msiFiles.first();
+    }
+    
+    const InstallerDetector::Result installer = InstallerDetector::detect(installerPath);
+    if (!installer.isInstaller())
+        return;
+    
+    info.installerPath = installerPath;
+    
+    // An earlier import of the same file already unpacked it. If unpacking
+    // fails the installer stays the executable, for the caller to report.
+    const QString unpackDir = InstallerDetector::unpackDirectory(installerPath);
+    if (!QFileInfo(unpackDir).isDir() && !InstallerDetector::unpack(installerPath, installer, unpackDir, errorMessage))
+        return;
+    
+    const QString root = InstallerDetector::contentRoot(unpackDir);
+    const QString executable = findExecutable(root);
+    if (executable.isEmpty()) {
+        if (errorMessage)
+            *errorMessage = i18n("No program found in the files unpacked to %1", unpackDir);
+        return;
+    }
+    
+    info.sourceDir = root;
+    info.executablePath = executable;
+}
+
+QString PortableAppDetector::findExecutable(const QString &dirPath)
+{
+    // Prefer executables at the top level of the app
+    QDir dir(dirPath);
+    const QFileInfoList topLevel = dir.entryInfoList(QStringList() << "*.exe", QDir::Files, QDir::Name);
+    for (const QFileInfo &exe : topLevel) {
+        if (!isUninstaller(exe.fileName()))
+            return exe.filePath();
+    }
+    
+    // Otherwise take the first one found anywhere below
+    QDirIterator it(dirPath, QStringList() << "*.exe", QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        if (!isUninstaller(it.fileName()))
+            return it.filePath();
+    }
+    
+    return QString();
+}
+
+QString PortableAppDetector::findIcon(const QString &dirPath, const QString &appName)
+{
+    // PortableApps.com ships icons in fixed sizes, take the largest
+    const QStringList appInfoIcons = {
+        "App/AppInfo/appicon_256.png",
+        "App/AppInfo/appicon_128.png",
+        "App/AppInfo/appicon_75.png",
+        "App/AppInfo/appicon_32.png",
+        "App/AppInfo/appicon.ico"
+    };
+    for (const QString &icon : appInfoIcons) {
+        if (QFileInfo::exists(dirPath + "/" + icon))
+            return dirPath + "/" + icon;
+    }
+    
+    // Look for icons
+    QStringList iconFiles;
+    QDirIterator iconIt(dirPath, QStringList() << "*.png" << "*.ico" << "*.svg" << "*.jpg",
+                        QDir::Files, QDirIterator::Subdirectories);
+    while (iconIt.hasNext()) {
+        iconIt.next();
+        iconFiles << iconIt.filePath();
+    }
+    
+    // Try to find an icon that contains common names
+    const QStringList iconKeywords = {"icon", "logo", appName.toLower()};
+    for (const QString &keyword : iconKeywords) {
+        for (const QString &iconFile : qAsConst(iconFiles)) {
+            if (QFileInfo(iconFile).fileName().toLower().contains(keyword))
+                return iconFile;
+        }
+    }
+    
+    // If no icon found yet, just use the first one
+    return iconFiles.isEmpty() ? QString() : iconFiles.first();
+}
+
+bool PortableAppDetector::isAppRoot(const QString &dirPath)
+{
+    if (QFileInfo::exists(dirPath + "/App/AppInfo/appinfo.ini"))
+        return true;
+    
+    QDir dir(dirPath);
+    return !dir.entryList(QStringList() << "*.exe" << "*.msi", QDir::Files).isEmpty();
+}
+
+QStringList PortableAppDetector::findAppRoots(const QString &libraryDir)
+{
+    // On a PortableApps.com drive the apps live in PortableApps/
+    QString searchDir = libraryDir;
+    if (QFileInfo(libraryDir + "/PortableApps").isDir()) {
+        searchDir = libraryDir + "/PortableApps";
+    }
+    
+    QStringList roots;
+    QDir dir(searchDir);
+    const QFileInfoList entries = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    for (const QFileInfo &entry : entries) {
+        // The platform itself and shared runtimes are not apps
+        if (entry.fileName() == "PortableApps.com" || entry.fileName() == "CommonFiles")
+            continue;
+        
+        if (isAppRoot(entry.filePath())) {
+            roots << entry.filePath();
+        }
+    }
+    
+    return roots;
+}
\ No newline at end of file
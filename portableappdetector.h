@@ -0,0 +1,41 @@
+#ifndef PORTABLEAPPDETECTOR_H
+#define PORTABLEAPPDETECTOR_H
+
+#include <QString>
+#include <QStringList>
+
+#include "portableappinfo.h"
+
+/**
+ * Detects metadata, main executable and icon of PortableApps.
+ *
+ * All functions are reentrant and only touch the filesystem (and the
+ * unpacking tools), so they can be run concurrently for a whole library
+ * of apps.
+ */
+class PortableAppDetector
+{
+public:
+    // Fill in everything that can be derived from the app directory.
+    // A setup program instead of an app is unpacked first, and sourceDir
+    // then points to the unpacked files. The returned info has no id yet.
+    static PortableAppInfo detect(const QString &dirPath);
+    
+    // Same, with the reason if a setup program could not be unpacked
+    static PortableAppInfo detect(const QString &dirPath, QString *errorMessage);
+    
+    // Find every app root below a library directory, e.g. the root of a
+    // PortableApps.com drive or its PortableApps/ folder
+    static QStringList findAppRoots(const QString &libraryDir);
+    
+    // Whether dirPath looks like the root of a single portable app
+    static bool isAppRoot(const QString &dirPath);
+    
+private:
+    static void readAppInfo(const QString &dirPath, PortableAppInfo &info);
+    static void unpackInstaller(PortableAppInfo &info, QString *errorMessage);
+    static QString findExecutable(const QString &dirPath);
+    static QString findIcon(const QString &dirPath, const QString &appName);
+};
+
+#endif // PORTABLEAPPDETECTOR_H
\ No newline at end of file
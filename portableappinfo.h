@@ -21,16 +21,31 @@ public:
     // Paths
     QString sourceDir;      // Directory containing the PortableApp
     QString executablePath; // Path to the main executable
+    QString installerPath;  // Setup program sourceDir was unpacked from, if any
     
     // Wine configuration
     QString wineVersion;
     QString wineDllOverrides;
     QString wineArch;       // win32 or win64
+    QString performanceProfile; // Id of a WineProfile, empty for none
+    bool enableDxvk = false;
+    QString dxvkVersion = QStringLiteral("latest");
+    QString dxvkStateCachePath; // Pre-recorded .dxvk-cache to ship, optional
+    QString prefixMode = QStringLiteral("private"); // private or layered
+    int serverTimeout = 300; // Seconds an idle wineserver is kept running, 0 for none
+    
+    // Wine version/architecture combinations to build side by side,
+    // e.g. "staging-win32", see BuildVariant
+    QStringList variants;
+    QString variantId;      // Set on the copy built for one of them
     
     // Additional data
     QStringList requiredDLLs;
     QStringList additionalFiles;
     
+    // Payload pruning overrides, e.g. "keep App/locales/de.pak"
+    QStringList pruneRules;
+    
     // Flatpak specific settings
     bool allowNetworkAccess = true;
     bool allowDocumentsAccess = true;
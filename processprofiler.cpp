@@ -0,0 +1,331 @@
+#include "processprofiler.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QLocale>
+#include <QMultiHash>
+
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+struct ProcStat
+{
+    QString command;
+    qint64 ppid = 0;
+    quint64 startTime = 0;
+    double cpuSeconds = 0;          // utime + stime
+    double childCpuSeconds = 0;     // cutime + cstime, of waited children
+};
+
+QByteArray readProcFile(qint64 pid, const char *name)
+{
+    QFile file(QStringLiteral("/proc/%1/").arg(pid) + QLatin1String(name));
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    
+    return file.readAll();
+}
+
+bool readStat(qint64 pid, ProcStat *stat)
+{
+    // The command may contain spaces and parentheses itself
+    const QByteArray data = readProcFile(pid, "stat");
+    const int open = data.indexOf('(');
+    const int close = data.lastIndexOf(')');
+    if (open < 0 || close < open)
+        return false;
+    
+    // Fields from the third ("state") on, see proc(5)
+    const QList<QByteArray> fields = data.mid(close + 2).split(' ');
+    if (fields.size() < 20)
+        return false;
+    
+    static const double ticks = ::sysconf(_SC_CLK_TCK);
+    
+    stat->command = QString::fromUtf8(data.mid(open + 1, close - open - 1));
+    stat->ppid = fields[1].toLongLong();
+    stat->cpuSeconds = (fields[11].toULongLong() + fields[12].toULongLong()) / ticks;
+    stat->childCpuSeconds = (fields[13].toLongLong() + fields[14].toLongLong()) / ticks;
+    stat->startTime = fields[19].toULongLong();
+    
+    return true;
+}
+
+// Value of a "key: value" line of status or io
+quint64 procField(const QByteArray &data, const QByteArray &key)
+{
+    int start = data.startsWith(key) ? 0 : data.indexOf("\n" + key);
+    if (start < 0)
+        return 0;
+    
+    start += (start > 0 ? 1 : 0) + key.size();
+    const int end = data.indexOf('\n', start);
+    return data.mid(start, end < 0 ? -1 : end - start).simplified().split(' ').value(0).toULongLong();
+}
+
+// The root and all its descendants, parents first
+QVector<qint64> processTree(qint64 rootPid)
+{
+    // Lists of children need CONFIG_PROC_CHILDREN, without it the parents
+    // of all processes are read
+    static const bool childrenFiles = QFile::exists(QStringLiteral("/proc/thread-self/children"));
+    
+    QMultiHash<qint64, qint64> children;
+    if (!childrenFiles) {
+        const QStringList names = QDir(QStringLiteral("/proc")).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        for (const QString &name : names) {
+            bool ok;
+            const qint64 pid = name.toLongLong(&ok);
+            ProcStat stat;
+            if (ok && readStat(pid, &stat)) {
+                children.insert(stat.ppid, pid);
+            }
+        }
+    }
+    
+    QVector<qint64> tree{ rootPid };
+    for (int i = 0; i < tree.size(); ++i) {
+        if (!childrenFiles) {
+            tree += children.values(tree[i]).toVector();
+            continue;
+        }
+        
+        // Each thread lists the children it forked
+        const QString taskDir = QStringLiteral("/proc/%1/task").arg(tree[i]);
+        const QStringList tids = QDir(taskDir).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        for (const QString &tid : tids) {
+            QFile file(taskDir + "/" + tid + "/children");
+            if (!file.open(QIODevice::ReadOnly))
+                continue;
+            
+            for (const QByteArray &child : file.readAll().split(' ')) {
+                bool ok;
+                const qint64 pid = child.trimmed().toLongLong(&ok);
+                if (ok) {
+                    tree << pid;
+                }
+            }
+        }
+    }
+    
+    return tree;
+}
+
+} // namespace
+
+QString ProcessProfile::toString() const
+{
+    const QLocale locale;
+    
+    QStringList consumers;
+    for (const Consumer &consumer : topConsumers.mid(0, 3)) {
+        consumers << i18nc("process and its CPU time", "%1 (%2 s)", consumer.command, QString::number(consumer.cpuSeconds, 'f', 1));
+    }
+    
+    return i18n("%1 processes, memory average %2, peak %3, most CPU time: %4",
+                processes,
+                locale.formattedDataSize(rssAverage),
+                locale.formattedDataSize(rssPeak),
+                consumers.join(", "));
+}
+
+QJsonObject ProcessProfile::toJson() const
+{
+    if (!available)
+        return QJsonObject();
+    
+    QJsonArray stageArray;
+    for (const Stage &stage : stages) {
+        stageArray.append(QJsonObject{
+            { "name", stage.name },
+            { "seconds", stage.seconds },
+            { "cpuSeconds", stage.cpuSeconds },
+            { "rssPeak", double(stage.rssPeak) },
+            { "readBytes", double(stage.readBytes) },
+            { "writeBytes", double(stage.writeBytes) },
+        });
+    }
+    
+    QJsonArray consumerArray;
+    for (const Consumer &consumer : topConsumers) {
+        consumerArray.append(QJsonObject{
+            { "command", consumer.command },
+            { "processes", consumer.processes },
+            { "cpuSeconds", consumer.cpuSeconds },
+            { "rssPeak", double(consumer.rssPeak) },
+        });
+    }
+    
+    return QJsonObject{
+        { "samples", samples },
+        { "processes", processes },
+        { "cpuSeconds", cpuSeconds },
+        { "rssPeak", double(rssPeak) },
+        { "rssAverage", double(rssAverage) },
+        { "readBytes", double(readBytes) },
+        { "writeBytes", double(writeBytes) },
+        { "stages", stageArray },
+        { "topConsumers", consumerArray },
+    };
+}
+
+ProcessProfile ProcessProfile::fromJson(const QJsonObject &json)
+{
+    ProcessProfile profile;
+    profile.available = json.contains("samples");
+    profile.samples = json.value("samples").toInt();
+    profile.processes = json.value("processes").toInt();
+    profile.cpuSeconds = json.value("cpuSeconds").toDouble();
+    profile.rssPeak = quint64(json.value("rssPeak").toDouble());
+    profile.rssAverage = quint64(json.value("rssAverage").toDouble());
+    profile.readBytes = quint64(json.value("readBytes").toDouble());
+    profile.writeBytes = quint64(json.value("writeBytes").toDouble());
+    
+    for (const QJsonValue &value : json.value("stages").toArray()) {
+        const QJsonObject object = value.toObject();
+        Stage stage;
+        stage.name = object.value("name").toString();
+        stage.seconds = object.value("seconds").toDouble();
+        stage.cpuSeconds = object.value("cpuSeconds").toDouble();
+        stage.rssPeak = quint64(object.value("rssPeak").toDouble());
+        stage.readBytes = quint64(object.value("readBytes").toDouble());
+        stage.writeBytes = quint64(object.value("writeBytes").toDouble());
+        profile.stages << stage;
+    }
+    
+    for (const QJsonValue &value : json.value("topConsumers").toArray()) {
+        const QJsonObject object = value.toObject();
+        Consumer consumer;
+        consumer.command = object.value("command").toString();
+        consumer.processes = object.value("processes").toInt();
+        consumer.cpuSeconds = object.value("cpuSeconds").toDouble();
+        consumer.rssPeak = quint64(object.value("rssPeak").toDouble());
+        profile.topConsumers << consumer;
+    }
+    
+    return profile;
+}
+
+ProcessProfiler::ProcessProfiler()
+    : m_stage(QStringLiteral("startup"))
+{
+}
+
+void ProcessProfiler::sample(qint64 rootPid)
+{
+    double cpuSeconds = 0;
+    quint64 readBytes = 0;
+    quint64 writeBytes = 0;
+    quint64 rss = 0;
+    bool found = false;
+    
+    for (const qint64 pid : processTree(rootPid)) {
+        ProcStat stat;
+        if (!readStat(pid, &stat))
+            continue;
+        found = true;
+        
+        Process &process = m_processes[qMakePair(pid, stat.startTime)];
+        process.command = stat.command;
+        process.cpuSeconds = stat.cpuSeconds;
+        cpuSeconds += stat.cpuSeconds + stat.childCpuSeconds;
+        
+        const QByteArray status = readProcFile(pid, "status");
+        const quint64 processRss = procField(status, "VmRSS:") * 1024;
+        rss += processRss;
+        process.rssPeak = qMax(process.rssPeak, qMax(processRss, procField(status, "VmHWM:") * 1024));
+        
+        // Includes the children it waited for. Not readable for
+        // processes that changed their credentials.
+        const QByteArray io = readProcFile(pid, "io");
+        readBytes += procField(io, "read_bytes:");
+        writeBytes += procField(io, "write_bytes:");
+    }
+    
+    if (!found)
+        return;
+    
+    ProcessProfile::Stage &stage = currentStage();
+    if (m_lastSample.isValid()) {
+        stage.seconds += m_lastSample.restart() / 1000.0;
+    } else {
+        m_lastSample.start();
+    }
+    
+    // The sums drop when a process exits that nobody in the tree waits
+    // for, e.g. a daemon that was reparented. Only growth counts.
+    stage.cpuSeconds += qMax(0.0, cpuSeconds - m_cpuSeconds);
+    stage.readBytes += readBytes > m_readBytes ? readBytes - m_readBytes : 0;
+    stage.writeBytes += writeBytes > m_writeBytes ? writeBytes - m_writeBytes : 0;
+    stage.rssPeak = qMax(stage.rssPeak, rss);
+    m_cpuSeconds = cpuSeconds;
+    m_readBytes = readBytes;
+    m_writeBytes = writeBytes;
+    
+    m_rssPeak = qMax(m_rssPeak, rss);
+    m_rssSum += rss;
+    m_samples++;
+}
+
+void ProcessProfiler::setStage(const QString &stage)
+{
+    if (!stage.isEmpty()) {
+        m_stage = stage;
+    }
+}
+
+ProcessProfile ProcessProfiler::profile(int topConsumers) const
+{
+    ProcessProfile profile;
+    profile.available = m_samples > 0;
+    profile.samples = m_samples;
+    profile.processes = m_processes.size();
+    profile.rssPeak = m_rssPeak;
+    profile.rssAverage = m_samples > 0 ? quint64(m_rssSum / m_samples) : 0;
+    profile.stages = m_stages;
+    
+    for (const ProcessProfile::Stage &stage : m_stages) {
+        profile.cpuSeconds += stage.cpuSeconds;
+        profile.readBytes += stage.readBytes;
+        profile.writeBytes += stage.writeBytes;
+    }
+    
+    // Processes of the same command add up, e.g. all cc1 runs
+    QHash<QString, ProcessProfile::Consumer> consumers;
+    for (const Process &process : m_processes) {
+        ProcessProfile::Consumer &consumer = consumers[process.command];
+        consumer.command = process.command;
+        consumer.processes++;
+        consumer.cpuSeconds += process.cpuSeconds;
+        consumer.rssPeak = qMax(consumer.rssPeak, process.rssPeak);
+    }
+    
+    profile.topConsumers = consumers.values().toVector();
+    std::sort(profile.topConsumers.begin(), profile.topConsumers.end(),
+              [](const ProcessProfile::Consumer &a, const ProcessProfile::Consumer &b) {
+                  return a.cpuSeconds > b.cpuSeconds;
+              });
+    profile.topConsumers.resize(qMin(profile.topConsumers.size(), topConsumers));
+    
+    return profile;
+}
+
+ProcessProfile::Stage &ProcessProfiler::currentStage()
+{
+    // Stages that come back, e.g. "commit to cache", add up
+    for (ProcessProfile::Stage &stage : m_stages) {
+        if (stage.name == m_stage)
+            return stage;
+    }
+    
+    ProcessProfile::Stage stage;
+    stage.name = m_stage;
+    m_stages << stage;
+    return m_stages.last();
+}
\ No newline at end of file
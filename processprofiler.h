@@ -0,0 +1,98 @@
+#ifndef PROCESSPROFILER_H
+#define PROCESSPROFILER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+/**
+ * Resources a process tree used, sampled from /proc
+ */
+struct ProcessProfile
+{
+    struct Stage
+    {
+        QString name;
+        double seconds = 0;
+        double cpuSeconds = 0;
+        quint64 rssPeak = 0;
+        quint64 readBytes = 0;
+        quint64 writeBytes = 0;
+    };
+    
+    struct Consumer
+    {
+        QString command;
+        int processes = 0;
+        double cpuSeconds = 0;
+        quint64 rssPeak = 0;
+    };
+    
+    bool available = false;
+    int samples = 0;
+    int processes = 0;              // Distinct processes seen by a sample
+    double cpuSeconds = 0;
+    quint64 rssPeak = 0;            // Largest resident memory of the whole tree
+    quint64 rssAverage = 0;
+    quint64 readBytes = 0;          // Storage I/O
+    quint64 writeBytes = 0;
+    QVector<Stage> stages;          // In the order they started
+    QVector<Consumer> topConsumers; // By CPU time
+    
+    QString toString() const;
+    QJsonObject toJson() const;
+    static ProcessProfile fromJson(const QJsonObject &json);
+};
+
+/**
+ * Samples the resource use of a process and all its descendants.
+ *
+ * Each sample walks the tree below the root process and reads stat,
+ * status and io of every process in it. CPU time and I/O of processes
+ * that exited and were waited for by a parent in the tree are included
+ * in the parent's counters, so short-lived compiler runs count towards
+ * the totals and stages even if no sample caught them. Only processes
+ * that were running during a sample show up among the top consumers.
+ */
+class ProcessProfiler
+{
+public:
+    ProcessProfiler();
+    
+    // Take a sample of rootPid and its descendants
+    void sample(qint64 rootPid);
+    
+    // Samples from now on count towards stage
+    void setStage(const QString &stage);
+    
+    ProcessProfile profile(int topConsumers = 10) const;
+    
+private:
+    struct Process
+    {
+        QString command;
+        double cpuSeconds = 0;  // Own CPU time, without waited children
+        quint64 rssPeak = 0;
+    };
+    
+    ProcessProfile::Stage &currentStage();
+    
+    // Keyed by pid and start time, pids are reused
+    QHash<QPair<qint64, quint64>, Process> m_processes;
+    
+    QString m_stage;
+    QVector<ProcessProfile::Stage> m_stages;
+    QElapsedTimer m_lastSample;
+    
+    int m_samples = 0;
+    double m_cpuSeconds = 0;
+    quint64 m_readBytes = 0;
+    quint64 m_writeBytes = 0;
+    quint64 m_rssPeak = 0;
+    double m_rssSum = 0;
+};
+
+#endif // PROCESSPROFILER_H
\ No newline at end of file
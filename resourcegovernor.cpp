@@ -0,0 +1,367 @@
+#include "resourcegovernor.h"
+#include "buildmetrics.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QLocale>
+#include <QProcess>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QUuid>
+
+namespace {
+
+// Time for a new job's load to show up in the 10 s pressure averages
+const int SettleTimeMs = 15000;
+
+const QString CgroupRoot = QStringLiteral("/sys/fs/cgroup");
+
+// "some" avg10 of /proc/pressure/<resource>
+double readPressure(const QString &resource, bool *ok)
+{
+    *ok = false;
+    
+    QFile file("/proc/pressure/" + resource);
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    
+    // some avg10=1.23 avg60=0.50 avg300=0.10 total=12345
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        if (!line.startsWith("some "))
+            continue;
+        
+        for (const QByteArray &field : line.split(' ')) {
+            if (field.startsWith("avg10=")) {
+                return field.mid(6).toDouble(ok);
+            }
+        }
+    }
+    
+    return 0;
+}
+
+QByteArray readCgroupFile(const QString &cgroupDir, const QString &name, bool *ok = nullptr)
+{
+    QFile file(cgroupDir + "/" + name);
+    const bool opened = file.open(QIODevice::ReadOnly);
+    if (ok) {
+        *ok = opened;
+    }
+    
+    return opened ? file.readAll() : QByteArray();
+}
+
+} // namespace
+
+ResourceLimits ResourceLimits::fromSettings()
+{
+    ResourceLimits limits;
+    
+    QSettings settings;
+    settings.beginGroup("resources");
+    limits.cpuWeight = settings.value("cpuWeight", limits.cpuWeight).toInt();
+    limits.memoryHigh = settings.value("memoryHigh", limits.memoryHigh).toString();
+    limits.memoryMax = settings.value("memoryMax", limits.memoryMax).toString();
+    limits.ioWeight = settings.value("ioWeight", limits.ioWeight).toInt();
+    limits.maxCpuPressure = settings.value("maxCpuPressure", limits.maxCpuPressure).toDouble();
+    limits.maxMemoryPressure = settings.value("maxMemoryPressure", limits.maxMemoryPressure).toDouble();
+    limits.maxIoPressure = settings.value("maxIoPressure", limits.maxIoPressure).toDouble();
+    limits.sampleInterval = settings.value("sampleInterval", limits.sampleInterval).toInt();
+    
+    return limits;
+}
+
+PressureSample PressureSample::read()
+{
+    PressureSample sample;
+    
+    bool cpuOk, memoryOk, ioOk;
+    sample.cpu = readPressure(QStringLiteral("cpu"), &cpuOk);
+    sample.memory = readPressure(QStringLiteral("memory"), &memoryOk);
+    sample.io = readPressure(QStringLiteral("io"), &ioOk);
+    sample.available = cpuOk && memoryOk && ioOk;
+    
+    return sample;
+}
+
+QString ResourceUsage::toString() const
+{
+    const QLocale locale;
+    return i18n("CPU time %1 s, memory peak %2, read %3, written %4",
+                QString::number(cpuSeconds, 'f', 1),
+                locale.formattedDataSize(memoryPeak),
+                locale.formattedDataSize(ioReadBytes),
+                locale.formattedDataSize(ioWriteBytes));
+}
+
+QJsonObject ResourceUsage::toJson() const
+{
+    if (!available)
+        return QJsonObject();
+    
+    QJsonObject json{
+        { "cpuSeconds", cpuSeconds },
+        { "memoryPeak", double(memoryPeak) },
+        { "ioReadBytes", double(ioReadBytes) },
+        { "ioWriteBytes", double(ioWriteBytes) },
+    };
+    if (profile.available) {
+        json.insert("profile", profile.toJson());
+    }
+    
+    return json;
+}
+
+ResourceUsage ResourceUsage::fromJson(const QJsonObject &json)
+{
+    ResourceUsage usage;
+    usage.available = json.contains("cpuSeconds");
+    usage.cpuSeconds = json.value("cpuSeconds").toDouble();
+    usage.memoryPeak = quint64(json.value("memoryPeak").toDouble());
+    usage.ioReadBytes = quint64(json.value("ioReadBytes").toDouble());
+    usage.ioWriteBytes = quint64(json.value("ioWriteBytes").toDouble());
+    usage.profile = ProcessProfile::fromJson(json.value("profile").toObject());
+    
+    return usage;
+}
+
+ResourceGovernor::ResourceGovernor(const QString &pool, QObject *parent)
+    : QObject(parent)
+    , m_pool(pool)
+    , m_limits(ResourceLimits::fromSettings())
+{
+    // Scopes disappear with their last process, so usage is sampled
+    // while the job runs
+    m_sampleTimer.setInterval(m_limits.sampleInterval > 0 ? m_limits.sampleInterval : 1000);
+    connect(&m_sampleTimer, &QTimer::timeout, this, &ResourceGovernor::sample);
+}
+
+void ResourceGovernor::setLimits(const ResourceLimits &limits)
+{
+    m_limits = limits;
+    m_sampleTimer.setInterval(m_limits.sampleInterval > 0 ? m_limits.sampleInterval : 1000);
+}
+
+bool ResourceGovernor::scopesAvailable()
+{
+    static const bool available = []() {
+        if (QStandardPaths::findExecutable("systemd-run").isEmpty())
+            return false;
+        
+        // cgroup v2 only, v1 has neither memory.high nor PSI per group
+        if (!QFile::exists(CgroupRoot + "/cgroup.controllers"))
+            return false;
+        
+        // A user manager to talk to
+        const QString runtimeDir = qEnvironmentVariable("XDG_RUNTIME_DIR");
+        return !runtimeDir.isEmpty()
+               && (QFile::exists(runtimeDir + "/bus") || QFile::exists(runtimeDir + "/systemd/private"));
+    }();
+    
+    return available && QSettings().value("resources/useScopes", true).toBool();
+}
+
+void ResourceGovernor::start(QProcess *process, const QString &program, const QStringList &arguments)
+{
+    // Jobs are sampled with or without a scope
+    m_jobs.insert(process, TrackedJob());
+    connect(process, &QObject::destroyed, this, [this, process]() {
+        m_jobs.remove(process);
+    });
+    
+    if (!m_sampleTimer.isActive()) {
+        m_sampleTimer.start();
+    }
+    
+    if (!scopesAvailable()) {
+        process->start(program, arguments);
+        return;
+    }
+    
+    TrackedJob &job = m_jobs[process];
+    job.unit = "fpb-" + m_pool + "-" + QUuid::createUuid().toString(QUuid::Id128).left(12);
+    
+    // systemd-run execs the program in place, so the QProcess still
+    // sees its exit code and output
+    QStringList scopeArguments;
+    scopeArguments << "--user" << "--scope" << "--quiet" << "--collect"
+                   << "--unit=" + job.unit
+                   << "--property=CPUWeight=" + QString::number(m_limits.cpuWeight)
+                   << "--property=IOWeight=" + QString::number(m_limits.ioWeight);
+    if (!m_limits.memoryHigh.isEmpty()) {
+        scopeArguments << "--property=MemoryHigh=" + m_limits.memoryHigh;
+    }
+    if (!m_limits.memoryMax.isEmpty()) {
+        scopeArguments << "--property=MemoryMax=" + m_limits.memoryMax;
+    }
+    scopeArguments << "--" << program << arguments;
+    
+    process->start("systemd-run", scopeArguments);
+}
+
+void ResourceGovernor::setStage(QProcess *process, const QString &stage)
+{
+    auto it = m_jobs.find(process);
+    if (it != m_jobs.end()) {
+        it->profiler.setStage(stage);
+    }
+}
+
+ResourceUsage ResourceGovernor::takeUsage(QProcess *process)
+{
+    auto it = m_jobs.find(process);
+    if (it == m_jobs.end())
+        return ResourceUsage();
+    
+    TrackedJob job = it.value();
+    m_jobs.erase(it);
+    
+    // Usually gone by now, but a scope outlives its main process while
+    // children linger
+    sampleCgroup(job);
+    
+    ResourceUsage usage = job.usage;
+    usage.profile = job.profiler.profile();
+    
+    // The process tree misses what reparented daemons used, the cgroup
+    // does not
+    if (!usage.available && usage.profile.available) {
+        usage.available = true;
+        usage.cpuSeconds = usage.profile.cpuSeconds;
+        usage.memoryPeak = usage.profile.rssPeak;
+        usage.ioReadBytes = usage.profile.readBytes;
+        usage.ioWriteBytes = usage.profile.writeBytes;
+    }
+    
+    if (usage.available) {
+        const QString pool = BuildMetrics::label("pool", m_pool);
+        BuildMetrics &metrics = BuildMetrics::instance();
+        metrics.increment("fpb_job_cpu_seconds_total", pool, usage.cpuSeconds);
+        metrics.observe("fpb_job_memory_peak_bytes", pool, usage.memoryPeak);
+        metrics.increment("fpb_job_io_bytes_total", pool + "," + BuildMetrics::label("direction", "read"), usage.ioReadBytes);
+        metrics.increment("fpb_job_io_bytes_total", pool + "," + BuildMetrics::label("direction", "write"), usage.ioWriteBytes);
+    }
+    
+    if (usage.profile.available) {
+        BuildMetrics &metrics = BuildMetrics::instance();
+        const QString pool = BuildMetrics::label("pool", m_pool);
+        metrics.observe("fpb_job_memory_average_bytes", pool, usage.profile.rssAverage);
+        for (const ProcessProfile::Stage &stage : qAsConst(usage.profile.stages)) {
+            metrics.increment("fpb_job_stage_cpu_seconds_total", pool + "," + BuildMetrics::label("stage", stage.name), stage.cpuSeconds);
+        }
+    }
+    
+    return usage;
+}
+
+bool ResourceGovernor::admit(int running)
+{
+    const PressureSample pressure = PressureSample::read();
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    if (pressure.available) {
+        metrics.setGauge("fpb_pressure_avg10", BuildMetrics::label("resource", "cpu"), pressure.cpu);
+        metrics.setGauge("fpb_pressure_avg10", BuildMetrics::label("resource", "memory"), pressure.memory);
+        metrics.setGauge("fpb_pressure_avg10", BuildMetrics::label("resource", "io"), pressure.io);
+    }
+    
+    bool admitted = true;
+    if (running > 0) {
+        if (m_lastAdmission.isValid() && m_lastAdmission.elapsed() < SettleTimeMs) {
+            admitted = false;
+        } else if (pressure.available) {
+            admitted = pressure.cpu <= m_limits.maxCpuPressure
+                       && pressure.memory <= m_limits.maxMemoryPressure
+                       && pressure.io <= m_limits.maxIoPressure;
+        }
+    }
+    
+    if (admitted) {
+        m_lastAdmission.start();
+    } else {
+        metrics.increment("fpb_admissions_deferred_total", BuildMetrics::label("pool", m_pool));
+    }
+    
+    return admitted;
+}
+
+void ResourceGovernor::sample()
+{
+    if (m_jobs.isEmpty()) {
+        m_sampleTimer.stop();
+        return;
+    }
+    
+    for (auto it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+        TrackedJob &job = it.value();
+        const qint64 pid = it.key()->processId();
+        
+        if (pid > 0 && m_limits.sampleInterval > 0) {
+            job.profiler.sample(pid);
+        }
+        
+        // systemd-run moves itself into the scope before exec, so the
+        // scope shows up in /proc shortly after the start
+        if (job.cgroupDir.isEmpty() && !job.unit.isEmpty()) {
+            if (pid <= 0)
+                continue;
+            
+            QFile file(QStringLiteral("/proc/%1/cgroup").arg(pid));
+            if (!file.open(QIODevice::ReadOnly))
+                continue;
+            
+            // 0::/user.slice/.../app.slice/fpb-build-0123456789ab.scope
+            const QByteArray line = file.readLine().trimmed();
+            const QString path = QString::fromUtf8(line.mid(line.indexOf("::") + 2));
+            if (!line.startsWith("0::") || !path.endsWith("/" + job.unit + ".scope"))
+                continue;
+            
+            job.cgroupDir = CgroupRoot + path;
+        }
+        
+        sampleCgroup(job);
+    }
+}
+
+void ResourceGovernor::sampleCgroup(TrackedJob &job)
+{
+    if (job.cgroupDir.isEmpty())
+        return;
+    
+    bool ok;
+    const QByteArray cpuStat = readCgroupFile(job.cgroupDir, QStringLiteral("cpu.stat"), &ok);
+    if (!ok)
+        return;
+    
+    ResourceUsage usage;
+    usage.available = true;
+    
+    for (const QByteArray &line : cpuStat.split('\n')) {
+        if (line.startsWith("usage_usec ")) {
+            usage.cpuSeconds = line.mid(11).toULongLong() / 1e6;
+        }
+    }
+    
+    // memory.peak needs Linux 5.19, older kernels only give the current
+    // value and the samples have to catch the peak
+    const QByteArray peak = readCgroupFile(job.cgroupDir, QStringLiteral("memory.peak"), &ok);
+    usage.memoryPeak = ok ? peak.trimmed().toULongLong()
+                          : readCgroupFile(job.cgroupDir, QStringLiteral("memory.current")).trimmed().toULongLong();
+    usage.memoryPeak = qMax(usage.memoryPeak, job.usage.memoryPeak);
+    
+    // 8:0 rbytes=1234 wbytes=5678 rios=1 wios=2 dbytes=0 dios=0
+    for (const QByteArray &line : readCgroupFile(job.cgroupDir, QStringLiteral("io.stat")).split('\n')) {
+        for (const QByteArray &field : line.split(' ')) {
+            if (field.startsWith("rbytes=")) {
+                usage.ioReadBytes += field.mid(7).toULongLong();
+            } else if (field.startsWith("wbytes=")) {
+                usage.ioWriteBytes += field.mid(7).toULongLong();
+            }
+        }
+    }
+    
+    job.usage = usage;
+}
\ No newline at end of file
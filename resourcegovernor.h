@@ -0,0 +1,133 @@
+#ifndef RESOURCEGOVERNOR_H
+#define RESOURCEGOVERNOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+#include "processprofiler.h"
+
+class QProcess;
+
+/**
+ * Resource controls of a build job's scope, in systemd's notation
+ */
+struct ResourceLimits
+{
+    int cpuWeight = 50;                             // Desktop sessions default to 100
+    QString memoryHigh = QStringLiteral("75%");     // Reclaim and throttle above this
+    QString memoryMax = QStringLiteral("90%");      // OOM-kill the job above this
+    int ioWeight = 50;
+    
+    // Pressure (PSI "some" avg10, in percent) above which no further
+    // job is admitted
+    double maxCpuPressure = 80;
+    double maxMemoryPressure = 10;
+    double maxIoPressure = 30;
+    
+    // Milliseconds between samples of running jobs, 0 leaves out the
+    // per-process profile
+    int sampleInterval = 1000;
+    
+    // Values from the resources/ group of the config file
+    static ResourceLimits fromSettings();
+};
+
+/**
+ * Share of time in which tasks stalled on a resource, from /proc/pressure
+ */
+struct PressureSample
+{
+    bool available = false;
+    double cpu = 0;
+    double memory = 0;
+    double io = 0;
+    
+    static PressureSample read();
+};
+
+/**
+ * What a job consumed, read from its cgroup. Without one the totals come
+ * from the profile of its process tree.
+ */
+struct ResourceUsage
+{
+    bool available = false;
+    double cpuSeconds = 0;
+    quint64 memoryPeak = 0;
+    quint64 ioReadBytes = 0;
+    quint64 ioWriteBytes = 0;
+    ProcessProfile profile;
+    
+    QString toString() const;
+    QJsonObject toJson() const;
+    static ResourceUsage fromJson(const QJsonObject &json);
+};
+
+/**
+ * Runs build jobs in cgroups of their own and decides when to start more.
+ *
+ * Each job is started in a transient systemd scope with the configured
+ * CPU weight, memory.high/memory.max and IO weight, so concurrent builds
+ * neither starve the desktop nor OOM-kill each other. New jobs are only
+ * admitted while the pressure stall information of the host stays below
+ * the limits, and some time after the previous admission so its load
+ * shows up in the averages first. Without systemd or cgroup v2, jobs run
+ * unconfined and only the admission control applies. While a job runs,
+ * its process tree is sampled for a profile of CPU time, memory and I/O
+ * by stage and command.
+ */
+class ResourceGovernor : public QObject
+{
+    Q_OBJECT
+    
+public:
+    // pool labels the metrics of the jobs, e.g. "build" or "farm-worker"
+    explicit ResourceGovernor(const QString &pool, QObject *parent = nullptr);
+    
+    void setLimits(const ResourceLimits &limits);
+    ResourceLimits limits() const { return m_limits; }
+    
+    // Whether systemd-run can create scopes in the user's cgroup v2 tree
+    static bool scopesAvailable();
+    
+    // Start program in a scope of its own, or plainly if there are no
+    // scopes
+    void start(QProcess *process, const QString &program, const QStringList &arguments);
+    
+    // Stage the process is in, e.g. the flatpak-builder module, for the
+    // samples of its profile
+    void setStage(QProcess *process, const QString &stage);
+    
+    // Final usage of a finished process started with start(), also
+    // recorded in the metrics. Call it from the finished() handler.
+    ResourceUsage takeUsage(QProcess *process);
+    
+    // Whether another job may start next to running ones. A job is
+    // always admitted if nothing else runs.
+    bool admit(int running);
+    
+private:
+    struct TrackedJob
+    {
+        QString unit;           // Empty without a scope
+        QString cgroupDir;
+        ResourceUsage usage;
+        ProcessProfiler profiler;
+    };
+    
+    void sample();
+    static void sampleCgroup(TrackedJob &job);
+    
+    QString m_pool;
+    ResourceLimits m_limits;
+    QHash<QProcess *, TrackedJob> m_jobs;
+    QTimer m_sampleTimer;
+    QElapsedTimer m_lastAdmission;
+};
+
+#endif // RESOURCEGOVERNOR_H
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "sharedmodules.h"
+#include "manifestwriter.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSaveFile>
+
+#include <functional>
+
+namespace {
+
+QMutex compiledMutex;
+QHash<QString, QByteArray> compiledModules;
+
+// Module files are named after user settings, e.g. the DXVK version
+QString modulePath(const QString &name)
+{
+    static const QRegularExpression unsafe(QStringLiteral("[^A-Za-z0-9._-]"));
+    return "modules/" + QString(name).replace(unsafe, QStringLiteral("_")) + ".json";
+}
+
+// Serialize the module the first time its path is asked for
+QString compile(const QString &path, const std::function<void(ManifestWriter &)> &writeModule)
+{
+    QMutexLocker locker(&compiledMutex);
+    if (!compiledModules.contains(path)) {
+        QByteArray contents;
+        ManifestWriter writer(&contents);
+        writer.beginObject();
+        writeModule(writer);
+        writer.endObject();
+        contents.append('\n');
+        compiledModules.insert(path, contents);
+    }
+    
+    return path;
+}
+
+} // namespace
+
+QString SharedModules::wine(const QString &wineVersion)
+{
+    // Anything but staging and devel installs stable Wine
+    const QString package = wineVersion == "staging" || wineVersion == "devel" ? "wine-" + wineVersion
+                                                                               : QStringLiteral("wine");
+    
+    return compile(modulePath(package), [&package](ManifestWriter &writer) {
+        writer.writeMember(QLatin1String("name"), QStringLiteral("wine"));
+        writer.writeMember(QLatin1String("buildsystem"), QStringLiteral("simple"));
+        writer.writeMember(QLatin1String("build-commands"), QStringList{
+            "mkdir -p ${FLATPAK_DEST}/wine && dnf install -y --installroot=${FLATPAK_DEST}/wine " + package
+        });
+    });
+}
+
+QString SharedModules::dxvk(const QString &dxvkVersion)
+{
+    return compile(modulePath("dxvk-" + dxvkVersion), [&dxvkVersion](ManifestWriter &writer) {
+        QString dxvkUrl;
+        if (dxvkVersion == "latest") {
+            dxvkUrl = "https://github.com/doitsujin/dxvk/releases/latest/download/dxvk-latest.tar.gz";
+        } else {
+            dxvkUrl = "https://github.com/doitsujin/dxvk/releases/download/v" + dxvkVersion + "/dxvk-" + dxvkVersion + ".tar.gz";
+        }
+        
+        writer.writeMember(QLatin1String("name"), QStringLiteral("dxvk"));
+        writer.writeMember(QLatin1String("buildsystem"), QStringLiteral("simple"));
+        writer.writeMember(QLatin1String("build-commands"), QStringList{
+            "mkdir -p ${FLATPAK_DEST}/dxvk && curl -L " + dxvkUrl + " -o dxvk.tar.gz"
+            " && tar -xf dxvk.tar.gz -C ${FLATPAK_DEST}/dxvk --strip-components=1"
+        });
+    });
+}
+
+QString SharedModules::basePrefix(const QString &arch, const QStringList &components)
+{
+    const QString wineArch = arch.isEmpty() ? QStringLiteral("win64") : arch;
+    
+    // wineboot installs Mono and Gecko into the prefix if they are there,
+    // and would prompt for a download if they are not
+    QString name = "wine-base-prefix-" + wineArch;
+    QStringList disabled;
+    if (components.contains("mono")) {
+        name += "-mono";
+    } else {
+        disabled << "mscoree";
+    }
+    if (components.contains("gecko")) {
+        name += "-gecko";
+    } else {
+        disabled << "mshtml";
+    }
+    
+    return compile(modulePath(name), [&wineArch, &disabled](ManifestWriter &writer) {
+        writer.writeMember(QLatin1String("name"), QStringLiteral("wine-base-prefix"));
+        writer.writeMember(QLatin1String("buildsystem"), QStringLiteral("simple"));
+        
+        // Identical files of the base prefix are deduplicated by OSTree,
+        // both in the export repo and in client installations. It is
+        // created before the app module, so it does not depend on the
+        // app and its cache is shared between apps.
+        writer.writeKey(QLatin1String("build-options"));
+        writer.beginObject();
+        writer.writeKey(QLatin1String("env"));
+        writer.beginObject();
+        writer.writeMember(QLatin1String("WINEARCH"), wineArch);
+        writer.writeMember(QLatin1String("WINEDEBUG"), QStringLiteral("-all"));
+        if (!disabled.isEmpty()) {
+            writer.writeMember(QLatin1String("WINEDLLOVERRIDES"), disabled.join(',') + "=");
+        }
+        writer.writeMember(QLatin1String("WINEPREFIX"), QStringLiteral("/app/share/wine-base-prefix"));
+        writer.endObject();
+        writer.endObject();
+        
+        writer.writeMember(QLatin1String("build-commands"), QStringList{
+            "/app/wine/usr/bin/wineboot --init",
+            "/app/wine/usr/bin/wineserver --wait"
+        });
+    });
+}
+
+QByteArray SharedModules::contents(const QString &path)
+{
+    QMutexLocker locker(&compiledMutex);
+    return compiledModules.value(path);
+}
+
+bool SharedModules::write(const QStringList &paths, const QString &dirPath, QString *errorMessage)
+{
+    for (const QString &path : paths) {
+        const QByteArray data = contents(path);
+        if (data.isEmpty()) {
+            if (errorMessage)
+                *errorMessage = i18n("Unknown shared module %1", path);
+            return false;
+        }
+        
+        // Every manifest in a build directory shares the files, so they
+        // are usually there already
+        const QString filePath = dirPath + "/" + path;
+        QFile existing(filePath);
+        if (existing.size() == data.size() && existing.open(QIODevice::ReadOnly) && existing.readAll() == data)
+            continue;
+        
+        QDir().mkpath(QFileInfo(filePath).absolutePath());
+        
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+            if (errorMessage)
+                *errorMessage = i18n("Cannot write %1: %2", filePath, file.errorString());
+            return false;
+        }
+    }
+    
+    return true;
+}
\ No newline at end of file
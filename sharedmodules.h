@@ -0,0 +1,38 @@
+#ifndef SHAREDMODULES_H
+#define SHAREDMODULES_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Modules that are the same for every app with the same Wine settings.
+ *
+ * Wine, DXVK and the base prefix make up the larger part of every
+ * manifest. Instead of repeating them in each app's manifest, each of
+ * them is compiled once per process into a module file, e.g.
+ * "modules/wine-staging.json", which the manifests refer to by path.
+ * flatpak-builder reads the file and caches the module just like an
+ * inline one, so existing module caches stay valid.
+ *
+ * All functions are thread-safe.
+ */
+class SharedModules
+{
+public:
+    // Path of the module file, relative to the manifest
+    static QString wine(const QString &wineVersion);
+    static QString dxvk(const QString &dxvkVersion);
+    // components are the Wine components (mono, gecko) installed before
+    // the base prefix. The others are disabled while it is created.
+    static QString basePrefix(const QString &arch, const QStringList &components);
+    
+    // Contents of a module file returned above, empty for other paths
+    static QByteArray contents(const QString &path);
+    
+    // Write the module files below dirPath, the manifest's directory.
+    // Files that are already up to date are left alone.
+    static bool write(const QStringList &paths, const QString &dirPath, QString *errorMessage = nullptr);
+};
+
+#endif // SHAREDMODULES_H
\ No newline at end of file
@@ -0,0 +1,501 @@
+#include "storagemanager.h"
+#include "builddirlock.h"
+#include "buildmetrics.h"
+#include "flatpakexporter.h"
+#include "tracer.h"
+
+#include <KLocalizedString>
+
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QLocale>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QSet>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QStorageInfo>
+#include <QUuid>
+#include <QtConcurrent>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+
+struct StorageManager::Pins
+{
+    QMutex mutex;
+    QHash<QString, int> counts;
+    
+    // The caller holds the mutex
+    bool covers(const QString &path) const
+    {
+        for (auto it = counts.constBegin(); it != counts.constEnd(); ++it) {
+            const QString &pinned = it.key();
+            if (pinned == path || pinned.startsWith(path + '/') || path.startsWith(pinned + '/'))
+                return true;
+        }
+        
+        return false;
+    }
+};
+
+namespace {
+
+const QString StampName = QStringLiteral(".fpb-last-used");
+const QString TrashName = QStringLiteral(".trash");
+
+typedef QSet<QPair<quint64, quint64>> InodeSet;
+
+struct Entry
+{
+    QString path;
+    int area = 0;
+    qint64 bytes = 0;
+    qint64 lastUsed = 0;    // Seconds since the epoch
+};
+
+// Disk space taken by path and everything below it. Files with several
+// links are counted the first time one of them is seen. Without
+// seenInodes, only what removing path would free is counted, i.e. files
+// with other links elsewhere are left out.
+qint64 diskUsage(const QString &path, InodeSet *seenInodes)
+{
+    qint64 bytes = 0;
+    
+    auto account = [&](const QString &filePath) {
+        struct stat st;
+        if (::lstat(QFile::encodeName(filePath).constData(), &st) != 0)
+            return;
+        
+        if (!S_ISDIR(st.st_mode) && st.st_nlink > 1) {
+            if (!seenInodes)
+                return;
+            
+            const QPair<quint64, quint64> inode(st.st_dev, st.st_ino);
+            if (seenInodes->contains(inode))
+                return;
+            seenInodes->insert(inode);
+        }
+        
+        bytes += qint64(st.st_blocks) * 512;
+    };
+    
+    account(path);
+    
+    // Symlinks are counted, not followed
+    QDirIterator it(path, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        account(it.next());
+    }
+    
+    return bytes;
+}
+
+// Time of the last touch() of path, or of its last change
+qint64 lastUsed(const QString &path)
+{
+    struct stat st;
+    if (::stat(QFile::encodeName(path + "/" + StampName).constData(), &st) == 0
+        || ::lstat(QFile::encodeName(path).constData(), &st) == 0) {
+        return st.st_mtime;
+    }
+    
+    return 0;
+}
+
+bool hasMarker(const QString &path, const QStringList &markers)
+{
+    for (const QString &marker : markers) {
+        if (QFileInfo::exists(path + "/" + marker))
+            return true;
+    }
+    
+    return markers.isEmpty();
+}
+
+} // namespace
+
+StoragePolicy StoragePolicy::fromSettings()
+{
+    StoragePolicy policy;
+    
+    QSettings settings;
+    settings.beginGroup("storage");
+    policy.quota = qint64(settings.value("quotaGiB", double(policy.quota >> 30)).toDouble() * (1LL << 30));
+    policy.minFreeSpace = qint64(settings.value("minFreeGiB", double(policy.minFreeSpace >> 30)).toDouble() * (1LL << 30));
+    policy.minAge = settings.value("minAgeMinutes", policy.minAge / 60).toInt() * 60;
+    
+    return policy;
+}
+
+StorageManager::StorageManager(QObject *parent)
+    : QObject(parent)
+    , m_dataDir(defaultDataDir())
+    , m_policy(StoragePolicy::fromSettings())
+    , m_pins(std::make_shared<Pins>())
+{
+    connect(&m_watcher, &QFutureWatcher<StorageReport>::finished, this, &StorageManager::collectionFinished);
+}
+
+StorageManager::~StorageManager()
+{
+    // A running collection holds its own reference to the pins and
+    // finishes on its own
+    m_watcher.disconnect(this);
+}
+
+QString StorageManager::defaultDataDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder";
+}
+
+QVector<StorageArea> StorageManager::builderAreas(const QString &dataDir)
+{
+    QVector<StorageArea> areas;
+    
+    // One directory per app id, with the staged app, the manifest and
+    // flatpak-builder's state. The build directories are recreated by
+    // every build, the state is its module cache.
+    StorageArea build;
+    build.name = QStringLiteral("build");
+    build.path = dataDir;
+    build.markers = QStringList{ "journal.jsonl", "manifest.json" };
+    build.outputs = QStringList{ "build", "build-*" };
+    build.weight = 4;
+    areas << build;
+    
+    // Wine Mono and Gecko, downloaded by hand
+    StorageArea artifacts;
+    artifacts.name = QStringLiteral("artifacts");
+    artifacts.path = dataDir + "/wine-components";
+    artifacts.weight = 16;
+    areas << artifacts;
+    
+    // Installers unpacked on import are the sources of their apps
+    StorageArea unpacked;
+    unpacked.name = QStringLiteral("unpacked");
+    unpacked.path = dataDir + "/unpacked";
+    unpacked.policy = StorageArea::Orphans;
+    areas << unpacked;
+    
+    StorageArea bundles;
+    bundles.name = QStringLiteral("bundles");
+    bundles.path = dataDir + "/bundles";
+    bundles.nameFilters = QStringList{ "*.flatpak" };
+    areas << bundles;
+    
+    // Removing commits would break the static deltas clients update with
+    StorageArea repo;
+    repo.name = QStringLiteral("repo");
+    repo.path = QSettings().value("export/repoPath", FlatpakExporter::defaultRepoPath()).toString();
+    repo.entries = false;
+    repo.policy = StorageArea::Account;
+    areas << repo;
+    
+    return areas;
+}
+
+void StorageManager::touch(const QString &path)
+{
+    const QFileInfo info(path);
+    if (info.isDir()) {
+        QFile stamp(path + "/" + StampName);
+        stamp.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    } else if (info.exists()) {
+        QFile file(path);
+        if (file.open(QIODevice::ReadWrite)) {
+            file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+        }
+    }
+}
+
+void StorageManager::setDataDir(const QString &dataDir)
+{
+    m_dataDir = dataDir;
+}
+
+void StorageManager::setAreas(const QVector<StorageArea> &areas)
+{
+    m_areas = areas;
+}
+
+void StorageManager::setPolicy(const StoragePolicy &policy)
+{
+    m_policy = policy;
+}
+
+void StorageManager::setReferenced(const QStringList &paths)
+{
+    m_referenced = paths;
+}
+
+void StorageManager::pin(const QString &path)
+{
+    QMutexLocker locker(&m_pins->mutex);
+    m_pins->counts[QDir::cleanPath(path)]++;
+}
+
+void StorageManager::unpin(const QString &path)
+{
+    QMutexLocker locker(&m_pins->mutex);
+    
+    const QString cleanPath = QDir::cleanPath(path);
+    auto it = m_pins->counts.find(cleanPath);
+    if (it != m_pins->counts.end() && --it.value() <= 0) {
+        m_pins->counts.erase(it);
+    }
+}
+
+void StorageManager::collect()
+{
+    if (isCollecting() || m_areas.isEmpty())
+        return;
+    
+    m_watcher.setFuture(QtConcurrent::run(&StorageManager::run, m_areas, m_policy, m_referenced, m_dataDir, m_pins));
+}
+
+bool StorageManager::isCollecting() const
+{
+    return m_watcher.isRunning();
+}
+
+void StorageManager::remove(const QStringList &paths)
+{
+    const QString dataDir = m_dataDir;
+    const std::shared_ptr<Pins> pins = m_pins;
+    
+    QtConcurrent::run([paths, dataDir, pins]() {
+        for (const QString &path : paths) {
+            if (QFileInfo::exists(path) || QFileInfo(path).isSymLink()) {
+                removeEntry(QDir::cleanPath(path), dataDir, pins.get());
+            }
+        }
+    });
+}
+
+StorageReport StorageManager::run(const QVector<StorageArea> &areas, const StoragePolicy &policy,
+                                  const QStringList &referenced, const QString &dataDir,
+                                  const std::shared_ptr<Pins> &pins)
+{
+    TraceSpan span("storage", QStringLiteral("collect"), dataDir);
+    
+    StorageReport report;
+    
+    // Left over if the process died while deleting
+    QDir(dataDir + "/" + TrashName).removeRecursively();
+    
+    const qint64 cutoff = QDateTime::currentSecsSinceEpoch() - policy.minAge;
+    
+    // A reference may point into an entry, e.g. the content root of an
+    // unpacked installer
+    auto isReferenced = [&referenced](const QString &path) {
+        for (const QString &reference : referenced) {
+            const QString cleanReference = QDir::cleanPath(reference);
+            if (cleanReference == path || cleanReference.startsWith(path + '/'))
+                return true;
+        }
+        return false;
+    };
+    
+    // Account every entry
+    QVector<Entry> entries;
+    InodeSet seenInodes;
+    for (int i = 0; i < areas.size(); ++i) {
+        const StorageArea &area = areas[i];
+        report.areaBytes.insert(area.name, report.areaBytes.value(area.name));
+        
+        QStringList paths;
+        if (area.entries) {
+            const QDir dir(area.path);
+            const QStringList names = dir.entryList(area.nameFilters,
+                                                    QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot,
+                                                    QDir::Name);
+            for (const QString &name : names) {
+                // Partial directories belong to a running import or download
+                if (name == TrashName || name.endsWith(".partial"))
+                    continue;
+                
+                const QString path = QDir::cleanPath(dir.filePath(name));
+                if (hasMarker(path, area.markers)) {
+                    paths << path;
+                }
+            }
+        } else if (QFileInfo::exists(area.path)) {
+            paths << QDir::cleanPath(area.path);
+        }
+        
+        for (const QString &path : qAsConst(paths)) {
+            Entry entry;
+            entry.path = path;
+            entry.area = i;
+            entry.bytes = diskUsage(path, &seenInodes);
+            entry.lastUsed = lastUsed(path);
+            
+            report.areaBytes[area.name] += entry.bytes;
+            report.totalBytes += entry.bytes;
+            entries << entry;
+        }
+    }
+    
+    // Stay below the quota, and leave the minimum free space on the disk
+    report.target = policy.quota;
+    const QStorageInfo storage(dataDir);
+    if (storage.isValid() && storage.bytesAvailable() < policy.minFreeSpace) {
+        report.target = qMin(report.target, report.totalBytes - (policy.minFreeSpace - storage.bytesAvailable()));
+    }
+    
+    auto evict = [&](Entry &entry) {
+        const StorageArea &area = areas[entry.area];
+        
+        QString error;
+        if (!removeEntry(entry.path, dataDir, pins.get(), &error)) {
+            if (!error.isEmpty()) {
+                report.errors << error;
+            }
+            return;
+        }
+        
+        report.areaBytes[area.name] -= entry.bytes;
+        report.totalBytes -= entry.bytes;
+        report.freedBytes += entry.bytes;
+        report.evictions[area.name]++;
+        entry.bytes = 0;
+    };
+    
+    // Unreferenced entries, e.g. the installers of removed apps, always go
+    for (Entry &entry : entries) {
+        const StorageArea &area = areas[entry.area];
+        if (area.policy == StorageArea::Orphans && entry.lastUsed < cutoff && !isReferenced(entry.path)) {
+            evict(entry);
+        }
+    }
+    
+    // Build outputs are never read again, so they go before any cache
+    for (Entry &entry : entries) {
+        const StorageArea &area = areas[entry.area];
+        if (area.policy != StorageArea::Evict || area.outputs.isEmpty() || entry.lastUsed >= cutoff)
+            continue;
+        
+        const QStringList names = QDir(entry.path).entryList(area.outputs, QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot);
+        for (const QString &name : names) {
+            const QString outputPath = entry.path + "/" + name;
+            const qint64 bytes = diskUsage(outputPath, nullptr);
+            
+            QString error;
+            if (removeEntry(outputPath, dataDir, pins.get(), &error)) {
+                report.areaBytes[area.name] -= bytes;
+                report.totalBytes -= bytes;
+                report.freedBytes += bytes;
+                entry.bytes -= bytes;
+            } else if (!error.isEmpty()) {
+                report.errors << error;
+            }
+        }
+    }
+    
+    if (report.totalBytes <= report.target)
+        return report;
+    
+    // Then the entries whose loss costs least: long unused ones of areas
+    // that are cheap to recreate
+    QVector<Entry *> candidates;
+    for (Entry &entry : entries) {
+        if (areas[entry.area].policy == StorageArea::Evict && entry.bytes > 0 && entry.lastUsed < cutoff) {
+            candidates << &entry;
+        }
+    }
+    
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    std::sort(candidates.begin(), candidates.end(), [&](const Entry *a, const Entry *b) {
+        return double(now - a->lastUsed) / areas[a->area].weight > double(now - b->lastUsed) / areas[b->area].weight;
+    });
+    
+    for (Entry *entry : qAsConst(candidates)) {
+        if (report.totalBytes <= report.target)
+            break;
+        evict(*entry);
+    }
+    
+    return report;
+}
+
+bool StorageManager::removeEntry(const QString &path, const QString &dataDir, Pins *pins, QString *errorMessage)
+{
+    const QString trashDir = dataDir + "/" + TrashName;
+    const QString trashPath = trashDir + "/" + QUuid::createUuid().toString(QUuid::Id128);
+    QDir().mkpath(trashDir);
+    
+    // Build directories, and outputs below them, that another process or
+    // a build of this one owns are locked. Holding their lock while
+    // renaming keeps new owners out.
+    BuildDirLock lock;
+    for (const QString &dir : { path, QFileInfo(path).path() }) {
+        if (QFileInfo::exists(dir + "/" + BuildDirLock::FileName)) {
+            if (!lock.lock(dir))
+                return false;
+            break;
+        }
+    }
+    
+    // Once renamed, a pin taken afterwards cannot see the entry any more
+    {
+        QMutexLocker locker(&pins->mutex);
+        if (pins->covers(path))
+            return false;
+        
+        if (!QDir().rename(path, trashPath)) {
+            if (errorMessage) {
+                *errorMessage = i18n("Cannot move %1 to %2", path, trashDir);
+            }
+            return false;
+        }
+    }
+    
+    const QFileInfo info(trashPath);
+    const bool removed = info.isDir() && !info.isSymLink() ? QDir(trashPath).removeRecursively() : QFile::remove(trashPath);
+    if (!removed && errorMessage) {
+        *errorMessage = i18n("Cannot remove %1", trashPath);
+    }
+    
+    return removed;
+}
+
+void StorageManager::collectionFinished()
+{
+    m_lastReport = m_watcher.result();
+    
+    BuildMetrics &metrics = BuildMetrics::instance();
+    for (auto it = m_lastReport.areaBytes.constBegin(); it != m_lastReport.areaBytes.constEnd(); ++it) {
+        metrics.setGauge("fpb_storage_bytes", BuildMetrics::label("area", it.key()), it.value());
+    }
+    for (auto it = m_lastReport.evictions.constBegin(); it != m_lastReport.evictions.constEnd(); ++it) {
+        metrics.increment("fpb_storage_evictions_total", BuildMetrics::label("area", it.key()), it.value());
+    }
+    metrics.setGauge("fpb_storage_quota_bytes", QString(), m_policy.quota);
+    metrics.increment("fpb_storage_freed_bytes_total", QString(), m_lastReport.freedBytes);
+    metrics.writeTextFile();
+    
+    for (const QString &error : qAsConst(m_lastReport.errors)) {
+        emit logMessage(error);
+    }
+    
+    if (m_lastReport.freedBytes > 0) {
+        emit logMessage(i18n("Freed %1 of build storage, %2 in use",
+                             QLocale().formattedDataSize(m_lastReport.freedBytes),
+                             QLocale().formattedDataSize(m_lastReport.totalBytes)));
+    }
+    if (m_lastReport.totalBytes > m_lastReport.target) {
+        emit logMessage(i18n("Build storage uses %1, more than the %2 allowed, the rest is in use",
+                             QLocale().formattedDataSize(m_lastReport.totalBytes),
+                             QLocale().formattedDataSize(qMax<qint64>(0, m_lastReport.target))));
+    }
+    
+    emit collected(m_lastReport.freedBytes);
+}
\ No newline at end of file
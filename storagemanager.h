@@ -0,0 +1,159 @@
+#ifndef STORAGEMANAGER_H
+#define STORAGEMANAGER_H
+
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <memory>
+
+/**
+ * A directory whose contents the storage manager accounts for
+ */
+struct StorageArea
+{
+    enum Policy {
+        Evict,      // Least recently used entries go once over the quota
+        Orphans,    // Entries go as soon as nothing refers to them
+        Account,    // Only counted, never removed
+    };
+    
+    QString name;           // Metric label, e.g. "build"
+    QString path;
+    Policy policy = Evict;
+    
+    // Each child is an entry of its own, otherwise the whole directory is one
+    bool entries = true;
+    QStringList nameFilters;
+    
+    // Only children that contain one of these files are entries, e.g. the
+    // build directories among the other directories of the data directory
+    QStringList markers;
+    
+    // How expensive an entry is to recreate. Of two entries used equally
+    // long ago, the one of the cheaper area goes first.
+    int weight = 1;
+    
+    // Subdirectories of an entry that are only written, never read back,
+    // e.g. flatpak-builder's "build". They are removed from entries that
+    // are not in use before anything is evicted.
+    QStringList outputs;
+};
+
+/**
+ * Limits of the storage manager
+ */
+struct StoragePolicy
+{
+    qint64 quota = 20LL << 30;          // Bytes all areas may use together
+    qint64 minFreeSpace = 5LL << 30;    // Keep at least this much free on the disk
+    int minAge = 3600;                  // Seconds an entry is kept after its last use
+    
+    // Values from the storage/ group of the config file
+    static StoragePolicy fromSettings();
+};
+
+/**
+ * Outcome of a collection
+ */
+struct StorageReport
+{
+    QHash<QString, qint64> areaBytes;   // Bytes in use by area, after the collection
+    qint64 totalBytes = 0;
+    qint64 freedBytes = 0;
+    qint64 target = 0;                  // What the collection aimed for
+    QHash<QString, int> evictions;      // Removed entries by area
+    QStringList errors;
+};
+
+/**
+ * Keeps the directories the builder creates within a disk budget.
+ *
+ * Build directories, downloaded artifacts, unpacked installers, bundles
+ * and the export repo are accounted for by disk usage. Once they take
+ * more than the quota, or the disk runs low, build outputs are dropped
+ * first, then entries by age since their last use, weighted by how
+ * expensive they are to recreate. Recently used and pinned entries are
+ * kept, so the caches of the apps being worked on stay warm.
+ *
+ * Collections run in a worker thread. Entries are renamed into a trash
+ * directory while holding the pin lock, so a path pinned from the GUI
+ * thread is never removed underneath a build. Pins only count within the
+ * process, build directories owned by other processes are recognized by
+ * their BuildDirLock.
+ */
+class StorageManager : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit StorageManager(QObject *parent = nullptr);
+    ~StorageManager() override;
+    
+    // <data>/flatpak-wine-builder
+    static QString defaultDataDir();
+    
+    // Build directories, artifact cache, unpacked installers, bundles and
+    // the export repo below dataDir
+    static QVector<StorageArea> builderAreas(const QString &dataDir);
+    
+    // Record that the file or directory was used now
+    static void touch(const QString &path);
+    
+    // Removed entries are moved to <dataDir>/.trash first
+    void setDataDir(const QString &dataDir);
+    void setAreas(const QVector<StorageArea> &areas);
+    void setPolicy(const StoragePolicy &policy);
+    StoragePolicy policy() const { return m_policy; }
+    
+    // Entries of Orphans areas that are still in use
+    void setReferenced(const QStringList &paths);
+    
+    // Pinned paths, their parents and everything below them are left
+    // alone. Pins are counted.
+    void pin(const QString &path);
+    void unpin(const QString &path);
+    
+    // Account and collect in the background, unless already running
+    void collect();
+    bool isCollecting() const;
+    
+    // Remove paths in the background, e.g. the files of a removed app.
+    // Pinned paths are skipped.
+    void remove(const QStringList &paths);
+    
+    // Report of the last finished collection
+    StorageReport lastReport() const { return m_lastReport; }
+    
+signals:
+    void logMessage(const QString &message);
+    void collected(qint64 freedBytes);
+    
+private:
+    struct Pins;
+    
+    static StorageReport run(const QVector<StorageArea> &areas, const StoragePolicy &policy,
+                             const QStringList &referenced, const QString &dataDir,
+                             const std::shared_ptr<Pins> &pins);
+    
+    // Move path to the trash and delete it there. False if it is pinned
+    // or could not be removed.
+    static bool removeEntry(const QString &path, const QString &dataDir, Pins *pins,
+                            QString *errorMessage = nullptr);
+    
+    void collectionFinished();
+    
+    QString m_dataDir;
+    QVector<StorageArea> m_areas;
+    StoragePolicy m_policy;
+    QStringList m_referenced;
+    std::shared_ptr<Pins> m_pins;
+    
+    QFutureWatcher<StorageReport> m_watcher;
+    StorageReport m_lastReport;
+};
+
+#endif // STORAGEMANAGER_H
\ No newline at end of file
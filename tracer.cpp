@@ -0,0 +1,407 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QThread>
+
+#include <atomic>
+#include <chrono>
+
+#include <unistd.h>
+
+namespace {
+
+// Category used for thread and track names
+const char *const MetadataCategory = "__metadata";
+
+struct TraceEvent
+{
+    const char *category = nullptr;
+    QString name;
+    QString detail;
+    qint64 start = 0;
+    qint64 duration = 0;
+    int track = 0;
+};
+
+const int ChunkSize = 512;
+
+// Fixed-size event buffer owned by one thread. The owner only appends and
+// publishes each event with a release store of count; the flusher reads up
+// to count. A full chunk is never touched by its owner again.
+struct Chunk
+{
+    TraceEvent events[ChunkSize];
+    std::atomic<int> count{0};
+    int tid = 0;
+    
+    // Only used by the flusher once the chunk is published
+    int flushed = 0;
+    Chunk *next = nullptr;
+};
+
+std::atomic<bool> s_enabled{false};
+std::atomic<bool> s_flushing{false};
+std::atomic<int> s_nextTid{1};
+
+// Lock-free list of all chunks, newest first. Producers only push at the
+// head, the flusher unlinks drained chunks behind it.
+std::atomic<Chunk *> s_chunks{nullptr};
+
+// Only accessed while holding s_flushing
+QFile &traceFile()
+{
+    static QFile file;
+    return file;
+}
+bool s_firstEvent = true;
+
+struct ThreadState
+{
+    int tid = s_nextTid.fetch_add(1, std::memory_order_relaxed);
+    bool named = false;
+    Chunk *chunk = nullptr;
+};
+
+thread_local ThreadState t_state;
+
+void publish(Chunk *chunk)
+{
+    chunk->next = s_chunks.load(std::memory_order_relaxed);
+    while (!s_chunks.compare_exchange_weak(chunk->next, chunk, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+void append(const char *category, const QString &name, qint64 start, qint64 duration,
+            const QString &detail, int track)
+{
+    Chunk *chunk = t_state.chunk;
+    if (!chunk) {
+        chunk = new Chunk;
+        chunk->tid = t_state.tid;
+        publish(chunk);
+        t_state.chunk = chunk;
+    }
+    
+    const int index = chunk->count.load(std::memory_order_relaxed);
+    TraceEvent &event = chunk->events[index];
+    event.category = category;
+    event.name = name;
+    event.detail = detail;
+    event.start = start;
+    event.duration = duration;
+    event.track = track;
+    chunk->count.store(index + 1, std::memory_order_release);
+    
+    if (index + 1 == ChunkSize) {
+        t_state.chunk = nullptr;
+    }
+}
+
+void record(const char *category, const QString &name, qint64 start, qint64 duration,
+            const QString &detail, int track)
+{
+    // Give every thread a readable row name with its first event
+    if (!t_state.named) {
+        t_state.named = true;
+        
+        QString threadName = QThread::currentThread()->objectName();
+        if (QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread()) {
+            threadName = QStringLiteral("Main thread");
+        } else if (threadName.isEmpty() || threadName.contains(QLatin1String("pooled"))) {
+            threadName = QStringLiteral("Worker %1").arg(t_state.tid);
+        }
+        
+        if (category != MetadataCategory || track != 0) {
+            append(MetadataCategory, threadName, 0, 0, QString(), 0);
+        }
+    }
+    
+    append(category, name, start, duration, detail, track);
+}
+
+QByteArray toJson(const TraceEvent &event, int tid)
+{
+    QJsonObject object;
+    object["pid"] = static_cast<qint64>(getpid());
+    object["tid"] = event.track ? event.track : tid;
+    
+    QJsonObject args;
+    if (event.category == MetadataCategory) {
+        object["ph"] = "M";
+        object["name"] = "thread_name";
+        args["name"] = event.name;
+    } else {
+        object["ph"] = "X";
+        object["cat"] = event.category;
+        object["name"] = event.name;
+        object["ts"] = event.start;
+        object["dur"] = event.duration;
+        if (!event.detail.isEmpty()) {
+            args["detail"] = event.detail;
+        }
+    }
+    object["args"] = args;
+    
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+} // namespace
+
+bool Tracer::start(const QString &filePath)
+{
+    stop();
+    
+    bool expected = false;
+    while (!s_flushing.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
+        expected = false;
+    }
+    
+    QFile &file = traceFile();
+    file.setFileName(filePath);
+    
+    // JSON array format, the closing bracket is added by stop(). Viewers
+    // accept the file without it, so a crashed run can still be opened.
+    const bool opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    if (opened) {
+        file.write("[\n");
+        s_firstEvent = true;
+    }
+    
+    s_flushing.store(false, std::memory_order_release);
+    
+    if (!opened)
+        return false;
+    
+    s_enabled.store(true, std::memory_order_relaxed);
+    
+    return true;
+}
+
+void Tracer::stop()
+{
+    if (!s_enabled.exchange(false, std::memory_order_relaxed))
+        return;
+    
+    flush();
+    
+    bool expected = false;
+    while (!s_flushing.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
+        expected = false;
+    }
+    
+    traceFile().write("\n]\n");
+    traceFile().close();
+    
+    s_flushing.store(false, std::memory_order_release);
+}
+
+bool Tracer::isEnabled()
+{
+    return s_enabled.load(std::memory_order_relaxed);
+}
+
+void Tracer::flush()
+{
+    bool expected = false;
+    if (!s_flushing.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        return;
+    
+    QFile &file = traceFile();
+    if (file.isOpen()) {
+        QByteArray out;
+        
+        Chunk *previous = nullptr;
+        Chunk *chunk = s_chunks.load(std::memory_order_acquire);
+        while (chunk) {
+            const int count = chunk->count.load(std::memory_order_acquire);
+            for (int i = chunk->flushed; i < count; ++i) {
+                if (!s_firstEvent) {
+                    out += ",\n";
+                }
+                s_firstEvent = false;
+                out += toJson(chunk->events[i], chunk->tid);
+            }
+            chunk->flushed = count;
+            
+            Chunk *next = chunk->next;
+            
+            // The head stays, producers may be pushing in front of it
+            if (previous && count == ChunkSize) {
+                previous->next = next;
+                delete chunk;
+            } else {
+                previous = chunk;
+            }
+            chunk = next;
+        }
+        
+        file.write(out);
+        file.flush();
+    }
+    
+    s_flushing.store(false, std::memory_order_release);
+}
+
+qint64 Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::complete(const char *category, const QString &name, qint64 start, qint64 duration,
+                      const QString &detail, int track)
+{
+    if (!isEnabled())
+        return;
+    
+    record(category, name, start, duration, detail, track);
+}
+
+void Tracer::setThreadName(const QString &name)
+{
+    if (!isEnabled())
+        return;
+    
+    record(MetadataCategory, name, 0, 0, QString(), 0);
+}
+
+int Tracer::newTrack(const QString &name)
+{
+    const int track = s_nextTid.fetch_add(1, std::memory_order_relaxed);
+    
+    if (isEnabled()) {
+        record(MetadataCategory, name, 0, 0, QString(), track);
+    }
+    
+    return track;
+}
+
+TraceSpan::TraceSpan(const char *category, const QString &name, const QString &detail)
+    : m_category(category)
+    , m_start(Tracer::isEnabled() ? Tracer::now() : -1)
+{
+    // Skip the string copies when tracing is off
+    if (m_start >= 0) {
+        m_name = name;
+        m_detail = detail;
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (m_start >= 0) {
+        Tracer::complete(m_category, m_name, m_start, Tracer::now() - m_start, m_detail);
+    }
+}
+
+void TraceSpan::setDetail(const QString &detail)
+{
+    if (m_start >= 0) {
+        m_detail = detail;
+    }
+}
+
+ProcessTrace::ProcessTrace(const QString &name, const QString &detail)
+    : m_name(name)
+    , m_detail(detail)
+{
+}
+
+void ProcessTrace::start()
+{
+    m_phase.clear();
+    m_phaseStart = -1;
+    m_partialLine.clear();
+    m_moduleBuilds = 0;
+    m_moduleCacheHits = 0;
+    
+    if (!Tracer::isEnabled())
+        return;
+    
+    m_track = Tracer::newTrack(m_name);
+    m_start = Tracer::now();
+}
+
+void ProcessTrace::addOutput(const QByteArray &data)
+{
+    m_partialLine += data;
+    
+    int lineStart = 0;
+    int newline;
+    while ((newline = m_partialLine.indexOf('\n', lineStart)) >= 0) {
+        parseLine(QString::fromLocal8Bit(m_partialLine.constData() + lineStart, newline - lineStart).trimmed());
+        lineStart = newline + 1;
+    }
+    m_partialLine.remove(0, lineStart);
+}
+
+void ProcessTrace::finish(int exitCode)
+{
+    if (m_start < 0)
+        return;
+    
+    endPhase();
+    
+    const QString detail = m_detail.isEmpty()
+        ? QStringLiteral("exit code %1").arg(exitCode)
+        : QStringLiteral("%1, exit code %2").arg(m_detail).arg(exitCode);
+    Tracer::complete("process", m_name, m_start, Tracer::now() - m_start, detail, m_track);
+    
+    m_start = -1;
+}
+
+void ProcessTrace::parseLine(const QString &line)
+{
+    // Progress lines printed by flatpak-builder between its stages
+    static const QRegularExpression buildingModule(QStringLiteral("^Building module (\\S+)"));
+    static const QRegularExpression cacheHit(QStringLiteral("^Cache hit for (\\S+), skipping"));
+    static const QRegularExpression committing(QStringLiteral("^Committing stage (\\S+) to cache"));
+    static const QRegularExpression exporting(QStringLiteral("^Exporting (\\S+) to repo"));
+    
+    QRegularExpressionMatch match;
+    
+    if (line.startsWith(QLatin1String("Downloading sources"))) {
+        beginPhase(QStringLiteral("download sources"), QString());
+    } else if (line.startsWith(QLatin1String("Initializing build dir"))) {
+        beginPhase(QStringLiteral("init build dir"), QString());
+    } else if ((match = buildingModule.match(line)).hasMatch()) {
+        m_moduleBuilds++;
+        beginPhase(QStringLiteral("module ") + match.captured(1), QString());
+    } else if ((match = cacheHit.match(line)).hasMatch()) {
+        m_moduleCacheHits++;
+        beginPhase(QStringLiteral("cached ") + match.captured(1), QString());
+    } else if ((match = committing.match(line)).hasMatch()) {
+        beginPhase(QStringLiteral("commit to cache"), match.captured(1));
+    } else if (line.startsWith(QLatin1String("Cleaning up"))) {
+        beginPhase(QStringLiteral("cleanup"), QString());
+    } else if (line.startsWith(QLatin1String("Finishing app"))) {
+        beginPhase(QStringLiteral("finish"), QString());
+    } else if ((match = exporting.match(line)).hasMatch()) {
+        beginPhase(QStringLiteral("export"), match.captured(1));
+    } else if (line.startsWith(QLatin1String("Installing"))) {
+        beginPhase(QStringLiteral("install"), line);
+    }
+}
+
+void ProcessTrace::beginPhase(const QString &name, const QString &detail)
+{
+    endPhase();
+    
+    // The phase is kept for phase() even when tracing is off
+    m_phase = name;
+    m_phaseDetail = detail;
+    m_phaseStart = m_start < 0 ? -1 : Tracer::now();
+}
+
+void ProcessTrace::endPhase()
+{
+    if (m_phaseStart < 0)
+        return;
+    
+    Tracer::complete("flatpak-builder", m_phase, m_phaseStart, Tracer::now() - m_phaseStart, m_phaseDetail, m_track);
+    m_phaseStart = -1;
+}
\ No newline at end of file
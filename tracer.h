@@ -0,0 +1,115 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Low-overhead tracing of the packaging pipeline.
+ *
+ * Spans are recorded into per-thread buffers without taking locks and
+ * written by flush() as Chrome trace events, so the file opens in
+ * Perfetto (ui.perfetto.dev) and chrome://tracing. When tracing is off,
+ * recording a span costs a single atomic load.
+ */
+class Tracer
+{
+public:
+    // Start writing a trace to filePath. Returns false if the file cannot
+    // be created.
+    static bool start(const QString &filePath);
+    
+    // Flush the remaining events and finish the file
+    static void stop();
+    
+    static bool isEnabled();
+    
+    // Write all events recorded so far. Safe to call from any thread; if
+    // another flush is running the call returns right away.
+    static void flush();
+    
+    // Monotonic timestamp in microseconds
+    static qint64 now();
+    
+    // Record a finished span on the current thread, or on a track
+    // created with newTrack()
+    static void complete(const char *category, const QString &name, qint64 start, qint64 duration,
+                         const QString &detail = QString(), int track = 0);
+    
+    // Name the current thread in the trace viewer
+    static void setThreadName(const QString &name);
+    
+    // A separate row in the trace viewer, for spans that do not nest with
+    // the current thread's spans, e.g. child processes
+    static int newTrack(const QString &name);
+};
+
+/**
+ * Records the lifetime of a scope as a span
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char *category, const QString &name, const QString &detail = QString());
+    ~TraceSpan();
+    
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+    
+    // Attach information only known at the end, e.g. a file count
+    void setDetail(const QString &detail);
+    
+private:
+    const char *m_category;
+    QString m_name;
+    QString m_detail;
+    qint64 m_start;
+};
+
+/**
+ * Span for a child process on its own track.
+ *
+ * For flatpak-builder the output is split into nested spans at module
+ * and stage boundaries (source downloads, each module build, cleanup,
+ * export, install). Module builds and cache hits are counted even when
+ * tracing is off.
+ */
+class ProcessTrace
+{
+public:
+    explicit ProcessTrace(const QString &name, const QString &detail = QString());
+    
+    void start();
+    
+    // Feed stdout/stderr of the process, partial lines are buffered
+    void addOutput(const QByteArray &data);
+    
+    void finish(int exitCode);
+    
+    // flatpak-builder modules built and reused from the cache in this run
+    int moduleBuilds() const { return m_moduleBuilds; }
+    int moduleCacheHits() const { return m_moduleCacheHits; }
+    
+    // Stage flatpak-builder is in, e.g. "module wine", empty before the
+    // first one
+    QString phase() const { return m_phase; }
+    
+private:
+    void parseLine(const QString &line);
+    void beginPhase(const QString &name, const QString &detail);
+    void endPhase();
+    
+    QString m_name;
+    QString m_detail;
+    int m_track = 0;
+    qint64 m_start = -1;
+    
+    QString m_phase;
+    QString m_phaseDetail;
+    qint64 m_phaseStart = -1;
+    QByteArray m_partialLine;
+    int m_moduleBuilds = 0;
+    int m_moduleCacheHits = 0;
+};
+
+#endif // TRACER_H
\ No newline at end of file
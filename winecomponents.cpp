@@ -0,0 +1,129 @@
+#include "winecomponents.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSettings>
+#include <QStandardPaths>
+
+namespace {
+
+struct Release
+{
+    const char *name;
+    const char *wineVersion;
+    const char *arch;
+    const char *version;
+    const char *sha256;
+};
+
+// Installers required by the Wine releases the repository packages ship,
+// with the SHA-256 Wine itself checks them against (dlls/appwiz.cpl).
+// A version and its checksum are changed together. Hashes not confirmed
+// yet are left empty and have to be set in the config file.
+const Release releases[] = {
+    {"mono", "stable", "x86", "8.1.0", "0ed3ec533aef79b2f312155931cf7b1080009ac0c5b4c2bcfeb678ac948e0810"},
+    {"mono", "devel", "x86", "9.4.0", ""},
+    {"mono", "staging", "x86", "9.4.0", ""},
+    {"gecko", "stable", "x86", "2.47.4", "26cecc47706b091908f7f814bddb074c61beb8063318e9efc5a7f789857793d6"},
+    {"gecko", "stable", "x86_64", "2.47.4", "e590b7d988a32d6aa4cf1d8aa3aa3d33766fdd4cf4c89c2dcc2095ecb28d066f"},
+    {"gecko", "devel", "x86", "2.47.4", "26cecc47706b091908f7f814bddb074c61beb8063318e9efc5a7f789857793d6"},
+    {"gecko", "devel", "x86_64", "2.47.4", "e590b7d988a32d6aa4cf1d8aa3aa3d33766fdd4cf4c89c2dcc2095ecb28d066f"},
+    {"gecko", "staging", "x86", "2.47.4", "26cecc47706b091908f7f814bddb074c61beb8063318e9efc5a7f789857793d6"},
+    {"gecko", "staging", "x86_64", "2.47.4", "e590b7d988a32d6aa4cf1d8aa3aa3d33766fdd4cf4c89c2dcc2095ecb28d066f"},
+};
+
+WineComponents::Component componentFor(const QString &name, const QString &wineVersion, const QString &arch)
+{
+    // Unknown Wine versions get what the development branch needs
+    const Release *release = nullptr;
+    for (const Release &candidate : releases) {
+        if (name == QLatin1String(candidate.name) && arch == QLatin1String(candidate.arch)) {
+            if (wineVersion == QLatin1String(candidate.wineVersion)) {
+                release = &candidate;
+                break;
+            }
+            if (!release && qstrcmp(candidate.wineVersion, "devel") == 0) {
+                release = &candidate;
+            }
+        }
+    }
+    Q_ASSERT(release);
+    
+    // The config file can move a Wine version on to a newer installer.
+    // Its checksum is looked up by file name, so it never pairs a
+    // version with the hash of another.
+    QSettings settings;
+    WineComponents::Component component;
+    component.name = name;
+    component.version = settings.value("wineComponents/" + name + "-" + wineVersion, QString::fromLatin1(release->version)).toString();
+    component.fileName = "wine-" + name + "-" + component.version + "-" + arch + ".msi";
+    component.url = "https://dl.winehq.org/wine/wine-" + name + "/" + component.version + "/" + component.fileName;
+    
+    const QString sha256 = component.version == QLatin1String(release->version) ? QString::fromLatin1(release->sha256) : QString();
+    component.sha256 = settings.value("wineComponents/sha256/" + component.fileName, sha256).toString().toLower();
+    
+    return component;
+}
+
+} // namespace
+
+QVector<WineComponents::Component> WineComponents::mono(const QString &wineVersion)
+{
+    // Mono is a single installer for both architectures
+    return {componentFor(QStringLiteral("mono"), wineVersion, QStringLiteral("x86"))};
+}
+
+QVector<WineComponents::Component> WineComponents::gecko(const QString &wineVersion, const QString &arch)
+{
+    // 64-bit prefixes need both the 32 and the 64-bit Gecko
+    QStringList archs{"x86"};
+    if (arch != "win32") {
+        archs << "x86_64";
+    }
+    
+    QVector<Component> components;
+    for (const QString &geckoArch : archs) {
+        components.append(componentFor(QStringLiteral("gecko"), wineVersion, geckoArch));
+    }
+    
+    return components;
+}
+
+bool WineComponents::needsMono(const QStringList &dlls)
+{
+    return dlls.contains("mscoree.dll", Qt::CaseInsensitive);
+}
+
+bool WineComponents::needsGecko(const QStringList &dlls)
+{
+    return dlls.contains("mshtml.dll", Qt::CaseInsensitive)
+        || dlls.contains("ieframe.dll", Qt::CaseInsensitive);
+}
+
+QString WineComponents::cacheDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + "/flatpak-wine-builder/wine-components";
+}
+
+QString WineComponents::cachedPath(const Component &component)
+{
+    return cacheDir() + "/" + component.fileName;
+}
+
+bool WineComponents::checksum(const Component &component)
+{
+    QFile file(cachedPath(component));
+    if (component.sha256.isEmpty() || !file.open(QIODevice::ReadOnly))
+        return false;
+    
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(&file);
+    if (QString::fromLatin1(hash.result().toHex()) == component.sha256)
+        return true;
+    
+    // Truncated or tampered with
+    file.close();
+    file.remove();
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef WINECOMPONENTS_H
+#define WINECOMPONENTS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Wine Mono and Wine Gecko installers matching a Wine version.
+ *
+ * Wine offers to download these when a prefix is created. Shipping them
+ * in Wine's data directory lets it install them offline and silently.
+ * The installers are taken from a local cache, so builds work on
+ * air-gapped hosts, and otherwise downloaded by flatpak-builder. Both are
+ * checked against the checksums published upstream.
+ */
+class WineComponents
+{
+public:
+    struct Component
+    {
+        QString name;       // "mono" or "gecko", also the data subdirectory
+        QString version;
+        QString fileName;
+        QString url;        // Where to fetch it into the cache
+        QString sha256;     // Published upstream, empty if not known
+    };
+    
+    // Components needed for a Wine version ("stable", "devel", "staging")
+    static QVector<Component> mono(const QString &wineVersion);
+    static QVector<Component> gecko(const QString &wineVersion, const QString &arch);
+    
+    // Whether an app importing these DLLs needs Mono or Gecko
+    static bool needsMono(const QStringList &dlls);
+    static bool needsGecko(const QStringList &dlls);
+    
+    // Local cache holding the downloaded installers
+    static QString cacheDir();
+    static QString cachedPath(const Component &component);
+    
+    // Whether the cached installer matches the published SHA-256. One
+    // that does not is deleted, so it is downloaded again.
+    static bool checksum(const Component &component);
+};
+
+#endif // WINECOMPONENTS_H
\ No newline at end of file
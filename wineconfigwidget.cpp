@@ -8,8 +8,15 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QLabel>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QFileDialog>
 #include <KLocalizedString>
 
+#include "wineprofile.h"
+
+#include <algorithm>
+
 WineConfigWidget::WineConfigWidget(QWidget *parent)
     : QWidget(parent)
 {
@@ -36,9 +43,33 @@ void WineConfigWidget::setupUi()
     m_wineDllOverridesEdit = new QLineEdit();
     m_wineDllOverridesEdit->setPlaceholderText(i18n("e.g., mscoree=n,b"));
     
+    // Performance profiles come from data files
+    m_profileCombo = new QComboBox();
+    m_profileCombo->addItem(i18n("None"), QString());
+    const QVector<WineProfile> profiles = WineProfile::loadAll();
+    for (const WineProfile &profile : profiles) {
+        m_profileCombo->addItem(profile.name, profile.id);
+        m_profileCombo->setItemData(m_profileCombo->count() - 1, profile.description, Qt::ToolTipRole);
+    }
+    
     wineLayout->addRow(i18n("Wine Version:"), m_wineVersionCombo);
     wineLayout->addRow(i18n("Architecture:"), m_wineArchCombo);
     wineLayout->addRow(i18n("DLL Overrides:"), m_wineDllOverridesEdit);
+    wineLayout->addRow(i18n("Performance Profile:"), m_profileCombo);
+    
+    m_prefixModeCombo = new QComboBox();
+    m_prefixModeCombo->addItem(i18n("Private (full prefix per user)"), "private");
+    m_prefixModeCombo->addItem(i18n("Layered (read-only base prefix in the app)"), "layered");
+    wineLayout->addRow(i18n("Wine Prefix:"), m_prefixModeCombo);
+    
+    // Idle wineserver lifetime, in minutes
+    m_serverTimeoutSpin = new QSpinBox();
+    m_serverTimeoutSpin->setRange(0, 120);
+    m_serverTimeoutSpin->setValue(5);
+    m_serverTimeoutSpin->setSuffix(i18n(" min"));
+    m_serverTimeoutSpin->setSpecialValueText(i18n("Stop with the app"));
+    m_serverTimeoutSpin->setToolTip(i18n("Later launches and further windows start in the running Wine session"));
+    wineLayout->addRow(i18n("Keep Wine Running:"), m_serverTimeoutSpin);
     
     // DXVK Configuration Group
     m_dxvkGroup = new QGroupBox(i18n("DXVK Configuration (DirectX to Vulkan)"));
@@ -58,11 +89,36 @@ void WineConfigWidget::setupUi()
     dxvkVersionLayout->addWidget(dxvkVersionLabel);
     dxvkVersionLayout->addWidget(m_dxvkVersionCombo);
     
+    // Pre-recorded pipeline state cache, shipped with the app
+    QHBoxLayout *dxvkCacheLayout = new QHBoxLayout();
+    QLabel *dxvkCacheLabel = new QLabel(i18n("State Cache:"));
+    m_dxvkCacheEdit = new QLineEdit();
+    m_dxvkCacheEdit->setPlaceholderText(i18n("Optional pre-recorded .dxvk-cache"));
+    m_dxvkCacheEdit->setEnabled(false);
+    m_dxvkCacheBrowseButton = new QPushButton(i18n("Browse..."));
+    m_dxvkCacheBrowseButton->setEnabled(false);
+    
+    dxvkCacheLayout->addWidget(dxvkCacheLabel);
+    dxvkCacheLayout->addWidget(m_dxvkCacheEdit);
+    dxvkCacheLayout->addWidget(m_dxvkCacheBrowseButton);
+    
     dxvkLayout->addWidget(m_enableDxvkCheck);
     dxvkLayout->addLayout(dxvkVersionLayout);
+    dxvkLayout->addLayout(dxvkCacheLayout);
     
     // Connect DXVK checkbox to enable/disable version combo
     connect(m_enableDxvkCheck, &QCheckBox::toggled, m_dxvkVersionCombo, &QComboBox::setEnabled);
+    connect(m_enableDxvkCheck, &QCheckBox::toggled, m_dxvkCacheEdit, &QLineEdit::setEnabled);
+    connect(m_enableDxvkCheck, &QCheckBox::toggled, m_dxvkCacheBrowseButton, &QPushButton::setEnabled);
+    connect(m_dxvkCacheBrowseButton, &QPushButton::clicked, this, [this]() {
+        QString path = QFileDialog::getOpenFileName(this,
+                                                    i18n("Select DXVK State Cache"),
+                                                    QString(),
+                                                    i18n("DXVK State Cache (*.dxvk-cache);;All Files (*)"));
+        if (!path.isEmpty()) {
+            m_dxvkCacheEdit->setText(path);
+        }
+    });
     
     // Permissions Group
     m_permissionsGroup = new QGroupBox(i18n("Flatpak Permissions"));
@@ -83,11 +139,50 @@ void WineConfigWidget::setupUi()
     permissionsLayout->addWidget(m_downloadsCheck);
     permissionsLayout->addWidget(m_audioCheck);
     
+    // Variant matrix, every checked version with every checked architecture
+    m_matrixGroup = new QGroupBox(i18n("Variant Matrix"));
+    QFormLayout *matrixLayout = new QFormLayout(m_matrixGroup);
+    
+    QHBoxLayout *matrixVersionLayout = new QHBoxLayout();
+    for (int i = 0; i < m_wineVersionCombo->count(); ++i) {
+        QCheckBox *check = new QCheckBox(m_wineVersionCombo->itemText(i));
+        check->setProperty("value", m_wineVersionCombo->itemData(i));
+        matrixVersionLayout->addWidget(check);
+        m_matrixVersionChecks << check;
+    }
+    
+    QHBoxLayout *matrixArchLayout = new QHBoxLayout();
+    for (int i = 0; i < m_wineArchCombo->count(); ++i) {
+        QCheckBox *check = new QCheckBox(m_wineArchCombo->itemText(i));
+        check->setProperty("value", m_wineArchCombo->itemData(i));
+        matrixArchLayout->addWidget(check);
+        m_matrixArchChecks << check;
+    }
+    
+    matrixLayout->addRow(i18n("Wine Versions:"), matrixVersionLayout);
+    matrixLayout->addRow(i18n("Architectures:"), matrixArchLayout);
+    
     // Add all groups to main layout
     mainLayout->addWidget(wineGroup);
     mainLayout->addWidget(m_dxvkGroup);
     mainLayout->addWidget(m_permissionsGroup);
+    mainLayout->addWidget(m_matrixGroup);
     mainLayout->addStretch();
+    
+    // Report every change, e.g. for watch mode rebuilds
+    connect(m_wineVersionCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &WineConfigWidget::settingsChanged);
+    connect(m_wineArchCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &WineConfigWidget::settingsChanged);
+    connect(m_wineDllOverridesEdit, &QLineEdit::textChanged, this, &WineConfigWidget::settingsChanged);
+    connect(m_profileCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &WineConfigWidget::settingsChanged);
+    connect(m_prefixModeCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &WineConfigWidget::settingsChanged);
+    connect(m_serverTimeoutSpin, QOverload<int>::of(&QSpinBox::valueChanged), this, &WineConfigWidget::settingsChanged);
+    connect(m_enableDxvkCheck, &QCheckBox::toggled, this, &WineConfigWidget::settingsChanged);
+    connect(m_dxvkVersionCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &WineConfigWidget::settingsChanged);
+    connect(m_dxvkCacheEdit, &QLineEdit::textChanged, this, &WineConfigWidget::settingsChanged);
+    connect(m_networkCheck, &QCheckBox::toggled, this, &WineConfigWidget::settingsChanged);
+    connect(m_documentsCheck, &QCheckBox::toggled, this, &WineConfigWidget::settingsChanged);
+    connect(m_downloadsCheck, &QCheckBox::toggled, this, &WineConfigWidget::settingsChanged);
+    connect(m_audioCheck, &QCheckBox::toggled, this, &WineConfigWidget::settingsChanged);
 }
 
 QString WineConfigWidget::wineVersion() const
@@ -105,6 +200,56 @@ QString WineConfigWidget::wineArch() const
     return m_wineArchCombo->currentData().toString();
 }
 
+QString WineConfigWidget::performanceProfile() const
+{
+    return m_profileCombo->currentData().toString();
+}
+
+QString WineConfigWidget::prefixMode() const
+{
+    return m_prefixModeCombo->currentData().toString();
+}
+
+int WineConfigWidget::serverTimeout() const
+{
+    return m_serverTimeoutSpin->value() * 60;
+}
+
+bool WineConfigWidget::dxvkEnabled() const
+{
+    return m_enableDxvkCheck->isChecked();
+}
+
+QString WineConfigWidget::dxvkVersion() const
+{
+    return m_dxvkVersionCombo->currentData().toString();
+}
+
+QString WineConfigWidget::dxvkStateCachePath() const
+{
+    return m_dxvkCacheEdit->text();
+}
+
+bool WineConfigWidget::allowNetwork() const
+{
+    return m_networkCheck->isChecked();
+}
+
+bool WineConfigWidget::allowDocuments() const
+{
+    return m_documentsCheck->isChecked();
+}
+
+bool WineConfigWidget::allowDownloads() const
+{
+    return m_downloadsCheck->isChecked();
+}
+
+bool WineConfigWidget::allowAudio() const
+{
+    return m_audioCheck->isChecked();
+}
+
 void WineConfigWidget::setWineVersion(const QString &version)
 {
     for (int i = 0; i < m_wineVersionCombo->count(); ++i) {
@@ -128,4 +273,91 @@ void WineConfigWidget::setWineArch(const QString &arch)
             break;
         }
     }
+}
+
+void WineConfigWidget::setPerformanceProfile(const QString &profileId)
+{
+    int index = m_profileCombo->findData(profileId);
+    m_profileCombo->setCurrentIndex(index >= 0 ? index : 0);
+}
+
+void WineConfigWidget::setPrefixMode(const QString &mode)
+{
+    int index = m_prefixModeCombo->findData(mode);
+    m_prefixModeCombo->setCurrentIndex(index >= 0 ? index : 0);
+}
+
+void WineConfigWidget::setServerTimeout(int seconds)
+{
+    // Round up, so short timeouts are not switched off
+    m_serverTimeoutSpin->setValue((seconds + 59) / 60);
+}
+
+void WineConfigWidget::setDxvkEnabled(bool enabled)
+{
+    m_enableDxvkCheck->setChecked(enabled);
+}
+
+void WineConfigWidget::setDxvkVersion(const QString &version)
+{
+    int index = m_dxvkVersionCombo->findData(version);
+    if (index >= 0) {
+        m_dxvkVersionCombo->setCurrentIndex(index);
+    }
+}
+
+void WineConfigWidget::setDxvkStateCachePath(const QString &path)
+{
+    m_dxvkCacheEdit->setText(path);
+}
+
+void WineConfigWidget::setAllowNetwork(bool allow)
+{
+    m_networkCheck->setChecked(allow);
+}
+
+void WineConfigWidget::setAllowDocuments(bool allow)
+{
+    m_documentsCheck->setChecked(allow);
+}
+
+void WineConfigWidget::setAllowDownloads(bool allow)
+{
+    m_downloadsCheck->setChecked(allow);
+}
+
+void WineConfigWidget::setAllowAudio(bool allow)
+{
+    m_audioCheck->setChecked(allow);
+}
+
+QStringList WineConfigWidget::variants() const
+{
+    QStringList variants;
+    for (const QCheckBox *version : m_matrixVersionChecks) {
+        for (const QCheckBox *arch : m_matrixArchChecks) {
+            if (version->isChecked() && arch->isChecked()) {
+                variants << version->property("value").toString() + "-" + arch->property("value").toString();
+            }
+        }
+    }
+    
+    return variants;
+}
+
+void WineConfigWidget::setVariants(const QStringList &variants)
+{
+    for (QCheckBox *version : qAsConst(m_matrixVersionChecks)) {
+        const QString prefix = version->property("value").toString() + "-";
+        version->setChecked(std::any_of(variants.begin(), variants.end(), [&prefix](const QString &variant) {
+            return variant.startsWith(prefix);
+        }));
+    }
+    
+    for (QCheckBox *arch : qAsConst(m_matrixArchChecks)) {
+        const QString suffix = "-" + arch->property("value").toString();
+        arch->setChecked(std::any_of(variants.begin(), variants.end(), [&suffix](const QString &variant) {
+            return variant.endsWith(suffix);
+        }));
+    }
 }
\ No newline at end of file
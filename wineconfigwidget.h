@@ -1,12 +1,15 @@
 #ifndef WINECONFIGWIDGET_H
 #define WINECONFIGWIDGET_H
 
+#include <QVector>
 #include <QWidget>
 
 class QComboBox;
 class QLineEdit;
 class QGroupBox;
 class QCheckBox;
+class QPushButton;
+class QSpinBox;
 
 /**
  * Widget for configuring Wine settings
@@ -22,11 +25,39 @@ public:
     QString wineVersion() const;
     QString wineDllOverrides() const;
     QString wineArch() const;
+    QString performanceProfile() const;
+    QString prefixMode() const;
+    int serverTimeout() const;
+    bool dxvkEnabled() const;
+    QString dxvkVersion() const;
+    QString dxvkStateCachePath() const;
+    bool allowNetwork() const;
+    bool allowDocuments() const;
+    bool allowDownloads() const;
+    bool allowAudio() const;
+    
+    // Checked matrix combinations, e.g. "staging-win32"
+    QStringList variants() const;
     
     // Setters
     void setWineVersion(const QString &version);
     void setWineDllOverrides(const QString &overrides);
     void setWineArch(const QString &arch);
+    void setPerformanceProfile(const QString &profileId);
+    void setPrefixMode(const QString &mode);
+    void setServerTimeout(int seconds);
+    void setDxvkEnabled(bool enabled);
+    void setDxvkVersion(const QString &version);
+    void setDxvkStateCachePath(const QString &path);
+    void setAllowNetwork(bool allow);
+    void setAllowDocuments(bool allow);
+    void setAllowDownloads(bool allow);
+    void setAllowAudio(bool allow);
+    void setVariants(const QStringList &variants);
+    
+signals:
+    // Emitted whenever any setting is changed in the UI
+    void settingsChanged();
     
 private:
     void setupUi();
@@ -34,16 +65,25 @@ private:
     QComboBox *m_wineVersionCombo;
     QLineEdit *m_wineDllOverridesEdit;
     QComboBox *m_wineArchCombo;
+    QComboBox *m_profileCombo;
+    QComboBox *m_prefixModeCombo;
+    QSpinBox *m_serverTimeoutSpin;
     
     QGroupBox *m_dxvkGroup;
     QCheckBox *m_enableDxvkCheck;
     QComboBox *m_dxvkVersionCombo;
+    QLineEdit *m_dxvkCacheEdit;
+    QPushButton *m_dxvkCacheBrowseButton;
     
     QGroupBox *m_permissionsGroup;
     QCheckBox *m_networkCheck;
     QCheckBox *m_documentsCheck;
     QCheckBox *m_downloadsCheck;
     QCheckBox *m_audioCheck;
+    
+    QGroupBox *m_matrixGroup;
+    QVector<QCheckBox *> m_matrixVersionChecks;
+    QVector<QCheckBox *> m_matrixArchChecks;
 };
 
 #endif // WINECONFIGWIDGET_H
\ No newline at end of file
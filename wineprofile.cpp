@@ -0,0 +1,102 @@
+#include "wineprofile.h"
+
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QStandardPaths>
+
+#include <algorithm>
+
+WineProfile WineProfile::fromFile(const QString &filePath, QString *errorMessage)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return WineProfile();
+    }
+    
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!doc.isObject()) {
+        if (errorMessage)
+            *errorMessage = parseError.errorString();
+        return WineProfile();
+    }
+    
+    const QJsonObject object = doc.object();
+    
+    // Refuse files written for a newer format rather than misreading them
+    if (object["format-version"].toInt() > FormatVersion) {
+        if (errorMessage)
+            *errorMessage = QStringLiteral("Unsupported format version %1").arg(object["format-version"].toInt());
+        return WineProfile();
+    }
+    
+    WineProfile profile;
+    profile.id = object["id"].toString();
+    profile.version = object["version"].toInt();
+    profile.name = object["name"].toString(profile.id);
+    profile.description = object["description"].toString();
+    
+    const QJsonObject env = object["environment"].toObject();
+    for (auto it = env.constBegin(); it != env.constEnd(); ++it) {
+        profile.environment[it.key()] = it.value().toString();
+    }
+    
+    const QJsonArray args = object["finish-args"].toArray();
+    for (const QJsonValue &arg : args) {
+        profile.finishArgs << arg.toString();
+    }
+    
+    if (profile.id.isEmpty() && errorMessage)
+        *errorMessage = QStringLiteral("Profile has no id");
+    
+    return profile;
+}
+
+QVector<WineProfile> WineProfile::loadAll()
+{
+    QVector<WineProfile> profiles;
+    QSet<QString> seenIds;
+    
+    // The user's data directory comes first, so its profiles override
+    // shipped ones with the same id
+    const QStringList dirs = QStandardPaths::locateAll(QStandardPaths::AppDataLocation,
+                                                       QStringLiteral("profiles"),
+                                                       QStandardPaths::LocateDirectory);
+    for (const QString &dirPath : dirs) {
+        const QStringList files = QDir(dirPath).entryList(QStringList() << "*.json", QDir::Files, QDir::Name);
+        for (const QString &fileName : files) {
+            WineProfile profile = fromFile(dirPath + "/" + fileName);
+            if (!profile.isValid() || seenIds.contains(profile.id))
+                continue;
+            
+            seenIds.insert(profile.id);
+            profiles.append(profile);
+        }
+    }
+    
+    std::sort(profiles.begin(), profiles.end(), [](const WineProfile &a, const WineProfile &b) {
+        return a.name.localeAwareCompare(b.name) < 0;
+    });
+    
+    return profiles;
+}
+
+WineProfile WineProfile::find(const QString &id)
+{
+    if (id.isEmpty())
+        return WineProfile();
+    
+    const QVector<WineProfile> profiles = loadAll();
+    for (const WineProfile &profile : profiles) {
+        if (profile.id == id)
+            return profile;
+    }
+    
+    return WineProfile();
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef WINEPROFILE_H
+#define WINEPROFILE_H
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * A Wine runtime performance profile, loaded from a JSON data file.
+ *
+ * Profiles are looked up in the "profiles" folder of the application
+ * data directories, so users can add their own or override the shipped
+ * ones by id.
+ */
+class WineProfile
+{
+public:
+    // Highest data file format this build understands
+    static const int FormatVersion = 1;
+    
+    QString id;
+    int version = 0;
+    QString name;
+    QString description;
+    QMap<QString, QString> environment;
+    QStringList finishArgs;
+    
+    bool isValid() const { return !id.isEmpty(); }
+    
+    // Parse a single profile file, returns an invalid profile on errors
+    static WineProfile fromFile(const QString &filePath, QString *errorMessage = nullptr);
+    
+    // All available profiles, sorted by name
+    static QVector<WineProfile> loadAll();
+    
+    // Look up a profile by id, returns an invalid profile if unknown
+    static WineProfile find(const QString &id);
+};
+
+#endif // WINEPROFILE_H
\ No newline at end of file